@@ -0,0 +1,140 @@
+/*
+  bench_line_block
+
+  Times finding the block that contains a line, in a file with many
+  small blocks:
+   - ZlineFile_get_line_block (line directory, then binary search)
+   - a plain binary search of the block starts
+   - the linear scan zlines used to do
+
+  bench_line_block [<block count> [<zlines file>]]
+
+  The file is created with <block count> blocks (default 1000000) of a
+  few short lines each, and removed afterwards.
+
+
+  https://github.com/oshkosher/bioio/tree/master/zlines
+
+  Ed Karrels, ed.karrels@gmail.com, January 2017
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "zline_api.h"
+#include "common.h"
+
+#define DEFAULT_BLOCK_COUNT 1000000
+#define DEFAULT_FILENAME "bench_line_block.out"
+#define BLOCK_SIZE 100
+#define LOOKUPS 10000000
+#define LINEAR_LOOKUPS 2000
+
+typedef uint64_t u64;
+
+/* xorshift, so every run looks up the same lines */
+static u64 rng_state = (((u64)0x12345678) << 32) | 0x9abcdef1;
+static u64 nextRandom(void) {
+  rng_state ^= rng_state << 13;
+  rng_state ^= rng_state >> 7;
+  rng_state ^= rng_state << 17;
+  return rng_state;
+}
+
+static u64 linearScan(const u64 *starts, u64 n, u64 line) {
+  u64 i;
+  for (i=0; i < n; i++)
+    if (line < starts[i]) return i;
+  return i;
+}
+
+static u64 binarySearch(const u64 *starts, u64 n, u64 line) {
+  u64 lo = 0, hi = n, mid;
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (line < starts[mid])
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+  return lo;
+}
+
+
+int main(int argc, char **argv) {
+  u64 block_count = DEFAULT_BLOCK_COUNT, line_count, i, *starts, *lines;
+  u64 sum_dir = 0, sum_binary = 0, sum_linear = 0;
+  const char *filename = DEFAULT_FILENAME;
+  char line[100];
+  double timer, t_dir, t_binary, t_linear;
+  ZlineFile zf;
+
+  if (argc > 1 && 1 != sscanf(argv[1], "%" SCNu64, &block_count)) {
+    printf("\n  bench_line_block [<block count> [<zlines file>]]\n\n");
+    return 1;
+  }
+  if (argc > 2) filename = argv[2];
+
+  /* 2 to 8 lines of 10 to 20 bytes per block */
+  printf("Creating %s with %" PRIu64 " blocks...", filename, block_count);
+  fflush(stdout);
+  timer = getSeconds();
+  zf = ZlineFile_create2(filename, BLOCK_SIZE);
+  if (!zf) return 1;
+  memset(line, 'x', sizeof line);
+  while (ZlineFile_get_block_count(zf) < block_count)
+    ZlineFile_add_line2(zf, line, 10 + nextRandom() % 11);
+  ZlineFile_close(zf);
+  printf(" %.2fs\n", getSeconds() - timer);
+
+  zf = ZlineFile_read(filename);
+  if (!zf) return 1;
+  block_count = ZlineFile_get_block_count(zf);
+  line_count = ZlineFile_line_count(zf);
+
+  starts = (u64*) malloc(sizeof(u64) * block_count);
+  lines = (u64*) malloc(sizeof(u64) * LOOKUPS);
+  assert(starts && lines);
+  for (i=1; i < block_count; i++)
+    starts[i-1] = ZlineFile_get_block_first_line(zf, i);
+  for (i=0; i < LOOKUPS; i++)
+    lines[i] = nextRandom() % line_count;
+
+  timer = getSeconds();
+  for (i=0; i < LOOKUPS; i++)
+    sum_dir += ZlineFile_get_line_block(zf, lines[i]);
+  t_dir = getSeconds() - timer;
+
+  timer = getSeconds();
+  for (i=0; i < LOOKUPS; i++)
+    sum_binary += binarySearch(starts, block_count - 1, lines[i]);
+  t_binary = getSeconds() - timer;
+
+  timer = getSeconds();
+  for (i=0; i < LINEAR_LOOKUPS; i++)
+    sum_linear += linearScan(starts, block_count - 1, lines[i]);
+  t_linear = getSeconds() - timer;
+
+  /* the same lines were found */
+  for (i=0; i < LINEAR_LOOKUPS; i++)
+    sum_linear -= ZlineFile_get_line_block(zf, lines[i]);
+  if (sum_dir != sum_binary || sum_linear != 0) {
+    printf("Mismatched results\n");
+    return 1;
+  }
+
+  printf("%" PRIu64 " lines in %" PRIu64 " blocks, random lookups:\n",
+         line_count, block_count);
+  printf("  ZlineFile_get_line_block: %8.1f ns\n", t_dir * 1e9 / LOOKUPS);
+  printf("  binary search:            %8.1f ns\n", t_binary * 1e9 / LOOKUPS);
+  printf("  linear scan:              %8.1f ns\n",
+         t_linear * 1e9 / LINEAR_LOOKUPS);
+
+  ZlineFile_close(zf);
+  free(starts);
+  free(lines);
+  if (argc <= 2) remove(filename);
+
+  return 0;
+}
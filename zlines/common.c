@@ -36,8 +36,6 @@ typedef int mode_t;
   reportError(__FILE__, __LINE__, context, isFatal);
 void reportError(const char *filename, int lineNo,
 		 const char *context, int die);
-int64_t pread(int fildes, void *buf, uint64_t nbyte, uint64_t offset);
-int64_t pwrite(int fildes, const void *buf, uint64_t nbyte, uint64_t offset);
 #else
 #include <sys/mman.h>
 #include <sys/time.h>
@@ -149,11 +147,20 @@ int mapFile(const char *filename, int for_writing, char **data, u64 *length) {
   return 0;
 }
 
+
+int unmapFile(char *data, u64 length) {
+  return munmap(data, length);
+}
+
 #else /* _WIN32 */
 int mapFile(const char *filename, int for_writing, char **data, u64 *length) {
   fprintf(stderr, "mapFile not implemented yet on Windows\n");
   return -1;
 }
+
+int unmapFile(char *data, u64 length) {
+  return -1;
+}
 #endif
 
 
@@ -265,6 +272,85 @@ uint64_t getMemorySize(void) {
 #endif
 }
 
+
+
+/* Returns the number of processors available. */
+int getCpuCount(void) {
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo(&info);
+  return (int) info.dwNumberOfProcessors;
+#else
+  long n = sysconf(_SC_NPROCESSORS_ONLN);
+  return n > 0 ? (int) n : 1;
+#endif
+}
+
+
+#ifdef _WIN32
+
+typedef struct {
+  ThreadFn fn;
+  void *arg;
+} ThreadStartArgs;
+
+static DWORD WINAPI threadTrampoline(LPVOID param) {
+  ThreadStartArgs args = *(ThreadStartArgs*) param;
+  free(param);
+  args.fn(args.arg);
+  return 0;
+}
+
+int threadStart(Thread *thread, ThreadFn fn, void *arg) {
+  ThreadStartArgs *args = (ThreadStartArgs*) malloc(sizeof(ThreadStartArgs));
+  if (!args) return -1;
+  args->fn = fn;
+  args->arg = arg;
+  *thread = CreateThread(NULL, 0, threadTrampoline, args, 0, NULL);
+  if (!*thread) {
+    free(args);
+    return -1;
+  }
+  return 0;
+}
+
+void threadJoin(Thread thread) {
+  WaitForSingleObject(thread, INFINITE);
+  CloseHandle(thread);
+}
+
+void mutexInit(Mutex *m) {InitializeCriticalSection(m);}
+void mutexDestroy(Mutex *m) {DeleteCriticalSection(m);}
+void mutexLock(Mutex *m) {EnterCriticalSection(m);}
+void mutexUnlock(Mutex *m) {LeaveCriticalSection(m);}
+
+void condInit(CondVar *c) {InitializeConditionVariable(c);}
+void condDestroy(CondVar *c) {}
+void condWait(CondVar *c, Mutex *m) {SleepConditionVariableCS(c, m, INFINITE);}
+void condSignal(CondVar *c) {WakeConditionVariable(c);}
+void condBroadcast(CondVar *c) {WakeAllConditionVariable(c);}
+
+#else /* _WIN32 */
+
+int threadStart(Thread *thread, ThreadFn fn, void *arg) {
+  return pthread_create(thread, NULL, fn, arg);
+}
+
+void threadJoin(Thread thread) {pthread_join(thread, NULL);}
+
+void mutexInit(Mutex *m) {pthread_mutex_init(m, NULL);}
+void mutexDestroy(Mutex *m) {pthread_mutex_destroy(m);}
+void mutexLock(Mutex *m) {pthread_mutex_lock(m);}
+void mutexUnlock(Mutex *m) {pthread_mutex_unlock(m);}
+
+void condInit(CondVar *c) {pthread_cond_init(c, NULL);}
+void condDestroy(CondVar *c) {pthread_cond_destroy(c);}
+void condWait(CondVar *c, Mutex *m) {pthread_cond_wait(c, m);}
+void condSignal(CondVar *c) {pthread_cond_signal(c);}
+void condBroadcast(CondVar *c) {pthread_cond_broadcast(c);}
+
+#endif /* _WIN32 */
+
     
 /* Parse a number with a case-insensitive magnitude suffix:
      k : multiply by 1024
@@ -532,19 +618,29 @@ void reportError(const char *filename, int lineNo,
   if (die) ExitProcess(1);
 }
 
+/* Like POSIX pread, this doesn't use the file position, so multiple
+   threads can call it on the same file descriptor. */
 int64_t pread(int fildes, void *bufv, uint64_t nbyte, uint64_t offset) {
   int64_t bytes_done = 0;
   char *buf = (char*) bufv;
-  if (-1 == lseek(fildes, offset, SEEK_SET)) return -1;
+  HANDLE h = (HANDLE) _get_osfhandle(fildes);
+
+  if (h == INVALID_HANDLE_VALUE) return -1;
 
   /* handle nbyte > INT_MAX */
   while (nbyte) {
-    int result, len = (int)MIN(nbyte, INT_MAX);
-    result = read(fildes, buf, len);
+    OVERLAPPED overlapped;
+    DWORD result, len = (DWORD)MIN(nbyte, INT_MAX);
+    memset(&overlapped, 0, sizeof overlapped);
+    overlapped.Offset = (DWORD) offset;
+    overlapped.OffsetHigh = (DWORD) (offset >> 32);
+    if (!ReadFile(h, buf, len, &result, &overlapped))
+      return bytes_done ? bytes_done : -1;
     bytes_done += result;
     if (result != len) return bytes_done;
     nbyte -= len;
     buf += len;
+    offset += len;
   }
   return bytes_done;
 }
@@ -24,6 +24,8 @@ typedef int64_t ssize_t;
 typedef int32_t ssize_t;
 #endif
 ssize_t getline(char **bufptr, size_t *n, FILE *fp);
+int64_t pread(int fildes, void *buf, uint64_t nbyte, uint64_t offset);
+int64_t pwrite(int fildes, const void *buf, uint64_t nbyte, uint64_t offset);
 #else
 #include <inttypes.h>
 #endif
@@ -53,6 +55,9 @@ int isDirectory(const char *filename);
 int mapFile(const char *filename, int for_writing, char **data,
             uint64_t *length);
 
+/* Unmap a file mapped with mapFile. */
+int unmapFile(char *data, uint64_t length);
+
 
 /* Formats a number with commas every 3 digits: 1234567 -> "1,234,567".
    The string will be written to buf (which must be at least 21 bytes),
@@ -65,6 +70,9 @@ double getSeconds(void);
 
 /* Returns the amount of physical memory. */
 uint64_t getMemorySize(void);
+
+/* Returns the number of processors available. */
+int getCpuCount(void);
     
 /* Parse a number with a case-insensitive magnitude suffix:
      k : multiply by 1024
@@ -115,6 +123,36 @@ void transposeTile
  Array2d *src, int src_row, int src_col,
  int height, int width);
 
+/* Minimal portable threads: POSIX threads, or Win32 threads on Windows. */
+#ifdef _WIN32
+#include <windows.h>
+typedef HANDLE Thread;
+typedef CRITICAL_SECTION Mutex;
+typedef CONDITION_VARIABLE CondVar;
+#else
+#include <pthread.h>
+typedef pthread_t Thread;
+typedef pthread_mutex_t Mutex;
+typedef pthread_cond_t CondVar;
+#endif
+
+typedef void *(*ThreadFn)(void *arg);
+
+/* Start a thread running fn(arg). Returns nonzero on error. */
+int threadStart(Thread *thread, ThreadFn fn, void *arg);
+void threadJoin(Thread thread);
+
+void mutexInit(Mutex *m);
+void mutexDestroy(Mutex *m);
+void mutexLock(Mutex *m);
+void mutexUnlock(Mutex *m);
+
+void condInit(CondVar *c);
+void condDestroy(CondVar *c);
+void condWait(CondVar *c, Mutex *m);
+void condSignal(CondVar *c);
+void condBroadcast(CondVar *c);
+
 #define NEWLINE_UNIX 1
 #define NEWLINE_DOS 2
 
@@ -4,10 +4,128 @@
 #include <inttypes.h>
 #include <string.h>
 #include "zline_api.h"
+#include "zrec_api.h"
 
 #define MIN(a,b) ((a)<(b)?(a):(b))
 #define MAX(a,b) ((a)>(b)?(a):(b))
 
+/* Keep a few decompressed blocks in memory, so reads that straddle
+   a block boundary don't decompress the same blocks repeatedly. */
+#define BLOCK_CACHE_SIZE (16*1024*1024)
+
+/* Number of lines requested from ZlineFile_get_lines at once. */
+#define LINE_BATCH_SIZE 65536
+
+
+/* Fetch the lines listed in idx and print them. */
+static void printBatch(ZlineFile zf, uint64_t *idx, int count,
+                       uint64_t *offsets, uint64_t *lengths,
+                       char **buf, uint64_t *buf_len) {
+  int64_t total;
+  int i;
+
+  total = ZlineFile_get_lines(zf, idx, count, *buf, *buf_len,
+                              offsets, lengths);
+  if (total > 0 && (uint64_t)total > *buf_len) {
+    *buf_len = MAX(*buf_len * 2, (uint64_t)total);
+    free(*buf);
+    *buf = (char*) malloc(*buf_len);
+    if (!*buf) {
+      fprintf(stderr, "Out of memory\n");
+      exit(1);
+    }
+    total = ZlineFile_get_lines(zf, idx, count, *buf, *buf_len,
+                                offsets, lengths);
+  }
+  if (total < 0) {
+    fprintf(stderr, "Failed to read lines\n");
+    exit(1);
+  }
+
+  for (i=0; i < count; i++) {
+    char *line = *buf + offsets[i];
+    line[lengths[i]] = '\n';
+    fwrite(line, lengths[i] + 1, 1, stdout);
+  }
+}
+
+
+/* Print some fields of a range of records from a record file
+   (see zrec_api.h). Only the selected fields are read. */
+static int printRecords(const char *filename, int64_t first_read,
+                        int64_t read_count, const int *selected,
+                        int n_selected) {
+  ZrecFile zr;
+  uint64_t *offsets, *lengths, buf_len = 0, batch, r, total_read_count;
+  int64_t total;
+  char *buf = NULL, *value;
+  int i;
+
+  zr = ZrecFile_read(filename, 0);
+  if (!zr) {
+    fprintf(stderr, "Cannot open \"%s\"\n", filename);
+    return 1;
+  }
+
+  total_read_count = ZrecFile_record_count(zr);
+  for (i=0; i < n_selected; i++) {
+    if (selected[i] >= ZrecFile_field_count(zr)) {
+      fprintf(stderr, "\"%s\" has only %d fields per record\n", filename,
+              ZrecFile_field_count(zr));
+      return 1;
+    }
+  }
+  if (first_read >= (int64_t)total_read_count) {
+    fprintf(stderr, "Invalid first read: %" PRIi64 "\n", first_read);
+    return 1;
+  }
+  read_count = MIN(read_count, (int64_t)total_read_count - first_read);
+
+  offsets = (uint64_t*) malloc(sizeof(uint64_t) * LINE_BATCH_SIZE);
+  lengths = (uint64_t*) malloc(sizeof(uint64_t) * LINE_BATCH_SIZE);
+  if (!offsets || !lengths) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+
+  while (read_count > 0) {
+    batch = MIN(read_count, LINE_BATCH_SIZE / n_selected);
+    total = ZrecFile_get_records(zr, first_read, batch, selected, n_selected,
+                                 buf, buf_len, offsets, lengths);
+    if (total > 0 && (uint64_t)total > buf_len) {
+      buf_len = MAX(buf_len * 2, (uint64_t)total);
+      free(buf);
+      buf = (char*) malloc(buf_len);
+      if (!buf) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+      }
+      total = ZrecFile_get_records(zr, first_read, batch, selected,
+                                   n_selected, buf, buf_len, offsets,
+                                   lengths);
+    }
+    if (total < 0) {
+      fprintf(stderr, "Failed to read records\n");
+      return 1;
+    }
+
+    for (r=0; r < batch * n_selected; r++) {
+      value = buf + offsets[r];
+      value[lengths[r]] = '\n';
+      fwrite(value, lengths[r] + 1, 1, stdout);
+    }
+
+    first_read += batch;
+    read_count -= batch;
+  }
+
+  free(offsets);
+  free(lengths);
+  free(buf);
+  ZrecFile_close(zr);
+  return 0;
+}
+
 
 static void printHelp() {
   fprintf(stderr, "\n"
@@ -15,7 +133,8 @@ static void printHelp() {
           "    Extract \"reads\" (blocks of 4 text lines) from the given zlines file,\n"
           "    printing them to stdout.\n"
           "\n"
-          "    zlines-file: the data file, in 'zlines' format\n"
+          "    zlines-file: the data file, in 'zlines' format, or a record file\n"
+          "      (\"zlines create -r 4\") if its name ends in \".zrec\"\n"
           "    first-read: index of the first read, counting from 0\n"
           "    read-count: number of reads to extract\n"
           "    which-lines: which of the 4 lines of each read to print, counting from 1\n"
@@ -27,23 +146,17 @@ static void printHelp() {
 
 
 int main(int argc, const char **argv) {
-  int i, n_selected, selected[4];
+  int i, n_selected, selected[4], count = 0;
   const char *filename, *which_lines;
   int64_t first_read, read_count, total_read_count, read_no;
+  uint64_t *idx, *offsets, *lengths, buf_len = 0;
+  char *buf = NULL;
   ZlineFile zf;
 
   if (argc != 5) printHelp();
   filename = argv[1];
-  zf = ZlineFile_read(filename);
-  if (!zf) {
-    fprintf(stderr, "Cannot open \"%s\"\n", filename);
-    return 1;
-  }
-
-  total_read_count = ZlineFile_line_count(zf) / 4;
   
-  if (1 != sscanf(argv[2], "%" SCNi64, &first_read) ||
-      first_read < 0 || first_read >= total_read_count) {
+  if (1 != sscanf(argv[2], "%" SCNi64, &first_read) || first_read < 0) {
     fprintf(stderr, "Invalid first read: %s\n", argv[2]);
     return 1;
   }
@@ -71,17 +184,49 @@ int main(int argc, const char **argv) {
     selected[i] = which_lines[i] - '1';
   }
 
+  if (strlen(filename) > 5 && !strcmp(filename + strlen(filename) - 5, ".zrec"))
+    return printRecords(filename, first_read, read_count, selected,
+                        n_selected);
+
+  zf = ZlineFile_read2(filename, BLOCK_CACHE_SIZE);
+  if (!zf) {
+    fprintf(stderr, "Cannot open \"%s\"\n", filename);
+    return 1;
+  }
+
+  total_read_count = ZlineFile_line_count(zf) / 4;
+  if (first_read >= total_read_count) {
+    fprintf(stderr, "Invalid first read: %s\n", argv[2]);
+    return 1;
+  }
+
+  idx = (uint64_t*) malloc(sizeof(uint64_t) * LINE_BATCH_SIZE);
+  offsets = (uint64_t*) malloc(sizeof(uint64_t) * LINE_BATCH_SIZE);
+  lengths = (uint64_t*) malloc(sizeof(uint64_t) * LINE_BATCH_SIZE);
+  if (!idx || !offsets || !lengths) {
+    fprintf(stderr, "Out of memory\n");
+    return 1;
+  }
+
   for (read_no = first_read;
        read_no < first_read + read_count && read_no < total_read_count;
        read_no++) {
 
     for (i=0; i < n_selected; i++) {
-      char *line = ZlineFile_get_line(zf, read_no * 4 + selected[i]);
-      puts(line);
-      free(line);
+      idx[count++] = read_no * 4 + selected[i];
+      if (count == LINE_BATCH_SIZE) {
+        printBatch(zf, idx, count, offsets, lengths, &buf, &buf_len);
+        count = 0;
+      }
     }
   }
+  if (count > 0)
+    printBatch(zf, idx, count, offsets, lengths, &buf, &buf_len);
 
+  free(idx);
+  free(offsets);
+  free(lengths);
+  free(buf);
   ZlineFile_close(zf);
   return 0;
 }
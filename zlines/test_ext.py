@@ -0,0 +1,159 @@
+#!/usr/bin/python3
+
+"""
+Checks of the native module _zlines and of zlines.get_many/add_many.
+Build with "make pyext" and run with "make test_py", or with
+libzlines.so on LD_LIBRARY_PATH.
+"""
+
+import os, threading
+from array import array
+import _zlines, zlines
+
+FILENAME = 'test_ext.out'
+
+
+def testLine(i):
+  if i % 100 == 7: return ''
+  return 'line %d ' % i + 'ACGT' * (i % 13)
+
+
+def checkMany(f, indices, expected):
+  data, offsets, lengths = f.get_many(indices)
+  assert offsets.format == 'Q' and lengths.format == 'Q'
+  assert len(offsets) == len(expected) == len(lengths)
+  for i, line in enumerate(expected):
+    assert data[offsets[i] : offsets[i] + lengths[i]] == line
+    assert data[offsets[i] + lengths[i]] == 0
+
+
+def testNative():
+  n = 5000
+  lines = [testLine(i).encode() for i in range(n)]
+
+  # str and bytes, one at a time or in batches
+  with _zlines.File(FILENAME, 'w', block_size=1000) as f:
+    f.add_many([line.decode() for line in lines[:100]])
+    f.add_many(lines[100:n-1])
+    f.add(lines[n-1])
+    try:
+      f.add(5)
+      assert False
+    except TypeError:
+      pass
+
+  f = _zlines.File(FILENAME)
+  assert len(f) == n
+  checkMany(f, [5, 1000, 3, -1, 5], [lines[i] for i in (5, 1000, 3, -1, 5)])
+  checkMany(f, [], [])
+  checkMany(f, array('q', [9, -2, 4000]), [lines[i] for i in (9, -2, 4000)])
+  checkMany(f, slice(10, 300, 7), lines[10:300:7])
+  assert f.get_lines(slice(None, None, -997)) == lines[::-997]
+  assert f[17] == lines[17] and f[-1] == lines[-1]
+  assert f[40:60] == lines[40:60]
+  assert f[60:40] == []
+  for bad in (n, -n-1):
+    try:
+      f[bad]
+      assert False
+    except IndexError:
+      pass
+  try:
+    f.get_many([0, n])
+    assert False
+  except IndexError:
+    pass
+  try:
+    f.add(b'x')
+    assert False
+  except ValueError:
+    pass
+
+  # blocks() covers every line once, in order
+  assert f.block_count() > 10
+  next_line = 0
+  for first_line, data, offsets, lengths in f.blocks():
+    assert first_line == next_line
+    for i in range(len(offsets)):
+      assert (data[offsets[i] : offsets[i] + lengths[i]]
+              == lines[first_line + i])
+    next_line += len(offsets)
+  assert next_line == n
+  assert len(list(f.blocks(3, 5))) == 2
+  assert f.get_block(2)[0] == list(f.blocks(2, 3))[0][0]
+  try:
+    f.get_block(f.block_count())
+    assert False
+  except IndexError:
+    pass
+  f.close()
+
+  try:
+    len(f)
+    assert False
+  except ValueError:
+    pass
+
+  # appending
+  with _zlines.File(FILENAME, 'a') as f:
+    f.add_many([b'appended', 'appended too'])
+  with _zlines.File(FILENAME, mmap=True, threads=2) as f:
+    assert len(f) == n + 2
+    assert f[n-1:] == [lines[n-1], b'appended', b'appended too']
+
+
+def testCloseWhileReading():
+  """Closing a file while other threads read it must raise ValueError in
+  them, not use the freed file."""
+  for rep in range(20):
+    f = _zlines.File(FILENAME)
+    errors = []
+
+    def reader():
+      try:
+        while True:
+          len(f)
+          f.block_count()
+          f.get_many([0, 1, -1])
+          for block in f.blocks(0, 2): pass
+      except ValueError:
+        pass
+      except Exception as e:
+        errors.append(e)
+
+    threads = [threading.Thread(target=reader) for i in range(3)]
+    for t in threads: t.start()
+    f.close()
+    for t in threads: t.join()
+    assert errors == [], errors
+
+
+def testCtypes():
+  lines = [testLine(i) for i in range(3000)]
+  f = zlines.open(FILENAME, 'w')
+  f.add_many(lines[:2000])
+  for line in lines[2000:]: f.add(line)
+  f.close()
+
+  f = zlines.open(FILENAME)
+  assert len(f) == len(lines)
+  assert f.get_many([0, 2999, -1, 1500, 7]) == [lines[i] for i in
+                                                 (0, 2999, -1, 1500, 7)]
+  assert f.get_many([]) == []
+  try:
+    f.get_many([3000])
+    assert False
+  except IndexError:
+    pass
+  f.close()
+
+
+def main():
+  testNative()
+  testCloseWhileReading()
+  testCtypes()
+  os.remove(FILENAME)
+  print('ok')
+
+
+main()
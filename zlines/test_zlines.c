@@ -10,12 +10,18 @@
 #include <assert.h>
 #include <string.h>
 #include "zline_api.h"
+#include "zrec_api.h"
+#include "zindex_api.h"
+#include "common.h"
 
 #define FILENAME "test_zlines.out"
+#define REC_FILENAME "test_zlines.zrec"
+#define INDEX_FILENAME "test_zlines.idx"
 
 void test_add_one() {
   char *p, buf[100] = {0};
   ZlineFile z;
+  FILE *f;
 
   z = ZlineFile_create(FILENAME);
   assert(ZlineFile_line_count(z) == 0);
@@ -57,6 +63,18 @@ void test_add_one() {
 
   ZlineFile_close(z);
 
+  /* a file with no lines is just a header and an empty index */
+  z = ZlineFile_create(FILENAME);
+  ZlineFile_set_index_compression(z, 0);
+  ZlineFile_close(z);
+  f = fopen(FILENAME, "rb");
+  assert(f);
+  assert(8 == fread(buf, 1, 8, f));
+  assert(!memcmp(buf, "zline v2", 8));
+  fseek(f, 0, SEEK_END);
+  assert(256 == ftell(f));
+  fclose(f);
+
   putchar('.'); fflush(stdout);
 }
 
@@ -116,6 +134,7 @@ void test_blocks() {
   ZlineFile_add_line(z, "one more");
 
   assert(80 == ZlineFile_max_line_length(z));
+  assert(8 == ZlineFile_min_line_length(z));
 
   assert(!strcmp("one more", ZlineFile_get_line2(z, 2, buf, sizeof buf, 0)));
   assert(!strcmp("and here's 20*******", ZlineFile_get_line2(z, 1, buf, sizeof buf, 0)));
@@ -166,6 +185,36 @@ void test_long_line() {
 }  
 
 
+/* A block holding nothing but empty lines has no content, but it
+   still has to be written. */
+void test_empty_block() {
+  const char *s1 = "this is longer than a block";
+  char buf[100];
+  int threads, i;
+  ZlineFile z;
+
+  for (threads = 0; threads <= 2; threads += 2) {
+    z = ZlineFile_create3(FILENAME, 20, threads);
+    ZlineFile_add_line(z, s1);
+    for (i=0; i < 3; i++)
+      ZlineFile_add_line(z, "");
+    ZlineFile_close(z);
+
+    z = ZlineFile_read(FILENAME);
+    assert(ZlineFile_line_count(z) == 4);
+    assert(ZlineFile_get_block_count(z) == 2);
+    assert(!strcmp(s1, ZlineFile_get_line2(z, 0, buf, sizeof buf, 0)));
+    for (i=1; i < 4; i++) {
+      assert(ZlineFile_line_length(z, i) == 0);
+      assert(!strcmp("", ZlineFile_get_line2(z, i, buf, sizeof buf, 0)));
+    }
+    ZlineFile_close(z);
+  }
+
+  putchar('.'); fflush(stdout);
+}
+
+
 void test_many_lines() {
   char buf[100], buf2[100];
   int i, n = 1000;
@@ -198,16 +247,1949 @@ void test_many_lines() {
 
   putchar('.'); fflush(stdout);
 }    
+
+
+void test_block_cache() {
+  char buf[100], buf2[100];
+  int i, n = 1000;
+  uint64_t hits, misses, block_count, block_lines;
+  ZlineFile z;
+
+  z = ZlineFile_create2(FILENAME, 1000);
+  for (i=0; i < n; i++) {
+    sprintf(buf, "test line %10d", i);
+    ZlineFile_add_line(z, buf);
+  }
+  ZlineFile_close(z);
+
+  /* with no cache, alternating between two blocks reads a block
+     every time */
+  z = ZlineFile_read(FILENAME);
+  block_count = ZlineFile_get_block_count(z);
+  assert(block_count > 2);
+  for (i=0; i < 10; i++) {
+    ZlineFile_get_line2(z, (i & 1) ? n-1 : 0, buf, sizeof buf, 0);
+  }
+  ZlineFile_get_cache_stats(z, &hits, &misses);
+  assert(misses == 10);
+  ZlineFile_close(z);
+
+  /* big enough cache for every block */
+  z = ZlineFile_read2(FILENAME, 1024*1024);
+  for (i=0; i < n; i++) {
+    int line_no = (i & 1) ? n-1-i : i;
+    sprintf(buf2, "test line %10d", line_no);
+    ZlineFile_get_line2(z, line_no, buf, sizeof buf, 0);
+    assert(!strcmp(buf, buf2));
+  }
+  ZlineFile_get_cache_stats(z, &hits, &misses);
+  assert(misses == block_count);
+  assert(hits + misses == (uint64_t)n);
+  ZlineFile_close(z);
+
+  /* cache with room for about 3 blocks */
+  z = ZlineFile_read2(FILENAME, 3000 + 3 * 16 * 50);
+  for (i=0; i < n; i++) {
+    int line_no = (i & 1) ? n-1-i : i;
+    sprintf(buf2, "test line %10d", line_no);
+    ZlineFile_get_line2(z, line_no, buf, sizeof buf, 0);
+    assert(!strcmp(buf, buf2));
+  }
+  ZlineFile_get_cache_stats(z, &hits, &misses);
+  assert(misses > block_count);
+  assert(misses < (uint64_t)n / 2);
+  ZlineFile_close(z);
+
+  /* Blocks of one- and two-byte lines, whose line index decodes from
+     more bytes than the content. A cache with room for three blocks'
+     content and line arrays holds three blocks. */
+  z = ZlineFile_create2(FILENAME, 1000);
+  for (i=0; i < 10000; i++)
+    ZlineFile_add_line(z, (i & 1) ? "xy" : "x");
+  ZlineFile_close(z);
+  z = ZlineFile_read(FILENAME);
+  block_lines = ZlineFile_get_block_line_count(z, 0);
+  ZlineFile_close(z);
+  z = ZlineFile_read2(FILENAME, 3 * (1000 + 16 * block_lines) * 11 / 10);
+  for (i=0; i < 30; i++)
+    ZlineFile_get_line2(z, i % 3 * block_lines, buf, sizeof buf, 0);
+  ZlineFile_get_cache_stats(z, &hits, &misses);
+  assert(misses == 3);
+  ZlineFile_close(z);
+
+  putchar('.'); fflush(stdout);
+}
+
+
+void test_threaded_write() {
+  char buf[200], buf2[200], long_line[500], long_buf[600];
+  int i, n = 5000;
+  ZlineFile z;
+
+  memset(long_line, 'x', sizeof long_line - 1);
+  long_line[sizeof long_line - 1] = 0;
+
+  z = ZlineFile_create3(FILENAME, 200, 3);
+  assert(z);
+  for (i=0; i < n; i++) {
+    if (i == n/2) {
+      ZlineFile_add_line(z, long_line);
+    } else {
+      sprintf(buf, "test line %10d", i);
+      ZlineFile_add_line(z, buf);
+    }
+
+    /* read back an earlier line while blocks are being compressed */
+    if (i % 1000 == 999) {
+      sprintf(buf2, "test line %10d", i - 900);
+      assert(!strcmp(buf2, ZlineFile_get_line2(z, i-900, buf, sizeof buf, 0)));
+    }
+  }
+  ZlineFile_close(z);
+
+  z = ZlineFile_read(FILENAME);
+  assert(ZlineFile_line_count(z) == (uint64_t)n);
+  assert(ZlineFile_get_block_count(z) > 100);
+  for (i=0; i < n; i++) {
+    if (i == n/2) {
+      ZlineFile_get_line2(z, i, long_buf, sizeof long_buf, 0);
+      assert(!strcmp(long_line, long_buf));
+    } else {
+      sprintf(buf2, "test line %10d", i);
+      ZlineFile_get_line2(z, i, buf, sizeof buf, 0);
+      assert(!strcmp(buf, buf2));
+    }
+  }
+  ZlineFile_close(z);
+
+  putchar('.'); fflush(stdout);
+}
+
+
+#define CURSOR_THREADS 4
+#define CURSOR_LINES 20000
+/* long enough that it won't be loaded into memory */
+#define CURSOR_LONG_LINE (5*1024*1024)
+
+typedef struct {
+  ZlineFile z;
+  int seed, error_count;
+} CursorTestArgs;
+
+static void *cursorTestThread(void *arg) {
+  CursorTestArgs *args = (CursorTestArgs*) arg;
+  ZlineCursor cursor = ZlineCursor_create(args->z);
+  char buf[100], buf2[100];
+  unsigned r = args->seed;
+  int i, line_no;
+
+  for (i=0; i < 5000; i++) {
+    r = r * 1103515245 + 12345;
+    line_no = (r >> 8) % CURSOR_LINES;
+    sprintf(buf2, "cursor line %10d", line_no);
+    if (!ZlineCursor_get_line2(cursor, line_no, buf, sizeof buf, 0)
+        || strcmp(buf, buf2)
+        || ZlineCursor_line_length(cursor, line_no) != (int64_t)strlen(buf2))
+      args->error_count++;
+  }
+
+  /* the last line is long, so it is decompressed straight from the file */
+  line_no = CURSOR_LONG_LINE - 1000 - args->seed;
+  if (!ZlineCursor_get_line2(cursor, CURSOR_LINES, buf, 27, line_no)
+      || buf[0] != 'a' + line_no % 26 || strlen(buf) != 26)
+    args->error_count++;
+
+  ZlineCursor_close(cursor);
+  return NULL;
+}
+
+
+void test_cursors() {
+  char buf[100], *long_line;
+  int i;
+  ZlineFile z;
+  Thread threads[CURSOR_THREADS];
+  CursorTestArgs args[CURSOR_THREADS];
+
+  z = ZlineFile_create2(FILENAME, 1000);
+  for (i=0; i < CURSOR_LINES; i++) {
+    sprintf(buf, "cursor line %10d", i);
+    ZlineFile_add_line(z, buf);
+  }
+  long_line = malloc(CURSOR_LONG_LINE + 1);
+  for (i=0; i < CURSOR_LONG_LINE; i++)
+    long_line[i] = 'a' + i % 26;
+  long_line[CURSOR_LONG_LINE] = 0;
+  ZlineFile_add_line(z, long_line);
+  free(long_line);
+
+  /* cursors can only be used on files opened for reading */
+  assert(ZlineCursor_create(z) == NULL);
+  ZlineFile_close(z);
+
+  z = ZlineFile_read(FILENAME);
+  for (i=0; i < CURSOR_THREADS; i++) {
+    args[i].z = z;
+    args[i].seed = i;
+    args[i].error_count = 0;
+    assert(!threadStart(&threads[i], cursorTestThread, &args[i]));
+  }
+  for (i=0; i < CURSOR_THREADS; i++) {
+    threadJoin(threads[i]);
+    assert(args[i].error_count == 0);
+  }
+  ZlineFile_close(z);
+
+  putchar('.'); fflush(stdout);
+}
+
+
+void test_mmap() {
+  char buf[100], buf2[100], *long_line, *p;
+  int i, pass, n = 3000, long_len = 5*1024*1024;
+  ZlineFile z;
+  ZlineCursor cursor;
+
+  long_line = malloc(long_len + 1);
+  for (i=0; i < long_len; i++)
+    long_line[i] = 'a' + i % 26;
+  long_line[long_len] = 0;
+
+  /* pass 0: compressed index, pass 1: index used in place */
+  for (pass = 0; pass < 2; pass++) {
+    z = ZlineFile_create2(FILENAME, 1000);
+    if (pass == 1) assert(!ZlineFile_set_index_compression(z, 0));
+    for (i=0; i < n; i++) {
+      if (i == n/2) {
+        ZlineFile_add_line(z, long_line);
+      } else {
+        sprintf(buf, "mapped line %10d", i);
+        ZlineFile_add_line(z, buf);
+      }
+    }
+    ZlineFile_close(z);
+
+    z = ZlineFile_read_mmap(FILENAME, 0);
+    assert(z);
+    assert(ZlineFile_set_index_compression(z, 1) == -1);
+    assert(ZlineFile_line_count(z) == (uint64_t)n);
+    cursor = ZlineCursor_create(z);
+    for (i=n-1; i >= 0; i--) {
+      if (i == n/2) {
+        /* a piece from the middle, then the whole line */
+        ZlineFile_get_line2(z, i, buf, 27, long_len - 1000);
+        assert(!strncmp(buf, long_line + long_len - 1000, 26));
+        ZlineCursor_get_line2(cursor, i, buf, 27, 12345);
+        assert(!strncmp(buf, long_line + 12345, 26));
+        assert(strlen(buf) == 26);
+        p = ZlineFile_get_line(z, i);
+        assert(p && !strcmp(p, long_line));
+        free(p);
+      } else {
+        sprintf(buf2, "mapped line %10d", i);
+        assert(!strcmp(buf2, ZlineFile_get_line2(z, i, buf, sizeof buf, 0)));
+        assert(!strcmp(buf2,
+                       ZlineCursor_get_line2(cursor, i, buf, sizeof buf, 0)));
+      }
+    }
+    ZlineCursor_close(cursor);
+    ZlineFile_close(z);
+  }
+
+  free(long_line);
+  putchar('.'); fflush(stdout);
+}
+
+
+static void checkGetLines(ZlineFile z, const uint64_t *idx, uint64_t n,
+                          const char *long_line, int long_line_no) {
+  char *buf, expected[100];
+  uint64_t *offsets, *lengths, i;
+  int64_t total;
+
+  offsets = malloc(sizeof(uint64_t) * n);
+  lengths = malloc(sizeof(uint64_t) * n);
+
+  /* first get the size needed */
+  total = ZlineFile_get_lines(z, idx, n, NULL, 0, offsets, lengths);
+  assert(total > 0);
+  buf = malloc(total);
+  assert(total == ZlineFile_get_lines(z, idx, n, buf, total, offsets, lengths));
+
+  for (i=0; i < n; i++) {
+    if ((int)idx[i] == long_line_no) {
+      assert(!strcmp(buf + offsets[i], long_line));
+    } else {
+      sprintf(expected, "batch line %10d", (int)idx[i]);
+      assert(!strcmp(buf + offsets[i], expected));
+    }
+    assert(lengths[i] == strlen(buf + offsets[i]));
+  }
+
+  free(buf);
+  free(offsets);
+  free(lengths);
+}
+
+
+void test_get_lines() {
+  char buf[100], long_line[700];
+  int i, n = 20000;
+  uint64_t idx[3000], offset, length;
+  unsigned r = 1;
+  ZlineFile z;
+
+  memset(long_line, 'z', sizeof long_line - 1);
+  long_line[sizeof long_line - 1] = 0;
+
+  for (i=0; i < 3000; i++) {
+    r = r * 1103515245 + 12345;
+    idx[i] = (r >> 8) % n;
+  }
+  idx[10] = idx[11] = n/2;   /* the long line, twice */
+
+  z = ZlineFile_create2(FILENAME, 1000);
+  for (i=0; i < n; i++) {
+    if (i == n/2) {
+      ZlineFile_add_line(z, long_line);
+    } else {
+      sprintf(buf, "batch line %10d", i);
+      ZlineFile_add_line(z, buf);
+    }
+  }
+
+  /* works while writing too */
+  checkGetLines(z, idx, 100, long_line, n/2);
+  assert(ZlineFile_set_thread_count(z, 2) == -1);
+  ZlineFile_close(z);
+
+  z = ZlineFile_read(FILENAME);
+  checkGetLines(z, idx, 3000, long_line, n/2);
+
+  /* invalid line numbers */
+  idx[2999] = n;
+  assert(-1 == ZlineFile_get_lines(z, idx, 3000, NULL, 0, idx, idx));
+  idx[2999] = 0;
+
+  /* a buffer that's too small isn't written to */
+  buf[0] = 'x';
+  assert(ZlineFile_get_lines(z, idx, 1, buf, 5, &offset, &length) > 5);
+  assert(buf[0] == 'x' && offset == 0);
+
+  assert(!ZlineFile_set_thread_count(z, 4));
+  checkGetLines(z, idx, 3000, long_line, n/2);
+  for (i=0; i < 3000; i++) idx[i] = i;
+  checkGetLines(z, idx, 3000, long_line, n/2);
+  ZlineFile_close(z);
+
+  z = ZlineFile_read_mmap(FILENAME, 0);
+  ZlineFile_set_thread_count(z, 3);
+  checkGetLines(z, idx, 3000, long_line, n/2);
+  ZlineFile_close(z);
+
+  putchar('.'); fflush(stdout);
+}
+
+
+void test_line_views() {
+  char buf[100], *long_line;
+  int i, n = 2000, long_len = 5*1024*1024;
+  ZlineFile z;
+  ZlineView first, first2, last, long_view, empty, v;
+
+  long_line = malloc(long_len + 1);
+  for (i=0; i < long_len; i++)
+    long_line[i] = 'a' + i % 26;
+  long_line[long_len] = 0;
+
+  z = ZlineFile_create2(FILENAME, 1000);
+  for (i=0; i < n; i++) {
+    sprintf(buf, "view line %10d", i);
+    ZlineFile_add_line(z, buf);
+  }
+  ZlineFile_add_line(z, long_line);
+  ZlineFile_add_line(z, "");
+
+  /* not available while writing */
+  assert(ZlineFile_get_line_view(z, 0, &v) == -1);
+  ZlineFile_close(z);
+
+  /* with no cache, pinned blocks must survive reading other blocks */
+  z = ZlineFile_read(FILENAME);
+  assert(!ZlineFile_get_line_view(z, 0, &first));
+  assert(!ZlineFile_get_line_view(z, 1, &first2));
+  assert(!ZlineFile_get_line_view(z, n-1, &last));
+  assert(!ZlineFile_get_line_view(z, n, &long_view));
+  assert(!ZlineFile_get_line_view(z, n+1, &empty));
+  assert(ZlineFile_get_line_view(z, n+2, &v) == -1);
+
+  for (i=0; i < n; i += 37) {
+    sprintf(buf, "view line %10d", i);
+    assert(!ZlineFile_get_line_view(z, i, &v));
+    assert(v.length == strlen(buf) && !memcmp(v.data, buf, v.length));
+    ZlineFile_release_view(z, &v);
+  }
+
+  assert(first.length == 20 && !memcmp(first.data, "view line          0", 20));
+  assert(first2.length == 20 && !memcmp(first2.data, "view line          1", 20));
+  sprintf(buf, "view line %10d", n-1);
+  assert(last.length == 20 && !memcmp(last.data, buf, 20));
+  assert(long_view.length == (uint64_t)long_len &&
+         !memcmp(long_view.data, long_line, long_len));
+  assert(empty.length == 0);
+
+  ZlineFile_release_view(z, &first);
+  ZlineFile_release_view(z, &first2);
+  ZlineFile_release_view(z, &last);
+  ZlineFile_release_view(z, &long_view);
+  ZlineFile_release_view(z, &empty);
+  assert(first.data == NULL && first.pin == NULL);
+
+  /* once released, block 0 can be evicted and reread */
+  ZlineFile_get_line2(z, n-1, buf, sizeof buf, 0);
+  assert(!ZlineFile_get_line_view(z, 0, &v));
+  assert(!memcmp(v.data, "view line          0", 20));
+  ZlineFile_release_view(z, &v);
+  ZlineFile_close(z);
+
+  free(long_line);
+  putchar('.'); fflush(stdout);
+}
+
+
+#define ITER_LINES 20000
+#define ITER_LONG_LEN (5*1024*1024)
+
+/* Iterate through [first, end) and check every line. */
+static void checkIterator(ZlineFile z, uint64_t first, uint64_t end,
+                          int is_reverse, int threads) {
+  char expected[100];
+  ZlineIterator it;
+  ZlineView v;
+  uint64_t count = 0, line_no;
+
+  it = ZlineIterator_create(z, first, end, is_reverse, threads);
+  assert(it);
+  while (ZlineIterator_next(it, &v, &line_no) == 1) {
+    assert(line_no == (is_reverse ? end - 1 - count : first + count));
+    if (line_no == ITER_LINES/2) {
+      assert(v.length == ITER_LONG_LEN);
+      assert(v.data[0] == 'a' && v.data[ITER_LONG_LEN-1] == 'a' + (ITER_LONG_LEN-1) % 26);
+    } else {
+      sprintf(expected, "iter line %10d", (int)line_no);
+      assert(v.length == strlen(expected));
+      assert(!memcmp(v.data, expected, v.length));
+    }
+    count++;
+  }
+  assert(count == end - first);
+  assert(ZlineIterator_next(it, &v, NULL) == 0);
+  ZlineIterator_close(it);
+}
+
+
+void test_iterator() {
+  char buf[100], *long_line;
+  int i;
+  ZlineFile z;
+
+  long_line = malloc(ITER_LONG_LEN + 1);
+  for (i=0; i < ITER_LONG_LEN; i++)
+    long_line[i] = 'a' + i % 26;
+  long_line[ITER_LONG_LEN] = 0;
+
+  z = ZlineFile_create2(FILENAME, 1000);
+  for (i=0; i < ITER_LINES; i++) {
+    if (i == ITER_LINES/2) {
+      ZlineFile_add_line(z, long_line);
+    } else {
+      sprintf(buf, "iter line %10d", i);
+      ZlineFile_add_line(z, buf);
+    }
+  }
+  assert(ZlineIterator_create(z, 0, 1, 0, 0) == NULL);
+  ZlineFile_close(z);
+  free(long_line);
+
+  z = ZlineFile_read(FILENAME);
+  checkIterator(z, 0, ITER_LINES, 0, 0);
+  checkIterator(z, 0, ITER_LINES, 0, 3);
+  checkIterator(z, 0, ITER_LINES, 1, 0);
+  checkIterator(z, 0, ITER_LINES, 1, 4);
+  checkIterator(z, 5, 17, 0, 2);
+  checkIterator(z, 5, 17, 1, 2);
+  checkIterator(z, 977, 12345, 1, 1);
+  checkIterator(z, 100, 100, 0, 2);
+  assert(ZlineIterator_create(z, 10, 5, 0, 0) == NULL);
+  assert(ZlineIterator_create(z, 0, ITER_LINES+1, 0, 0) == NULL);
+  ZlineFile_close(z);
+
+  z = ZlineFile_read_mmap(FILENAME, 0);
+  checkIterator(z, 0, ITER_LINES, 0, 2);
+  ZlineFile_close(z);
+
+  putchar('.'); fflush(stdout);
+}
   
 
 
+static void checkLineLengths(ZlineFile z, int n, int long_line_no,
+                             uint64_t long_len) {
+  uint64_t *lengths = malloc(sizeof(uint64_t) * n), expected;
+  int i;
+
+  for (i=0; i < n; i++) {
+    expected = i == long_line_no ? long_len : (uint64_t)(i % 37);
+    assert(ZlineFile_line_length(z, i) == (int64_t)expected);
+  }
+
+  /* all at once, then ranges that start and end mid-block */
+  assert(!ZlineFile_line_lengths(z, 0, n, lengths));
+  for (i=0; i < n; i++)
+    assert(lengths[i] == (i == long_line_no ? long_len : (uint64_t)(i % 37)));
+  assert(!ZlineFile_line_lengths(z, 123, 4567, lengths));
+  for (i=0; i < 4567; i++)
+    assert(lengths[i] == (i+123 == long_line_no ? long_len
+                          : (uint64_t)((i+123) % 37)));
+  assert(!ZlineFile_line_lengths(z, n, 0, lengths));
+
+  assert(ZlineFile_line_length(z, n) == -1);
+  assert(ZlineFile_line_lengths(z, n-1, 2, lengths) == -1);
+
+  free(lengths);
+}
+
+
+void test_line_lengths() {
+  char buf[40], *long_line;
+  int i, n = 10000;
+  uint64_t long_len = 5 * 1024 * 1024;
+  ZlineFile z;
+
+  long_line = malloc(long_len + 1);
+  memset(long_line, 'q', long_len);
+  long_line[long_len] = 0;
+  memset(buf, 'a', sizeof buf);
+
+  z = ZlineFile_create2(FILENAME, 1000);
+  for (i=0; i < n; i++) {
+    if (i == n/3)
+      ZlineFile_add_line2(z, long_line, long_len);
+    else
+      ZlineFile_add_line2(z, buf, i % 37);
+  }
+  checkLineLengths(z, n, n/3, long_len);
+  ZlineFile_close(z);
+
+  z = ZlineFile_read(FILENAME);
+  checkLineLengths(z, n, n/3, long_len);
+  ZlineFile_close(z);
+
+  z = ZlineFile_read_mmap(FILENAME, 0);
+  checkLineLengths(z, n, n/3, long_len);
+  ZlineFile_close(z);
+
+  free(long_line);
+  putchar('.'); fflush(stdout);
+}
+
+
+/* Read some windows of a long line and all of it, and compare with
+   the original. */
+static void checkLongLineWindows(ZlineFile z, uint64_t line_no,
+                                 const char *line, uint64_t len) {
+  uint64_t frame = 1024*1024, offsets[6], i, copy_len;
+  char buf[1001], *whole;
+
+  offsets[0] = 0;
+  offsets[1] = frame - 500;     /* crosses a frame boundary */
+  offsets[2] = 3 * frame;       /* starts on a boundary */
+  offsets[3] = len - 1000;      /* near the end */
+  offsets[4] = len - 10;        /* runs off the end */
+  offsets[5] = len + 5;         /* past the end */
+
+  for (i=0; i < 6; i++) {
+    assert(buf == ZlineFile_get_line2(z, line_no, buf, sizeof buf,
+                                      offsets[i]));
+    copy_len = offsets[i] >= len ? 0 : MIN(len - offsets[i], 1000);
+    assert(strlen(buf) == copy_len);
+    assert(!memcmp(buf, line + offsets[i], copy_len));
+  }
+
+  whole = ZlineFile_get_line(z, line_no);
+  assert(whole && !memcmp(whole, line, len) && whole[len] == 0);
+  free(whole);
+}
+
+
+void test_long_line_frames() {
+  uint64_t len = 5 * 1024 * 1024 + 12345;
+  unsigned r = 7;
+  char *line = malloc(len + 1), buf[20];
+  uint64_t i;
+  ZlineFile z;
+
+  for (i=0; i < len; i++) {
+    r = r * 1103515245 + 12345;
+    line[i] = "ACGT"[(r >> 16) & 3];
+  }
+  line[len] = 0;
+
+  z = ZlineFile_create(FILENAME);
+  ZlineFile_add_line(z, "before");
+  ZlineFile_add_line2(z, line, len);
+  ZlineFile_add_line(z, "after");
+  checkLongLineWindows(z, 1, line, len);
+  ZlineFile_close(z);
+
+  /* one thread, then several decoding frames in parallel */
+  z = ZlineFile_read(FILENAME);
+  checkLongLineWindows(z, 1, line, len);
+  assert(!ZlineFile_set_thread_count(z, 4));
+  checkLongLineWindows(z, 1, line, len);
+  assert(!strcmp("after", ZlineFile_get_line2(z, 2, buf, sizeof buf, 0)));
+  ZlineFile_close(z);
+
+  z = ZlineFile_read_mmap(FILENAME, 0);
+  ZlineFile_set_thread_count(z, 3);
+  checkLongLineWindows(z, 1, line, len);
+  ZlineFile_close(z);
+
+  free(line);
+  putchar('.'); fflush(stdout);
+}
+
+
+static void dictTestLine(char *buf, int i) {
+  static const char *words[] = {"sample", "read", "quality", "ACGT",
+                                "forward", "reverse", "lane", "tile"};
+  sprintf(buf, "@%s:%d:%s:%d %s %s", words[i%8], i, words[(i/8)%8],
+          i*7 % 1000, words[(i/3)%8], i % 5 ? "pass" : "fail");
+}
+
+
+void test_dictionary() {
+  char buf[200], *samples, *long_line;
+  uint64_t lengths[2000], dict_size, pos = 0, long_len = 2*1024*1024 + 7;
+  int64_t trained;
+  int i, n = 5000, long_line_no = 1234, mode;
+  char dict[4096];
+  ZlineFile z;
+
+  samples = malloc(2000 * 100);
+  for (i=0; i < 2000; i++) {
+    dictTestLine(buf, i);
+    lengths[i] = strlen(buf);
+    memcpy(samples + pos, buf, lengths[i]);
+    pos += lengths[i];
+  }
+  trained = ZlineFile_train_dictionary(dict, sizeof dict, samples,
+                                       lengths, 2000);
+  assert(trained > 0 && trained <= (int64_t) sizeof dict);
+  dict_size = trained;
+
+  long_line = malloc(long_len + 1);
+  for (i=0; i < (int)long_len; i++) long_line[i] = 'a' + (i % 7) * (i % 3);
+  long_line[long_len] = 0;
+
+  /* with and without background compression threads */
+  for (mode = 0; mode < 2; mode++) {
+    z = ZlineFile_create3(FILENAME, 500, mode ? 3 : 0);
+    assert(!ZlineFile_set_dictionary(z, dict, dict_size));
+    assert(ZlineFile_set_dictionary(z, dict, dict_size) == -1);
+    for (i=0; i < n; i++) {
+      if (i == long_line_no) {
+        ZlineFile_add_line2(z, long_line, long_len);
+      } else {
+        dictTestLine(buf, i);
+        ZlineFile_add_line(z, buf);
+      }
+    }
+    dictTestLine(buf, 10);
+    assert(!strcmp(buf, ZlineFile_get_line2(z, 10, samples, 200, 0)));
+    ZlineFile_close(z);
+
+    z = ZlineFile_read_mmap(FILENAME, 0);
+    ZlineFile_set_thread_count(z, 2);
+    for (i=0; i < n; i += 7) {
+      if (i == long_line_no) continue;
+      dictTestLine(buf, i);
+      assert(!strcmp(buf, ZlineFile_get_line2(z, i, samples, 200, 0)));
+    }
+    assert(ZlineFile_get_line2(z, long_line_no, samples, 101, long_len - 100));
+    assert(!strcmp(samples, long_line + long_len - 100));
+    ZlineFile_close(z);
+
+    z = ZlineFile_read(FILENAME);
+    for (i=n-1; i >= 0; i -= 3) {
+      if (i == long_line_no) continue;
+      dictTestLine(buf, i);
+      assert(!strcmp(buf, ZlineFile_get_line2(z, i, samples, 200, 0)));
+    }
+    ZlineFile_close(z);
+  }
+
+  /* it's too late once lines have been added */
+  z = ZlineFile_create(FILENAME);
+  ZlineFile_add_line(z, "x");
+  assert(ZlineFile_set_dictionary(z, dict, dict_size) == -1);
+  ZlineFile_close(z);
+
+  free(long_line);
+  free(samples);
+  putchar('.'); fflush(stdout);
+}
+
+
+/* Line i of the text for test_add_text: mostly short, some empty, and
+   one that is longer than a frame. */
+static uint64_t addTextLine(char *buf, int i, uint64_t long_len) {
+  uint64_t j;
+  if (i == 700) {
+    for (j=0; j < long_len; j++) buf[j] = 'A' + (j % 23);
+    return long_len;
+  }
+  if (i % 11 == 0) return 0;
+  return sprintf(buf, "text line %d %.*s", i, i % 40,
+                 "........................................");
+}
+
+
+void test_add_text() {
+  uint64_t long_len = 1500000, len, pos = 0, i, n = 3000;
+  char *text, *line, *buf;
+  ZlineFile z;
+  int threads;
+
+  text = malloc(n * 100 + long_len);
+  line = malloc(long_len + 1);
+  buf = malloc(long_len + 1);
+
+  /* mix "\n" and "\r\n", and leave off the last newline */
+  for (i=0; i < n; i++) {
+    len = addTextLine(text + pos, i, long_len);
+    pos += len;
+    if (i % 3 == 0) text[pos++] = '\r';
+    if (i < n-1) text[pos++] = '\n';
+  }
+
+  for (threads = 1; threads <= 4; threads += 3) {
+    z = ZlineFile_create3(FILENAME, 1000, threads == 4 ? 2 : 0);
+    assert(0 == ZlineFile_min_line_length(z));
+    ZlineFile_add_line(z, "first");
+    assert(5 == ZlineFile_min_line_length(z));
+    assert(!ZlineFile_add_text(z, text, pos, threads));
+    ZlineFile_add_line(z, "last");
+    assert(ZlineFile_line_count(z) == n + 2);
+    assert(0 == ZlineFile_min_line_length(z));
+    assert(long_len == ZlineFile_max_line_length(z));
+    assert(!strcmp("text line 1 .", ZlineFile_get_line2(z, 2, buf, 100, 0)));
+    ZlineFile_close(z);
+
+    z = ZlineFile_read(FILENAME);
+    assert(ZlineFile_line_count(z) == n + 2);
+    assert(ZlineFile_max_line_length(z) == long_len);
+    assert(!strcmp("first", ZlineFile_get_line2(z, 0, buf, 100, 0)));
+    for (i=0; i < n; i++) {
+      len = addTextLine(line, i, long_len);
+      /* the last line keeps its "\r" since it has no newline */
+      if (i == n-1 && i % 3 == 0) line[len++] = '\r';
+      line[len] = 0;
+      assert(ZlineFile_line_length(z, i+1) == (int64_t)len);
+      assert(buf == ZlineFile_get_line2(z, i+1, buf, long_len + 1, 0));
+      assert(!strcmp(buf, line));
+    }
+    assert(!strcmp("last", ZlineFile_get_line2(z, n+1, buf, 100, 0)));
+    ZlineFile_close(z);
+  }
+
+  free(text);
+  free(line);
+  free(buf);
+  putchar('.'); fflush(stdout);
+}
+
+
+void test_append() {
+  char buf[200], dict[4096], *samples;
+  uint64_t lengths[1000], pos = 0;
+  int64_t dict_size;
+  int i, n = 3000, mode;
+  ZlineFile z;
+
+  samples = malloc(1000 * 100);
+  for (i=0; i < 1000; i++) {
+    dictTestLine(buf, i);
+    lengths[i] = strlen(buf);
+    memcpy(samples + pos, buf, lengths[i]);
+    pos += lengths[i];
+  }
+  dict_size = ZlineFile_train_dictionary(dict, sizeof dict, samples,
+                                         lengths, 1000);
+  assert(dict_size > 0);
+
+  /* mode 1 uses a dictionary, an uncompressed index, and threads */
+  for (mode = 0; mode < 2; mode++) {
+    z = ZlineFile_create2(FILENAME, 1000);
+    if (mode) {
+      assert(!ZlineFile_set_dictionary(z, dict, dict_size));
+      ZlineFile_set_index_compression(z, 0);
+    }
+    for (i=0; i < n; i++) {
+      dictTestLine(buf, i);
+      ZlineFile_add_line(z, buf);
+    }
+    ZlineFile_close(z);
+
+    /* append twice, reading old and new lines along the way */
+    for (i=n; i < 3*n; i++) {
+      if (i % n == 0) {
+        z = ZlineFile_open_append2(FILENAME, 700, mode ? 2 : 0);
+        assert(z);
+        assert(ZlineFile_line_count(z) == (uint64_t)i);
+      }
+      dictTestLine(buf, i);
+      ZlineFile_add_line(z, buf);
+      if (i % 997 == 0) {
+        dictTestLine(buf, i - n + 1);
+        assert(!strcmp(buf, ZlineFile_get_line2(z, i-n+1, samples, 200, 0)));
+      }
+      if (i % n == n-1) ZlineFile_close(z);
+    }
+
+    /* appending nothing leaves the file as it was */
+    z = ZlineFile_open_append(FILENAME);
+    ZlineFile_close(z);
+
+    z = ZlineFile_read(FILENAME);
+    assert(ZlineFile_line_count(z) == (uint64_t)3*n);
+    for (i=0; i < 3*n; i++) {
+      dictTestLine(buf, i);
+      assert(!strcmp(buf, ZlineFile_get_line2(z, i, samples, 200, 0)));
+    }
+    ZlineFile_close(z);
+  }
+
+  free(samples);
+  putchar('.'); fflush(stdout);
+}
+
+
+/* Line i for test_nt2: mostly nucleotides, with some runs of other
+   characters, and now and then a line that isn't sequence at all. */
+static void nt2TestLine(char *buf, int i) {
+  static const char *extras[] = {"N", "NNNNNNNN", "-", "acgt", "R", "Y"};
+  int j, len = 20 + i % 150;
+  unsigned r = i * 2654435761u;
+
+  if (i % 400 >= 390) {
+    sprintf(buf, "this block is not DNA: %d", i);
+    return;
+  }
+  for (j=0; j < len; j++) {
+    r = r * 1103515245u + 12345;
+    buf[j] = "ACGT"[(r >> 16) & 3];
+  }
+  buf[j] = 0;
+  if (i % 3 == 0)
+    memcpy(buf + i % 12, extras[i % 6], strlen(extras[i % 6]));
+  if (i % 5 == 0) buf[len-1] = 'N';
+}
+
+
+void test_nt2() {
+  char buf[200], *long_line, *text, *out, header[300];
+  uint64_t long_len = 3000000, mid_len = 300000, pos = 0;
+  int i, n = 4000, mode;
+  FILE *f;
+  ZlineFile z;
+
+  long_line = malloc(long_len + 1);
+  for (i=0; i < (int)long_len; i++)
+    long_line[i] = i % 1000 == 999 ? 'N' : "ACGT"[(i * 7 + i / 5) & 3];
+  long_line[long_len] = 0;
+
+  text = malloc(n * 200);
+  out = malloc(1000);
+  for (i=0; i < n; i++) {
+    nt2TestLine(text + pos, i);
+    pos += strlen(text + pos);
+    text[pos++] = '\n';
+  }
+
+  /* 0: on this thread, 1: with background threads, 2: ZlineFile_add_text */
+  for (mode = 0; mode < 3; mode++) {
+    z = ZlineFile_create3(FILENAME, 2000, mode == 1 ? 2 : 0);
+    assert(ZlineFile_set_codec(z, 7) == -1);
+    assert(!ZlineFile_set_codec(z, ZLINE_CODEC_NT2));
+    if (mode == 2) {
+      assert(!ZlineFile_add_text(z, text, pos, 2));
+    } else {
+      for (i=0; i < n; i++) {
+        nt2TestLine(buf, i);
+        ZlineFile_add_line(z, buf);
+      }
+    }
+    /* one line too long for a block, and one long enough for frames */
+    ZlineFile_add_line2(z, long_line, mid_len);
+    ZlineFile_add_line2(z, long_line, long_len);
+    ZlineFile_add_line(z, "");
+    nt2TestLine(buf, 5);
+    assert(!strcmp(buf, ZlineFile_get_line2(z, 5, out, 200, 0)));
+    ZlineFile_close(z);
+
+    f = fopen(FILENAME, "rb");
+    assert(fread(header, 1, sizeof header, f) == sizeof header);
+    fclose(f);
+    header[sizeof header - 1] = 0;
+    assert(strstr(header, "alg fzstd+nt2\n"));
+
+    z = mode == 1 ? ZlineFile_read_mmap(FILENAME, 0) : ZlineFile_read(FILENAME);
+    assert(ZlineFile_line_count(z) == (uint64_t)n + 3);
+    for (i=0; i < n; i++) {
+      nt2TestLine(buf, i);
+      assert(!strcmp(buf, ZlineFile_get_line2(z, i, out, 200, 0)));
+    }
+    /* pieces of the long lines, at unaligned offsets */
+    for (i=0; i < 2; i++) {
+      uint64_t len = i ? long_len : mid_len, start = len - 1001;
+      assert(ZlineFile_get_line2(z, n+i, out, 1000, start));
+      assert(!memcmp(out, long_line + start, 999));
+      assert(ZlineFile_get_line2(z, n+i, out, 500, 3));
+      assert(!memcmp(out, long_line + 3, 499));
+    }
+    assert(!strcmp("", ZlineFile_get_line2(z, n+2, out, 200, 0)));
+    ZlineFile_close(z);
+  }
+
+  /* packed blocks of one line too big to be left in memory are read
+     once rather than on every access */
+  free(long_line);
+  long_len = 5000000;
+  long_line = malloc(long_len + 1);
+  for (i=0; i < (int)long_len; i++)
+    long_line[i] = i % 1000 == 999 ? 'N' : "ACGT"[(i * 7 + i / 5) & 3];
+  z = ZlineFile_create2(FILENAME, 6000000);
+  assert(!ZlineFile_set_codec(z, ZLINE_CODEC_NT2));
+  ZlineFile_add_line2(z, long_line, long_len);
+  ZlineFile_add_line2(z, long_line + 1, long_len - 1);
+  ZlineFile_close(z);
+  z = ZlineFile_read(FILENAME);
+  assert(ZlineFile_get_block_count(z) == 2);
+  for (i=0; i < 20; i++) {
+    uint64_t start = (uint64_t) i * 249989;
+    assert(ZlineFile_get_line2(z, i & 1, out, 1000, start));
+    assert(!memcmp(out, long_line + (i & 1) + start, 999));
+  }
+  ZlineFile_close(z);
+
+  free(text);
+  free(out);
+  free(long_line);
+  putchar('.'); fflush(stdout);
+}
+
+
+/* Field f of record i for test_records. */
+static void recordField(char *buf, int i, int f) {
+  if (f == 0)
+    sprintf(buf, "@read.%d", i);
+  else if (f == 1)
+    nt2TestLine(buf, i);
+  else
+    sprintf(buf, "%.*s", i % 30, "IIIIIIIIII::::::::::FFFFFFFFFF");
+}
+
+
+void test_records() {
+  char field_bufs[3][200], *buf, expected[200], name[100];
+  const char *fields[3];
+  uint64_t offsets[600], lengths[600], buf_len;
+  int i, f, n = 3000, want[2] = {2, 0}, bad_field = 3;
+  int64_t total;
+  ZrecFile zr;
+
+  zr = ZrecFile_create(REC_FILENAME, 3, 1000, 0);
+  assert(zr);
+  assert(ZrecFile_field_count(zr) == 3);
+  assert(!ZrecFile_field(zr, 3));
+  assert(!ZlineFile_set_codec(ZrecFile_field(zr, 1), ZLINE_CODEC_NT2));
+  for (i=0; i < n; i++) {
+    for (f=0; f < 3; f++) {
+      recordField(field_bufs[f], i, f);
+      fields[f] = field_bufs[f];
+    }
+    assert(!ZrecFile_add_record(zr, fields, NULL));
+  }
+  assert(ZrecFile_record_count(zr) == (uint64_t)n);
+  assert(0 == ZrecFile_close(zr));
+
+  zr = ZrecFile_read(REC_FILENAME, 0);
+  assert(zr);
+  assert(ZrecFile_record_count(zr) == (uint64_t)n);
+  assert(ZrecFile_field_count(zr) == 3);
+  assert(ZrecFile_add_record(zr, fields, NULL) == -1);
+
+  /* fields 2 and 0 of 300 records; the first call finds the size */
+  total = ZrecFile_get_records(zr, 1234, 300, want, 2, NULL, 0,
+                               offsets, lengths);
+  assert(total > 0);
+  buf_len = total;
+  buf = malloc(buf_len);
+  assert(total == ZrecFile_get_records(zr, 1234, 300, want, 2, buf, buf_len,
+                                       offsets, lengths));
+  for (i=0; i < 300; i++) {
+    for (f=0; f < 2; f++) {
+      recordField(expected, 1234 + i, want[f]);
+      assert(lengths[i*2 + f] == strlen(expected));
+      assert(!strcmp(buf + offsets[i*2 + f], expected));
+    }
+  }
+
+  /* the sequence field alone */
+  f = 1;
+  assert(ZrecFile_get_records(zr, n - 10, 10, &f, 1, buf, buf_len,
+                              offsets, lengths) > 0);
+  for (i=0; i < 10; i++) {
+    recordField(expected, n - 10 + i, 1);
+    assert(!strcmp(buf + offsets[i], expected));
+  }
+
+  assert(ZrecFile_get_records(zr, n - 10, 11, &f, 1, buf, buf_len,
+                              offsets, lengths) == -1);
+  assert(ZrecFile_get_records(zr, 0, 10, &bad_field, 1, buf, buf_len,
+                              offsets, lengths) == -1);
+  assert(ZrecFile_get_records(zr, n, 0, &f, 1, buf, buf_len,
+                              offsets, lengths) == 0);
+  ZrecFile_close(zr);
+  free(buf);
+
+  /* a field file that doesn't match the manifest */
+  sprintf(name, "%s.2", REC_FILENAME);
+  zr = ZrecFile_create(name, 1, 0, 0);
+  fields[0] = "x";
+  ZrecFile_add_record(zr, fields, NULL);
+  ZrecFile_close(zr);
+  remove(name);
+  sprintf(name, "%s.2.0", REC_FILENAME);
+  rename(name, REC_FILENAME ".2");
+  assert(!ZrecFile_read(REC_FILENAME, 0));
+
+  /* with no records there is no manifest, and nothing to read */
+  zr = ZrecFile_create(REC_FILENAME, 3, 1000, 0);
+  assert(-1 == ZrecFile_close(zr));
+  assert(!ZrecFile_read(REC_FILENAME, 0));
+
+  remove(REC_FILENAME);
+  for (f=0; f < 3; f++) {
+    sprintf(name, "%s.%d", REC_FILENAME, f);
+    remove(name);
+  }
+  putchar('.'); fflush(stdout);
+}
+
+
+typedef struct {
+  const char *const *patterns;
+  int pattern_count;
+  uint64_t next_line, found, stop_after;
+} SearchCheck;
+
+
+/* Check that every line between the previous match and this one
+   doesn't match, and this one does. */
+static int checkSearchMatch(void *arg, uint64_t line_idx, const char *line,
+                            uint64_t length) {
+  SearchCheck *check = (SearchCheck*) arg;
+  char buf[200];
+  int p, is_match;
+
+  for (; check->next_line <= line_idx; check->next_line++) {
+    nt2TestLine(buf, (int) check->next_line);
+    is_match = 0;
+    for (p=0; p < check->pattern_count; p++)
+      if (strstr(buf, check->patterns[p])) is_match = 1;
+    assert(is_match == (check->next_line == line_idx));
+  }
+  assert(length == strlen(buf) && !memcmp(line, buf, length));
+
+  return ++check->found == check->stop_after;
+}
+
+
+void test_search() {
+  const char *patterns[] = {"ACGTACG", "not DNA: 11", "NNNNNNNNGT", ""};
+  char buf[200], span[50];
+  SearchCheck check;
+  int i, n = 5000, threads;
+  int64_t found;
+  ZlineFile z;
+
+  z = ZlineFile_create2(FILENAME, 3000);
+  for (i=0; i < n; i++) {
+    nt2TestLine(buf, i);
+    ZlineFile_add_line(z, buf);
+  }
+  ZlineFile_close(z);
+
+  z = ZlineFile_read(FILENAME);
+  for (threads = 0; threads < 4; threads += 3) {
+    /* one pattern, then several, over part of the file */
+    memset(&check, 0, sizeof check);
+    check.patterns = patterns;
+    check.pattern_count = 1;
+    found = ZlineFile_search(z, patterns, 1, 0, n, threads,
+                             checkSearchMatch, &check);
+    assert(found > 10 && found == (int64_t)check.found);
+
+    memset(&check, 0, sizeof check);
+    check.patterns = patterns;
+    check.pattern_count = 3;
+    check.next_line = 1000;
+    found = ZlineFile_search(z, patterns, 3, 1000, 3210, threads,
+                             checkSearchMatch, &check);
+    assert(found > 10 && found == (int64_t)check.found);
+
+    /* stop early */
+    check.next_line = 0;
+    check.found = 0;
+    check.stop_after = 3;
+    assert(3 == ZlineFile_search(z, patterns, 3, 0, n, threads,
+                                 checkSearchMatch, &check));
+
+    /* count only; the empty pattern matches every line */
+    assert(n - 7 == ZlineFile_search(z, patterns + 3, 1, 7, n, threads,
+                                     NULL, NULL));
+    assert(0 == ZlineFile_search(z, patterns, 1, 5, 5, threads,
+                                 NULL, NULL));
+  }
+
+  /* a match that runs from one line into the next doesn't count */
+  nt2TestLine(buf, 800);
+  sprintf(span, "not DNA: 799%.3s", buf);
+  patterns[0] = span;
+  assert(0 == ZlineFile_search(z, patterns, 1, 0, n, 2, NULL, NULL));
+  assert(-1 == ZlineFile_search(z, patterns, 1, 0, n + 1, 2, NULL, NULL));
+  ZlineFile_close(z);
+
+  putchar('.'); fflush(stdout);
+}
+
+
+/* Make each block's filter rule out a motif that only one line has,
+   with each way of writing blocks. */
+void test_kmer_filter() {
+  const char *motif = "TTGACAGGCTTAGCATGCCA", *patterns[2];
+  char buf[200], *text;
+  int i, n = 6000, mode, k = 12, possible;
+  uint64_t block, block_count, text_len = 0, first_line;
+  ZlineFile z;
+
+  text = (char*) malloc(n * 200);
+  for (i=0; i < n; i++) {
+    nt2TestLine(buf, i);
+    if (i == 4321) memcpy(buf + 5, motif, strlen(motif));
+    text_len += sprintf(text + text_len, "%s\n", buf);
+  }
+
+  for (mode = 0; mode < 3; mode++) {
+    z = ZlineFile_create3(FILENAME, 5000, mode == 1 ? 2 : 0);
+    assert(-1 == ZlineFile_set_kmer_filter(z, 0, 0));
+    assert(0 == ZlineFile_set_kmer_filter(z, k, 0));
+    if (mode == 2) {
+      assert(0 == ZlineFile_add_text(z, text, text_len, 2));
+    } else {
+      for (i=0; i < n; i++) {
+        nt2TestLine(buf, i);
+        if (i == 4321) memcpy(buf + 5, motif, strlen(motif));
+        ZlineFile_add_line(z, buf);
+      }
+    }
+    assert(-1 == ZlineFile_set_kmer_filter(z, k, 0));
+    ZlineFile_close(z);
+
+    z = ZlineFile_read(FILENAME);
+    assert(ZlineFile_line_count(z) == (uint64_t) n);
+
+    /* the block with the motif is never ruled out, and most others are */
+    block_count = ZlineFile_get_block_count(z);
+    assert(block_count > 50);
+    possible = 0;
+    for (block = 0; block < block_count; block++) {
+      first_line = ZlineFile_get_block_first_line(z, block);
+      if (first_line <= 4321 &&
+          4321 < first_line + ZlineFile_get_block_line_count(z, block))
+        assert(1 == ZlineFile_block_may_contain(z, block, motif, 20));
+      possible += ZlineFile_block_may_contain(z, block, motif, 20);
+      /* too short to check */
+      assert(1 == ZlineFile_block_may_contain(z, block, motif, 11));
+    }
+    assert(possible >= 1 && possible < 5);
+    assert(-1 == ZlineFile_block_may_contain(z, block_count, motif, 20));
+
+    /* the search finds the same lines as without filters */
+    patterns[0] = motif;
+    patterns[1] = "ACGTACG";
+    assert(1 == ZlineFile_search(z, patterns, 1, 0, n, 2, NULL, NULL));
+    assert(ZlineFile_search(z, patterns, 2, 0, n, 0, NULL, NULL) ==
+           ZlineFile_search(z, patterns + 1, 1, 0, n, 0, NULL, NULL) + 1);
+    ZlineFile_close(z);
+  }
+
+  /* appended blocks get filters too */
+  z = ZlineFile_open_append(FILENAME);
+  assert(-1 == ZlineFile_set_kmer_filter(z, k, 0));
+  ZlineFile_add_line(z, motif);
+  ZlineFile_close(z);
+  z = ZlineFile_read(FILENAME);
+  block = ZlineFile_get_block_count(z) - 1;
+  assert(1 == ZlineFile_block_may_contain(z, block, motif, 20));
+  assert(2 == ZlineFile_search(z, patterns, 1, 0, n + 1, 2, NULL, NULL));
+  ZlineFile_close(z);
+
+  free(text);
+  putchar('.'); fflush(stdout);
+}
+
+
+/* Line i of test_sorted_keys. Read i/3 has three lines, so some runs
+   of equal keys cross block boundaries, and every tenth read number
+   is skipped. */
+static void sortedKeyLine(char *buf, int i) {
+  sprintf(buf, "@read%06d/%d chr%d\t%d\tACGT", (i / 3) * 10 / 9, i % 3,
+          i % 5, i * 17);
+}
+
+
+void test_sorted_keys() {
+  char buf[100], key[100], *text;
+  int i, n = 9000, mode;
+  uint64_t count, text_len = 0;
+  ZlineFile z;
+
+  text = (char*) malloc(n * 100);
+  for (i=0; i < n; i++) {
+    sortedKeyLine(buf, i);
+    text_len += sprintf(text + text_len, "%s\n", buf);
+  }
+
+  for (mode = 0; mode < 3; mode++) {
+    z = ZlineFile_create3(FILENAME, 2000, mode == 1 ? 2 : 0);
+    assert(-1 == ZlineFile_set_sorted_key(z, -1, 0, 0));
+    assert(0 == ZlineFile_set_sorted_key(z, 0, '/', 0));
+    if (mode == 2) {
+      assert(0 == ZlineFile_add_text(z, text, text_len, 3));
+    } else {
+      for (i=0; i < n; i++) {
+        sortedKeyLine(buf, i);
+        assert(0 == ZlineFile_add_line(z, buf));
+      }
+      /* out of order */
+      assert(-1 == ZlineFile_add_line(z, "@read000123"));
+    }
+    ZlineFile_close(z);
+
+    z = ZlineFile_read(FILENAME);
+    assert(ZlineFile_line_count(z) == (uint64_t) n);
+    assert(ZlineFile_get_block_count(z) > 100);
+    for (i=0; i < n; i += 3) {
+      sprintf(key, "@read%06d", (i / 3) * 10 / 9);
+      assert(i == ZlineFile_find_key(z, key, strlen(key), &count));
+      assert(count == 3);
+      assert(i == ZlineFile_find_key(z, key, strlen(key), NULL));
+    }
+    assert(-1 == ZlineFile_find_key(z, "@read000009", 11, &count));
+    assert(count == 0);
+    assert(-1 == ZlineFile_find_key(z, "@read", 5, NULL));
+    assert(-1 == ZlineFile_find_key(z, "@zzz", 4, NULL));
+    ZlineFile_close(z);
+  }
+
+  /* lines added to the end have to come after the last key */
+  z = ZlineFile_open_append(FILENAME);
+  assert(-1 == ZlineFile_add_line(z, "@read000000/5"));
+  assert(0 == ZlineFile_add_line(z, "@read999999"));
+  ZlineFile_close(z);
+  z = ZlineFile_read(FILENAME);
+  assert(n == ZlineFile_find_key(z, "@read999999", 11, &count));
+  assert(count == 1);
+  assert(3 == ZlineFile_find_key(z, "@read000001", 11, NULL));
+  ZlineFile_close(z);
+
+  /* text out of order */
+  z = ZlineFile_create(FILENAME);
+  assert(0 == ZlineFile_set_sorted_key(z, 0, 0, 0));
+  assert(-1 == ZlineFile_add_text(z, "b\na\n", 4, 2));
+  ZlineFile_close(z);
+
+  /* numeric keys in the third field, separated by spaces or tabs */
+  z = ZlineFile_create2(FILENAME, 1000);
+  assert(0 == ZlineFile_set_sorted_key(z, 2, 0, ZLINE_KEY_NUMERIC));
+  for (i=0; i < n; i++) {
+    sortedKeyLine(buf, i);
+    assert(0 == ZlineFile_add_line(z, buf));
+  }
+  ZlineFile_close(z);
+  z = ZlineFile_read(FILENAME);
+  assert(100 == ZlineFile_find_key(z, "1700", 4, &count) && count == 1);
+  assert(-1 == ZlineFile_find_key(z, "1701", 4, &count) && count == 0);
+  assert(0 == ZlineFile_find_key(z, "0", 1, NULL));
+  ZlineFile_close(z);
+
+  /* no keys */
+  z = ZlineFile_create(FILENAME);
+  ZlineFile_add_line(z, "@read000000");
+  ZlineFile_close(z);
+  z = ZlineFile_read(FILENAME);
+  assert(-1 == ZlineFile_find_key(z, "@read000000", 11, NULL));
+  ZlineFile_close(z);
+
+  free(text);
+  putchar('.'); fflush(stdout);
+}
+
+
+/* Check that every line is in the block ZlineFile_get_line_block says. */
+static void checkLineBlocks(ZlineFile z) {
+  uint64_t i, first, count, block_count = ZlineFile_get_block_count(z);
+  int64_t b = 0;
+
+  for (i=0; i < ZlineFile_line_count(z); i++) {
+    /* the first nonempty block that ends after line i */
+    while (ZlineFile_get_block_first_line(z, b)
+           + ZlineFile_get_block_line_count(z, b) <= i)
+      b++;
+    assert(b == ZlineFile_get_line_block(z, i));
+    first = ZlineFile_get_block_first_line(z, b);
+    count = ZlineFile_get_block_line_count(z, b);
+    assert(first <= i && i < first + count);
+  }
+  assert((uint64_t) b < block_count);
+  assert(-1 == ZlineFile_get_line_block(z, ZlineFile_line_count(z)));
+}
+
+
+void test_line_blocks() {
+  char buf[3000];
+  int i, n = 5000, len;
+  ZlineFile z;
+
+  /* Mostly short lines, with runs of lines that get a block of their
+     own, so the blocks are uneven. */
+  memset(buf, 'x', sizeof buf);
+  z = ZlineFile_create2(FILENAME, 500);
+  for (i=0; i < n; i++) {
+    len = (i % 1000 < 30) ? 2000 : i % 37;
+    assert(0 == ZlineFile_add_line2(z, buf, len));
+  }
+  assert(-1 == ZlineFile_get_line_block(z, n));
+  assert(0 == ZlineFile_get_line_block(z, 0));
+  ZlineFile_close(z);
+
+  z = ZlineFile_read(FILENAME);
+  assert(ZlineFile_get_block_count(z) > 200);
+  checkLineBlocks(z);
+  ZlineFile_close(z);
+
+  z = ZlineFile_read_mmap(FILENAME, 0);
+  checkLineBlocks(z);
+  ZlineFile_close(z);
+
+  /* lines can be found in the old and new blocks while appending */
+  z = ZlineFile_open_append2(FILENAME, 500, 0);
+  for (i=0; i < 1000; i++)
+    assert(0 == ZlineFile_add_line2(z, buf, i % 53));
+  assert(ZlineFile_get_line_block(z, n + 999) >
+         ZlineFile_get_line_block(z, n - 1));
+  assert(ZlineFile_get_line_block(z, 10) == 10);
+  ZlineFile_close(z);
+
+  z = ZlineFile_read(FILENAME);
+  assert(ZlineFile_line_count(z) == (uint64_t) n + 1000);
+  checkLineBlocks(z);
+  ZlineFile_close(z);
+
+  /* lines of one length fill every block but the last equally, so the
+     block is found by division */
+  z = ZlineFile_create2(FILENAME, 100);
+  for (i=0; i < 1234; i++) {
+    sprintf(buf, "%09d", i);
+    assert(0 == ZlineFile_add_line(z, buf));
+  }
+  ZlineFile_close(z);
+  z = ZlineFile_read(FILENAME);
+  assert(ZlineFile_get_block_count(z) > 100);
+  checkLineBlocks(z);
+  ZlineFile_close(z);
+
+  /* a file with one block has no directory */
+  z = ZlineFile_create(FILENAME);
+  ZlineFile_add_line(z, "one");
+  ZlineFile_add_line(z, "two");
+  ZlineFile_close(z);
+  z = ZlineFile_read(FILENAME);
+  checkLineBlocks(z);
+  ZlineFile_close(z);
+
+  putchar('.'); fflush(stdout);
+}
+
+
+void test_hash_index() {
+  char buf[100], keybufs[5][20];
+  const char *keys[5];
+  int64_t found[5], first;
+  uint64_t lines[10], counts[5], count, j;
+  int i, n = 20000;
+  ZlineFile z;
+  ZlineIndex zi;
+
+  /* keys in no particular order, and lines n..n+9 repeat the keys of
+     lines 0..9 */
+  z = ZlineFile_create2(FILENAME, 4000);
+  for (i=0; i < n + 10; i++) {
+    sprintf(buf, "id%06d\tline %d", (i % n) * 7919 % n, i);
+    assert(0 == ZlineFile_add_line(z, buf));
+  }
+  ZlineFile_close(z);
+
+  z = ZlineFile_read(FILENAME);
+  assert(-1 == ZlineIndex_build(z, INDEX_FILENAME, -1, 0, 0));
+  assert(0 == ZlineIndex_build(z, INDEX_FILENAME, 0, 0, 2));
+  zi = ZlineIndex_open(INDEX_FILENAME, z);
+  assert(zi);
+
+  for (i=0; i < n; i += 7) {
+    sprintf(buf, "id%06d", i * 7919 % n);
+    assert(i == ZlineIndex_find(zi, buf, 8));
+  }
+  assert(-1 == ZlineIndex_find(zi, "id020000", 8));
+  assert(-1 == ZlineIndex_find(zi, "id", 2));
+  assert(-1 == ZlineIndex_find(zi, "", 0));
+
+  /* a batch, with a repeated key and a missing one */
+  for (i=0; i < 5; i++) keys[i] = keybufs[i];
+  sprintf(keybufs[0], "id%06d", 3 * 7919 % n);
+  strcpy(keybufs[1], "nope");
+  sprintf(keybufs[2], "id%06d", 19999 * 7919 % n);
+  strcpy(keybufs[3], keybufs[0]);
+  sprintf(keybufs[4], "id%06d", 10 * 7919 % n);
+  assert(4 == ZlineIndex_lookup(zi, keys, NULL, 5, found));
+  assert(found[0] == 3 && found[1] == -1 && found[2] == 19999 &&
+         found[3] == 3 && found[4] == 10);
+  assert(0 == ZlineIndex_lookup(zi, keys, NULL, 0, found));
+
+  /* every line with each key; the first call is short of room */
+  lines[0] = 12345;
+  assert(6 == ZlineIndex_lookup_all(zi, keys, NULL, 5, lines, 2, counts));
+  assert(lines[0] == 12345);
+  assert(counts[0] == 2 && counts[1] == 0 && counts[2] == 1 &&
+         counts[3] == 2 && counts[4] == 1);
+  assert(6 == ZlineIndex_lookup_all(zi, keys, NULL, 5, lines, 10, counts));
+  assert(lines[0] == 3 && lines[1] == (uint64_t) n + 3 &&
+         lines[2] == 19999 && lines[3] == 3 &&
+         lines[4] == (uint64_t) n + 3 && lines[5] == 10);
+  ZlineIndex_close(zi);
+
+  /* the second field, split on tabs */
+  assert(0 == ZlineIndex_build(z, INDEX_FILENAME, 1, '\t', 0));
+  zi = ZlineIndex_open(INDEX_FILENAME, z);
+  assert(123 == ZlineIndex_find(zi, "line 123", 8));
+  assert(-1 == ZlineIndex_find(zi, "line", 4));
+  ZlineIndex_close(zi);
+  ZlineFile_close(z);
+
+  /* an index doesn't match a file with more lines */
+  z = ZlineFile_open_append(FILENAME);
+  assert(0 == ZlineFile_add_line(z, "id999999"));
+  ZlineFile_close(z);
+  z = ZlineFile_read(FILENAME);
+  assert(!ZlineIndex_open(INDEX_FILENAME, z));
+  assert(!ZlineIndex_open(FILENAME, z));
+  ZlineFile_close(z);
+
+  /* In a sorted file with repeated keys, the index and
+     ZlineFile_find_key find the same lines. */
+  z = ZlineFile_create2(FILENAME, 1000);
+  assert(0 == ZlineFile_set_sorted_key(z, 0, 0, 0));
+  for (i=0; i < 3000; i++) {
+    sprintf(buf, "key%05d line %d", i - i % (1 + i / 300 % 4), i);
+    assert(0 == ZlineFile_add_line(z, buf));
+  }
+  ZlineFile_close(z);
+  z = ZlineFile_read(FILENAME);
+  assert(0 == ZlineIndex_build(z, INDEX_FILENAME, 0, 0, 0));
+  zi = ZlineIndex_open(INDEX_FILENAME, z);
+  for (i=0; i < 3001; i += 13) {
+    sprintf(keybufs[0], "key%05d", i);
+    first = ZlineFile_find_key(z, keybufs[0], 8, &count);
+    assert(count <= 10);
+    assert((int64_t) count ==
+           ZlineIndex_lookup_all(zi, keys, NULL, 1, lines, 10, counts));
+    assert(counts[0] == count && (count > 0) == (first >= 0));
+    for (j=0; j < count; j++)
+      assert(lines[j] == first + j);
+  }
+  ZlineIndex_close(zi);
+  ZlineFile_close(z);
+
+  remove(INDEX_FILENAME);
+  putchar('.'); fflush(stdout);
+}
+
+
+/* Row i of a matrix for test_fixed_width, FIXED_TEST_WIDTH bytes long. */
+#define FIXED_TEST_WIDTH 30
+static void fixedTestRow(char *buf, int i) {
+  int j;
+  unsigned r = i * 2654435761u;
+  for (j=0; j < FIXED_TEST_WIDTH; j++) {
+    r = r * 1103515245u + 12345;
+    buf[j] = "ACGT-"[(r >> 16) % 5];
+  }
+  buf[j] = 0;
+}
+
+
+static void readHeader(const char *filename, char *header, int size) {
+  FILE *f = fopen(filename, "rb");
+  assert(f);
+  assert(fread(header, 1, size, f) == (size_t) size);
+  fclose(f);
+  header[size-1] = 0;
+}
+
+
+void test_fixed_width() {
+  char buf[100], out[100], header[256], *text;
+  uint64_t pos = 0, size = 0, lengths[100];
+  int i, n = 5000, mode;
+  ZlineFile z;
+
+  text = malloc(n * (FIXED_TEST_WIDTH + 1));
+  for (i=0; i < n; i++) {
+    fixedTestRow(text + pos, i);
+    pos += FIXED_TEST_WIDTH;
+    text[pos++] = '\n';
+  }
+
+  /* 0: off, the default, 1: width set, 2: detected with background
+     threads, 3: detected with ZlineFile_add_text */
+  for (mode = 0; mode < 4; mode++) {
+    z = ZlineFile_create3(FILENAME, 1000, mode == 2 ? 2 : 0);
+    if (mode == 1) {
+      assert(-1 == ZlineFile_set_fixed_width(z, -3));
+      assert(0 == ZlineFile_set_fixed_width(z, FIXED_TEST_WIDTH));
+    } else if (mode > 1) {
+      assert(0 == ZlineFile_set_fixed_width(z, ZLINE_FIXED_WIDTH_AUTO));
+    }
+    if (mode == 3) {
+      assert(0 == ZlineFile_add_text(z, text, pos, 2));
+    } else {
+      for (i=0; i < n; i++) {
+        fixedTestRow(buf, i);
+        assert(0 == ZlineFile_add_line(z, buf));
+      }
+    }
+    if (mode == 1) {
+      assert(-1 == ZlineFile_add_line(z, "too short"));
+      assert(-1 == ZlineFile_add_text(z, "too short\n", 10, 1));
+    }
+    assert(ZlineFile_line_count(z) == (uint64_t) n);
+    assert(FIXED_TEST_WIDTH == ZlineFile_get_fixed_width(z));
+    fixedTestRow(buf, 7);
+    assert(!strcmp(buf, ZlineFile_get_line2(z, 7, out, sizeof out, 0)));
+    ZlineFile_close(z);
+
+    readHeader(FILENAME, header, sizeof header);
+    assert((mode == 0) == !strstr(header, "fixed_width 30"));
+    assert((mode == 1) == !!strstr(header, "fixed_width 30 required\n"));
+
+    /* the line indexes take up space */
+    if (mode == 0)
+      size = getFileSize(FILENAME);
+    else
+      assert(getFileSize(FILENAME) + 1000 < size);
+
+    z = mode == 2 ? ZlineFile_read_mmap(FILENAME, 0) : ZlineFile_read(FILENAME);
+    assert(ZlineFile_line_count(z) == (uint64_t) n);
+    assert(ZlineFile_get_fixed_width(z) == (mode == 0 ? -1 : FIXED_TEST_WIDTH));
+    for (i=n-1; i >= 0; i--) {
+      fixedTestRow(buf, i);
+      assert(!strcmp(buf, ZlineFile_get_line2(z, i, out, sizeof out, 0)));
+      assert(ZlineFile_line_length(z, i) == FIXED_TEST_WIDTH);
+    }
+    assert(ZlineFile_get_line2(z, 100, out, 11, 5));
+    assert(!memcmp(out, text + 100 * (FIXED_TEST_WIDTH + 1) + 5, 10));
+    assert(0 == ZlineFile_line_lengths(z, n - 100, 100, lengths));
+    assert(lengths[0] == FIXED_TEST_WIDTH && lengths[99] == FIXED_TEST_WIDTH);
+    checkLineBlocks(z);
+    ZlineFile_close(z);
+
+    /* appending keeps a required width, or no fixed-width blocks */
+    if (mode < 2) {
+      z = ZlineFile_open_append2(FILENAME, 1000, 0);
+      for (i=0; i < 10; i++) {
+        fixedTestRow(buf, n + i);
+        assert(0 == ZlineFile_add_line(z, buf));
+      }
+      strcpy(buf + FIXED_TEST_WIDTH, "x");
+      assert((mode == 0 ? 0 : -1) == ZlineFile_add_line(z, buf));
+      ZlineFile_close(z);
+
+      readHeader(FILENAME, header, sizeof header);
+      if (mode == 0)
+        assert(!strstr(header, "fixed"));
+      else
+        assert(strstr(header, "fixed_width 30 required\n"));
+      z = ZlineFile_read(FILENAME);
+      assert(ZlineFile_line_count(z) == (uint64_t) n + 10 + (mode == 0));
+      fixedTestRow(buf, n + 9);
+      assert(!strcmp(buf, ZlineFile_get_line2(z, n + 9, out, sizeof out, 0)));
+      checkLineBlocks(z);
+      ZlineFile_close(z);
+    }
+  }
+
+  /* Append rows, which must match the width if it is set, and then a
+     few lines of other lengths; the blocks of rows still have no line
+     index. */
+  z = ZlineFile_open_append2(FILENAME, 1000, 0);
+  assert(-1 == ZlineFile_set_fixed_width(z, FIXED_TEST_WIDTH + 1));
+  assert(0 == ZlineFile_set_fixed_width(z, FIXED_TEST_WIDTH));
+  fixedTestRow(buf, n);
+  assert(0 == ZlineFile_add_line(z, buf));
+  assert(-1 == ZlineFile_add_line(z, "too short"));
+  assert(0 == ZlineFile_set_fixed_width(z, ZLINE_FIXED_WIDTH_AUTO));
+  for (i=0; i < 50; i++)
+    assert(0 == ZlineFile_add_line2(z, text, i % 7));
+  assert(-1 == ZlineFile_get_fixed_width(z));
+  ZlineFile_close(z);
+
+  readHeader(FILENAME, header, sizeof header);
+  assert(strstr(header, "fixed_blocks\n"));
+  z = ZlineFile_read(FILENAME);
+  assert(ZlineFile_line_count(z) == (uint64_t) n + 51);
+  assert(-1 == ZlineFile_get_fixed_width(z));
+  for (i=0; i <= n; i++) {
+    fixedTestRow(buf, i);
+    assert(!strcmp(buf, ZlineFile_get_line2(z, i, out, sizeof out, 0)));
+  }
+  for (i=0; i < 50; i++) {
+    assert(ZlineFile_line_length(z, n + 1 + i) == i % 7);
+    assert(!memcmp(text, ZlineFile_get_line2(z, n + 1 + i, out, sizeof out, 0),
+                   i % 7));
+  }
+  checkLineBlocks(z);
+  ZlineFile_close(z);
+
+  /* nothing but empty lines */
+  z = ZlineFile_create2(FILENAME, 1000);
+  assert(0 == ZlineFile_set_fixed_width(z, ZLINE_FIXED_WIDTH_AUTO));
+  for (i=0; i < 100; i++)
+    assert(0 == ZlineFile_add_line(z, ""));
+  ZlineFile_close(z);
+  z = ZlineFile_read(FILENAME);
+  assert(0 == ZlineFile_get_fixed_width(z));
+  assert(!strcmp("", ZlineFile_get_line2(z, 99, out, sizeof out, 0)));
+  ZlineFile_close(z);
+
+  free(text);
+  putchar('.'); fflush(stdout);
+}
+
+
+/* Row i of an alignment for test_ref_codec: most columns match, some
+   depend on the row's group, and a few are the row's own. Rows have
+   different lengths, and every 500th is unlike the rest. */
+static int refTestRow(char *buf, int i) {
+  int j, len = 300 - i % 4;
+  unsigned r = i * 2654435761u;
+
+  if (i % 500 == 499) return sprintf(buf, "not a row: %d", i);
+  for (j=0; j < len; j++)
+    buf[j] = "ACGT"[(j * 7 + j / 3) & 3];
+  for (j = i % 5; j < len; j += 23)
+    buf[j] = "ACGT-"[i % 5];
+  for (j=0; j < 3; j++) {
+    r = r * 1103515245u + 12345;
+    buf[(r >> 16) % len] = 'N';
+  }
+  if (i % 7 == 0) memset(buf + i % 200, '-', 40);
+  buf[len] = 0;
+  return len;
+}
+
+
+void test_ref_codec() {
+  char buf[400], out[400], header[256], *text;
+  uint64_t pos = 0, size = 0;
+  int i, n = 3000, mode;
+  ZlineFile z;
+
+  text = malloc(n * 400);
+  for (i=0; i < n; i++) {
+    pos += refTestRow(text + pos, i);
+    text[pos++] = '\n';
+  }
+
+  /* 0: no codec, 1: on this thread, 2: with background threads,
+     3: ZlineFile_add_text */
+  for (mode = 0; mode < 4; mode++) {
+    z = ZlineFile_create3(FILENAME, 20000, mode == 2 ? 2 : 0);
+    if (mode > 0) assert(!ZlineFile_set_codec(z, ZLINE_CODEC_REF));
+    if (mode == 3) {
+      assert(!ZlineFile_add_text(z, text, pos, 2));
+    } else {
+      for (i=0; i < n; i++) {
+        refTestRow(buf, i);
+        assert(!ZlineFile_add_line(z, buf));
+      }
+    }
+    /* empty lines, and a line long enough for frames */
+    ZlineFile_add_line(z, "");
+    ZlineFile_add_line(z, "");
+    ZlineFile_add_line2(z, text, pos);
+    ZlineFile_close(z);
+
+    readHeader(FILENAME, header, sizeof header);
+    assert((mode > 0) == !!strstr(header, "alg fzstd+ref\n"));
+    if (mode == 0)
+      size = getFileSize(FILENAME);
+    else
+      assert(getFileSize(FILENAME) < size);
+
+    z = mode == 2 ? ZlineFile_read_mmap(FILENAME, 0) : ZlineFile_read(FILENAME);
+    assert(ZlineFile_line_count(z) == (uint64_t) n + 3);
+    for (i=n-1; i >= 0; i--) {
+      refTestRow(buf, i);
+      assert(!strcmp(buf, ZlineFile_get_line2(z, i, out, sizeof out, 0)));
+    }
+    assert(!strcmp("", ZlineFile_get_line2(z, n, out, sizeof out, 0)));
+    assert(!strcmp("", ZlineFile_get_line2(z, n+1, out, sizeof out, 0)));
+    assert(ZlineFile_get_line2(z, n+2, out, 300, pos - 500));
+    assert(!memcmp(out, text + pos - 500, 299));
+    ZlineFile_close(z);
+  }
+
+  /* append blocks packed with NT2 to the blocks packed with REF */
+  z = ZlineFile_open_append(FILENAME);
+  assert(!ZlineFile_set_codec(z, ZLINE_CODEC_NT2));
+  assert(!ZlineFile_add_text(z, text, pos, 1));
+  ZlineFile_close(z);
+  readHeader(FILENAME, header, sizeof header);
+  assert(strstr(header, "alg fzstd+nt2+ref\n"));
+  z = ZlineFile_read(FILENAME);
+  assert(ZlineFile_line_count(z) == (uint64_t) 2 * n + 3);
+  for (i=0; i < n; i += 7) {
+    refTestRow(buf, i);
+    assert(!strcmp(buf, ZlineFile_get_line2(z, i, out, sizeof out, 0)));
+    assert(!strcmp(buf, ZlineFile_get_line2(z, n+3+i, out, sizeof out, 0)));
+  }
+  ZlineFile_close(z);
+
+  free(text);
+  putchar('.'); fflush(stdout);
+}
+
+
+/* Check ZlineFile_get_window against ZlineFile_get_line2. */
+static void checkWindow(ZlineFile z, uint64_t first, uint64_t n,
+                        uint64_t col, uint64_t width, uint64_t stride) {
+  char *tile = malloc(n * stride + 1), *line = malloc(width + 1);
+  uint64_t i, len, short_count = 0;
+
+  memset(tile, '#', n * stride + 1);
+  for (i=0; i < n; i++)
+    if ((uint64_t) ZlineFile_line_length(z, first + i) < col + width)
+      short_count++;
+  assert((int64_t) short_count ==
+         ZlineFile_get_window(z, first, n, col, width, tile, stride));
+  for (i=0; i < n; i++) {
+    assert(ZlineFile_get_line2(z, first + i, line, width + 1, col));
+    len = strlen(line);
+    memset(line + len, 0, width - len);
+    assert(!memcmp(tile + i * stride, line, width));
+    /* the gaps between rows aren't touched */
+    if (stride > width) assert(tile[i * stride + width] == '#');
+  }
+  assert(tile[n * stride] == '#');
+
+  free(tile);
+  free(line);
+}
+
+
+void test_window() {
+  char *buf, row[300];
+  uint64_t long_len = 3000000;
+  int i, n = 3000, threads;
+  ZlineFile z;
+
+  buf = malloc(long_len);
+  for (i=0; i < (int)long_len; i++)
+    buf[i] = "ACGT"[(i * 7 + i / 5) & 3];
+
+  /* rows of 200 to 260 bytes with a few short ones, and a row long
+     enough for frames */
+  z = ZlineFile_create2(FILENAME, 5000);
+  for (i=0; i < n; i++) {
+    memcpy(row, buf + i % 50, sizeof row);
+    sprintf(row + 100, "%d", i);
+    row[100 + strlen(row + 100)] = 'x';
+    assert(!ZlineFile_add_line2(z, row, i % 100 == 3 ? 20 : 200 + i % 61));
+    if (i == 1000) assert(!ZlineFile_add_line2(z, buf, long_len));
+  }
+  checkWindow(z, 0, 10, 10, 30, 30);
+  checkWindow(z, n - 10, 11, 190, 40, 50);
+  ZlineFile_close(z);
+
+  for (threads = 1; threads <= 3; threads += 2) {
+    z = ZlineFile_read(FILENAME);
+    ZlineFile_set_thread_count(z, threads);
+    checkWindow(z, 0, n + 1, 0, 200, 200);
+    checkWindow(z, 0, n + 1, 95, 10, 16);
+    checkWindow(z, 123, 1500, 190, 40, 40);
+    checkWindow(z, 999, 3, 2500000, 1000, 1000);
+    checkWindow(z, 5, 1, 500, 10, 10);
+    checkWindow(z, n, 1, 0, 1, 1);
+    assert(0 == ZlineFile_get_window(z, 0, 0, 0, 10, buf, 10));
+    assert(-1 == ZlineFile_get_window(z, 0, 2, 0, 10, buf, 9));
+    assert(-1 == ZlineFile_get_window(z, n, 2, 0, 10, buf, 10));
+    ZlineFile_close(z);
+  }
+
+  free(buf);
+  putchar('.'); fflush(stdout);
+}
+
+
+/* Check the lines of a completion against ZlineFile_get_line. */
+static void checkCompletion(ZlineFile z, ZlineCompletion *c) {
+  uint64_t i;
+  char *line;
+
+  assert(c->status == 0);
+  for (i=0; i < c->line_count; i++) {
+    line = ZlineFile_get_line(z, c->first_line + i);
+    assert(line);
+    assert(c->lengths[i] == strlen(line));
+    assert(!memcmp(c->data + c->offsets[i], line, c->lengths[i] + 1));
+    free(line);
+  }
+}
+
+
+/* Each request gets its own slot, so no locking is needed. */
+static void storeCompletion(void *arg, ZlineCompletion *c) {
+  *(ZlineCompletion**) arg = c;
+}
+
+
+void test_async() {
+  ZlineFile z;
+  ZlineAsync za;
+  ZlineCompletion *c, *results[2000];
+  char line[100], *buf;
+  uint64_t long_len = 3000000, count, first, len;
+  int i, polled = 0;
+
+  /* small blocks, and a line long enough to be framed */
+  buf = malloc(long_len + 1);
+  memset(buf, 'G', long_len);
+  buf[long_len] = 0;
+  z = ZlineFile_create2(FILENAME, 1000);
+  for (i=0; i < 5000; i++) {
+    sprintf(line, "line %d of the async test", i);
+    ZlineFile_add_line(z, i % 1000 == 500 ? "" : line);
+    if (i == 2000) ZlineFile_add_line(z, buf);
+  }
+  ZlineFile_close(z);
+
+  z = ZlineFile_read(FILENAME);
+  count = ZlineFile_line_count(z);
+  za = ZlineAsync_create(z, 3);
+  assert(za);
+
+  assert(-1 == ZlineAsync_submit(za, 0, 0, NULL, NULL));
+  assert(-1 == ZlineAsync_submit(za, count, 1, NULL, NULL));
+  assert(-1 == ZlineAsync_submit(za, count - 1, 2, NULL, NULL));
+  assert(NULL == ZlineAsync_poll(za, 0));
+  assert(NULL == ZlineAsync_poll(za, 1));
+
+  /* many requests for a few blocks, so they share decodes */
+  for (i=0; i < 2000; i++) {
+    results[i] = NULL;
+    first = (i * 7919) % count;
+    len = MIN(1 + i % 5, count - first);
+    assert(!ZlineAsync_submit(za, first, len, storeCompletion, results + i));
+  }
+
+  /* ranges spanning several blocks, including the long line */
+  for (i=0; i < 300; i++) {
+    first = (i * 104729) % count;
+    len = MIN(1 + i * 7 % 200, count - first);
+    assert(!ZlineAsync_submit(za, first, len, NULL, (void*)(size_t) i));
+  }
+  assert(!ZlineAsync_submit(za, 1990, 20, NULL, NULL));
+  assert(!ZlineAsync_submit(za, 0, count, NULL, NULL));
+  assert(ZlineAsync_pending(za) > 0);
+
+  while ((c = ZlineAsync_poll(za, 1))) {
+    checkCompletion(z, c);
+    ZlineCompletion_free(c);
+    polled++;
+  }
+  assert(polled == 302);
+
+  /* a completion that is never polled is freed by close */
+  assert(!ZlineAsync_submit(za, 17, 3, NULL, NULL));
+  ZlineAsync_close(za);
+
+  for (i=0; i < 2000; i++) {
+    assert(results[i]);
+    assert(results[i]->arg == results + i);
+    checkCompletion(z, results[i]);
+    ZlineCompletion_free(results[i]);
+  }
+
+  ZlineFile_close(z);
+  free(buf);
+  putchar('.'); fflush(stdout);
+}
+
+
 int main() {
 
   test_add_one();
   test_add_some();
   test_blocks();
   test_long_line();
+  test_empty_block();
   test_many_lines();
+  test_block_cache();
+  test_threaded_write();
+  test_cursors();
+  test_mmap();
+  test_get_lines();
+  test_line_views();
+  test_iterator();
+  test_line_lengths();
+  test_long_line_frames();
+  test_dictionary();
+  test_add_text();
+  test_append();
+  test_nt2();
+  test_records();
+  test_search();
+  test_kmer_filter();
+  test_sorted_keys();
+  test_hash_index();
+  test_line_blocks();
+  test_fixed_width();
+  test_ref_codec();
+  test_window();
+  test_async();
   
   remove(FILENAME);
 
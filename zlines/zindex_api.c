@@ -0,0 +1,477 @@
+/*
+  zindex
+
+  A hash table from the key of each line of a zlines file to the index
+  of the line. See zindex_api.h.
+
+  The file is a 256 byte text header like that of a zlines file,
+  followed by an array of 'slots' u64s, a power of two. It uses open
+  addressing with linear probing: a key starts at the slot given by the
+  low bits of its hash and moves forward until it finds an empty slot.
+  Each full slot holds the line index plus one in its low LINE_BITS
+  bits, and the top bits of the key's hash in the rest, so a probe
+  only reads a line if those bits match.
+
+
+  https://github.com/oshkosher/bioio/tree/master/zlines
+
+  Ed Karrels, ed.karrels@gmail.com, January 2017
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "zindex_api.h"
+#include "zline_internal_api.h"
+#include "common.h"
+
+#define HEADER_SIZE 256
+#define MAX_HEADER_LINE_LEN 100
+
+#define LINE_BITS 40
+#define LINE_MASK ((((u64)1) << LINE_BITS) - 1)
+#define slotLine(slot) (((slot) & LINE_MASK) - 1)
+#define hashTag(hash) ((hash) >> LINE_BITS)
+#define slotMatches(slot, hash) (((slot) >> LINE_BITS) == hashTag(hash))
+
+/* the table is at most 2/3 full */
+#define MIN_SLOTS 16
+
+/* ZlineIndex_lookup preallocates room for every candidate line to be
+   the longest line in the file, up to this much */
+#define MAX_LOOKUP_PREALLOC (64*1024*1024)
+
+/* FNV-1a */
+#define HASH_OFFSET ((((u64)0xcbf29ce4) << 32) | 0x84222325)
+#define HASH_PRIME ((((u64)0x100) << 32) | 0x1b3)
+#define HASH_MIX ((((u64)0xff51afd7) << 32) | 0xed558ccd)
+
+typedef uint64_t u64;
+typedef int64_t i64;
+
+struct ZlineIndex {
+  ZlineFile zf;
+  int key_field;
+  char key_delimiter;
+  u64 line_count, slot_count;
+
+  /* the whole index file, memory-mapped if possible */
+  char *data;
+  u64 data_len;
+  int is_mapped;
+
+  const u64 *slots;
+};
+
+
+static u64 keyHash(const char *key, u64 len);
+
+/* Returns the number of slots for this many lines. */
+static u64 slotCount(u64 line_count);
+
+/* Read the whole file into zi->data, for when it can't be mapped.
+   Returns nonzero on error. */
+static int readIndexFile(ZlineIndex zi, const char *filename);
+
+static int parseHeader(ZlineIndex zi, const char *filename);
+
+/* Find the lines with each key. Unless find_all is set, each key stops
+   at its first match. *matches is set to an array of (key number, line)
+   pairs, which the caller must free; the lines of each key are in
+   increasing order. Returns the number of pairs, or -1 on error. */
+static i64 lookupKeys(ZlineIndex zi, const char *const *keys,
+                      const uint64_t *key_lengths, u64 count, int find_all,
+                      u64 **matches);
+
+
+ZLINE_EXPORT int ZlineIndex_build(ZlineFile zf, const char *filename,
+                                  int key_field, char key_delimiter,
+                                  int thread_count) {
+  u64 line_count = ZlineFile_line_count(zf), slot_count, mask;
+  u64 *slots, line_idx, key_len, hash, pos;
+  ZlineIterator it;
+  ZlineView line;
+  const char *key;
+  char header[HEADER_SIZE];
+  int result, hpos = 0, err;
+  FILE *f;
+
+  if (key_field < 0) return -1;
+  if (line_count >= LINE_MASK) {
+    fprintf(stderr, "Too many lines to index: %" PRIu64 "\n", line_count);
+    return -1;
+  }
+
+  slot_count = slotCount(line_count);
+  mask = slot_count - 1;
+  slots = (u64*) calloc(slot_count, sizeof(u64));
+  if (!slots) {
+    fprintf(stderr, "Out of memory\n");
+    return -1;
+  }
+
+  it = ZlineIterator_create(zf, 0, line_count, 0, thread_count);
+  if (!it) {
+    free(slots);
+    return -1;
+  }
+
+  while ((result = ZlineIterator_next(it, &line, &line_idx)) == 1) {
+    lineFieldKey(line.data, line.length, key_field, key_delimiter,
+                 &key, &key_len);
+    hash = keyHash(key, key_len);
+    pos = hash & mask;
+    while (slots[pos]) pos = (pos + 1) & mask;
+    slots[pos] = (hashTag(hash) << LINE_BITS) | (line_idx + 1);
+  }
+  ZlineIterator_close(it);
+  if (result < 0) {
+    free(slots);
+    return -1;
+  }
+
+  hpos += sprintf(header, "zindex v1\n");
+  hpos += sprintf(header+hpos, "lines %" PRIu64 "\n", line_count);
+  hpos += sprintf(header+hpos, "slots %" PRIu64 "\n", slot_count);
+  hpos += sprintf(header+hpos, "key %d %d\n", key_field,
+                  (unsigned char) key_delimiter);
+  header[hpos++] = '\n';
+  memset(header+hpos, ' ', HEADER_SIZE - 1 - hpos);
+  header[HEADER_SIZE-1] = '\n';
+
+  f = fopen(filename, "wb");
+  if (!f) {
+    fprintf(stderr, "Failed to open \"%s\" for writing\n", filename);
+    free(slots);
+    return -1;
+  }
+  err = fwrite(header, 1, HEADER_SIZE, f) != HEADER_SIZE
+    || fwrite(slots, sizeof(u64), slot_count, f) != slot_count;
+  err |= fclose(f);
+  free(slots);
+
+  if (err) {
+    fprintf(stderr, "Failed to write \"%s\"\n", filename);
+    remove(filename);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+ZLINE_EXPORT ZlineIndex ZlineIndex_open(const char *filename, ZlineFile zf) {
+  ZlineIndex zi = (ZlineIndex) calloc(1, sizeof(struct ZlineIndex));
+  if (!zi) return NULL;
+  zi->zf = zf;
+
+  if (!mapFile(filename, 0, &zi->data, &zi->data_len)) {
+    zi->is_mapped = 1;
+  } else if (readIndexFile(zi, filename)) {
+    free(zi);
+    return NULL;
+  }
+
+  if (parseHeader(zi, filename)) {
+    ZlineIndex_close(zi);
+    return NULL;
+  }
+
+  if (zi->line_count != ZlineFile_line_count(zf)) {
+    fprintf(stderr, "\"%s\" indexes %" PRIu64 " lines, but the file has "
+            "%" PRIu64 "; rebuild it\n", filename, zi->line_count,
+            ZlineFile_line_count(zf));
+    ZlineIndex_close(zi);
+    return NULL;
+  }
+
+  zi->slots = (const u64*) (zi->data + HEADER_SIZE);
+  return zi;
+}
+
+
+ZLINE_EXPORT void ZlineIndex_close(ZlineIndex zi) {
+  if (zi->is_mapped)
+    unmapFile(zi->data, zi->data_len);
+  else
+    free(zi->data);
+  free(zi);
+}
+
+
+ZLINE_EXPORT int64_t ZlineIndex_lookup
+  (ZlineIndex zi, const char *const *keys, const uint64_t *key_lengths,
+   uint64_t count, int64_t *line_idx) {
+
+  u64 i, *matches;
+  i64 found;
+
+  for (i=0; i < count; i++)
+    line_idx[i] = -1;
+  if (count == 0) return 0;
+
+  found = lookupKeys(zi, keys, key_lengths, count, 0, &matches);
+  for (i=0; i < (u64)MAX(found, 0); i++)
+    line_idx[matches[2*i]] = matches[2*i+1];
+  free(matches);
+
+  return found;
+}
+
+
+ZLINE_EXPORT int64_t ZlineIndex_lookup_all
+  (ZlineIndex zi, const char *const *keys, const uint64_t *key_lengths,
+   uint64_t count, uint64_t *lines, uint64_t max_lines,
+   uint64_t *line_counts) {
+
+  u64 i, *matches, *next;
+  i64 found;
+
+  for (i=0; i < count; i++)
+    line_counts[i] = 0;
+  if (count == 0) return 0;
+
+  found = lookupKeys(zi, keys, key_lengths, count, 1, &matches);
+  if (found < 0) return -1;
+
+  for (i=0; i < (u64)found; i++)
+    line_counts[matches[2*i]]++;
+
+  /* each key's lines follow the previous key's, in the order found */
+  if ((u64)found <= max_lines) {
+    next = (u64*) malloc(sizeof(u64) * count);
+    if (!next) {
+      fprintf(stderr, "Out of memory\n");
+      free(matches);
+      return -1;
+    }
+    next[0] = 0;
+    for (i=1; i < count; i++)
+      next[i] = next[i-1] + line_counts[i-1];
+    for (i=0; i < (u64)found; i++)
+      lines[next[matches[2*i]]++] = matches[2*i+1];
+    free(next);
+  }
+
+  free(matches);
+  return found;
+}
+
+
+static i64 lookupKeys(ZlineIndex zi, const char *const *keys,
+                      const uint64_t *key_lengths, u64 count, int find_all,
+                      u64 **matches) {
+  u64 mask = zi->slot_count - 1, i, p, slot, pending_count, candidate_count;
+  u64 *arrays, *hashes, *lens, *pos, *pending, *candidates, *offsets, *lengths;
+  u64 buf_len = 0, max_len = ZlineFile_max_line_length(zi->zf), key_len;
+  u64 match_capacity = 0;
+  i64 needed, found = 0;
+  char *buf = NULL;
+  const char *key;
+  int is_match;
+
+  *matches = NULL;
+
+  arrays = (u64*) malloc(sizeof(u64) * count * 7);
+  if (!arrays) {
+    fprintf(stderr, "Out of memory\n");
+    return -1;
+  }
+  hashes = arrays;
+  lens = hashes + count;
+  pos = lens + count;
+  pending = pos + count;
+  candidates = pending + count;
+  offsets = candidates + count;
+  lengths = offsets + count;
+
+  for (i=0; i < count; i++) {
+    lens[i] = key_lengths ? key_lengths[i] : strlen(keys[i]);
+    hashes[i] = keyHash(keys[i], lens[i]);
+    pos[i] = hashes[i] & mask;
+    pending[i] = i;
+  }
+  pending_count = count;
+
+  /* Each round moves every pending key to the next slot whose hash bits
+     match, reads all of those lines at once, and checks their keys. A
+     key is done when it reaches an empty slot, or unless find_all is
+     set, when its line matches. Lines with the same key were added in
+     order, so they are found in order. */
+  while (pending_count > 0) {
+    candidate_count = 0;
+    for (p=0; p < pending_count; p++) {
+      i = pending[p];
+      while ((slot = zi->slots[pos[i]]) && !slotMatches(slot, hashes[i]))
+        pos[i] = (pos[i] + 1) & mask;
+      if (!slot) continue;
+      pending[candidate_count] = i;
+      candidates[candidate_count++] = slotLine(slot);
+    }
+    if (candidate_count == 0) break;
+
+    needed = (i64) MIN(candidate_count * (max_len + 1), MAX_LOOKUP_PREALLOC);
+    while (1) {
+      if ((u64)needed > buf_len) {
+        char *tmp = (char*) realloc(buf, needed);
+        if (!tmp) {
+          fprintf(stderr, "Out of memory\n");
+          found = -1;
+          goto done;
+        }
+        buf = tmp;
+        buf_len = needed;
+      }
+      needed = ZlineFile_get_lines(zi->zf, candidates, candidate_count,
+                                   buf, buf_len, offsets, lengths);
+      if (needed < 0) {
+        found = -1;
+        goto done;
+      }
+      if ((u64)needed <= buf_len) break;
+    }
+
+    pending_count = 0;
+    for (p=0; p < candidate_count; p++) {
+      i = pending[p];
+      lineFieldKey(buf + offsets[p], lengths[p], zi->key_field,
+                   zi->key_delimiter, &key, &key_len);
+      is_match = key_len == lens[i] && !memcmp(key, keys[i], key_len);
+      if (is_match) {
+        if ((u64)found == match_capacity) {
+          u64 *tmp;
+          match_capacity = MAX(match_capacity * 2, count);
+          tmp = (u64*) realloc(*matches, sizeof(u64) * 2 * match_capacity);
+          if (!tmp) {
+            fprintf(stderr, "Out of memory\n");
+            found = -1;
+            goto done;
+          }
+          *matches = tmp;
+        }
+        (*matches)[2*found] = i;
+        (*matches)[2*found+1] = candidates[p];
+        found++;
+      }
+      if (!is_match || find_all) {
+        pos[i] = (pos[i] + 1) & mask;
+        pending[pending_count++] = i;
+      }
+    }
+  }
+
+ done:
+  free(buf);
+  free(arrays);
+  if (found < 0) {
+    free(*matches);
+    *matches = NULL;
+  }
+  return found;
+}
+
+
+ZLINE_EXPORT int64_t ZlineIndex_find(ZlineIndex zi, const char *key,
+                                     uint64_t key_len) {
+  int64_t line_idx;
+
+  if (ZlineIndex_lookup(zi, &key, &key_len, 1, &line_idx) < 0) return -1;
+  return line_idx;
+}
+
+
+static u64 keyHash(const char *key, u64 len) {
+  u64 hash = HASH_OFFSET, i;
+
+  for (i=0; i < len; i++) {
+    hash ^= (unsigned char) key[i];
+    hash *= HASH_PRIME;
+  }
+
+  /* FNV's low bits are weak, and they pick the slot */
+  hash ^= hash >> 33;
+  hash *= HASH_MIX;
+  hash ^= hash >> 33;
+
+  return hash;
+}
+
+
+static u64 slotCount(u64 line_count) {
+  u64 slots = MIN_SLOTS;
+  while (slots < line_count + line_count / 2) slots *= 2;
+  return slots;
+}
+
+
+static int readIndexFile(ZlineIndex zi, const char *filename) {
+  FILE *f = fopen(filename, "rb");
+
+  if (!f) {
+    fprintf(stderr, "Failed to open \"%s\"\n", filename);
+    return -1;
+  }
+
+  zi->data_len = getFileSize(filename);
+  zi->data = (char*) malloc(zi->data_len ? zi->data_len : 1);
+  if (!zi->data || fread(zi->data, 1, zi->data_len, f) != zi->data_len) {
+    fprintf(stderr, "Failed to read \"%s\"\n", filename);
+    free(zi->data);
+    fclose(f);
+    return -1;
+  }
+
+  fclose(f);
+  return 0;
+}
+
+
+static int parseHeader(ZlineIndex zi, const char *filename) {
+  char buf[HEADER_SIZE+1], word[MAX_HEADER_LINE_LEN], *line, *end;
+  int has_lines = 0, has_slots = 0, has_key = 0, delimiter, pos;
+
+  if (zi->data_len < HEADER_SIZE) goto format_error;
+  memcpy(buf, zi->data, HEADER_SIZE);
+  buf[HEADER_SIZE] = 0;
+
+  if (strncmp(buf, "zindex v1\n", 10)) goto format_error;
+
+  for (line = buf + 10; *line != '\n'; line = end + 1) {
+    end = strchr(line, '\n');
+    if (!end || end - line >= MAX_HEADER_LINE_LEN) goto format_error;
+    *end = 0;
+    if (1 != sscanf(line, "%s %n", word, &pos)) goto format_error;
+
+    if (!strcmp(word, "lines")) {
+      if (1 != sscanf(line+pos, "%" SCNu64, &zi->line_count))
+        goto format_error;
+      has_lines = 1;
+    } else if (!strcmp(word, "slots")) {
+      if (1 != sscanf(line+pos, "%" SCNu64, &zi->slot_count))
+        goto format_error;
+      has_slots = 1;
+    } else if (!strcmp(word, "key")) {
+      if (2 != sscanf(line+pos, "%d %d", &zi->key_field, &delimiter) ||
+          zi->key_field < 0 || delimiter < 0 || delimiter > 255)
+        goto format_error;
+      zi->key_delimiter = (char) delimiter;
+      has_key = 1;
+    } else {
+      goto format_error;
+    }
+  }
+
+  /* the slots must be a power of two and fill the rest of the file */
+  if (!has_lines || !has_slots || !has_key ||
+      zi->slot_count < MIN_SLOTS || (zi->slot_count & (zi->slot_count - 1)) ||
+      zi->line_count >= zi->slot_count ||
+      zi->data_len != HEADER_SIZE + zi->slot_count * sizeof(u64))
+    goto format_error;
+
+  return 0;
+
+ format_error:
+  fprintf(stderr, "Error reading \"%s\", invalid format\n", filename);
+  return -1;
+}
@@ -0,0 +1,87 @@
+/*
+  zindex
+
+  A hash table from a key in each line of a zlines file to the index
+  of that line, stored in a file of its own next to the zlines file.
+
+  Use it for lines that aren't in order by key, such as the headers of
+  FASTQ reads, where ZlineFile_find_key can't help. Finding a key takes
+  one probe of the memory-mapped table and one block decode to check
+  the line, rather than a scan of the whole file.
+
+
+  https://github.com/oshkosher/bioio/tree/master/zlines
+
+  Ed Karrels, ed.karrels@gmail.com, January 2017
+*/
+
+#ifndef __ZINDEX_API_H__
+#define __ZINDEX_API_H__
+
+#include <stdint.h>
+#include "zline_api.h"
+
+struct ZlineIndex;
+typedef struct ZlineIndex* ZlineIndex;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Write an index of the lines of zf (open for reading) to filename.
+   The key of each line is field key_field (counting from 0) when the
+   line is split on key_delimiter, or on spaces and tabs if
+   key_delimiter is 0, as in ZlineFile_set_sorted_key.
+
+   thread_count is passed to ZlineIterator_create for the pass over
+   the file. Returns 0 on success or -1 on error. */
+ZLINE_EXPORT int ZlineIndex_build(ZlineFile zf, const char *filename,
+                                  int key_field, char key_delimiter,
+                                  int thread_count);
+
+/* Open an index of zf written by ZlineIndex_build. The table is
+   memory-mapped, so only the parts that are probed are read.
+   zf must remain open until ZlineIndex_close.
+   Returns NULL on error, or if the index doesn't have the same number
+   of lines as zf, as when lines were appended after it was built. */
+ZLINE_EXPORT ZlineIndex ZlineIndex_open(const char *filename, ZlineFile zf);
+
+/* Unmap the index. This doesn't close its ZlineFile. */
+ZLINE_EXPORT void ZlineIndex_close(ZlineIndex zi);
+
+/* Look up count keys at once. keys[i] has length key_lengths[i], or
+   is nul-terminated if key_lengths is NULL. line_idx[i] is set to the
+   index of the first line with key keys[i], or -1 if there isn't one.
+
+   The candidate lines of all the keys are read with one call to
+   ZlineFile_get_lines, so each block is decompressed once per batch
+   rather than once per key.
+
+   Returns the number of keys found, or -1 on error. */
+ZLINE_EXPORT int64_t ZlineIndex_lookup
+  (ZlineIndex zi, const char *const *keys, const uint64_t *key_lengths,
+   uint64_t count, int64_t *line_idx);
+
+/* Like ZlineIndex_lookup, but finds every line with each key.
+   line_counts[i] is set to the number of lines with key keys[i]. If
+   there are no more than max_lines in all, they are stored in lines[],
+   the lines of keys[0] first, then those of keys[1], and so on, each in
+   increasing order; otherwise lines[] is untouched, and the call can be
+   repeated with a bigger array.
+
+   Returns the total number of lines found, or -1 on error. */
+ZLINE_EXPORT int64_t ZlineIndex_lookup_all
+  (ZlineIndex zi, const char *const *keys, const uint64_t *key_lengths,
+   uint64_t count, uint64_t *lines, uint64_t max_lines,
+   uint64_t *line_counts);
+
+/* Look up one key. Returns the index of the first line with that key,
+   or -1 if there is none or on error. */
+ZLINE_EXPORT int64_t ZlineIndex_find(ZlineIndex zi, const char *key,
+                                     uint64_t key_len);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ZINDEX_API_H__ */
@@ -23,9 +23,15 @@
 #include <unistd.h>
 #endif
 
+#if defined(__SSE2__) && defined(__GNUC__)
+#include <emmintrin.h>
+#define USE_SSE2_SEARCH
+#endif
+
 #include "zline_api.h"
 #include "zline_internal_api.h"
 #include "zstd.h"
+#include "zdict.h"
 #include "common.h"
 
 #define DEFAULT_BLOCK_SIZE (4*1024*1024)
@@ -36,8 +42,24 @@
 #define ZSTD_COMPRESSION_LEVEL 3
 #define MAX_HEADER_LINE_LEN 100
 #define DO_COMPRESS_INDEX 1
+
+/* Files are written as "zline v2.1". Version 2.0 is still readable. */
+#define ZLINE_VERSION_MINOR 1
+
+/* Lines longer than this that get a block of their own are compressed
+   as a series of independent frames of this many bytes, so any part
+   of the line can be read without decompressing what comes before it. */
+#define LONG_LINE_FRAME_SIZE (1024*1024)
+
+/* ZlineFile_add_text splits its input into pieces of about this size,
+   or more if needed to keep every thread busy. */
+#define TEXT_SEGMENT_SIZE (64*1024*1024)
 #define FILE_BUFFER_SIZE 8192
 
+/* Files with at least this many blocks get a line directory (see
+   ZlineFile.line_dir); smaller ones just binary search block_starts. */
+#define LINE_DIR_MIN_BLOCKS 64
+
 #define ZLINE_MODE_CREATE 1
 #define ZLINE_MODE_READ 2
 
@@ -66,42 +88,224 @@ static int flushOutbuf(ZlineFile zf, ZSTD_outBuffer *outbuf,
 /* Returns the number of compressed bytes written to zf->fp or -1 on error */
 static int64_t compressToFile(ZlineFile zf, const void *buf, int64_t len);
 
+/* Read exactly len bytes from the file at the given offset.
+   Returns nonzero on error. */
+static int readFromFile(ZlineFile zf, void *buf, u64 len, u64 offset);
+
 /* Returns # of bytes written to buf.
+   ds - decompression stream to use
    readbuf_len - size of readbuf. Write no more than this many bytes.
    compressed_len - size of the compressed data on disk.
+   file_offset - where the compressed data starts in the file
    read_offset - skip this many (decompressed) bytes at the beginning
+   ddict - dictionary the data was compressed with, or NULL
 */
 static int64_t decompressFromFile
-  (ZlineFile zf, void *readbuf, int64_t readbuf_len,
-   int64_t compressed_len, uint64_t read_offset);
+  (ZlineFile zf, ZSTD_DStream *ds, void *readbuf, int64_t readbuf_len,
+   int64_t compressed_len, uint64_t file_offset, uint64_t read_offset,
+   const ZSTD_DDict *ddict);
+
+/* Like decompressFromFile, but the compressed data is at 'src' in the
+   memory-mapped file. */
+static int64_t decompressFromMap
+  (ZlineFile zf, ZSTD_DStream *ds, void *readbuf, int64_t readbuf_len,
+   const char *src, int64_t compressed_len, uint64_t read_offset,
+   const ZSTD_DDict *ddict);
+
+/* Read the dictionary stored after the header, if there is one. */
+static int readDictionary(ZlineFile zf);
+
+/* Open a file for reading, with or without memory-mapping it. */
+static ZlineFile openForReading(const char *filename, uint64_t cache_size,
+                                int use_map);
 
 /* Flush the current write_block. Return a pointer to the new write_block
    (which may be the same one). */
 static ZlineBlock* flushBlock(ZlineFile zf);
 
-/* Given the line index for one block, see if compressing the index makes
-   it smaller. If so, return the compressed data and its size in *data
-   and *len and return true. Otherwise return false. */
-static int useCompressedLineIndex(ZlineFile zf, void **data, uint64_t *len);
+/* Compress and write the current write_block on this thread. */
+static ZlineBlock* flushBlockSync(ZlineFile zf);
+
+/* Encode the line index of a block as it is stored in the file: a u64
+   byte count, then the length of each line as a varint, compressed with
+   zstd if that makes it smaller. Line offsets aren't stored; they are
+   the running sum of the lengths. 'out' must have room for
+   LINE_INDEX_BOUND(b->lines_size) bytes. Returns the number of bytes
+   written, and sets *flags to LINE_INDEX_COMPRESSED_FLAG if the
+   lengths were compressed.
+
+   If the lines all have the same length, nothing is written unless
+   fixed_width (ZlineFile.fixed_width) is ZLINE_FIXED_WIDTH_OFF, and
+   *flags is set to FIXED_WIDTH_FLAG. */
+static u64 encodeLineIndex(ZlineBlock *b, ZSTD_CCtx *cctx, char *out,
+                           u64 *flags, i64 fixed_width);
+#define MAX_VARINT_LEN 10
+#define LINE_INDEX_BOUND(line_count) \
+  (sizeof(u64) + (u64)(line_count) * MAX_VARINT_LEN)
+
+/* Decode a line index written by encodeLineIndex. */
+static int decodeLineIndex(ZlineBlock *b, const char *p, u64 len,
+                           u64 content_len);
+
+/* Start background threads for compressing and writing blocks. */
+static int writerStart(ZlineFile zf, int thread_count);
+
+/* Hand the current write_block to the background threads and return
+   an empty block to replace it. */
+static ZlineBlock* writerSubmit(ZlineFile zf);
+
+/* Wait for the background threads to write every queued block.
+   Afterwards zf->fp and zf->blocks can be accessed by the caller.
+   Returns nonzero if there was an error writing any block. */
+static int writerDrain(ZlineFile zf);
+
+/* Stop the background threads and deallocate their state. */
+static void writerStop(ZlineFile zf);
+
+static void *compressThreadFn(void *arg);
+static void *writeThreadFn(void *arg);
+
+/* Compress job->block into job->output. Returns nonzero on error. */
+static int compressJob(ZlineWriteJob *job, ZSTD_CCtx *cctx,
+                       const ZSTD_CDict *cdict);
 
 /* Handle the hack where ZlineIndexBlock.compressed_length_x contains both
-   the compressed length of a block and a bit noting whether the line
-   index for that block is compressed. */
+   the compressed length of a block and bits noting whether the line
+   index for that block is compressed, whether its content is split
+   into frames, whether it has no line index because its lines all
+   have the same length, and which codec (ZLINE_CODEC_*) packed its
+   content before compression, in bits 56..58. */
 #define LINE_INDEX_COMPRESSED_FLAG ((u64)1 << 63)
+#define CONTENT_FRAMED_FLAG ((u64)1 << 62)
+#define FIXED_WIDTH_FLAG ((u64)1 << 61)
+#define CODEC_SHIFT 56
 #define getBlockCompressedLen(block) \
-  ((block)->compressed_length_x & ~LINE_INDEX_COMPRESSED_FLAG)
+  ((block)->compressed_length_x & (((u64)1 << CODEC_SHIFT) - 1))
+#define getBlockCodec(block) \
+  ((int)(((block)->compressed_length_x >> CODEC_SHIFT) & 7))
 #define isBlockLineIndexCompressed(block) \
   ((((block)->compressed_length_x) >> 63) & 1)
+#define isBlockContentFramed(block) \
+  ((((block)->compressed_length_x) >> 62) & 1)
+#define isBlockFixedWidth(block) \
+  ((((block)->compressed_length_x) >> 61) & 1)
+
+/* A block holding just one line that was too big for the content
+   buffer, so b->content points at the caller's copy of the line
+   (see ZlineFile_add_line2), and long enough to be split into frames. */
+#define isLongLineBlock(b) \
+  ((b)->content_size > (b)->content_capacity && \
+   (b)->content_size > LONG_LINE_FRAME_SIZE)
+
+/* Compress a long line as a series of LONG_LINE_FRAME_SIZE frames
+   followed by a seek table: the compressed size of each frame as a u64,
+   then the frame size and the number of frames. Returns the number of
+   bytes written to zf->fp or -1 on error. */
+static int64_t compressFramesToFile(ZlineFile zf, const char *buf, u64 len);
+
+/* Like compressFramesToFile, but the output goes to a buffer of at least
+   FRAMES_BOUND(len) bytes. */
+static int64_t compressFramesToBuffer(ZSTD_CCtx *cctx,
+                                      const ZSTD_CDict *cdict,
+                                      const char *buf, u64 len, char *out,
+                                      u64 capacity);
+#define FRAME_COUNT(len) \
+  (((len) + LONG_LINE_FRAME_SIZE - 1) / LONG_LINE_FRAME_SIZE)
+#define FRAMES_BOUND(len) \
+  (FRAME_COUNT(len) * (ZSTD_compressBound(LONG_LINE_FRAME_SIZE) \
+                       + sizeof(u64)) + 2 * sizeof(u64))
+
+/* Split the lines in one segment of a ZlineFile_add_text call into
+   blocks and compress them. Returns nonzero on error. */
+static int buildTextSegment(ZlineTextJob *text, ZlineTextSegment *seg,
+                            ZlineWriteJob *job, ZSTD_CCtx *cctx);
+
+/* Worker thread for ZlineFile_add_text. */
+static void *textThreadFn(void *arg);
+
+/* Write a block built by buildTextSegment at the end of the file and
+   add it to the index. Returns nonzero on error. */
+static int appendTextBlock(ZlineFile zf, ZlineTextBlock *tb);
+
+/* Decompress 'len' bytes of a block's content starting 'offset' bytes
+   into it. The block's line index must have been read into b.
+   Returns the number of bytes written to buf. */
+static int64_t decompressContent(ZlineFile zf, ZSTD_DStream *ds,
+                                 ZlineBlock *b, char *buf, u64 len,
+                                 u64 offset);
+
+/* Decode frames of a ZlineFrameJob until there are none left. */
+static void *frameThreadFn(void *arg);
+
+/* Names of the codecs in the "alg" line of the header, by ZLINE_CODEC_*. */
+static const char *codec_names[] = {"", "nt2", "ref"};
+
+/* Pack content with ZLINE_CODEC_NT2: 2 bits for each character, A, C,
+   G, T = 0, 1, 2, 3, four to a byte starting with the low bits, followed
+   by the runs of other characters, which are packed as A. Each run is a
+   varint gap since the end of the previous run, a varint length, and the
+   character. Returns the packed length, or 0 if it would be more than
+   PACKED_BOUND(len) bytes, in which case the content is better off as
+   is. */
+static u64 packNt2(const char *content, u64 len, char *out);
+#define PACKED_BOUND(len) ((len) / 2)
+
+/* Unpack characters [start, end) of 'len' bytes of content packed by
+   packNt2 into out. Returns nonzero if the packed data is bad. */
+static int unpackNt2(const char *packed, u64 packed_len, u64 len,
+                     u64 start, u64 end, char *out);
+
+/* Pack the lines of a block with ZLINE_CODEC_REF: a reference line,
+   then each line as its differences from the reference. Character i of
+   the reference is the one most common in column i of the lines, by a
+   majority vote, and it is as long as the longest line. The packed form
+   is a varint reference length and the reference, then for each line a
+   varint count of characters that match the reference, and until the
+   line ends, the varint length of a run that doesn't, its characters,
+   and the count of matches after it. Runs of differences take in
+   stretches of fewer than REF_MIN_MATCH matches. Returns the packed
+   length, or 0 if it would be more than PACKED_BOUND(content length)
+   bytes. */
+static u64 packRef(const ZlineBlock *b, char *out);
+#define REF_MIN_MATCH 3
+
+/* Unpack characters [start, end) of the content of b, whose line index
+   has been read, from data packed by packRef. The requested part of
+   each line is copied from the reference, and then the runs that
+   differ are written over it. Returns nonzero if the data is bad. */
+static int unpackRef(const char *packed, u64 packed_len, const ZlineBlock *b,
+                     u64 start, u64 end, char *out);
+
+/* Returns the number of bytes at the start of a and b that match, out
+   of at most len. */
+static u64 matchLength(const char *a, const char *b, u64 len);
+
+/* Pack the content of b with a codec, into PACKED_BOUND(content size)
+   bytes at out. Returns the packed length, or 0 if it didn't help. */
+static u64 packContent(int codec, const ZlineBlock *b, char *out);
+
+/* Like decompressContent, for a block packed with a codec. The packed
+   content is decompressed in full, and just the requested part of it
+   is unpacked. */
+static int64_t decompressPacked(ZlineFile zf, ZSTD_DStream *ds,
+                                ZlineBlock *b, u64 content_offset,
+                                char *buf, u64 len, u64 offset);
 
 /* returns the index of the block containing this line */
 static u64 getLineBlock(ZlineFile zf, u64 line_idx);
 
+/* Build zf->line_dir from block_starts, once a file's index has been
+   read, or set zf->lines_per_block if the blocks are all the same size.
+   Returns nonzero if out of memory. */
+static int buildLineDirectory(ZlineFile zf);
+
 /* Make sure a line is in memory.
-   Set *block to the either zf->write_block or zf->read_block, whichever
-   contains the line.
+   Set *block to the either zf->write_block or the cached block
+   that contains the line.
    Set *line to point to the record of its offset and length.
    If the line isn't in memory, the block containing it will
-   be loaded into zf->read_block.
+   be loaded into the cache, and it will become zf->read_block.
+   Returns nonzero on error.
 */
 static int loadLine(ZlineFile zf, u64 line_idx, ZlineIndexLine **line,
                     ZlineBlock **block);
@@ -110,8 +314,148 @@ static int loadLine(ZlineFile zf, u64 line_idx, ZlineIndexLine **line,
    Otherwise return NULL. */
 static ZlineIndexLine* lineInBlock(ZlineBlock *block, u64 line_idx);
 
-/* read a block, store the decompressed result in read_block */
-static int readBlock(ZlineFile zf, u64 block_idx);
+/* Like loadLine, but only the line index of the block is needed, so
+   if the block isn't in memory just its index is read, into
+   zf->index_block. Returns NULL on error. */
+static ZlineIndexLine *loadLineIndex(ZlineFile zf, u64 line_idx);
+
+/* Read a block and store the decompressed result in b, using the
+   given decompression stream. */
+static int readBlock(ZlineFile zf, ZSTD_DStream *ds, u64 block_idx,
+                     ZlineBlock *b);
+
+/* Read just the line index of a block into b, without its content.
+   Sets b->content_size to 0. */
+static int readBlockIndex(ZlineFile zf, ZSTD_DStream *ds, u64 block_idx,
+                          ZlineBlock *b);
+
+/* Decompress the content of a block whose line index has been read
+   into b with readBlockIndex, no matter how large it is. */
+static int readBlockContent(ZlineFile zf, ZSTD_DStream *ds, ZlineBlock *b);
+
+/* Decode blocks ahead of a ZlineIterator's reader. */
+static void *iteratorThreadFn(void *arg);
+
+/* ZlineIterator_create, but if search is not NULL, the matching lines
+   of each block are found as it is decoded. */
+static ZlineIterator iteratorCreate
+  (ZlineFile zf, uint64_t first_line, uint64_t end_line, int is_reverse,
+   int thread_count, const ZlineSearch *search);
+
+/* k-mer filters. Each k-mer of a line sets one bit of its block's
+   filter, chosen by a rolling polynomial hash of its bytes. A search
+   checks at most MAX_FILTER_PROBES k-mers of each pattern, spread
+   along it; that is plenty to rule out nearly every block. */
+#define KMER_HASH_BASE (((u64)0x100 << 32) | 0x1b3)
+#define KMER_HASH_MIX (((u64)0x9e3779b9 << 32) | 0x7f4a7c15)
+#define MAX_KMER_LEN 256
+#define MAX_FILTER_SIZE ((u64)1 << 29)
+#define MIN_FILTER_SIZE 64
+#define MAX_FILTER_PROBES 32
+
+/* Map the hash of a k-mer to one of nbits filter bits. nbits is at
+   most 2^32, so the product can't overflow. */
+#define kmerBit(h, nbits) \
+  (((((h) ^ ((h) >> 29)) * KMER_HASH_MIX >> 32) * (nbits)) >> 32)
+
+/* Set the filter bit of every k-mer in the lines of b. */
+static void buildKmerFilter(const ZlineBlock *b, int k, unsigned char *filter,
+                            u64 filter_size);
+
+/* Compute the filter bits of up to MAX_FILTER_PROBES k-mers of a
+   pattern. Returns how many, or 0 if the file has no filters or the
+   pattern is shorter than k. */
+static int kmerProbes(ZlineFile zf, const char *pattern, u64 len,
+                      u64 *probes);
+
+/* Returns 0 if any of the probed bits is clear in the filter of the
+   block, so it can't contain the pattern, or 1 if it might. */
+static int filterMayMatch(ZlineFile zf, u64 block_idx, const u64 *probes,
+                          int probe_count);
+
+/* Returns 0 if the block's filter rules out every search pattern. */
+static int searchMayMatch(ZlineFile zf, const ZlineSearch *search,
+                          u64 block_idx);
+
+/* Set *key and *key_len to the key of a line, for files sorted by key:
+   field zf->key_field of it, as lineFieldKey finds it. */
+#define lineKey(zf, line, len, key, key_len) \
+  lineFieldKey(line, len, (zf)->key_field, (zf)->key_delimiter, key, key_len)
+
+/* Compare two keys like memcmp, or as integers with ZLINE_KEY_NUMERIC. */
+static int compareKeys(ZlineFile zf, const char *a, u64 a_len,
+                       const char *b, u64 b_len);
+
+/* Add the key of the first line of the next block to zf->fences.
+   Returns nonzero if out of memory. */
+static int addFence(ZlineFile zf, const char *key, u64 len);
+#define fenceStart(zf, block_idx) \
+  ((block_idx) == 0 ? 0 : (zf)->fence_ends[(block_idx) - 1])
+
+/* Copy a key to zf->last_key. Returns nonzero if out of memory. */
+static int setLastKey(ZlineFile zf, const char *key, u64 len);
+
+/* Write the fences at the current position of zf->fp, or read them from
+   zf->fence_offset. Return nonzero on error. */
+static int writeFences(ZlineFile zf);
+static int readFences(ZlineFile zf);
+
+/* Get the key of line i of a block, counting from the start of the
+   block. The key of the first line is its fence, so only later lines
+   need the block to be read. Returns nonzero on error. */
+static int blockLineKey(ZlineFile zf, u64 block_idx, u64 i,
+                        const char **key, u64 *key_len);
+
+/* Find the lines of a decoded block that contain any of the search
+   patterns. Returns nonzero if out of memory. */
+static int searchBlock(const ZlineSearch *search, ZlineBlock *b,
+                       ZlineSearchMatches *m);
+
+/* Returns the first occurrence of pat in [s, s+len) or NULL. */
+static const char *findPattern(const char *s, u64 len, const char *pat,
+                               u64 pat_len);
+
+/* Work on the groups of a ZlineBatch until there are none left. */
+static void *batchThreadFn(void *arg);
+
+/* Copy the window of the lines in each block of a ZlineWindow until
+   there are none left. */
+static void *windowThreadFn(void *arg);
+
+/* Decode the queued blocks of a ZlineAsync until it is shut down. */
+static void *asyncThreadFn(void *arg);
+
+/* Copy the lines of a piece from its decoded block. Returns nonzero
+   on error, leaving piece->data NULL. */
+static int asyncCopyPiece(ZlineFile zf, ZSTD_DStream *ds, ZlineBlock *b,
+                          ZlineAsyncPiece *piece);
+
+/* Gather the pieces of a request whose blocks have all been decoded
+   into its completion, and call its callback or queue it. */
+static void asyncFinish(ZlineAsync za, ZlineAsyncRequest *req);
+
+/* Make sure the cursor's block contains the given line, and return
+   the line's entry in the block. Returns NULL on error. */
+static ZlineIndexLine *cursorLoadLine(ZlineCursor cursor, u64 line_idx);
+
+/* Copy part of a line to buf, given the block containing it. */
+static int copyLine(ZlineFile zf, ZSTD_DStream *ds, ZlineBlock *block,
+                    ZlineIndexLine *line, char *buf, u64 buf_len,
+                    u64 offset);
+
+/* Return the cached copy of a block, reading it from the file if it is
+   not in the cache. The result becomes zf->read_block.
+   Returns NULL on error. */
+static ZlineBlock *getBlock(ZlineFile zf, u64 block_idx);
+
+/* Number of bytes of memory used by a block's content and line index. */
+static u64 blockMemorySize(ZlineBlock *b);
+
+/* Add a block to the front of the cache's LRU list. */
+static void cacheInsert(ZlineBlockCache *cache, ZlineBlock *b);
+
+/* Remove a block from the cache's LRU list. */
+static void cacheRemove(ZlineBlockCache *cache, ZlineBlock *b);
 
 
 /* Creates a new zlines file using blocks of the default size
@@ -130,6 +474,15 @@ ZLINE_EXPORT ZlineFile ZlineFile_create(const char *output_filename) {
 /* Like ZlineFile_create, but the user can select the block size. */
 ZLINE_EXPORT ZlineFile ZlineFile_create2(const char *output_filename,
                                          uint64_t block_size) {
+  return ZlineFile_create3(output_filename, block_size, 0);
+}
+
+
+/* Like ZlineFile_create2, but blocks are compressed by 'thread_count'
+   background threads. */
+ZLINE_EXPORT ZlineFile ZlineFile_create3(const char *output_filename,
+                                         uint64_t block_size,
+                                         int thread_count) {
 
   if (block_size > INT_MAX) {
     fprintf(stderr, "ZlineFile_create error: block_size too large\n");
@@ -146,7 +499,10 @@ ZLINE_EXPORT ZlineFile ZlineFile_create2(const char *output_filename,
 
   zf->filename = strdup(output_filename);
   zf->mode = ZLINE_MODE_CREATE;
+  zf->version_minor = ZLINE_VERSION_MINOR;
   zf->is_index_compressed = DO_COMPRESS_INDEX;
+  zf->fixed_width = ZLINE_FIXED_WIDTH_OFF;
+  zf->min_line_len = UINT64_MAX;
   zf->data_offset = HEADER_SIZE;
   zf->write_block = createBlock(block_size, -1);
   zf->write_block->idx = 0;
@@ -154,6 +510,7 @@ ZLINE_EXPORT ZlineFile ZlineFile_create2(const char *output_filename,
   /* open the output file */
   zf->fp = fopen(output_filename, "w+b");
   if (!zf->fp) goto fail;
+  zf->fd = fileno(zf->fp);
 
   if (writeHeader(zf)) goto fail;
 
@@ -172,6 +529,8 @@ ZLINE_EXPORT ZlineFile ZlineFile_create2(const char *output_filename,
 
   /* only allocate if needed */
   zf->decompress_stream = NULL;
+
+  if (thread_count > 0 && writerStart(zf, thread_count)) goto fail;
   
   return zf;
 
@@ -182,20 +541,149 @@ ZLINE_EXPORT ZlineFile ZlineFile_create2(const char *output_filename,
 }
 
 
+ZLINE_EXPORT ZlineFile ZlineFile_open_append(const char *filename) {
+  return ZlineFile_open_append2(filename, DEFAULT_BLOCK_SIZE, 0);
+}
+
+
+ZLINE_EXPORT ZlineFile ZlineFile_open_append2(const char *filename,
+                                              uint64_t block_size,
+                                              int thread_count) {
+  ZlineFile zf;
+  char *dict;
+  const char *key;
+  u64 n, key_len, end_offset;
+
+  if (block_size > INT_MAX) {
+    fprintf(stderr, "ZlineFile_open_append error: block_size too large\n");
+    return NULL;
+  } else if (block_size == 0) {
+    block_size = DEFAULT_BLOCK_SIZE;
+  }
+
+  /* read the header, dictionary, and index */
+  zf = openForReading(filename, 0, 0);
+  if (!zf) return NULL;
+
+  /* v2.0 line indexes are stored differently, and the header can only
+     describe one format. */
+  if (zf->version_minor != ZLINE_VERSION_MINOR) {
+    fprintf(stderr, "Cannot append to \"%s\": it was written in the "
+            "v2.%d format\n", filename, zf->version_minor);
+    goto fail;
+  }
+
+  /* the directory would go stale as blocks are added */
+  free(zf->line_dir);
+  zf->line_dir = NULL;
+  zf->line_dir_size = 0;
+  zf->lines_per_block = 0;
+
+  /* new blocks use the same codec and dictionary as the old ones */
+  for (n = ZLINE_CODEC_NT2; n <= ZLINE_CODEC_REF; n++)
+    if (zf->codecs_used & (1 << n))
+      zf->codec = n;
+
+  /* new lines must not have keys before the last one */
+  if (zf->has_keys) {
+    n = zf->blocks_size - 1;
+    if (blockLineKey(zf, n, ZlineFile_get_block_line_count(zf, n) - 1,
+                     &key, &key_len) ||
+        setLastKey(zf, key, key_len))
+      goto fail;
+  }
+
+  if (zf->dict_size) {
+    dict = (char*) malloc(zf->dict_size);
+    if (!dict) goto fail;
+    if (!readFromFile(zf, dict, zf->dict_size, HEADER_SIZE))
+      zf->cdict = ZSTD_createCDict(dict, zf->dict_size,
+                                   ZSTD_COMPRESSION_LEVEL);
+    free(dict);
+    if (!zf->cdict) goto fail;
+  }
+
+  /* reopen for writing and drop the index, which has been read into
+     zf->blocks and zf->block_starts, along with the fences before it */
+  end_offset = zf->has_keys ? zf->fence_offset : zf->index_offset;
+  fclose(zf->fp);
+  zf->fp = fopen(filename, "r+b");
+  if (!zf->fp) goto fail;
+  zf->fd = fileno(zf->fp);
+  if (ftruncate(zf->fd, end_offset) ||
+      fseek(zf->fp, end_offset, SEEK_SET)) {
+    fprintf(stderr, "Failed to truncate the index of \"%s\"\n", filename);
+    goto fail;
+  }
+
+  /* start a new block after the last one, as ZlineFile_create3 does
+     after the header */
+  zf->mode = ZLINE_MODE_CREATE;
+  zf->write_block = createBlock(block_size, -1);
+  linesInsureCapacity(zf->write_block, INITIAL_LINE_CAPACITY);
+
+  n = zf->blocks_size;
+  blocksInsureCapacity(zf, n + 1);
+  zf->blocks[n].offset = 0;
+  zf->blocks[n].decompressed_length = 0;
+  zf->blocks[n].compressed_length_x = 0;
+  zf->block_starts[n-1] = zf->line_count;
+  zf->blocks_size = n + 1;
+
+  zf->write_block->idx = n;
+  zf->write_block->offset = end_offset;
+  zf->index_offset = 0;
+
+  zf->compress_stream = ZSTD_createCStream();
+  assert(zf->compress_stream);
+
+  if (thread_count > 0 && writerStart(zf, thread_count)) goto fail;
+
+  return zf;
+
+ fail:
+  ZlineFile_deallocate(zf);
+
+  return NULL;
+}
+
+
 static int writeHeader(ZlineFile zf) {
   char buf[HEADER_SIZE];
-  int pos = 0;
+  int pos = 0, codec;
   size_t write_len;
 
-  pos += sprintf(buf, "zline v2.0\n");
+  pos += sprintf(buf, "zline v2.%d\n", ZLINE_VERSION_MINOR);
   pos += sprintf(buf+pos, "data_offset %" PRIu64 "\n", zf->data_offset);
   pos += sprintf(buf+pos, "index_offset %" PRIu64 "\n", zf->index_offset);
   pos += sprintf(buf+pos, "lines %" PRIu64 "\n", zf->line_count);
   pos += sprintf(buf+pos, "blocks %" PRIu64 "\n", zf->blocks_size);
   pos += sprintf(buf+pos, "maxlen %" PRIu64 "\n", zf->max_line_len);
-  pos += sprintf(buf+pos, "alg fzstd\n");
+  pos += sprintf(buf+pos, "alg fzstd");
+  for (codec = ZLINE_CODEC_NT2; codec <= ZLINE_CODEC_REF; codec++)
+    if (zf->codecs_used & (1 << codec))
+      pos += sprintf(buf+pos, "+%s", codec_names[codec]);
+  buf[pos++] = '\n';
   if (zf->is_index_compressed)
     pos += sprintf(buf+pos, "zi\n");
+  if (zf->dict_size)
+    pos += sprintf(buf+pos, "dict %" PRIu64 "\n", zf->dict_size);
+  if (zf->filter_size)
+    pos += sprintf(buf+pos, "kmer_filter %d %" PRIu64 "\n", zf->filter_k,
+                   zf->filter_size);
+  if (zf->has_keys)
+    pos += sprintf(buf+pos, "sorted_key %d %d %d %" PRIu64 "\n",
+                   zf->key_field, (unsigned char) zf->key_delimiter,
+                   zf->key_flags, zf->fence_offset);
+  if (zf->has_fixed_blocks) {
+    if (zf->fixed_width >= 0)
+      pos += sprintf(buf+pos, "fixed_width %" PRIu64 " required\n",
+                     zf->max_line_len);
+    else if (zf->min_line_len == zf->max_line_len)
+      pos += sprintf(buf+pos, "fixed_width %" PRIu64 "\n", zf->max_line_len);
+    else
+      pos += sprintf(buf+pos, "fixed_blocks\n");
+  }
   buf[pos++] = '\n';
   assert(pos <= HEADER_SIZE);
 
@@ -216,7 +704,7 @@ static int writeHeader(ZlineFile zf) {
   }
   fflush(zf->fp);
 
-  assert((u64)ftell(zf->fp) == zf->data_offset);
+  assert((u64)ftell(zf->fp) == HEADER_SIZE);
   
   return 0;
 }
@@ -224,10 +712,18 @@ static int writeHeader(ZlineFile zf) {
 
 static int readHeader(ZlineFile zf) {
   char buf[MAX_HEADER_LINE_LEN], word[MAX_HEADER_LINE_LEN];
+  const char *p;
+  int has_width = 0, codec;
+  size_t len;
 
   assert(zf->fp);
 
   zf->is_index_compressed = 0;
+
+  /* ZlineFile_open_append continues with the setting the file was
+     written with: a required width, or detection if any block was
+     stored without a line index, or neither */
+  zf->fixed_width = ZLINE_FIXED_WIDTH_OFF;
   
   if (fseek(zf->fp, 0, SEEK_SET)) {
     fprintf(stderr, "Failed to move to top of file to read header.\n");
@@ -237,7 +733,12 @@ static int readHeader(ZlineFile zf) {
   if (!fgets(buf, MAX_HEADER_LINE_LEN, zf->fp))
     goto format_error;
   
-  if (strncmp(buf, "zline v2.0", 10))
+  /* v2.0 files stored each line's offset and length as two u64s */
+  if (!strncmp(buf, "zline v2.0", 10))
+    zf->version_minor = 0;
+  else if (!strncmp(buf, "zline v2.1", 10))
+    zf->version_minor = 1;
+  else
     goto format_error;
 
   while (fgets(buf, MAX_HEADER_LINE_LEN, zf->fp) && buf[0] != '\n') {
@@ -255,18 +756,60 @@ static int readHeader(ZlineFile zf) {
     } else if (!strcmp(word, "maxlen")) {
       if (1 != sscanf(buf+pos, "%" SCNu64, &zf->max_line_len)) goto format_error;
     } else if (!strcmp(word, "alg")) {
+      /* zstd, plus any codecs used before it, as in "fzstd+nt2+ref" */
       if (1 != sscanf(buf+pos, "%s", word)) goto format_error;
-      if (strcmp(word, "fzstd")) {
-        fprintf(stderr, "Unrecognized compression algorithm: \"%s\"\n", word);
-        return 1;
+      if (strncmp(word, "fzstd", 5)) goto unknown_alg;
+      for (p = word + 5; *p == '+'; p += 1 + strlen(codec_names[codec])) {
+        for (codec = ZLINE_CODEC_NT2; codec <= ZLINE_CODEC_REF; codec++) {
+          len = strlen(codec_names[codec]);
+          if (!strncmp(p+1, codec_names[codec], len) &&
+              (p[len+1] == '+' || p[len+1] == 0))
+            break;
+        }
+        if (codec > ZLINE_CODEC_REF) goto unknown_alg;
+        zf->codecs_used |= 1 << codec;
       }
+      if (*p) goto unknown_alg;
     } else if (!strcmp(word, "zi")) {
       zf->is_index_compressed = 1;
+    } else if (!strcmp(word, "dict")) {
+      if (1 != sscanf(buf+pos, "%" SCNu64, &zf->dict_size)) goto format_error;
+    } else if (!strcmp(word, "kmer_filter")) {
+      if (2 != sscanf(buf+pos, "%d %" SCNu64, &zf->filter_k,
+                      &zf->filter_size) ||
+          zf->filter_k < 1 || zf->filter_k > MAX_KMER_LEN ||
+          zf->filter_size < 1 || zf->filter_size > MAX_FILTER_SIZE)
+        goto format_error;
+    } else if (!strcmp(word, "sorted_key")) {
+      int delimiter;
+      if (4 != sscanf(buf+pos, "%d %d %d %" SCNu64, &zf->key_field,
+                      &delimiter, &zf->key_flags, &zf->fence_offset) ||
+          zf->key_field < 0 || delimiter < 0 || delimiter > 255 ||
+          (zf->key_flags & ~ZLINE_KEY_NUMERIC))
+        goto format_error;
+      zf->key_delimiter = (char) delimiter;
+      zf->has_keys = 1;
+    } else if (!strcmp(word, "fixed_width")) {
+      /* "fixed_width <w> required" if ZlineFile_set_fixed_width set it */
+      int n = sscanf(buf+pos, "%" SCNu64 " %s", &zf->min_line_len, word);
+      if (n < 1 || (n == 2 && strcmp(word, "required")))
+        goto format_error;
+      zf->fixed_width = n == 2 ? (i64) zf->min_line_len
+        : ZLINE_FIXED_WIDTH_AUTO;
+      zf->has_fixed_blocks = has_width = 1;
+    } else if (!strcmp(word, "fixed_blocks")) {
+      zf->fixed_width = ZLINE_FIXED_WIDTH_AUTO;
+      zf->has_fixed_blocks = 1;
     } else {
       goto format_error;
     }
   }
 
+  /* every line is as long as the longest one */
+  if ((has_width && zf->min_line_len != zf->max_line_len) ||
+      (zf->has_fixed_blocks && zf->version_minor < 1))
+    goto format_error;
+
   if (zf->data_offset == 0 ||
       zf->index_offset == 0 ||
       zf->line_count == 0 ||
@@ -277,6 +820,10 @@ static int readHeader(ZlineFile zf) {
   
   return 0;
 
+ unknown_alg:
+  fprintf(stderr, "Unrecognized compression algorithm: \"%s\"\n", word);
+  return 1;
+
  format_error:
   fprintf(stderr, "Error reading \"%s\", invalid format\n", zf->filename);
   return 1;
@@ -295,6 +842,7 @@ static ZlineBlock *createBlock(int content_capacity, int line_capacity) {
 
   linesInsureCapacity(b, line_capacity);
   contentInsureCapacity(b, content_capacity);
+  b->idx = -1;
 
   return b;
 }
@@ -332,45 +880,385 @@ static void addLineInternal(ZlineFile zf, u64 length) {
 
   b->lines_size++;
   zf->line_count++;
+  zf->min_line_len = MIN(length, zf->min_line_len);
   zf->max_line_len = MAX(length, zf->max_line_len);
 }
 
 
-/* Given the line index for one block, see if compressing the index makes
-   it smaller. If so, return the compressed data and its size in *data
-   and *len and return true. Otherwise return false. */
-static int useCompressedLineIndex
-(ZlineFile zf, void **compressed_line_index, uint64_t *compressed_len) {
+/* Write a varint: 7 bits per byte, least significant first, with the
+   high bit set on every byte but the last. Returns the number of bytes
+   written, at most MAX_VARINT_LEN. */
+static int writeVarint(char *p, u64 value) {
+  int len = 0;
+  while (value >= 0x80) {
+    p[len++] = (char) (value | 0x80);
+    value >>= 7;
+  }
+  p[len++] = (char) value;
+  return len;
+}
+
 
-  ZlineBlock *b = zf->write_block;
-  size_t result, array_size, buf_size;
-  char *buf;
+/* Read a varint from [*p, end). Advances *p. Returns nonzero if the
+   data runs out or the value doesn't fit in 64 bits. */
+static int readVarint(const char **p, const char *end, u64 *value) {
+  const unsigned char *q = (const unsigned char*) *p;
+  u64 result = 0;
+  int shift = 0;
 
-  assert(zf->compress_stream);
+  while (1) {
+    if ((const char*)q >= end || shift > 63) return -1;
+    result |= (u64)(*q & 0x7f) << shift;
+    if (!(*q++ & 0x80)) break;
+    shift += 7;
+  }
 
-  /* never compress blocks with less than two lines in them */
-  if (b->lines_size < 2) return 0;
+  *p = (const char*) q;
+  *value = result;
+  return 0;
+}
 
-  array_size = b->lines_size * sizeof(ZlineIndexLine);
-  buf_size = ZSTD_compressBound(array_size);
-  buf = (char*) malloc(buf_size);
-  assert(buf);
 
-  /*
-  result = ZSTD_compressCCtx(zf->compress_stream, buf, buf_size,
-                             b->lines, array_size, ZSTD_COMPRESSION_LEVEL);
-  */
-  result = ZSTD_compress(buf, buf_size, b->lines, array_size,
-                         ZSTD_COMPRESSION_LEVEL);
-  
-  assert(!ZSTD_isError(result));
+static u64 encodeLineIndex(ZlineBlock *b, ZSTD_CCtx *cctx, char *out,
+                           u64 *flags, i64 fixed_width) {
+  char *lengths = out + sizeof(u64), *buf;
+  u64 len = 0;
+  size_t result, buf_size;
+  int i;
+
+  *flags = 0;
+
+  /* If every line has the same length, the reader can work out the
+     index from the line count and the content length. Unless the width
+     was set, leave single lines alone, like compression below. */
+  if (fixed_width != ZLINE_FIXED_WIDTH_OFF &&
+      b->lines_size >= (fixed_width >= 0 ? 1 : 2)) {
+    for (i=1; i < b->lines_size &&
+           b->lines[i].length == b->lines[0].length; i++) ;
+    if (i == b->lines_size) {
+      *flags = FIXED_WIDTH_FLAG;
+      return 0;
+    }
+  }
 
-  if (result + sizeof(uint64_t) < array_size) {
-    *compressed_line_index = buf;
-    *compressed_len = result;
-    return 1;
-  } else {
-    free(buf);
+  for (i=0; i < b->lines_size; i++)
+    len += writeVarint(lengths + len, b->lines[i].length);
+
+  /* Try compressing the lengths, and keep the result if it's smaller.
+     Never compress blocks with less than two lines in them, so the
+     index of a very long line can be read without decompressing. */
+  if (b->lines_size >= 2) {
+    assert(cctx);
+    buf_size = ZSTD_compressBound(len);
+    buf = (char*) malloc(buf_size);
+    if (buf) {
+      result = ZSTD_compressCCtx(cctx, buf, buf_size, lengths, len,
+                                 ZSTD_COMPRESSION_LEVEL);
+      if (!ZSTD_isError(result) && result < len) {
+        memcpy(lengths, buf, result);
+        len = result;
+        *flags = LINE_INDEX_COMPRESSED_FLAG;
+      }
+      free(buf);
+    }
+  }
+
+  memcpy(out, &len, sizeof len);
+  return sizeof len + len;
+}
+
+
+/* Fill in b->lines from the varint line lengths in [p, p+len).
+   The lengths must add up to content_len. */
+static int decodeLineIndex(ZlineBlock *b, const char *p, u64 len,
+                           u64 content_len) {
+  const char *end = p + len;
+  u64 offset = 0, length;
+  int i;
+
+  for (i=0; i < b->lines_size; i++) {
+    if (readVarint(&p, end, &length)) return -1;
+    b->lines[i].offset = offset;
+    b->lines[i].length = length;
+    offset += length;
+  }
+
+  return (p == end && offset == content_len) ? 0 : -1;
+}
+
+
+/* The 2-bit code for each character, or 4 for characters that
+   ZLINE_CODEC_NT2 stores as exceptions. */
+#define NT2_CODE(c) \
+  ((c) == 'A' ? 0 : (c) == 'C' ? 1 : (c) == 'G' ? 2 : (c) == 'T' ? 3 : 4)
+#define NT2_CODE4(c) NT2_CODE(c), NT2_CODE(c+1), NT2_CODE(c+2), NT2_CODE(c+3)
+#define NT2_CODE16(c) \
+  NT2_CODE4(c), NT2_CODE4(c+4), NT2_CODE4(c+8), NT2_CODE4(c+12)
+#define NT2_CODE64(c) \
+  NT2_CODE16(c), NT2_CODE16(c+16), NT2_CODE16(c+32), NT2_CODE16(c+48)
+static const unsigned char nt2_codes[256] = {
+  NT2_CODE64(0), NT2_CODE64(64), NT2_CODE64(128), NT2_CODE64(192)
+};
+
+/* The four characters packed in each byte, so a byte can be unpacked
+   with a single 4-byte copy. */
+#define NT2_CHAR(x) ((x) == 0 ? 'A' : (x) == 1 ? 'C' : (x) == 2 ? 'G' : 'T')
+#define NT2_CHARS(b) {NT2_CHAR((b) & 3), NT2_CHAR(((b) >> 2) & 3), \
+      NT2_CHAR(((b) >> 4) & 3), NT2_CHAR(((b) >> 6) & 3)}
+#define NT2_CHARS4(b) NT2_CHARS(b), NT2_CHARS(b+1), NT2_CHARS(b+2), \
+    NT2_CHARS(b+3)
+#define NT2_CHARS16(b) \
+  NT2_CHARS4(b), NT2_CHARS4(b+4), NT2_CHARS4(b+8), NT2_CHARS4(b+12)
+#define NT2_CHARS64(b) \
+  NT2_CHARS16(b), NT2_CHARS16(b+16), NT2_CHARS16(b+32), NT2_CHARS16(b+48)
+static const char nt2_chars[256][4] = {
+  NT2_CHARS64(0), NT2_CHARS64(64), NT2_CHARS64(128), NT2_CHARS64(192)
+};
+
+
+static u64 packNt2(const char *content, u64 len, char *out) {
+  const unsigned char *in = (const unsigned char*) content;
+  unsigned char *bases = (unsigned char*) out;
+  u64 capacity = PACKED_BOUND(len), pos = (len + 3) / 4, run_end = 0, i, j;
+  int code;
+
+  if (pos == 0 || pos > capacity) return 0;
+  memset(bases, 0, pos);
+
+  for (i=0; i < len; i++) {
+    code = nt2_codes[in[i]];
+    if (code < 4) {
+      bases[i >> 2] |= code << ((i & 3) * 2);
+      continue;
+    }
+
+    /* add a run of this character to the exceptions */
+    for (j = i+1; j < len && in[j] == in[i]; j++) ;
+    if (capacity - pos < 2 * MAX_VARINT_LEN + 1) return 0;
+    pos += writeVarint(out + pos, i - run_end);
+    pos += writeVarint(out + pos, j - i);
+    out[pos++] = in[i];
+    run_end = j;
+    i = j - 1;
+  }
+
+  return pos;
+}
+
+
+static int unpackNt2(const char *packed, u64 packed_len, u64 len,
+                     u64 start, u64 end, char *out) {
+  const unsigned char *bases = (const unsigned char*) packed;
+  const char *p, *runs_end = packed + packed_len;
+  u64 i, gap, run_len, run_start, run_end = 0, base_len = (len + 3) / 4;
+  char c;
+
+  if (packed_len < base_len || start > end || end > len) return -1;
+  out -= start;
+
+  /* the whole bytes in the middle are copied four characters at a time */
+  for (i = start; i < end && (i & 3); i++)
+    out[i] = nt2_chars[bases[i >> 2]][i & 3];
+
+#ifdef USE_SSE2_SEARCH
+  /* or sixteen at a time: each of four bytes is copied to four lanes,
+     lane j keeps bits 2*(j%4) and up, and the code in each lane is
+     matched to its character */
+  {
+    const __m128i field = _mm_set1_epi32((int) 0xc0300c03);
+    const __m128i code1 = _mm_set1_epi32(0x40100401);
+    const __m128i code2 = _mm_set1_epi32((int) 0x80200802);
+    __m128i v, m;
+    unsigned x;
+
+    for (; i + 16 <= end; i += 16) {
+      memcpy(&x, bases + (i >> 2), 4);
+      v = _mm_cvtsi32_si128((int) x);
+      v = _mm_unpacklo_epi8(v, v);
+      v = _mm_unpacklo_epi16(v, v);
+      m = _mm_and_si128(v, field);
+      v = _mm_or_si128
+        (_mm_and_si128(_mm_cmpeq_epi8(m, code1), _mm_set1_epi8('C' - 'A')),
+         _mm_or_si128
+         (_mm_and_si128(_mm_cmpeq_epi8(m, code2), _mm_set1_epi8('G' - 'A')),
+          _mm_and_si128(_mm_cmpeq_epi8(m, field),
+                        _mm_set1_epi8('T' - 'A'))));
+      _mm_storeu_si128((__m128i*) (out + i),
+                       _mm_add_epi8(v, _mm_set1_epi8('A')));
+    }
+  }
+#endif
+
+  for (; i + 4 <= end; i += 4)
+    memcpy(out + i, nt2_chars[bases[i >> 2]], 4);
+  for (; i < end; i++)
+    out[i] = nt2_chars[bases[i >> 2]][i & 3];
+
+  /* then the exceptions are written over them */
+  p = packed + base_len;
+  while (p < runs_end) {
+    if (readVarint(&p, runs_end, &gap) ||
+        readVarint(&p, runs_end, &run_len) ||
+        p >= runs_end ||
+        gap > len - run_end ||
+        run_len > len - run_end - gap)
+      return -1;
+    c = *p++;
+    run_start = run_end + gap;
+    run_end = run_start + run_len;
+
+    if (run_start >= end) break;
+    if (run_end > start)
+      memset(out + MAX(run_start, start), c,
+             MIN(run_end, end) - MAX(run_start, start));
+  }
+
+  return 0;
+}
+
+
+static u64 matchLength(const char *a, const char *b, u64 len) {
+  u64 i = 0;
+
+#ifdef USE_SSE2_SEARCH
+  unsigned mask;
+  for (; i + 16 <= len; i += 16) {
+    mask = _mm_movemask_epi8
+      (_mm_cmpeq_epi8(_mm_loadu_si128((const __m128i*) (a + i)),
+                      _mm_loadu_si128((const __m128i*) (b + i))));
+    if (mask != 0xffff) return i + __builtin_ctz(~mask);
+  }
+#endif
+
+  while (i < len && a[i] == b[i]) i++;
+  return i;
+}
+
+
+static u64 packRef(const ZlineBlock *b, char *out) {
+  const char *line, *ref;
+  char *vote;
+  unsigned *votes;
+  u64 capacity = PACKED_BOUND(b->content_size), pos, ref_len = 0;
+  u64 len, i, j, k, min_match;
+  int l;
+
+  for (l=0; l < b->lines_size; l++)
+    ref_len = MAX(ref_len, b->lines[l].length);
+  if (ref_len == 0 || capacity < MAX_VARINT_LEN ||
+      ref_len > capacity - MAX_VARINT_LEN)
+    return 0;
+
+  /* Build the reference in place. A column's candidate is replaced
+     when its count drops to zero, so a character that is in more than
+     half the lines that long will win. */
+  pos = writeVarint(out, ref_len);
+  vote = out + pos;
+  votes = (unsigned*) calloc(ref_len, sizeof(unsigned));
+  if (!votes) return 0;
+  for (l=0; l < b->lines_size; l++) {
+    line = b->content + b->lines[l].offset;
+    len = b->lines[l].length;
+    for (i=0; i < len; i++) {
+      if (votes[i] == 0) {
+        vote[i] = line[i];
+        votes[i] = 1;
+      } else if (vote[i] == line[i]) {
+        votes[i]++;
+      } else {
+        votes[i]--;
+      }
+    }
+  }
+  free(votes);
+  ref = vote;
+  pos += ref_len;
+
+  for (l=0; l < b->lines_size; l++) {
+    line = b->content + b->lines[l].offset;
+    len = b->lines[l].length;
+    i = 0;
+    while (1) {
+      /* matching characters */
+      j = i + matchLength(line + i, ref + i, len - i);
+      if (capacity - pos < MAX_VARINT_LEN) return 0;
+      pos += writeVarint(out + pos, j - i);
+      if (j == len) break;
+
+      /* characters that differ, up to the next REF_MIN_MATCH matches
+         or the end of the line */
+      for (k = j + 1; k < len; k++) {
+        min_match = MIN(REF_MIN_MATCH, len - k);
+        if (matchLength(line + k, ref + k, min_match) == min_match) break;
+      }
+      if (capacity - pos < MAX_VARINT_LEN + (k - j)) return 0;
+      pos += writeVarint(out + pos, k - j);
+      memcpy(out + pos, line + j, k - j);
+      pos += k - j;
+      i = k;
+      if (i == len) break;
+    }
+  }
+
+  return pos;
+}
+
+
+static int unpackRef(const char *packed, u64 packed_len, const ZlineBlock *b,
+                     u64 start, u64 end, char *out) {
+  const char *p = packed, *packed_end = packed + packed_len, *ref;
+  u64 ref_len, line_start, len, lo, hi, i, gap, run_len, from, to;
+  int l;
+
+  if (readVarint(&p, packed_end, &ref_len) ||
+      ref_len > (u64)(packed_end - p) || start > end)
+    return -1;
+  ref = p;
+  p += ref_len;
+  out -= start;
+
+  for (l=0; l < b->lines_size; l++) {
+    line_start = b->lines[l].offset;
+    len = b->lines[l].length;
+    if (line_start >= end) break;
+    if (len > ref_len) return -1;
+
+    /* the requested part of the line, which may be empty */
+    lo = MAX(start, line_start) - line_start;
+    hi = MIN(end, line_start + len) - line_start;
+    if (lo < hi)
+      memcpy(out + line_start + lo, ref + lo, hi - lo);
+
+    /* every line's runs are read, to find the next one's */
+    i = 0;
+    while (1) {
+      if (readVarint(&p, packed_end, &gap) || gap > len - i) return -1;
+      i += gap;
+      if (i == len) break;
+      if (readVarint(&p, packed_end, &run_len) || run_len == 0 ||
+          run_len > len - i || run_len > (u64)(packed_end - p))
+        return -1;
+      from = MAX(i, lo);
+      to = MIN(i + run_len, hi);
+      if (from < to)
+        memcpy(out + line_start + from, p + (from - i), to - from);
+      p += run_len;
+      i += run_len;
+      if (i == len) break;
+    }
+  }
+
+  return 0;
+}
+
+
+static u64 packContent(int codec, const ZlineBlock *b, char *out) {
+  switch (codec) {
+  case ZLINE_CODEC_NT2:
+    return packNt2(b->content, b->content_size, out);
+  case ZLINE_CODEC_REF:
+    return packRef(b, out);
+  default:
     return 0;
   }
 }
@@ -380,67 +1268,83 @@ static int useCompressedLineIndex
    (which may be the same one).
 */
 static ZlineBlock* flushBlock(ZlineFile zf) {
+  if (zf->writer)
+    return writerSubmit(zf);
+  else
+    return flushBlockSync(zf);
+}
+
+
+/* Compress and write the current write_block on this thread. Return a
+   pointer to the new write_block (which will be the same one). */
+static ZlineBlock* flushBlockSync(ZlineFile zf) {
   ZlineIndexBlock *block_idx = zf->blocks + (zf->blocks_size-1);
   ZlineBlock *b = zf->write_block;
   int64_t write_len, compressed_len, line_index_len;
-  u64 next_block_start, block_no;
-  void *compressed_line_index;
-  uint64_t compressed_line_index_len;
+  u64 next_block_start, block_no, packed_len;
+  char *line_index, *packed = NULL;
+  unsigned char *filter;
   uint64_t compressed_line_index_flag = 0;
 
   assert(b);
   assert(b->offset > 0);
 
-  /* if there is no data in the block, do nothing */
-  if (b->content_size == 0) return b;
+  /* if there are no lines in the block, do nothing */
+  if (b->lines_size == 0) return b;
+
+  /* XXX expensive assert */
+  assert((u64)ftell(zf->fp) == b->offset);
+
+  /* the k-mer filter goes just before the block */
+  if (zf->filter_size) {
+    filter = (unsigned char*) malloc(zf->filter_size);
+    if (!filter) goto fail;
+    buildKmerFilter(b, zf->filter_k, filter, zf->filter_size);
+    write_len = fwrite(filter, 1, zf->filter_size, zf->fp);
+    free(filter);
+    if ((u64)write_len != zf->filter_size) goto fail;
+    b->offset += zf->filter_size;
+  }
 
   block_idx->offset = b->offset;
   block_idx->decompressed_length = b->content_size;
   if (b->idx > 0)
     zf->block_starts[b->idx - 1] = b->first_line;
 
-  /* XXX expensive assert */
-  assert((u64)ftell(zf->fp) == b->offset);
-
-  if (b->lines_size == 0) {
-    line_index_len = 0;
+  /* write the line index */
+  line_index = (char*) malloc(LINE_INDEX_BOUND(b->lines_size));
+  if (!line_index) goto fail;
+  line_index_len = encodeLineIndex(b, zf->compress_stream, line_index,
+                                   &compressed_line_index_flag,
+                                   zf->fixed_width);
+  write_len = fwrite(line_index, 1, line_index_len, zf->fp);
+  free(line_index);
+  if (write_len != line_index_len) goto fail;
+  
+  /* Compress the line contents. A line too big for the content buffer
+     is passed in place of it (see ZlineFile_add_line2); if it's long,
+     split it into frames. */
+  if (isLongLineBlock(b)) {
+    assert(b->lines_size == 1);
+    compressed_len = compressFramesToFile(zf, b->content, b->content_size);
+    compressed_line_index_flag |= CONTENT_FRAMED_FLAG;
   } else {
-
-    /* Try compressing the line index. If it's smaller, leave the data
-       and its size in compressed_line_index and compressed_line_index_len,
-       respectively and return true. Otherwise, return false. */
-    if (useCompressedLineIndex(zf, &compressed_line_index,
-                               &compressed_line_index_len)) {
-      /* write 4-byte length of compressed line index */
-      write_len = fwrite(&compressed_line_index_len,
-                         sizeof compressed_line_index_len, 1, zf->fp);
-      if (write_len != 1) goto fail;
-
-      /* write compressed line index */
-      write_len = fwrite(compressed_line_index, 1, compressed_line_index_len,
-                         zf->fp);
-      if (write_len != compressed_line_index_len) goto fail;
-      free(compressed_line_index);
-    
-      line_index_len = (sizeof compressed_line_index_len) +
-        compressed_line_index_len;
-      compressed_line_index_flag = LINE_INDEX_COMPRESSED_FLAG;
-
+    packed_len = 0;
+    if (zf->codec != ZLINE_CODEC_NONE) {
+      packed = (char*) malloc(PACKED_BOUND(b->content_size));
+      if (packed) packed_len = packContent(zf->codec, b, packed);
+    }
+    if (packed_len > 0) {
+      compressed_len = compressToFile(zf, packed, packed_len);
+      compressed_line_index_flag |= (u64)zf->codec << CODEC_SHIFT;
     } else {
-      /* write uncompressed line index */
-      write_len = fwrite(b->lines, sizeof(ZlineIndexLine), b->lines_size,
-                         zf->fp);
-      if (write_len != b->lines_size) goto fail;
-      line_index_len = sizeof(ZlineIndexLine) * b->lines_size;
+      compressed_len = compressToFile(zf, b->content, b->content_size);
     }
-    
+    free(packed);
   }
-  
-  /* compress the line contents */
-  compressed_len = compressToFile(zf, b->content, b->content_size);
   if (compressed_len < 0) return b;
   
-  assert(compressed_len > 0);
+  assert(compressed_len >= 0);
   next_block_start = b->offset + line_index_len + compressed_len;
   block_idx->compressed_length_x = compressed_len | compressed_line_index_flag;
 
@@ -468,859 +1372,4055 @@ static ZlineBlock* flushBlock(ZlineFile zf) {
   fprintf(stderr, "Error writing compressed block.\n");
   return NULL;
 }
-            
-  
-/* Adds a line of text to the file.
-   Returns -1 if the file is opened for reading, or 0 on success.
-*/
-ZLINE_EXPORT int ZlineFile_add_line(ZlineFile zf, const char *line) {
-  return ZlineFile_add_line2(zf, line, strlen(line));
-}
 
 
-/* Like ZlineFile_add_line, but the length of the line is supplied. */
-ZLINE_EXPORT int ZlineFile_add_line2(ZlineFile zf, const char *line,
-                                     uint64_t length) {
-  ZlineBlock *b;
+static int writerStart(ZlineFile zf, int thread_count) {
+  ZlineWriter *w;
+  int i;
 
-  if (zf->mode != ZLINE_MODE_CREATE) {
+  w = (ZlineWriter*) calloc(1, sizeof(ZlineWriter));
+  if (!w) return -1;
+
+  w->job_count = thread_count * 2;
+  w->write_offset = zf->write_block->offset;
+  mutexInit(&w->lock);
+  condInit(&w->cond);
+
+  /* each job owns a spare block, which is swapped with write_block
+     when the job is submitted */
+  w->jobs = (ZlineWriteJob*) calloc(w->job_count, sizeof(ZlineWriteJob));
+  w->compress_threads = (Thread*) malloc(sizeof(Thread) * thread_count);
+  if (!w->jobs || !w->compress_threads) {
+    fprintf(stderr, "Out of memory\n");
+    free(w->jobs);
+    free(w->compress_threads);
+    free(w);
     return -1;
   }
-  
-  if (length < 0) length = strlen(line);
-  
-  b = zf->write_block;
-  assert(b);
-
-  /* the line doesn't fit in the current block, flush the current block */
-  if (b->content_size + length > (u64)b->content_capacity) {
-    b = flushBlock(zf);
+  for (i=0; i < w->job_count; i++) {
+    w->jobs[i].block = createBlock(zf->write_block->content_capacity, -1);
   }
 
-  /* add an entry to the line index */
-  addLineInternal(zf, length);
+  zf->writer = w;
 
-  if (length <= (u64)b->content_capacity) {
-    /* add the line to the content buffer */
-    memcpy(b->content + b->content_size, line, length);
-    b->content_size += length;
-  } else {
-    /* for really long lines, send them straight to disk */
-    char *content_buffer_saved = b->content;
-    assert(b->content_size == 0);
-    b->content = (char*) line;
-    b->content_size = length;
-    flushBlock(zf);
-    b->content = content_buffer_saved;
-  }    
+  if (threadStart(&w->write_thread, writeThreadFn, zf)) {
+    fprintf(stderr, "Failed to start write thread\n");
+    for (i=0; i < w->job_count; i++)
+      freeBlock(w->jobs[i].block);
+    free(w->jobs);
+    free(w->compress_threads);
+    free(w);
+    zf->writer = NULL;
+    return -1;
+  }
+
+  /* if this fails, writerStop() will clean up the threads
+     that were started */
+  for (i=0; i < thread_count; i++) {
+    if (threadStart(&w->compress_threads[i], compressThreadFn, zf)) {
+      fprintf(stderr, "Failed to start compression threads\n");
+      return -1;
+    }
+    w->thread_count++;
+  }
 
   return 0;
 }
 
-  
-/* If the file is open for writing, this finishes writing the file.
-   The file is closed, and any memory allocated internally is deallocated. */
-ZLINE_EXPORT void ZlineFile_close(ZlineFile zf) {
-  size_t write_len;
-  int pad_size;
-  char pad_buf[7] = {0};
-  u64 current_pos;
 
-  if (zf->mode == ZLINE_MODE_READ) goto ok;
+static ZlineBlock* writerSubmit(ZlineFile zf) {
+  ZlineWriter *w = zf->writer;
+  ZlineBlock *b = zf->write_block;
+  ZlineWriteJob *job;
+  ZlineIndexBlock *block_idx;
+  u64 block_no;
 
-  assert(zf->write_block);
-  assert(zf->write_block->idx == zf->blocks_size-1);
-  
-  if (zf->write_block->content_size > 0) {
-    flushBlock(zf);
-  }
-  zf->blocks_size--;
-    
-  current_pos = zf->write_block->offset;
-  
-  /* XXX slow assert */
-  assert((u64)ftell(zf->fp) == current_pos);
+  /* if there are no lines in the block, do nothing */
+  if (b->lines_size == 0) return b;
 
-  /* pad the file so the index is 8-byte aligned */
-  pad_size = (~current_pos + 1) & 7;
-  zf->index_offset = current_pos + pad_size;
-  assert(pad_size >= 0 &&
-         pad_size <= 7 &&
-         zf->index_offset % 8 == 0);
+  mutexLock(&w->lock);
 
-  write_len = fwrite(pad_buf, 1, pad_size, zf->fp);
-  if (write_len != (size_t)pad_size) goto fail;
+  /* wait for a free job slot */
+  while (w->next_submit - w->next_write >= (u64)w->job_count &&
+         !w->is_error)
+    condWait(&w->cond, &w->lock);
 
-  /* write the index */
-  if (zf->is_index_compressed) {
-    u64 size_block_array_compressed, size_starts_array_compressed;
+  if (w->is_error) {
+    mutexUnlock(&w->lock);
+    fprintf(stderr, "Error writing compressed block.\n");
+    return NULL;
+  }
 
-    /* fill in the compressed sizes later */
-    if (fseek(zf->fp, sizeof(u64) * 2, SEEK_CUR)) goto fail;
+  /* the rest of this block's index entry will be filled in when
+     it is written */
+  block_idx = zf->blocks + b->idx;
+  block_idx->decompressed_length = b->content_size;
+  if (b->idx > 0)
+    zf->block_starts[b->idx - 1] = b->first_line;
 
-    /* write the block index */
-    size_block_array_compressed = compressToFile
-      (zf, zf->blocks, sizeof(ZlineIndexBlock) * zf->blocks_size);
+  job = w->jobs + (w->next_submit % w->job_count);
+  zf->write_block = job->block;
+  job->block = b;
+  job->codec = zf->codec;
+  job->fixed_width = zf->fixed_width;
+  job->filter_k = zf->filter_k;
+  job->filter_len = zf->filter_size;
+  job->is_compressed = 0;
+  w->next_submit++;
+  condBroadcast(&w->cond);
+
+  /* move to the next block. The blocks array is shared with the write
+     thread, so only resize it while holding the lock. */
+  blocksInsureCapacity(zf, zf->blocks_size + 2);
+  block_no = zf->blocks_size;
+  zf->blocks_size++;
+  zf->blocks[block_no].offset = 0;
+  zf->blocks[block_no].decompressed_length = 0;
+  zf->blocks[block_no].compressed_length_x = 0;
+  zf->block_starts[block_no-1] = zf->line_count;
 
-    /* write the block_starts array */
-    size_starts_array_compressed = compressToFile
-      (zf, zf->block_starts, sizeof(u64) * (zf->blocks_size - 1));
+  mutexUnlock(&w->lock);
 
-    /* write the compressed sizes of the arrays */
-    if (fseek(zf->fp, zf->index_offset, SEEK_SET)) goto fail;
-    
-    fwrite(&size_block_array_compressed, sizeof(u64), 1, zf->fp);
-    fwrite(&size_starts_array_compressed, sizeof(u64), 1, zf->fp);
+  b = zf->write_block;
+  b->idx = block_no;
+  b->offset = 0;  /* unknown until the previous blocks are written */
+  b->lines_size = 0;
+  b->content_size = 0;
+
+  return b;
+}
+
+
+static int writerDrain(ZlineFile zf) {
+  ZlineWriter *w = zf->writer;
+  int err;
+
+  mutexLock(&w->lock);
+  while (w->next_write < w->next_submit && !w->is_error)
+    condWait(&w->cond, &w->lock);
+  err = w->is_error;
+  zf->write_block->offset = w->write_offset;
+  zf->blocks[zf->write_block->idx].offset = w->write_offset;
+  mutexUnlock(&w->lock);
+
+  return err;
+}
+
+
+static void writerStop(ZlineFile zf) {
+  ZlineWriter *w = zf->writer;
+  int i;
+
+  if (!w) return;
+
+  mutexLock(&w->lock);
+  w->is_shutdown = 1;
+  condBroadcast(&w->cond);
+  mutexUnlock(&w->lock);
+
+  for (i=0; i < w->thread_count; i++)
+    threadJoin(w->compress_threads[i]);
+  threadJoin(w->write_thread);
+
+  for (i=0; i < w->job_count; i++) {
+    freeBlock(w->jobs[i].block);
+    free(w->jobs[i].output);
+    free(w->jobs[i].packed);
   }
+  free(w->jobs);
+  free(w->compress_threads);
+  mutexDestroy(&w->lock);
+  condDestroy(&w->cond);
+  free(w);
+  zf->writer = NULL;
+}
 
-  /* write uncompressed block index */
-  else {
-    if (zf->blocks_size != fwrite(zf->blocks, sizeof(ZlineIndexBlock),
-                                  zf->blocks_size, zf->fp))
-      goto fail;
-    
-    if (zf->blocks_size-1 != fwrite(zf->block_starts, sizeof(u64),
-                                    zf->blocks_size - 1, zf->fp))
-      goto fail;
+
+/* Compressor thread: compress queued blocks in the order they
+   were submitted. */
+static void *compressThreadFn(void *arg) {
+  ZlineFile zf = (ZlineFile) arg;
+  ZlineWriter *w = zf->writer;
+  ZSTD_CCtx *cctx = ZSTD_createCCtx();
+  ZlineWriteJob *job;
+  int err;
+
+  assert(cctx);
+
+  mutexLock(&w->lock);
+  while (1) {
+    while (w->next_compress == w->next_submit && !w->is_shutdown)
+      condWait(&w->cond, &w->lock);
+    if (w->next_compress == w->next_submit) break;
+
+    job = w->jobs + (w->next_compress % w->job_count);
+    w->next_compress++;
+    mutexUnlock(&w->lock);
+
+    err = compressJob(job, cctx, zf->cdict);
+
+    mutexLock(&w->lock);
+    job->is_compressed = 1;
+    if (err) w->is_error = 1;
+    condBroadcast(&w->cond);
   }
+  mutexUnlock(&w->lock);
 
-  /* write the header */
-  if (writeHeader(zf)) goto fail;
+  ZSTD_freeCCtx(cctx);
+  return NULL;
+}
 
-  /* close the file */
-    goto ok;
- fail:
-    fprintf(stderr, "Error writing index to \"%s\"\n", zf->filename);
- ok:
 
-  ZlineFile_deallocate(zf);
+/* Write thread: write compressed blocks to the file in order, and fill
+   in their offsets and sizes in the block index. */
+static void *writeThreadFn(void *arg) {
+  ZlineFile zf = (ZlineFile) arg;
+  ZlineWriter *w = zf->writer;
+  ZlineWriteJob *job;
+  ZlineIndexBlock *block_idx;
+  u64 offset, len;
+  size_t write_len;
+
+  mutexLock(&w->lock);
+  while (1) {
+    job = w->jobs + (w->next_write % w->job_count);
+    while (!(w->next_write < w->next_submit && job->is_compressed)
+           && !w->is_shutdown)
+      condWait(&w->cond, &w->lock);
+    if (!(w->next_write < w->next_submit && job->is_compressed)) break;
+
+    offset = w->write_offset;
+    len = job->filter_len + job->line_index_len + job->compressed_len;
+    mutexUnlock(&w->lock);
+
+    write_len = fwrite(job->output, 1, len, zf->fp);
+
+    mutexLock(&w->lock);
+    if (write_len != len) {
+      fprintf(stderr, "Failed to write to \"%s\"\n", zf->filename);
+      w->is_error = 1;
+    }
+    block_idx = zf->blocks + job->block->idx;
+    block_idx->offset = job->block->offset = offset + job->filter_len;
+    block_idx->compressed_length_x = job->compressed_len | job->flags;
+    w->write_offset += len;
+    job->is_compressed = 0;
+    w->next_write++;
+    condBroadcast(&w->cond);
+  }
+  mutexUnlock(&w->lock);
+
+  return NULL;
 }
 
 
-static void blocksInsureCapacity(ZlineFile zf, u64 capacity) {
-  u64 new_cap;
-  if (!zf->blocks || zf->blocks_capacity < capacity) {
-    new_cap = zf->blocks_capacity * 2;
-    if (new_cap < capacity) new_cap = capacity;
-    zf->blocks = (ZlineIndexBlock*) realloc
-      (zf->blocks, sizeof(ZlineIndexBlock) * new_cap);
-    if (!zf->blocks) goto fail;
-    if (new_cap > 1) {
-      zf->block_starts = (uint64_t*) realloc
-        (zf->block_starts, sizeof(uint64_t) * (new_cap - 1));
-      if (!zf->block_starts) goto fail;
+static int compressJob(ZlineWriteJob *job, ZSTD_CCtx *cctx,
+                       const ZSTD_CDict *cdict) {
+  ZlineBlock *b = job->block;
+  const char *content = b->content;
+  char *out;
+  u64 capacity, content_len = b->content_size, packed_len, packed_bound;
+  size_t result;
+
+  capacity = job->filter_len + LINE_INDEX_BOUND(b->lines_size) +
+    (isLongLineBlock(b) ? FRAMES_BOUND(b->content_size)
+     : ZSTD_compressBound(b->content_size));
+  if (job->output_capacity < capacity) {
+    free(job->output);
+    job->output = (char*) malloc(capacity);
+    if (!job->output) {
+      job->output_capacity = 0;
+      fprintf(stderr, "Out of memory compressing block\n");
+      return -1;
     }
-    zf->blocks_capacity = new_cap;
+    job->output_capacity = capacity;
   }
 
-  return;
+  if (job->filter_len)
+    buildKmerFilter(b, job->filter_k, (unsigned char*) job->output,
+                    job->filter_len);
+  out = job->output + job->filter_len;
+  capacity = job->output_capacity - job->filter_len;
+
+  job->line_index_len = encodeLineIndex(b, cctx, out, &job->flags,
+                                        job->fixed_width);
+  out += job->line_index_len;
+  capacity -= job->line_index_len;
+
+  if (isLongLineBlock(b)) {
+    int64_t len = compressFramesToBuffer
+      (cctx, cdict, b->content, b->content_size, out, capacity);
+    if (len < 0) return -1;
+    job->compressed_len = len;
+    job->flags |= CONTENT_FRAMED_FLAG;
+    return 0;
+  }
+
+  if (job->codec != ZLINE_CODEC_NONE) {
+    packed_bound = PACKED_BOUND(b->content_size);
+    if (job->packed_capacity < packed_bound) {
+      free(job->packed);
+      job->packed = (char*) malloc(packed_bound);
+      job->packed_capacity = job->packed ? packed_bound : 0;
+    }
+    packed_len = job->packed ? packContent(job->codec, b, job->packed) : 0;
+    if (packed_len > 0) {
+      content = job->packed;
+      content_len = packed_len;
+      job->flags |= (u64)job->codec << CODEC_SHIFT;
+    }
+  }
+
+  if (cdict)
+    result = ZSTD_compress_usingCDict(cctx, out, capacity,
+                                      content, content_len, cdict);
+  else
+    result = ZSTD_compressCCtx(cctx, out, capacity, content, content_len,
+                               ZSTD_COMPRESSION_LEVEL);
+  if (ZSTD_isError(result)) {
+    fprintf(stderr, "Error compressing block: %s\n",
+            ZSTD_getErrorName(result));
+    return -1;
+  }
+  job->compressed_len = result;
+
+  return 0;
+}
+            
   
+ZLINE_EXPORT int ZlineFile_set_dictionary(ZlineFile zf, const void *dict,
+                                          uint64_t dict_size) {
+  if (zf->mode != ZLINE_MODE_CREATE || zf->line_count > 0 ||
+      zf->dict_size > 0 || dict_size == 0)
+    return -1;
+
+  /* the reader side is needed too, for lines read back while writing */
+  zf->cdict = ZSTD_createCDict(dict, dict_size, ZSTD_COMPRESSION_LEVEL);
+  zf->ddict = ZSTD_createDDict(dict, dict_size);
+  if (!zf->cdict || !zf->ddict) goto fail;
+
+  /* the dictionary goes right after the header, and blocks follow it */
+  assert((u64)ftell(zf->fp) == HEADER_SIZE);
+  if (fwrite(dict, 1, dict_size, zf->fp) != dict_size) {
+    fprintf(stderr, "Failed to write dictionary to \"%s\"\n", zf->filename);
+    goto fail;
+  }
+
+  zf->dict_size = dict_size;
+  zf->data_offset = HEADER_SIZE + dict_size;
+  zf->write_block->offset = zf->data_offset;
+  if (zf->writer) zf->writer->write_offset = zf->data_offset;
+  return 0;
+
  fail:
-  fprintf(stderr, "Out of memory allocating block array\n");
-  assert(0);
+  ZSTD_freeCDict(zf->cdict);
+  ZSTD_freeDDict(zf->ddict);
+  zf->cdict = NULL;
+  zf->ddict = NULL;
+  fseek(zf->fp, HEADER_SIZE, SEEK_SET);
+  return -1;
+}
+
+
+ZLINE_EXPORT int64_t ZlineFile_train_dictionary
+  (void *dict, uint64_t dict_capacity, const char *samples,
+   const uint64_t *sample_lengths, uint64_t sample_count) {
+  size_t *sizes, result;
+  u64 i;
+
+  if (sample_count == 0 || sample_count > UINT_MAX) return -1;
+
+  sizes = (size_t*) malloc(sizeof(size_t) * sample_count);
+  if (!sizes) return -1;
+  for (i=0; i < sample_count; i++)
+    sizes[i] = sample_lengths[i];
+
+  result = ZDICT_trainFromBuffer(dict, dict_capacity, samples, sizes,
+                                 (unsigned) sample_count);
+  free(sizes);
+
+  if (ZDICT_isError(result)) {
+    fprintf(stderr, "Failed to train dictionary: %s\n",
+            ZDICT_getErrorName(result));
+    return -1;
+  }
+  return result;
+}
+
+
+ZLINE_EXPORT int ZlineFile_add_text(ZlineFile zf, const char *text,
+                                    uint64_t length, int thread_count) {
+  ZlineTextJob job;
+  ZlineTextSegment *seg;
+  Thread *threads = NULL;
+  const char *p, *end = text + length, *target;
+  u64 s, i;
+  int started = 0, err = 0;
+
+  if (zf->mode != ZLINE_MODE_CREATE) return -1;
+  if (length == 0) return 0;
+  if (thread_count <= 0) thread_count = getCpuCount();
+
+  /* finish the current block, so the new ones go after it */
+  if (zf->write_block->lines_size > 0 && !flushBlock(zf)) return -1;
+  if (zf->writer && writerDrain(zf)) return -1;
+
+  memset(&job, 0, sizeof job);
+  job.zf = zf;
+  job.block_size = zf->write_block->content_capacity;
+  job.codec = zf->codec;
+  job.max_ahead = thread_count * 2;
+  job.segment_count = MAX(length / TEXT_SEGMENT_SIZE + 1,
+                          (u64) thread_count * 4);
+  job.segments = (ZlineTextSegment*)
+    calloc(job.segment_count, sizeof(ZlineTextSegment));
+  threads = (Thread*) malloc(sizeof(Thread) * thread_count);
+  if (!job.segments || !threads) {
+    free(job.segments);
+    free(threads);
+    return -1;
+  }
+
+  /* split the text just after newlines */
+  p = text;
+  for (s=0; s < job.segment_count; s++) {
+    job.segments[s].start = p;
+    target = text + length / job.segment_count * (s+1);
+    if (s == job.segment_count - 1) {
+      p = end;
+    } else if (target > p) {
+      p = (const char*) memchr(target, '\n', end - target);
+      p = p ? p + 1 : end;
+    }
+    job.segments[s].end = p;
+  }
+
+  mutexInit(&job.lock);
+  condInit(&job.cond);
+  for (started = 0; started < thread_count; started++)
+    if (threadStart(&threads[started], textThreadFn, &job)) break;
+  if (started == 0) job.is_error = 1;
+
+  /* write the blocks in order as their segments are finished */
+  for (s=0; s < job.segment_count; s++) {
+    seg = job.segments + s;
+    mutexLock(&job.lock);
+    while (!seg->is_done && !job.is_error)
+      condWait(&job.cond, &job.lock);
+    err = job.is_error;
+    mutexUnlock(&job.lock);
+    if (err) break;
+
+    for (i=0; i < seg->block_count && !err; i++)
+      err = appendTextBlock(zf, seg->blocks + i);
+    zf->min_line_len = MIN(zf->min_line_len, seg->min_line_len);
+    zf->max_line_len = MAX(zf->max_line_len, seg->max_line_len);
+
+    mutexLock(&job.lock);
+    job.next_write++;
+    if (err) job.is_error = 1;
+    condBroadcast(&job.cond);
+    mutexUnlock(&job.lock);
+    if (err) break;
+  }
+
+  while (started > 0)
+    threadJoin(threads[--started]);
+  mutexDestroy(&job.lock);
+  condDestroy(&job.cond);
+
+  for (s=0; s < job.segment_count; s++) {
+    for (i=0; i < job.segments[s].block_count; i++) {
+      free(job.segments[s].blocks[i].output);
+      free(job.segments[s].blocks[i].keys);
+    }
+    free(job.segments[s].blocks);
+  }
+  free(job.segments);
+  free(threads);
+
+  if (zf->writer) zf->writer->write_offset = zf->write_block->offset;
+
+  if (err) {
+    fprintf(stderr, "Error writing compressed block.\n");
+    return -1;
+  }
+  return 0;
+}
+
+
+static void *textThreadFn(void *arg) {
+  ZlineTextJob *text = (ZlineTextJob*) arg;
+  ZSTD_CCtx *cctx = ZSTD_createCCtx();
+  ZlineWriteJob job;
+  u64 s;
+  int err = 0;
+
+  memset(&job, 0, sizeof job);
+  job.block = createBlock(text->block_size, -1);
+  job.codec = text->codec;
+  job.fixed_width = text->zf->fixed_width;
+  job.filter_k = text->zf->filter_k;
+  job.filter_len = text->zf->filter_size;
+  if (!cctx || !job.block) err = 1;
+
+  while (!err) {
+    /* don't get too far ahead of the writer */
+    mutexLock(&text->lock);
+    while (text->next_segment < text->segment_count &&
+           text->next_segment >= text->next_write + text->max_ahead &&
+           !text->is_error)
+      condWait(&text->cond, &text->lock);
+    s = text->next_segment;
+    if (text->is_error || s >= text->segment_count) {
+      mutexUnlock(&text->lock);
+      break;
+    }
+    text->next_segment++;
+    mutexUnlock(&text->lock);
+
+    err = buildTextSegment(text, text->segments + s, &job, cctx);
+
+    /* set is_error along with is_done, so the writer doesn't take an
+       incomplete segment as finished */
+    mutexLock(&text->lock);
+    text->segments[s].is_done = 1;
+    if (err) text->is_error = 1;
+    condBroadcast(&text->cond);
+    mutexUnlock(&text->lock);
+  }
+
+  if (err) {
+    mutexLock(&text->lock);
+    text->is_error = 1;
+    condBroadcast(&text->cond);
+    mutexUnlock(&text->lock);
+  }
+
+  ZSTD_freeCCtx(cctx);
+  freeBlock(job.block);
+  free(job.output);
+  free(job.packed);
+  return NULL;
+}
+
+
+/* Compress job->block and move the result to the end of seg->blocks. */
+static int finishTextBlock(ZlineTextJob *text, ZlineTextSegment *seg,
+                           ZlineWriteJob *job, ZSTD_CCtx *cctx) {
+  ZlineTextBlock *tb;
+  ZlineBlock *b = job->block;
+  ZlineFile zf = text->zf;
+  ZlineIndexLine *line;
+  const char *first_key = NULL, *last_key = NULL;
+  u64 first_key_len = 0, last_key_len = 0;
+  char *keys = NULL;
+
+  if (seg->block_count == seg->block_capacity) {
+    seg->block_capacity = MAX(seg->block_capacity * 2, 16);
+    tb = (ZlineTextBlock*) realloc
+      (seg->blocks, sizeof(ZlineTextBlock) * seg->block_capacity);
+    if (!tb) return -1;
+    seg->blocks = tb;
+  }
+
+  if (compressJob(job, cctx, zf->cdict)) return -1;
+
+  if (zf->has_keys) {
+    line = b->lines;
+    lineKey(zf, b->content + line->offset, line->length,
+            &first_key, &first_key_len);
+    line = b->lines + b->lines_size - 1;
+    lineKey(zf, b->content + line->offset, line->length,
+            &last_key, &last_key_len);
+    keys = (char*) malloc(first_key_len + last_key_len + 1);
+    if (!keys) return -1;
+    memcpy(keys, first_key, first_key_len);
+    memcpy(keys + first_key_len, last_key, last_key_len);
+  }
+
+  /* the segment takes the output buffer */
+  tb = seg->blocks + seg->block_count++;
+  tb->keys = keys;
+  tb->first_key_len = first_key_len;
+  tb->last_key_len = last_key_len;
+  tb->output = job->output;
+  tb->filter_len = job->filter_len;
+  tb->line_index_len = job->line_index_len;
+  tb->compressed_len = job->compressed_len;
+  tb->flags = job->flags;
+  tb->decompressed_length = b->content_size;
+  tb->line_count = b->lines_size;
+  job->output = NULL;
+  job->output_capacity = 0;
+
+  b->lines_size = 0;
+  b->content_size = 0;
+  return 0;
+}
+
+
+static int buildTextSegment(ZlineTextJob *text, ZlineTextSegment *seg,
+                            ZlineWriteJob *job, ZSTD_CCtx *cctx) {
+  ZlineBlock *b = job->block;
+  ZlineFile zf = text->zf;
+  const char *p = seg->start, *nl, *saved_content;
+  const char *key, *prev_key = NULL;
+  u64 len, key_len, prev_key_len = 0;
+
+  b->lines_size = 0;
+  b->content_size = 0;
+  seg->min_line_len = UINT64_MAX;
+
+  while (p < seg->end) {
+    /* find the end of the line, and trim "\n" or "\r\n" */
+    nl = (const char*) memchr(p, '\n', seg->end - p);
+    if (nl) {
+      len = nl - p;
+      if (len > 0 && p[len-1] == '\r') len--;
+    } else {
+      len = seg->end - p;
+    }
+
+    /* the order of lines in different segments is checked as their
+       blocks are written */
+    if (zf->has_keys) {
+      lineKey(zf, p, len, &key, &key_len);
+      if (prev_key &&
+          compareKeys(zf, prev_key, prev_key_len, key, key_len) > 0) {
+        fprintf(stderr, "Text is not in order by key at \"%.*s\"\n",
+                (int) MIN(len, 100), p);
+        return -1;
+      }
+      prev_key = key;
+      prev_key_len = key_len;
+    }
+
+    if (zf->fixed_width >= 0 && len != (u64)zf->fixed_width) {
+      fprintf(stderr, "Text has a line of %" PRIu64 " bytes, not %" PRIi64
+              ", at \"%.*s\"\n", len, zf->fixed_width, (int) MIN(len, 100), p);
+      return -1;
+    }
+
+    if (b->content_size + len > (u64)b->content_capacity &&
+        b->lines_size > 0 &&
+        finishTextBlock(text, seg, job, cctx))
+      return -1;
+
+    linesInsureCapacity(b, b->lines_size + 1);
+    b->lines[b->lines_size].offset = b->content_size;
+    b->lines[b->lines_size].length = len;
+    b->lines_size++;
+
+    if (len <= (u64)b->content_capacity) {
+      memcpy(b->content + b->content_size, p, len);
+      b->content_size += len;
+    } else {
+      /* a long line gets a block of its own, compressed in place */
+      saved_content = b->content;
+      b->content = (char*) p;
+      b->content_size = len;
+      if (finishTextBlock(text, seg, job, cctx)) return -1;
+      b->content = (char*) saved_content;
+    }
+
+    seg->line_count++;
+    seg->min_line_len = MIN(seg->min_line_len, len);
+    seg->max_line_len = MAX(seg->max_line_len, len);
+    p = nl ? nl + 1 : seg->end;
+  }
+
+  if (b->lines_size > 0 && finishTextBlock(text, seg, job, cctx))
+    return -1;
+
+  return 0;
+}
+
+
+static int appendTextBlock(ZlineFile zf, ZlineTextBlock *tb) {
+  ZlineBlock *b = zf->write_block;
+  ZlineIndexBlock *block_idx = zf->blocks + b->idx;
+  u64 len = tb->filter_len + tb->line_index_len + tb->compressed_len;
+  u64 block_no;
+
+  assert(b->lines_size == 0);
+  assert(b->idx == zf->blocks_size - 1);
+
+  if (zf->has_keys) {
+    if (zf->line_count > 0 &&
+        compareKeys(zf, zf->last_key, zf->last_key_len,
+                    tb->keys, tb->first_key_len) > 0) {
+      fprintf(stderr, "Line %" PRIu64 " of \"%s\" is not in order by key\n",
+              zf->line_count, zf->filename);
+      return -1;
+    }
+    assert(zf->fence_count == (u64)b->idx);
+    if (addFence(zf, tb->keys, tb->first_key_len) ||
+        setLastKey(zf, tb->keys + tb->first_key_len, tb->last_key_len))
+      return -1;
+  }
+
+  if (fwrite(tb->output, 1, len, zf->fp) != len) return -1;
+
+  block_idx->offset = b->offset + tb->filter_len;
+  block_idx->decompressed_length = tb->decompressed_length;
+  block_idx->compressed_length_x = tb->compressed_len | tb->flags;
+  if (b->idx > 0)
+    zf->block_starts[b->idx - 1] = zf->line_count;
+  zf->line_count += tb->line_count;
+
+  /* move to the next block */
+  blocksInsureCapacity(zf, zf->blocks_size + 2);
+  block_no = zf->blocks_size++;
+  zf->blocks[block_no].offset = b->offset + len;
+  zf->blocks[block_no].decompressed_length = 0;
+  zf->blocks[block_no].compressed_length_x = 0;
+  zf->block_starts[block_no-1] = zf->line_count;
+
+  b->idx = block_no;
+  b->offset += len;
+  return 0;
+}
+
+
+/* Selects whether the block index at the end of the file is compressed.
+   Returns -1 if the file is opened for reading, or 0 on success.
+*/
+ZLINE_EXPORT int ZlineFile_set_index_compression(ZlineFile zf, int compress) {
+  if (zf->mode != ZLINE_MODE_CREATE) return -1;
+  zf->is_index_compressed = compress ? 1 : 0;
+  return 0;
+}
+
+
+ZLINE_EXPORT int ZlineFile_set_codec(ZlineFile zf, int codec) {
+  if (zf->mode != ZLINE_MODE_CREATE ||
+      codec < ZLINE_CODEC_NONE || codec > ZLINE_CODEC_REF)
+    return -1;
+  zf->codec = codec;
+  if (codec != ZLINE_CODEC_NONE) zf->codecs_used |= 1 << codec;
+  return 0;
+}
+
+
+ZLINE_EXPORT int ZlineFile_set_kmer_filter(ZlineFile zf, int k,
+                                          uint64_t filter_size) {
+  if (zf->mode != ZLINE_MODE_CREATE || zf->line_count > 0 ||
+      k < 1 || k > MAX_KMER_LEN || filter_size > MAX_FILTER_SIZE)
+    return -1;
+
+  /* one bit per byte of content */
+  if (filter_size == 0)
+    filter_size = MAX(zf->write_block->content_capacity / 8,
+                      MIN_FILTER_SIZE);
+
+  zf->filter_k = k;
+  zf->filter_size = filter_size;
+  return 0;
+}
+
+
+ZLINE_EXPORT int ZlineFile_set_sorted_key(ZlineFile zf, int field,
+                                         char delimiter, int flags) {
+  if (zf->mode != ZLINE_MODE_CREATE || zf->line_count > 0 || field < 0 ||
+      delimiter == '\n' || (flags & ~ZLINE_KEY_NUMERIC))
+    return -1;
+
+  zf->has_keys = 1;
+  zf->key_field = field;
+  zf->key_delimiter = delimiter;
+  zf->key_flags = flags;
+  return 0;
+}
+
+
+ZLINE_EXPORT int ZlineFile_get_sorted_key(ZlineFile zf, int *field,
+                                         char *delimiter, int *flags) {
+  if (!zf->has_keys) return -1;
+  if (field) *field = zf->key_field;
+  if (delimiter) *delimiter = zf->key_delimiter;
+  if (flags) *flags = zf->key_flags;
+  return 0;
+}
+
+
+ZLINE_EXPORT int ZlineFile_set_fixed_width(ZlineFile zf, int64_t width) {
+  if (zf->mode != ZLINE_MODE_CREATE || width < ZLINE_FIXED_WIDTH_OFF)
+    return -1;
+
+  /* lines already added must have the width too */
+  if (width >= 0 && zf->line_count > 0 &&
+      (zf->min_line_len != (u64)width || zf->max_line_len != (u64)width))
+    return -1;
+
+  zf->fixed_width = width;
+  return 0;
+}
+
+
+ZLINE_EXPORT int64_t ZlineFile_get_fixed_width(ZlineFile zf) {
+  if (zf->line_count == 0 || zf->min_line_len != zf->max_line_len)
+    return -1;
+  return zf->max_line_len;
+}
+
+
+ZLINE_EXPORT int ZlineFile_block_may_contain
+  (ZlineFile zf, uint64_t block_idx, const char *pattern, uint64_t length) {
+  u64 probes[MAX_FILTER_PROBES];
+
+  if (zf->mode != ZLINE_MODE_READ || block_idx >= zf->blocks_size)
+    return -1;
+
+  return filterMayMatch(zf, block_idx, probes,
+                        kmerProbes(zf, pattern, length, probes));
+}
+
+
+/* Adds a line of text to the file.
+   Returns -1 if the file is opened for reading, or 0 on success.
+*/
+ZLINE_EXPORT int ZlineFile_add_line(ZlineFile zf, const char *line) {
+  return ZlineFile_add_line2(zf, line, strlen(line));
+}
+
+
+/* Like ZlineFile_add_line, but the length of the line is supplied. */
+ZLINE_EXPORT int ZlineFile_add_line2(ZlineFile zf, const char *line,
+                                     uint64_t length) {
+  ZlineBlock *b;
+  const char *key = NULL;
+  u64 key_len = 0;
+
+  if (zf->mode != ZLINE_MODE_CREATE) {
+    return -1;
+  }
+  
+  if (length < 0) length = strlen(line);
+
+  if (zf->fixed_width >= 0 && length != (u64)zf->fixed_width) {
+    fprintf(stderr, "Line %" PRIu64 " of \"%s\" is %" PRIu64 " bytes, not %"
+            PRIi64 "\n", zf->line_count, zf->filename, length,
+            zf->fixed_width);
+    return -1;
+  }
+
+  if (zf->has_keys) {
+    lineKey(zf, line, length, &key, &key_len);
+    if (zf->line_count > 0 &&
+        compareKeys(zf, zf->last_key, zf->last_key_len, key, key_len) > 0) {
+      fprintf(stderr, "Line %" PRIu64 " of \"%s\" is not in order by key\n",
+              zf->line_count, zf->filename);
+      return -1;
+    }
+  }
+  
+  b = zf->write_block;
+  assert(b);
+
+  /* the line doesn't fit in the current block, flush the current block */
+  if (b->content_size + length > (u64)b->content_capacity) {
+    b = flushBlock(zf);
+    if (!b) return -1;
+  }
+
+  if (zf->has_keys) {
+    assert(b->lines_size > 0 || zf->fence_count == (u64)b->idx);
+    if ((b->lines_size == 0 && addFence(zf, key, key_len)) ||
+        setLastKey(zf, key, key_len))
+      return -1;
+  }
+
+  /* add an entry to the line index */
+  addLineInternal(zf, length);
+
+  if (length <= (u64)b->content_capacity) {
+    /* add the line to the content buffer */
+    memcpy(b->content + b->content_size, line, length);
+    b->content_size += length;
+  } else {
+    /* For really long lines, send them straight to disk. The line can't
+       be handed to the background threads, so let them finish and
+       write it from this thread. */
+    char *content_buffer_saved = b->content;
+    assert(b->content_size == 0);
+    if (zf->writer && writerDrain(zf)) return -1;
+    b->content = (char*) line;
+    b->content_size = length;
+    flushBlockSync(zf);
+    b->content = content_buffer_saved;
+    if (zf->writer) zf->writer->write_offset = b->offset;
+  }    
+
+  return 0;
+}
+
+  
+/* If the file is open for writing, this finishes writing the file.
+   The file is closed, and any memory allocated internally is deallocated. */
+ZLINE_EXPORT void ZlineFile_close(ZlineFile zf) {
+  size_t write_len;
+  int pad_size;
+  char pad_buf[7] = {0};
+  u64 current_pos, starts_count, i;
+
+  if (zf->mode == ZLINE_MODE_READ) goto ok;
+
+  assert(zf->write_block);
+  assert(zf->write_block->idx == zf->blocks_size-1);
+  
+  /* check lines_size rather than content_size, because the last
+     block may hold nothing but empty lines */
+  if (zf->write_block->lines_size > 0) {
+    flushBlock(zf);
+  }
+  if (zf->writer) {
+    if (writerDrain(zf)) goto fail;
+    writerStop(zf);
+  }
+  zf->blocks_size--;
+
+  /* block_starts has an entry for each block after the first; if no
+     lines were added there are no blocks */
+  starts_count = zf->blocks_size > 0 ? zf->blocks_size - 1 : 0;
+    
+  current_pos = zf->write_block->offset;
+  
+  /* XXX slow assert */
+  assert((u64)ftell(zf->fp) == current_pos);
+
+  /* the first key of each block goes after the last block */
+  if (zf->has_keys) {
+    assert(zf->fence_count == zf->blocks_size);
+    zf->fence_offset = current_pos;
+    if (writeFences(zf)) goto fail;
+    current_pos += sizeof(u64) * zf->fence_count + zf->fences_size;
+  }
+
+  /* pad the file so the index is 8-byte aligned */
+  pad_size = (~current_pos + 1) & 7;
+  zf->index_offset = current_pos + pad_size;
+  assert(pad_size >= 0 &&
+         pad_size <= 7 &&
+         zf->index_offset % 8 == 0);
+
+  write_len = fwrite(pad_buf, 1, pad_size, zf->fp);
+  if (write_len != (size_t)pad_size) goto fail;
+
+  /* write the index, without the dictionary */
+  ZSTD_freeCDict(zf->cdict);
+  zf->cdict = NULL;
+  if (zf->is_index_compressed) {
+    u64 size_block_array_compressed, size_starts_array_compressed;
+
+    /* fill in the compressed sizes later */
+    if (fseek(zf->fp, sizeof(u64) * 2, SEEK_CUR)) goto fail;
+
+    /* write the block index */
+    size_block_array_compressed = compressToFile
+      (zf, zf->blocks, sizeof(ZlineIndexBlock) * zf->blocks_size);
+
+    /* write the block_starts array */
+    size_starts_array_compressed = compressToFile
+      (zf, zf->block_starts, sizeof(u64) * starts_count);
+
+    /* write the compressed sizes of the arrays */
+    if (fseek(zf->fp, zf->index_offset, SEEK_SET)) goto fail;
+    
+    fwrite(&size_block_array_compressed, sizeof(u64), 1, zf->fp);
+    fwrite(&size_starts_array_compressed, sizeof(u64), 1, zf->fp);
+  }
+
+  /* write uncompressed block index */
+  else {
+    if (zf->blocks_size != fwrite(zf->blocks, sizeof(ZlineIndexBlock),
+                                  zf->blocks_size, zf->fp))
+      goto fail;
+    
+    if (starts_count != fwrite(zf->block_starts, sizeof(u64),
+                               starts_count, zf->fp))
+      goto fail;
+  }
+
+  /* write the header, noting any blocks without a line index */
+  for (i=0; i < zf->blocks_size && !zf->has_fixed_blocks; i++)
+    zf->has_fixed_blocks = isBlockFixedWidth(zf->blocks + i);
+  if (writeHeader(zf)) goto fail;
+
+  /* close the file */
+    goto ok;
+ fail:
+    fprintf(stderr, "Error writing index to \"%s\"\n", zf->filename);
+ ok:
+
+  ZlineFile_deallocate(zf);
+}
+
+
+static void blocksInsureCapacity(ZlineFile zf, u64 capacity) {
+  u64 new_cap;
+  if (!zf->blocks || zf->blocks_capacity < capacity) {
+    new_cap = zf->blocks_capacity * 2;
+    if (new_cap < capacity) new_cap = capacity;
+    zf->blocks = (ZlineIndexBlock*) realloc
+      (zf->blocks, sizeof(ZlineIndexBlock) * new_cap);
+    if (!zf->blocks) goto fail;
+    if (new_cap > 1) {
+      zf->block_starts = (uint64_t*) realloc
+        (zf->block_starts, sizeof(uint64_t) * (new_cap - 1));
+      if (!zf->block_starts) goto fail;
+    }
+    zf->cache.by_index = (ZlineBlock**) realloc
+      (zf->cache.by_index, sizeof(ZlineBlock*) * new_cap);
+    if (!zf->cache.by_index) goto fail;
+    memset(zf->cache.by_index + zf->blocks_capacity, 0,
+           sizeof(ZlineBlock*) * (new_cap - zf->blocks_capacity));
+    zf->blocks_capacity = new_cap;
+  }
+
+  return;
+  
+ fail:
+  fprintf(stderr, "Out of memory allocating block array\n");
+  assert(0);
+}
+
+  
+static void linesInsureCapacity(ZlineBlock *b, int capacity) {
+  int new_cap;
+  if (!b->lines || b->lines_capacity < capacity) {
+    new_cap = b->lines_capacity * 2;
+    if (new_cap < capacity) new_cap = capacity;
+    b->lines = (ZlineIndexLine*) realloc
+      (b->lines, sizeof(ZlineIndexLine) * new_cap);
+    if (!b->lines) {
+      fprintf(stderr, "Out of memory allocating line array\n");
+      assert(0);
+    }
+    b->lines_capacity = new_cap;
+  }
+}
+
+
+static void contentInsureCapacity(ZlineBlock *b, int capacity) {
+  int new_cap;
+  if (!b->content || b->content_capacity < capacity) {
+    new_cap = b->content_capacity * 2;
+    if (new_cap < capacity) new_cap = capacity;
+    b->content = (char*) realloc(b->content, new_cap);
+    if (!b->content) {
+      fprintf(stderr, "Out of memory allocating content array\n");
+      assert(0);
+    }
+    b->content_capacity = new_cap;
+  }
+}
+
+
+static void ZlineFile_deallocate(ZlineFile zf) {
+  ZlineBlock *b, *next;
+  if (!zf) return;
+
+  writerStop(zf);
+  if (zf->compress_stream)
+    ZSTD_freeCStream(zf->compress_stream);
+  if (zf->decompress_stream)
+    ZSTD_freeDStream(zf->decompress_stream);
+  ZSTD_freeCDict(zf->cdict);
+  ZSTD_freeDDict(zf->ddict);
+  if (zf->fp) fclose(zf->fp);
+  freeBlock(zf->write_block);
+
+  /* zf->read_block is one of the blocks in the cache */
+  for (b = zf->cache.head; b; b = next) {
+    next = b->lru_next;
+    freeBlock(b);
+  }
+  free(zf->cache.by_index);
+  freeBlock(zf->index_block);
+  if (!zf->is_index_mapped) {
+    free(zf->blocks);
+    free(zf->block_starts);
+  }
+  if (zf->map) unmapFile(zf->map, zf->map_length);
+  free(zf->line_dir);
+  free(zf->fences);
+  free(zf->fence_ends);
+  free(zf->last_key);
+  free(zf->filename);
+  free(zf);
+}
+
+
+static int flushOutbuf(ZlineFile zf, ZSTD_outBuffer *outbuf,
+                       int64_t *bytes_written) {
+  size_t write_len;
+
+  write_len = fwrite(outbuf->dst, 1, outbuf->pos, zf->fp);
+  if (write_len != outbuf->pos) {
+    fprintf(stderr, "Failed to write to \"%s\"\n", zf->filename);
+    return 1;
+  } else {
+    *bytes_written += write_len;
+    outbuf->pos = 0;
+    return 0;
+  }
+}
+
+
+/* Return the number of compressed bytes written to zf->fp */
+static int64_t compressToFile(ZlineFile zf, const void *input,
+                              int64_t input_len) {
+  unsigned char buf[FILE_BUFFER_SIZE];
+  ZSTD_outBuffer outbuf;
+  ZSTD_inBuffer inbuf;
+  size_t write_len;
+  int64_t bytes_written = 0;
+
+  /* make sure the input data is not larger than a size_t can represent */
+  assert(input_len <= SIZE_MAX);
+  assert(zf->compress_stream);
+
+  if (input_len == 0) return 0;
+
+  inbuf.src = input;
+  inbuf.size = input_len;
+  inbuf.pos = 0;
+
+  outbuf.dst = buf;
+  outbuf.size = sizeof buf;
+  outbuf.pos = 0;
+
+  /* Record the size in the frame header, so a reader can see whether
+     the whole frame fits in its buffer and decode it in one call. */
+  ZSTD_CCtx_reset(zf->compress_stream, ZSTD_reset_session_only);
+  ZSTD_CCtx_setParameter(zf->compress_stream, ZSTD_c_compressionLevel,
+                         ZSTD_COMPRESSION_LEVEL);
+  ZSTD_CCtx_refCDict(zf->compress_stream, zf->cdict);
+  ZSTD_CCtx_setPledgedSrcSize(zf->compress_stream, input_len);
+
+  while (inbuf.pos < inbuf.size) {
+    ZSTD_compressStream(zf->compress_stream, &outbuf, &inbuf);
+
+    /* either the input data has been fully processed or
+       the output buffer is full */
+    assert(inbuf.pos == inbuf.size || outbuf.pos == outbuf.size);
+
+    /* only flush the output buffer if it is full, because the last bit
+       can probably be flushed along with the end-of-stream data. */
+    if (outbuf.pos == outbuf.size)
+      if (flushOutbuf(zf, &outbuf, &bytes_written)) return -1;
+  }
+
+  while (1) {
+    write_len = ZSTD_endStream(zf->compress_stream, &outbuf);
+    if (ZSTD_isError(write_len)) {
+      fprintf(stderr, "Error writing compressed data\n");
+      assert(write_len == 0);
+    }
+    if (write_len == 0) break;
+    if (flushOutbuf(zf, &outbuf, &bytes_written)) return -1;
+  }
+
+  assert(write_len == 0);
+
+  if (outbuf.pos > 0)
+    flushOutbuf(zf, &outbuf, &bytes_written);
+  
+  return bytes_written;
+}
+
+
+static int64_t compressFramesToFile(ZlineFile zf, const char *buf, u64 len) {
+  u64 frame_count = (len + LONG_LINE_FRAME_SIZE - 1) / LONG_LINE_FRAME_SIZE;
+  u64 *table, i, frame_len;
+  int64_t frame_bytes, total = 0;
+
+  /* the frame sizes, then the frame size and count */
+  table = (u64*) malloc(sizeof(u64) * (frame_count + 2));
+  if (!table) return -1;
+
+  for (i=0; i < frame_count; i++) {
+    frame_len = MIN(LONG_LINE_FRAME_SIZE, len - i * LONG_LINE_FRAME_SIZE);
+    frame_bytes = compressToFile(zf, buf + i * LONG_LINE_FRAME_SIZE,
+                                 frame_len);
+    if (frame_bytes < 0) goto fail;
+    table[i] = frame_bytes;
+    total += frame_bytes;
+  }
+  table[frame_count] = LONG_LINE_FRAME_SIZE;
+  table[frame_count + 1] = frame_count;
+
+  if (fwrite(table, sizeof(u64), frame_count + 2, zf->fp) != frame_count + 2)
+    goto fail;
+  total += sizeof(u64) * (frame_count + 2);
+
+  free(table);
+  return total;
+
+ fail:
+  free(table);
+  return -1;
+}
+
+
+static int64_t compressFramesToBuffer(ZSTD_CCtx *cctx,
+                                      const ZSTD_CDict *cdict,
+                                      const char *buf, u64 len, char *out,
+                                      u64 capacity) {
+  u64 frame_count = FRAME_COUNT(len), i, frame_len, pos = 0;
+  u64 *sizes;
+  size_t result;
+
+  sizes = (u64*) malloc(sizeof(u64) * (frame_count + 2));
+  if (!sizes) return -1;
+
+  for (i=0; i < frame_count; i++) {
+    frame_len = MIN(LONG_LINE_FRAME_SIZE, len - i * LONG_LINE_FRAME_SIZE);
+    if (cdict)
+      result = ZSTD_compress_usingCDict(cctx, out + pos, capacity - pos,
+                                        buf + i * LONG_LINE_FRAME_SIZE,
+                                        frame_len, cdict);
+    else
+      result = ZSTD_compressCCtx(cctx, out + pos, capacity - pos,
+                                 buf + i * LONG_LINE_FRAME_SIZE, frame_len,
+                                 ZSTD_COMPRESSION_LEVEL);
+    if (ZSTD_isError(result)) {
+      fprintf(stderr, "Error compressing line: %s\n",
+              ZSTD_getErrorName(result));
+      free(sizes);
+      return -1;
+    }
+    sizes[i] = result;
+    pos += result;
+  }
+  sizes[frame_count] = LONG_LINE_FRAME_SIZE;
+  sizes[frame_count + 1] = frame_count;
+
+  assert(pos + sizeof(u64) * (frame_count + 2) <= capacity);
+  memcpy(out + pos, sizes, sizeof(u64) * (frame_count + 2));
+  pos += sizeof(u64) * (frame_count + 2);
+
+  free(sizes);
+  return pos;
+}
+
+
+/* Read exactly len bytes from the file at the given offset without
+   changing the file position, so this can be called from multiple
+   threads. Returns nonzero on error. */
+static int readFromFile(ZlineFile zf, void *buf, u64 len, u64 offset) {
+  char *p = (char*) buf;
+  int64_t result;
+
+  if (zf->map) {
+    if (offset > zf->map_length || len > zf->map_length - offset) {
+      fprintf(stderr, "Read past the end of \"%s\"\n", zf->filename);
+      return -1;
+    }
+    memcpy(buf, zf->map + offset, len);
+    return 0;
+  }
+
+  while (len > 0) {
+    result = pread(zf->fd, p, len, offset);
+    if (result <= 0) {
+      fprintf(stderr, "Failed to read from \"%s\"\n", zf->filename);
+      return -1;
+    }
+    p += result;
+    len -= result;
+    offset += result;
+  }
+  return 0;
+}
+
+
+/* return # of bytes written to readbuf */
+static int64_t decompressFromFile
+  (ZlineFile zf, ZSTD_DStream *ds, void *readbuf, int64_t readbuf_len,
+   int64_t compressed_len, uint64_t file_offset, uint64_t read_offset,
+   const ZSTD_DDict *ddict) {
+
+  unsigned char buf[FILE_BUFFER_SIZE], junk_buf[FILE_BUFFER_SIZE];
+  ZSTD_outBuffer outbuf, junk, *out;
+  ZSTD_inBuffer inbuf;
+  size_t to_read, result, prev_pos;
+  u64 input_pos = 0, skip_remaining = read_offset;
+
+  /* make sure the input data is not larger than a size_t can represent */
+  assert(compressed_len <= SIZE_MAX);
+  assert(ds);
+
+  if (compressed_len == 0) return 0;
+
+  if (zf->map) {
+    if (file_offset > zf->map_length ||
+        (u64)compressed_len > zf->map_length - file_offset) {
+      fprintf(stderr, "Read past the end of \"%s\"\n", zf->filename);
+      return 0;
+    }
+    return decompressFromMap(zf, ds, readbuf, readbuf_len,
+                             zf->map + file_offset, compressed_len,
+                             read_offset, ddict);
+  }
+
+  inbuf.src = buf;
+  inbuf.size = 0;
+  inbuf.pos = 0;
+
+  outbuf.dst = readbuf;
+  outbuf.size = readbuf_len;
+  outbuf.pos = 0;
+  
+  ZSTD_initDStream(ds);
+  if (ddict) ZSTD_DCtx_refDDict(ds, ddict);
+
+  /* Stop if all compressed data has been read or readbuf is full.
+     The first 'read_offset' bytes are decompressed into junk_buf and
+     discarded. If readbuf fills up before all the content has been
+     decompressed, it's the caller's problem. */
+  while (1) {
+    if (skip_remaining > 0) {
+      junk.dst = junk_buf;
+      junk.size = MIN(sizeof junk_buf, skip_remaining);
+      junk.pos = 0;
+      out = &junk;
+    } else {
+      if (outbuf.pos == outbuf.size) break;
+      out = &outbuf;
+    }
+
+    /* refill the input buffer with compressed data */
+    if (inbuf.pos == inbuf.size && input_pos < (u64)compressed_len) {
+      to_read = MIN(sizeof buf, compressed_len - input_pos);
+      if (readFromFile(zf, buf, to_read, file_offset + input_pos))
+        return 0;
+      input_pos += to_read;
+      inbuf.size = to_read;
+      inbuf.pos = 0;
+    }
+
+    prev_pos = out->pos;
+    result = ZSTD_decompressStream(ds, out, &inbuf);
+    if (ZSTD_isError(result)) {
+      fprintf(stderr, "Error decompressing data from \"%s\"\n",
+              zf->filename);
+      return 0;
+    }
+
+    if (out == &junk) skip_remaining -= junk.pos;
+
+    /* end of the compressed frame */
+    if (result == 0) break;
+
+    /* out of input, and nothing more was decompressed */
+    if (inbuf.pos == inbuf.size && input_pos == (u64)compressed_len &&
+        out->pos == prev_pos)
+      break;
+  }
+
+  return outbuf.pos;
+}
+  
+
+
+/* Open an existing zlines file for reading.
+   Use the result as the 'zf' argument to other functions in this module.
+   Call ZlineFile_close(zf) to close the file.
+*/
+ZLINE_EXPORT ZlineFile ZlineFile_read(const char *filename) {
+  return ZlineFile_read2(filename, 0);
+}
+
+
+/* Like ZlineFile_read, but decompressed blocks will be cached, using
+   up to cache_size bytes of memory. */
+ZLINE_EXPORT ZlineFile ZlineFile_read2(const char *filename,
+                                       uint64_t cache_size) {
+  return openForReading(filename, cache_size, 0);
+}
+
+
+/* Like ZlineFile_read2, but the file is memory-mapped. */
+ZLINE_EXPORT ZlineFile ZlineFile_read_mmap(const char *filename,
+                                           uint64_t cache_size) {
+  return openForReading(filename, cache_size, 1);
+}
+
+
+static ZlineFile openForReading(const char *filename, uint64_t cache_size,
+                                int use_map) {
+  ZlineFile zf = (ZlineFile) calloc(1, sizeof(struct ZlineFile));
+  size_t read_len;
+  u64 file_size;
+  int64_t bytes_read;
+  
+  assert(zf);
+
+  zf->filename = strdup(filename);
+  zf->mode = ZLINE_MODE_READ;
+  zf->cache.max_bytes = cache_size;
+
+  file_size = getFileSize(filename);
+  
+  zf->fp = fopen(filename, "rb");
+  if (!zf->fp) goto fail;
+  zf->fd = fileno(zf->fp);
+
+  zf->decompress_stream = ZSTD_createDStream();
+
+  /* read the header */
+  if (readHeader(zf)) goto fail;
+
+  /* If the file can't be mapped, just read it with pread(). */
+  if (use_map && mapFile(filename, 0, &zf->map, &zf->map_length))
+    zf->map = NULL;
+
+  if (readDictionary(zf) || readFences(zf)) goto fail;
+
+  /* An uncompressed index can be used right where it is in the map. */
+  if (zf->map && !zf->is_index_compressed && zf->blocks_size > 0) {
+    u64 index_len = sizeof(ZlineIndexBlock) * zf->blocks_size
+      + sizeof(u64) * (zf->blocks_size - 1);
+    if (zf->index_offset % 8 != 0 ||
+        zf->index_offset > zf->map_length ||
+        index_len > zf->map_length - zf->index_offset) {
+      fprintf(stderr, "Error in index size\n");
+      goto fail;
+    }
+
+    zf->blocks = (ZlineIndexBlock*) (zf->map + zf->index_offset);
+    zf->block_starts = (u64*) (zf->blocks + zf->blocks_size);
+    zf->blocks_capacity = zf->blocks_size;
+    zf->is_index_mapped = 1;
+
+    zf->cache.by_index = (ZlineBlock**)
+      calloc(zf->blocks_size, sizeof(ZlineBlock*));
+    if (!zf->cache.by_index) goto fail;
+
+    if (buildLineDirectory(zf)) goto fail;
+    return zf;
+  }
+
+  /* allocate space for the index */
+  blocksInsureCapacity(zf, zf->blocks_size);
+
+  /* read the index */
+
+  if (zf->is_index_compressed) {
+    /* [0]: block array, [1]: line array */
+    u64 compressed_sizes[2];
+
+    if (readFromFile(zf, compressed_sizes, sizeof compressed_sizes,
+                     zf->index_offset))
+      goto fail;
+
+    if (zf->index_offset + compressed_sizes[0] >= file_size ||
+        zf->index_offset + compressed_sizes[1] >= file_size ||
+        zf->index_offset + compressed_sizes[0] + compressed_sizes[1]
+        + 2*sizeof(u64) != file_size) {
+      fprintf(stderr, "Error in compressed index size\n");
+      goto fail;
+    }
+
+    /* read the compressed block index */
+    bytes_read = decompressFromFile
+      (zf, zf->decompress_stream,
+       zf->blocks, zf->blocks_size * sizeof(ZlineIndexBlock),
+       compressed_sizes[0], zf->index_offset + sizeof compressed_sizes, 0,
+       NULL);
+    if (bytes_read != zf->blocks_size * sizeof(ZlineIndexBlock))
+      goto fail;
+
+    /* read the compressed line starts */
+    bytes_read = decompressFromFile
+      (zf, zf->decompress_stream,
+       zf->block_starts, (zf->blocks_size-1) * sizeof(u64),
+       compressed_sizes[1],
+       zf->index_offset + sizeof compressed_sizes + compressed_sizes[0], 0,
+       NULL);
+    if (bytes_read != (zf->blocks_size-1) * sizeof(u64))
+      goto fail;
+  }
+
+  /* read uncompressed index */
+  else {
+    read_len = sizeof(ZlineIndexBlock) * zf->blocks_size;
+    if (readFromFile(zf, zf->blocks, read_len, zf->index_offset))
+      goto fail;
+
+    if (readFromFile(zf, zf->block_starts, sizeof(u64) * (zf->blocks_size-1),
+                     zf->index_offset + read_len))
+      goto fail;
+  }
+
+  if (buildLineDirectory(zf)) goto fail;
+  return zf;
+
+ fail:
+  ZlineFile_deallocate(zf);
+
+  return NULL;
+}
+
+
+static int readDictionary(ZlineFile zf) {
+  char *dict;
+
+  if (zf->dict_size == 0) return 0;
+
+  if (zf->data_offset < HEADER_SIZE ||
+      zf->dict_size > zf->data_offset - HEADER_SIZE) {
+    fprintf(stderr, "Invalid dictionary size in \"%s\"\n", zf->filename);
+    return -1;
+  }
+
+  dict = (char*) malloc(zf->dict_size);
+  if (!dict) return -1;
+  if (!readFromFile(zf, dict, zf->dict_size, HEADER_SIZE))
+    zf->ddict = ZSTD_createDDict(dict, zf->dict_size);
+  free(dict);
+
+  return zf->ddict ? 0 : -1;
+}
+
+
+static int64_t decompressFromMap
+  (ZlineFile zf, ZSTD_DStream *ds, void *readbuf, int64_t readbuf_len,
+   const char *src, int64_t compressed_len, uint64_t read_offset,
+   const ZSTD_DDict *ddict) {
+
+  unsigned char junk_buf[FILE_BUFFER_SIZE];
+  ZSTD_outBuffer outbuf, junk;
+  ZSTD_inBuffer inbuf;
+  size_t result;
+  unsigned long long frame_len;
+
+  /* If the whole frame fits in readbuf, decode it in one call straight
+     from the mapped data. Frames written by older versions may not
+     record their size; for those try anyway and fall back to streaming
+     if readbuf turns out to be too small. */
+  if (read_offset == 0) {
+    frame_len = ZSTD_getFrameContentSize(src, compressed_len);
+    if (frame_len == ZSTD_CONTENTSIZE_UNKNOWN ||
+        (frame_len != ZSTD_CONTENTSIZE_ERROR &&
+         frame_len <= (unsigned long long)readbuf_len)) {
+      if (ddict)
+        result = ZSTD_decompress_usingDDict(ds, readbuf, readbuf_len,
+                                            src, compressed_len, ddict);
+      else
+        result = ZSTD_decompressDCtx(ds, readbuf, readbuf_len,
+                                     src, compressed_len);
+      if (!ZSTD_isError(result)) return result;
+      if (ZSTD_getErrorCode(result) != ZSTD_error_dstSize_tooSmall) {
+        fprintf(stderr, "Error decompressing data from \"%s\"\n",
+                zf->filename);
+        return 0;
+      }
+    }
+  }
+
+  /* Only part of the frame is wanted. Stream it, discarding the first
+     read_offset bytes, and stop when readbuf is full. */
+  inbuf.src = src;
+  inbuf.size = compressed_len;
+  inbuf.pos = 0;
+
+  outbuf.dst = readbuf;
+  outbuf.size = readbuf_len;
+  outbuf.pos = 0;
+
+  ZSTD_initDStream(ds);
+  if (ddict) ZSTD_DCtx_refDDict(ds, ddict);
+
+  while (read_offset > 0) {
+    junk.dst = junk_buf;
+    junk.size = MIN(sizeof junk_buf, read_offset);
+    junk.pos = 0;
+    result = ZSTD_decompressStream(ds, &junk, &inbuf);
+    if (ZSTD_isError(result) || junk.pos == 0) goto fail;
+    read_offset -= junk.pos;
+  }
+
+  while (outbuf.pos < outbuf.size) {
+    size_t prev_pos = outbuf.pos;
+    result = ZSTD_decompressStream(ds, &outbuf, &inbuf);
+    if (ZSTD_isError(result)) goto fail;
+    if (result == 0 || outbuf.pos == prev_pos) break;
+  }
+
+  return outbuf.pos;
+
+ fail:
+  fprintf(stderr, "Error decompressing data from \"%s\"\n", zf->filename);
+  return 0;
+}
+
+
+/* Returns the number of lines in the file. */
+ZLINE_EXPORT uint64_t ZlineFile_line_count(ZlineFile zf) {
+  return zf->line_count;
+}
+
+
+/* Returns the length of the given line or -1 if there is no such line. */
+ZLINE_EXPORT int64_t ZlineFile_line_length(ZlineFile zf, uint64_t line_idx) {
+  ZlineIndexLine *line;
+  
+  if (line_idx >= zf->line_count)
+    return -1;
+
+  if (zf->min_line_len == zf->max_line_len)
+    return zf->max_line_len;
+
+  line = loadLineIndex(zf, line_idx);
+  return line ? (int64_t) line->length : -1;
+}
+
+
+ZLINE_EXPORT int ZlineFile_line_lengths(ZlineFile zf, uint64_t first_line,
+                                        uint64_t count, uint64_t *lengths) {
+  ZlineIndexLine *line;
+  u64 i, n, block_idx, block_end;
+
+  if (first_line > zf->line_count || count > zf->line_count - first_line)
+    return -1;
+
+  if (zf->min_line_len == zf->max_line_len) {
+    for (i=0; i < count; i++)
+      lengths[i] = zf->max_line_len;
+    return 0;
+  }
+
+  while (count > 0) {
+    line = loadLineIndex(zf, first_line);
+    if (!line) return -1;
+
+    /* copy every requested line in this block */
+    block_idx = getLineBlock(zf, first_line);
+    block_end = block_idx + 1 < zf->blocks_size
+      ? zf->block_starts[block_idx] : zf->line_count;
+    n = block_end - first_line;
+    if (n > count) n = count;
+    for (i=0; i < n; i++)
+      lengths[i] = line[i].length;
+
+    lengths += n;
+    first_line += n;
+    count -= n;
+  }
+
+  return 0;
+}
+
+
+/* Returns the length of the longest line. */
+ZLINE_EXPORT uint64_t ZlineFile_max_line_length(ZlineFile zf) {
+  return zf->max_line_len;
+}
+
+
+ZLINE_EXPORT uint64_t ZlineFile_min_line_length(ZlineFile zf) {
+  return zf->line_count ? zf->min_line_len : 0;
+}
+
+
+/* returns the index of the block containing this line */
+static u64 getLineBlock(ZlineFile zf, u64 line_idx) {
+  u64 lo = 0, hi = zf->blocks_size - 1, mid, j;
+
+  if (zf->blocks_size <= 1) return 0;
+
+  if (zf->lines_per_block) {
+    j = line_idx / zf->lines_per_block;
+    return MIN(j, zf->blocks_size - 1);
+  }
+
+  /* narrow the search to the blocks between two directory entries */
+  if (zf->line_dir) {
+    j = line_idx >> zf->line_dir_shift;
+    if (j + 1 < zf->line_dir_size) {
+      lo = zf->line_dir[j];
+      hi = zf->line_dir[j+1];
+    }
+  }
+
+  /* find the first block whose successor starts after line_idx */
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    if (line_idx < zf->block_starts[mid])
+      hi = mid;
+    else
+      lo = mid + 1;
+  }
+
+  return lo;
+}
+
+
+static int buildLineDirectory(ZlineFile zf) {
+  u64 j, block = 0, last_block = zf->blocks_size - 1;
+  int shift = 0;
+
+  /* if every block but the last has as many lines as the first, the
+     directory isn't needed */
+  if (zf->blocks_size > 1) {
+    for (j=1; j < last_block &&
+           zf->block_starts[j] == (j+1) * zf->block_starts[0]; j++) ;
+    if (j == last_block) {
+      zf->lines_per_block = zf->block_starts[0];
+      return 0;
+    }
+  }
+
+  if (zf->blocks_size < LINE_DIR_MIN_BLOCKS) return 0;
+
+  /* about one entry per block */
+  while ((zf->line_count >> shift) > zf->blocks_size) shift++;
+
+  /* one more entry than needed, so every line has a j+1 entry */
+  zf->line_dir_size = ((zf->line_count - 1) >> shift) + 2;
+  zf->line_dir = (u64*) malloc(sizeof(u64) * zf->line_dir_size);
+  if (!zf->line_dir) {
+    fprintf(stderr, "Out of memory\n");
+    return -1;
+  }
+  zf->line_dir_shift = shift;
+
+  for (j=0; j < zf->line_dir_size; j++) {
+    u64 line = j << shift;
+    while (block < last_block && zf->block_starts[block] <= line) block++;
+    zf->line_dir[j] = block;
+  }
+
+  return 0;
+}
+
+
+/* Make sure a line is in memory.
+   Set *block to the either zf->write_block or the cached block
+   that contains the line.
+   Set *line to point to the record of its offset and length.
+   If the line isn't in memory, the block containing it will
+   be loaded into the cache, and it will become zf->read_block.
+   Returns nonzero on error.
+*/
+static int loadLine(ZlineFile zf, u64 line_idx, ZlineIndexLine **line,
+                    ZlineBlock **block) {
+  ZlineBlock *b;
+
+  /* check if the line is in the write block */
+  if (zf->mode == ZLINE_MODE_CREATE) {
+    *line = lineInBlock(zf->write_block, line_idx);
+    if (*line) {
+      *block = zf->write_block;
+      return 0;
+    }
+
+    /* the line is in a block that may still be queued for writing */
+    if (zf->writer && writerDrain(zf)) return -1;
+  }
+
+  /* check if it's in the most recently used block */
+  *line = lineInBlock(zf->read_block, line_idx);
+  if (*line) {
+    zf->cache.hits++;
+    *block = zf->read_block;
+    return 0;
+  }
+
+  /* find the block containing the line in the cache, or load it */
+  b = getBlock(zf, getLineBlock(zf, line_idx));
+  if (!b) {
+    *line = NULL;
+    *block = NULL;
+    return -1;
+  }
+  *line = lineInBlock(b, line_idx);
+  assert(*line);
+  *block = b;
+
+  return 0;
+}
+
+
+ZLINE_EXPORT int ZlineFile_get_line_details
+  (ZlineFile zf, uint64_t line_idx, uint64_t *length,
+   uint64_t *offset, uint64_t *block_idx) {
+  ZlineIndexLine *line;
+
+  if (line_idx >= zf->line_count) return -1;
+  
+  *block_idx = getLineBlock(zf, line_idx);
+  line = loadLineIndex(zf, line_idx);
+  if (!line) return -1;
+  *length = line->length;
+  *offset = line->offset;
+  return 0;
+}
+
+
+static ZlineIndexLine *loadLineIndex(ZlineFile zf, u64 line_idx) {
+  ZlineIndexLine *line;
+  ZlineBlock *b;
+  u64 block_idx;
+
+  if (zf->mode == ZLINE_MODE_CREATE) {
+    line = lineInBlock(zf->write_block, line_idx);
+    if (line) return line;
+    if (zf->writer && writerDrain(zf)) return NULL;
+  }
+
+  line = lineInBlock(zf->read_block, line_idx);
+  if (line) return line;
+
+  block_idx = getLineBlock(zf, line_idx);
+  b = zf->cache.by_index[block_idx];
+  if (!b) {
+    b = zf->index_block;
+    if (!lineInBlock(b, line_idx)) {
+      if (!b) {
+        b = zf->index_block = createBlock(0, 0);
+        if (!b) return NULL;
+      }
+      if (!zf->decompress_stream)
+        zf->decompress_stream = ZSTD_createDStream();
+      if (readBlockIndex(zf, zf->decompress_stream, block_idx, b)) {
+        b->lines_size = 0;
+        return NULL;
+      }
+    }
+  }
+
+  return lineInBlock(b, line_idx);
+}
+
+
+static ZlineIndexLine* lineInBlock(ZlineBlock *block, u64 line_idx) {
+  if (block &&
+      block->lines_size > 0 &&
+      line_idx >= block->first_line &&
+      line_idx < block->first_line + block->lines_size)
+    return block->lines + (line_idx - block->first_line);
+  else
+    return NULL;
+}
+
+
+static u64 blockMemorySize(ZlineBlock *b) {
+  return b->content_capacity + sizeof(ZlineIndexLine) * b->lines_capacity;
+}
+
+
+static void cacheInsert(ZlineBlockCache *cache, ZlineBlock *b) {
+  b->lru_prev = NULL;
+  b->lru_next = cache->head;
+  if (cache->head)
+    cache->head->lru_prev = b;
+  else
+    cache->tail = b;
+  cache->head = b;
+  cache->count++;
+  cache->bytes_used += blockMemorySize(b);
+  cache->by_index[b->idx] = b;
+}
+
+
+static void cacheRemove(ZlineBlockCache *cache, ZlineBlock *b) {
+  if (b->lru_prev)
+    b->lru_prev->lru_next = b->lru_next;
+  else
+    cache->head = b->lru_next;
+  if (b->lru_next)
+    b->lru_next->lru_prev = b->lru_prev;
+  else
+    cache->tail = b->lru_prev;
+  b->lru_prev = b->lru_next = NULL;
+  cache->count--;
+  cache->bytes_used -= blockMemorySize(b);
+  cache->by_index[b->idx] = NULL;
+}
+
+
+/* Return the cached copy of a block, reading it from the file if it is
+   not in the cache. The result becomes zf->read_block.
+
+   Least-recently-used blocks are evicted until the new block fits in
+   the memory budget. The cache always keeps at least one block, so with
+   a budget of 0 this behaves like a single read buffer.
+
+   Returns NULL on error.
+*/
+static ZlineBlock *getBlock(ZlineFile zf, u64 block_idx) {
+  ZlineBlockCache *cache = &zf->cache;
+  ZlineBlock *b = NULL, *victim;
+  u64 needed;
+
+  assert(block_idx < zf->blocks_size);
+
+  /* check if we already have this block decompressed */
+  if (cache->by_index[block_idx]) {
+    b = cache->by_index[block_idx];
+    cache->hits++;
+    if (b != cache->head) {
+      cacheRemove(cache, b);
+      cacheInsert(cache, b);
+    }
+    zf->read_block = b;
+    return b;
+  }
+
+  cache->misses++;
+
+  /* Evict blocks until this one fits. Reuse the first evicted block
+     rather than allocating a new one. Blocks pinned by views are
+     skipped. */
+  needed = zf->blocks[block_idx].decompressed_length +
+    sizeof(ZlineIndexLine) * ZlineFile_get_block_line_count(zf, block_idx);
+  victim = cache->tail;
+  while (victim && cache->bytes_used + needed > cache->max_bytes) {
+    ZlineBlock *prev = victim->lru_prev;
+    if (victim->pin_count == 0) {
+      cacheRemove(cache, victim);
+      if (victim == zf->read_block) zf->read_block = NULL;
+      if (b)
+        freeBlock(victim);
+      else
+        b = victim;
+    }
+    victim = prev;
+  }
+
+  if (!b) b = createBlock(0, 0);
+
+  if (!zf->decompress_stream)
+    zf->decompress_stream = ZSTD_createDStream();
+
+  if (readBlock(zf, zf->decompress_stream, block_idx, b)) {
+    freeBlock(b);
+    return NULL;
+  }
+
+  cacheInsert(cache, b);
+  zf->read_block = b;
+  return b;
+}
+
+
+/* Read a block, store the decompressed result in b.
+   Return nonzero on error. 
+   If the data is larger than a normal block, just read the line index.
+*/
+static int readBlock(ZlineFile zf, ZSTD_DStream *ds, u64 block_idx,
+                     ZlineBlock *b) {
+  if (readBlockIndex(zf, ds, block_idx, b)) return 1;
+
+  /* If the block is small enough, decompress it all into memory now.
+     If it's large, don't load the content into memory, unless it was
+     packed with a codec: reading any part of that means decompressing
+     all of it, so it's better done once. */
+  if (b->lines_size == 1 &&
+      zf->blocks[block_idx].decompressed_length > MAX_IN_MEMORY_BLOCK &&
+      getBlockCodec(zf->blocks + block_idx) == ZLINE_CODEC_NONE) {
+    b->content_size = 0;
+    return 0;
+  }
+
+  return readBlockContent(zf, ds, b);
+}
+
+
+static int readBlockContent(ZlineFile zf, ZSTD_DStream *ds, ZlineBlock *b) {
+  ZlineIndexBlock *block = zf->blocks + b->idx;
+  int64_t bytes_read;
+
+  contentInsureCapacity(b, block->decompressed_length);
+
+  /* Read compressed content */
+  b->content_size = block->decompressed_length;
+  bytes_read = decompressContent(zf, ds, b, b->content, b->content_size, 0);
+  if (bytes_read != b->content_size) {
+    fprintf(stderr, "Failed to read block %" PRIi64 "\n", b->idx);
+    b->idx = -1;
+    b->lines_size = 0;
+    b->content_size = 0;
+    return 1;
+  }
+
+  return 0;
+}
+
+
+static int readBlockIndex(ZlineFile zf, ZSTD_DStream *ds, u64 block_idx,
+                          ZlineBlock *b) {
+  ZlineIndexBlock *block;
+  int block_line_count, err;
+  int64_t line_bytes, bytes_read;
+
+  assert(block_idx < zf->blocks_size);
+
+  /* when writing, make sure everything written is visible to pread() */
+  if (zf->mode == ZLINE_MODE_CREATE)
+    fflush(zf->fp);
+
+  block = zf->blocks + block_idx;
+  b->content_size = 0;
+
+  /* compute the number of lines in this block */
+  block_line_count = ZlineFile_get_block_line_count(zf, block_idx);
+
+  /* make sure the line array is big enough */
+  linesInsureCapacity(b, block_line_count);
+
+  b->idx = block_idx;
+  b->offset = block->offset;
+  b->first_line = (block_idx == 0) ? 0 : zf->block_starts[block_idx-1];
+
+  b->lines_size = block_line_count;
+
+  /* the lines split the content evenly, and there's nothing to read */
+  if (isBlockFixedWidth(block)) {
+    u64 width, i;
+    if (block_line_count == 0) goto fail;
+    width = block->decompressed_length / block_line_count;
+    if (width * block_line_count != block->decompressed_length) goto fail;
+    for (i=0; i < (u64)block_line_count; i++) {
+      b->lines[i].offset = i * width;
+      b->lines[i].length = width;
+    }
+    b->line_index_size = 0;
+    return 0;
+  }
+
+  if (zf->version_minor >= 1) {
+    u64 index_len, max_len = LINE_INDEX_BOUND(block_line_count);
+    char *index_buf;
+
+    if (readFromFile(zf, &index_len, sizeof index_len, block->offset))
+      goto fail;
+    b->line_index_size = sizeof index_len + index_len;
+
+    /* Decode the lengths in a buffer of their own rather than in
+       b->content. The content buffer is only as big as the content,
+       which is what the block cache counts, and the encoded index of
+       many short lines can be bigger. */
+    index_buf = (char*) malloc(max_len);
+    if (!index_buf) goto fail;
+    if (isBlockLineIndexCompressed(block)) {
+      bytes_read = decompressFromFile
+        (zf, ds, index_buf, max_len, index_len,
+         block->offset + sizeof index_len, 0, NULL);
+    } else if (index_len > max_len ||
+               readFromFile(zf, index_buf, index_len,
+                            block->offset + sizeof index_len)) {
+      bytes_read = -1;
+    } else {
+      bytes_read = index_len;
+    }
+
+    err = bytes_read < 0 ||
+      decodeLineIndex(b, index_buf, bytes_read, block->decompressed_length);
+    free(index_buf);
+    if (err) goto fail;
+    return 0;
+  }
+
+  line_bytes = b->lines_size * sizeof(ZlineIndexLine);
+
+  /* Read line index */
+  if (isBlockLineIndexCompressed(block)) {
+    uint64_t compressed_index_len;
+    if (readFromFile(zf, &compressed_index_len, sizeof compressed_index_len,
+                     block->offset))
+      goto fail;
+
+    b->line_index_size = sizeof compressed_index_len + compressed_index_len;
+
+    bytes_read = decompressFromFile
+      (zf, ds, b->lines, line_bytes, compressed_index_len,
+       block->offset + sizeof compressed_index_len, 0, NULL);
+  } else {
+    b->line_index_size = line_bytes;
+    bytes_read = readFromFile(zf, b->lines, line_bytes, block->offset)
+      ? 0 : line_bytes;
+  }
+  if (bytes_read != line_bytes)
+    goto fail;
+
+  return 0;
+
+fail:
+  fprintf(stderr, "Failed to read block %" PRIu64 "\n", block_idx);
+  b->idx = -1;
+  b->lines_size = 0;
+  return 1;
+}
+
+
+/* Reads a line from the file and returns it as a string.
+   The result has been allocated with malloc(); the caller is responsible
+   for deallocating it with free().
+
+   If line_idx is invalid, a memory allocation failed, or an error was
+   encountered reading the file, this will return NULL.
+*/
+ZLINE_EXPORT char *ZlineFile_get_line(ZlineFile zf, uint64_t line_idx) {
+  int64_t len = ZlineFile_line_length(zf, line_idx);
+  char *buf, *result;
+
+  if (len < 0) return NULL;
+  
+  buf = (char*) malloc(len + 1);
+  if (buf == NULL) {
+    fprintf(stderr, "Out of memory reading line %" PRIu64 " containing %"
+            PRIi64 " bytes\n", line_idx, len);
+    return NULL;
+  }
+  
+  result = ZlineFile_get_line2(zf, line_idx, buf, len+1, 0);
+
+  if (result == NULL)
+    free(buf);
+
+  return result;
+}
+
+
+/* Like ZlineFile_get_line, but rather than copying the whole line, it
+   copies part of line starting 'offset' bytes from its beginning.
+
+   The results are written to 'buf', including a nul terminating
+   byte. If the results are longer than buf_len bytes, only the first
+   'buf_len'-1 bytes and a nul terminator are copied to 'buf'.
+
+   If 'offset' is past the end of the string, a zero-length string
+   is returned.
+
+   Returns NULL on error, otherwise it returns 'buf'.
+*/
+ZLINE_EXPORT char *ZlineFile_get_line2
+  (ZlineFile zf, uint64_t line_idx,
+   char *buf, uint64_t buf_len, uint64_t offset) {
+  
+  ZlineIndexLine *line;
+  ZlineBlock *block;
+
+  assert(zf);
+
+  if (line_idx >= zf->line_count) return NULL;
+
+  /* Load the block containing this line, either into write_block
+     or the block cache. */
+  if (loadLine(zf, line_idx, &line, &block)) return NULL;
+
+  if (copyLine(zf, zf->decompress_stream, block, line, buf, buf_len, offset))
+    return NULL;
+
+  return buf;
+}
+
+
+/* Copy up to buf_len-1 bytes of a line, starting 'offset' bytes from
+   its beginning, to buf, and add a nul terminator.
+   Returns nonzero on error. */
+static int copyLine(ZlineFile zf, ZSTD_DStream *ds, ZlineBlock *block,
+                    ZlineIndexLine *line, char *buf, u64 buf_len,
+                    u64 offset) {
+  int64_t copy_len = 0;
+
+  if (line->length > 0 && offset < line->length) {
+    
+    copy_len = MIN(line->length - offset, buf_len-1);
+
+    /* If the line was loaded into memory, copy it to the result buffer */
+    if (block->content_size > 0) {
+      memcpy(buf, block->content + line->offset + offset, copy_len);
+    }
+
+    /* if the line was long, loadLine will leave it on disk. Decompress
+       it straight to the buffer. */
+    else {
+      i64 decompressed_len;
+      assert(block->lines_size == 1);
+      assert(zf->blocks_size > block->idx);
+      assert(zf->blocks[block->idx].offset == block->offset);
+      assert(!isBlockLineIndexCompressed(zf->blocks + block->idx));
+      
+      decompressed_len = decompressContent(zf, ds, block, buf, copy_len,
+                                           offset);
+      if (decompressed_len != (i64)copy_len) {
+        fprintf(stderr, "Failed to decompress line %" PRIu64 " from file\n",
+                block->first_line);
+        return -1;
+      }
+    }
+  }
+
+  buf[copy_len] = 0;
+  return 0;
+}
+              
+
+static int64_t decompressContent(ZlineFile zf, ZSTD_DStream *ds,
+                                 ZlineBlock *b, char *buf, u64 len,
+                                 u64 offset) {
+  ZlineIndexBlock *block = zf->blocks + b->idx;
+  u64 content_offset = block->offset + b->line_index_size;
+  u64 compressed_len = getBlockCompressedLen(block);
+  u64 trailer[2], frame_count, i;
+  ZlineFrameJob job;
+  Thread *threads = NULL;
+  int thread_count, started;
+
+  if (getBlockCodec(block) != ZLINE_CODEC_NONE)
+    return decompressPacked(zf, ds, b, content_offset, buf, len, offset);
+
+  if (!isBlockContentFramed(block))
+    return decompressFromFile(zf, ds, buf, len, compressed_len,
+                              content_offset, offset, zf->ddict);
+
+  if (len == 0) return 0;
+
+  /* read the seek table from the end of the content */
+  if (compressed_len < sizeof trailer ||
+      readFromFile(zf, trailer, sizeof trailer,
+                   content_offset + compressed_len - sizeof trailer))
+    return 0;
+  frame_count = trailer[1];
+  if (trailer[0] == 0 ||
+      frame_count != (block->decompressed_length + trailer[0] - 1) / trailer[0]
+      || (compressed_len - sizeof trailer) / sizeof(u64) < frame_count)
+    return 0;
+
+  memset(&job, 0, sizeof job);
+  job.zf = zf;
+  job.frame_size = trailer[0];
+  job.line_length = block->decompressed_length;
+  job.buf = buf;
+  job.first_byte = offset;
+  job.end_byte = offset + len;
+  job.next_frame = offset / job.frame_size;
+  job.end_frame = (offset + len - 1) / job.frame_size + 1;
+
+  /* turn the compressed frame sizes into their offsets in the file */
+  job.frame_offsets = (u64*) malloc(sizeof(u64) * (frame_count + 1));
+  if (!job.frame_offsets) return 0;
+  if (readFromFile(zf, job.frame_offsets + 1, sizeof(u64) * frame_count,
+                   content_offset + compressed_len - sizeof trailer
+                   - sizeof(u64) * frame_count)) {
+    free(job.frame_offsets);
+    return 0;
+  }
+  job.frame_offsets[0] = content_offset;
+  for (i=1; i <= frame_count; i++)
+    job.frame_offsets[i] += job.frame_offsets[i-1];
+
+  /* decode the frames in parallel if there are several of them */
+  thread_count = MAX(zf->reader_thread_count, 1);
+  if ((u64)thread_count > job.end_frame - job.next_frame)
+    thread_count = job.end_frame - job.next_frame;
+  if (thread_count > 1) {
+    threads = (Thread*) malloc(sizeof(Thread) * (thread_count - 1));
+    if (!threads) thread_count = 1;
+  }
+
+  job.ds = ds;
+  mutexInit(&job.lock);
+  for (started = 0; started < thread_count - 1; started++)
+    if (threadStart(&threads[started], frameThreadFn, &job)) break;
+  frameThreadFn(&job);
+  while (started > 0)
+    threadJoin(threads[--started]);
+  mutexDestroy(&job.lock);
+
+  free(threads);
+  free(job.frame_offsets);
+  return job.is_error ? 0 : (int64_t) len;
+}
+
+
+static void *frameThreadFn(void *arg) {
+  ZlineFrameJob *job = (ZlineFrameJob*) arg;
+  ZSTD_DStream *ds;
+  u64 frame, frame_start, start, end;
+  int64_t want;
+  int err = 0, own_ds;
+
+  /* the first thread to get here uses the caller's stream */
+  mutexLock(&job->lock);
+  ds = job->ds;
+  job->ds = NULL;
+  mutexUnlock(&job->lock);
+  own_ds = !ds;
+  if (own_ds) {
+    ds = ZSTD_createDStream();
+    if (!ds) err = 1;
+  }
+
+  while (!err) {
+    mutexLock(&job->lock);
+    frame = job->next_frame++;
+    err = job->is_error;
+    mutexUnlock(&job->lock);
+    if (err || frame >= job->end_frame) break;
+
+    /* the part of this frame that is in the requested range */
+    frame_start = frame * job->frame_size;
+    start = MAX(frame_start, job->first_byte);
+    end = MIN(MIN(frame_start + job->frame_size, job->line_length),
+              job->end_byte);
+    want = end - start;
+
+    if (want != decompressFromFile
+        (job->zf, ds, job->buf + (start - job->first_byte), want,
+         job->frame_offsets[frame+1] - job->frame_offsets[frame],
+         job->frame_offsets[frame], start - frame_start, job->zf->ddict))
+      err = 1;
+  }
+
+  if (err) {
+    mutexLock(&job->lock);
+    job->is_error = 1;
+    mutexUnlock(&job->lock);
+  }
+  if (own_ds && ds) ZSTD_freeDStream(ds);
+
+  return NULL;
+}
+
+
+static int64_t decompressPacked(ZlineFile zf, ZSTD_DStream *ds,
+                                ZlineBlock *b, u64 content_offset,
+                                char *buf, u64 len, u64 offset) {
+  ZlineIndexBlock *block = zf->blocks + b->idx;
+  u64 content_len = block->decompressed_length;
+  int64_t packed_len;
+  char *packed;
+  int err;
+
+  if (offset > content_len || len > content_len - offset) return 0;
+
+  packed = (char*) malloc(PACKED_BOUND(content_len));
+  if (!packed) return 0;
+  packed_len = decompressFromFile(zf, ds, packed, PACKED_BOUND(content_len),
+                                  getBlockCompressedLen(block),
+                                  content_offset, 0, zf->ddict);
+  if (packed_len <= 0)
+    err = 1;
+  else if (getBlockCodec(block) == ZLINE_CODEC_NT2)
+    err = unpackNt2(packed, packed_len, content_len, offset, offset + len,
+                    buf);
+  else if (getBlockCodec(block) == ZLINE_CODEC_REF)
+    err = unpackRef(packed, packed_len, b, offset, offset + len, buf);
+  else
+    err = 1;
+  if (err) {
+    fprintf(stderr, "Invalid packed content in block %" PRIu64 "\n",
+            (u64)(block - zf->blocks));
+    len = 0;
+  }
+
+  free(packed);
+  return len;
+}
+
+
+/* Returns the number of compressed blocks in the file.
+   If the file is open in write mode, this may under-report the block
+   count by one. */
+ZLINE_EXPORT uint64_t ZlineFile_get_block_count(ZlineFile zf) {
+  assert(zf);
+  return zf->blocks_size;
+}
+
+
+/* Fetches the decompressed size of the given block.
+   If block_idx is invalid, returns 0. */
+ZLINE_EXPORT uint64_t ZlineFile_get_block_size_original
+(ZlineFile zf, uint64_t block_idx) {
+  assert(zf);
+  if (block_idx >= zf->blocks_size) return 0;
+  return zf->blocks[block_idx].decompressed_length;
+}
+
+
+/* Fetches the compressed size of the given block.
+   If block_idx is invalid, returns 0. */
+ZLINE_EXPORT uint64_t ZlineFile_get_block_size_compressed
+(ZlineFile zf, uint64_t block_idx) {
+  assert(zf);
+  if (block_idx >= zf->blocks_size) return 0;
+  return getBlockCompressedLen(zf->blocks + block_idx);
+}
+
+
+/* Returns the index of the first line in the block.
+   If block_idx is invalid, returns 0. */
+ZLINE_EXPORT uint64_t ZlineFile_get_block_first_line
+(ZlineFile zf, uint64_t block_idx) {
+  assert(zf);
+  if (block_idx >= zf->blocks_size) return 0;
+
+  if (block_idx == 0)
+    return 0;
+  else
+    return zf->block_starts[block_idx - 1];
+}
+
+
+/* Returns the number of lines stored in the block.
+   If block_idx is invalid, returns 0. */
+ZLINE_EXPORT uint64_t ZlineFile_get_block_line_count
+(ZlineFile zf, uint64_t block_idx) {
+  u64 block_start, block_end;
+
+  assert(zf);
+  if (block_idx >= zf->blocks_size) return 0;
+
+  block_start = (block_idx == 0)
+    ? 0
+    : zf->block_starts[block_idx-1];
+  block_end = (block_idx == zf->blocks_size-1)
+    ? zf->line_count
+    : zf->block_starts[block_idx];
+
+  return block_end - block_start;
+}
+
+
+/* Returns the index of the block containing a line, or -1 if line_idx
+   is invalid. */
+ZLINE_EXPORT int64_t ZlineFile_get_line_block
+(ZlineFile zf, uint64_t line_idx) {
+  assert(zf);
+  if (line_idx >= zf->line_count) return -1;
+  return getLineBlock(zf, line_idx);
+}
+
+
+ZLINE_EXPORT uint64_t ZlineFile_get_block_offset
+  (ZlineFile zf, uint64_t block_idx) {
+  if (block_idx >= zf->blocks_size) return 0;
+  return zf->blocks[block_idx].offset;
+}
+
+
+/* Return the offset in the file where the block index starts */
+ZLINE_EXPORT uint64_t ZlineFile_get_block_index_offset(ZlineFile zf) {
+  return zf->index_offset;
+}
+
+
+/* Returns the number of block lookups that were satisfied from the
+   cache of decompressed blocks, and the number that required reading
+   and decompressing a block. Either pointer may be NULL. */
+ZLINE_EXPORT void ZlineFile_get_cache_stats
+  (ZlineFile zf, uint64_t *hits, uint64_t *misses) {
+  if (hits) *hits = zf->cache.hits;
+  if (misses) *misses = zf->cache.misses;
+}
+
+
+ZLINE_EXPORT ZlineCursor ZlineCursor_create(ZlineFile zf) {
+  ZlineCursor cursor;
+
+  if (!zf || zf->mode != ZLINE_MODE_READ) return NULL;
+
+  cursor = (ZlineCursor) calloc(1, sizeof(struct ZlineCursor));
+  if (!cursor) return NULL;
+
+  cursor->zf = zf;
+  cursor->decompress_stream = ZSTD_createDStream();
+  cursor->block = NULL;
+
+  if (!cursor->decompress_stream) {
+    free(cursor);
+    return NULL;
+  }
+
+  return cursor;
+}
+
+
+ZLINE_EXPORT void ZlineCursor_close(ZlineCursor cursor) {
+  if (!cursor) return;
+  ZSTD_freeDStream(cursor->decompress_stream);
+  if (cursor->block) freeBlock(cursor->block);
+  free(cursor);
+}
+
+
+ZLINE_EXPORT int64_t ZlineCursor_line_length
+  (ZlineCursor cursor, uint64_t line_idx) {
+  ZlineIndexLine *line = cursorLoadLine(cursor, line_idx);
+  return line ? (int64_t) line->length : -1;
+}
+
+
+/* Make sure the cursor's block contains the given line, and return
+   the line's entry in the block. Returns NULL on error. */
+static ZlineIndexLine *cursorLoadLine(ZlineCursor cursor, u64 line_idx) {
+  ZlineFile zf = cursor->zf;
+  ZlineIndexLine *line;
+
+  if (line_idx >= zf->line_count) return NULL;
+
+  line = lineInBlock(cursor->block, line_idx);
+  if (line) return line;
+
+  if (!cursor->block) {
+    cursor->block = createBlock(0, 0);
+    if (!cursor->block) return NULL;
+  }
+
+  if (readBlock(zf, cursor->decompress_stream,
+                getLineBlock(zf, line_idx), cursor->block))
+    return NULL;
+
+  line = lineInBlock(cursor->block, line_idx);
+  assert(line);
+  return line;
+}
+
+
+ZLINE_EXPORT char *ZlineCursor_get_line
+  (ZlineCursor cursor, uint64_t line_idx) {
+  int64_t len = ZlineCursor_line_length(cursor, line_idx);
+  char *buf, *result;
+
+  if (len < 0) return NULL;
+
+  buf = (char*) malloc(len + 1);
+  if (!buf) return NULL;
+
+  result = ZlineCursor_get_line2(cursor, line_idx, buf, len+1, 0);
+  if (!result) free(buf);
+  return result;
+}
+
+
+ZLINE_EXPORT char *ZlineCursor_get_line2
+  (ZlineCursor cursor, uint64_t line_idx,
+   char *buf, uint64_t buf_len, uint64_t offset) {
+  ZlineIndexLine *line;
+
+  line = cursorLoadLine(cursor, line_idx);
+  if (!line) return NULL;
+
+  if (copyLine(cursor->zf, cursor->decompress_stream, cursor->block,
+               line, buf, buf_len, offset))
+    return NULL;
+
+  return buf;
+}
+
+
+ZLINE_EXPORT int ZlineFile_set_thread_count(ZlineFile zf, int thread_count) {
+  if (zf->mode != ZLINE_MODE_READ) return -1;
+  if (thread_count <= 0) thread_count = getCpuCount();
+  zf->reader_thread_count = thread_count;
+  return 0;
+}
+
+
+static int compareLineRequests(const void *a_v, const void *b_v) {
+  const ZlineLineRequest *a = (const ZlineLineRequest*) a_v;
+  const ZlineLineRequest *b = (const ZlineLineRequest*) b_v;
+  if (a->line_idx != b->line_idx)
+    return a->line_idx < b->line_idx ? -1 : 1;
+  return a->pos < b->pos ? -1 : (a->pos > b->pos);
+}
+
+
+ZLINE_EXPORT int64_t ZlineFile_get_lines
+  (ZlineFile zf, const uint64_t *line_idx, uint64_t n,
+   char *buf, uint64_t buf_len, uint64_t *offsets, uint64_t *lengths) {
+
+  ZlineBatch batch;
+  Thread *threads = NULL;
+  u64 i, block_idx, block_end, total = 0;
+  int thread_count, started = 0, is_sorted = 1, phase;
+
+  for (i=0; i < n; i++) {
+    if (line_idx[i] >= zf->line_count) return -1;
+    if (i > 0 && line_idx[i] < line_idx[i-1]) is_sorted = 0;
+  }
+  if (n == 0) return 0;
+
+  /* While writing, some lines are only in memory, so just get them
+     one at a time. */
+  if (zf->mode == ZLINE_MODE_CREATE) {
+    for (i=0; i < n; i++) {
+      int64_t len = ZlineFile_line_length(zf, line_idx[i]);
+      if (len < 0) return -1;
+      lengths[i] = len;
+      offsets[i] = total;
+      total += len + 1;
+    }
+    if (total <= buf_len) {
+      for (i=0; i < n; i++) {
+        if (!ZlineFile_get_line2(zf, line_idx[i], buf + offsets[i],
+                                 lengths[i] + 1, 0))
+          return -1;
+      }
+    }
+    return total;
+  }
+
+  memset(&batch, 0, sizeof batch);
+  batch.zf = zf;
+  batch.buf = buf;
+  batch.offsets = offsets;
+  batch.lengths = lengths;
+
+  batch.requests = (ZlineLineRequest*) malloc(sizeof(ZlineLineRequest) * n);
+  batch.group_start = (u64*) malloc(sizeof(u64) * (n+1));
+  batch.group_block = (u64*) malloc(sizeof(u64) * n);
+  if (!batch.requests || !batch.group_start || !batch.group_block) {
+    fprintf(stderr, "Out of memory allocating %" PRIu64 " line requests\n", n);
+    total = (u64)-1;
+    goto done;
+  }
+
+  for (i=0; i < n; i++) {
+    batch.requests[i].line_idx = line_idx[i];
+    batch.requests[i].pos = i;
+  }
+  if (!is_sorted)
+    qsort(batch.requests, n, sizeof(ZlineLineRequest), compareLineRequests);
+
+  /* split the requests into one group per block, walking forward
+     through the blocks since the requests are in order */
+  block_idx = getLineBlock(zf, batch.requests[0].line_idx);
+  block_end = block_idx + 1 < zf->blocks_size
+    ? zf->block_starts[block_idx] : zf->line_count;
+  batch.group_start[0] = 0;
+  batch.group_block[0] = block_idx;
+  batch.group_count = 1;
+  for (i=1; i < n; i++) {
+    if (batch.requests[i].line_idx >= block_end) {
+      while (batch.requests[i].line_idx >= block_end) {
+        block_idx++;
+        block_end = block_idx + 1 < zf->blocks_size
+          ? zf->block_starts[block_idx] : zf->line_count;
+      }
+      batch.group_start[batch.group_count] = i;
+      batch.group_block[batch.group_count] = block_idx;
+      batch.group_count++;
+    }
+  }
+  batch.group_start[batch.group_count] = n;
+
+  thread_count = MAX(zf->reader_thread_count, 1);
+  if ((u64)thread_count > batch.group_count)
+    thread_count = batch.group_count;
+
+  mutexInit(&batch.lock);
+  if (thread_count > 1) {
+    threads = (Thread*) malloc(sizeof(Thread) * thread_count);
+    if (!threads) thread_count = 1;
+  }
+
+  /* Phase 0 fills in lengths. Then offsets can be computed, and
+     phase 1 copies the lines into buf if it is big enough. */
+  for (phase = 0; phase < 2; phase++) {
+    batch.phase = phase;
+    batch.next_group = 0;
+
+    for (started = 0; started < thread_count - 1; started++) {
+      if (threadStart(&threads[started], batchThreadFn, &batch)) break;
+    }
+    /* this thread does its share too */
+    batchThreadFn(&batch);
+    while (started > 0)
+      threadJoin(threads[--started]);
+
+    if (batch.is_error) {
+      total = (u64)-1;
+      break;
+    }
+
+    if (phase == 0) {
+      for (i=0; i < n; i++) {
+        offsets[i] = total;
+        total += lengths[i] + 1;
+      }
+      if (total > buf_len) break;
+    }
+  }
+
+  mutexDestroy(&batch.lock);
+  free(threads);
+
+ done:
+  free(batch.requests);
+  free(batch.group_start);
+  free(batch.group_block);
+  return (int64_t) total;
+}
+
+
+static void *batchThreadFn(void *arg) {
+  ZlineBatch *batch = (ZlineBatch*) arg;
+  ZlineFile zf = batch->zf;
+  ZSTD_DStream *ds = ZSTD_createDStream();
+  ZlineBlock *b = createBlock(0, 0);
+  ZlineLineRequest *req;
+  ZlineIndexLine *line;
+  u64 group, i;
+  int err;
+
+  if (!ds || !b) {
+    mutexLock(&batch->lock);
+    batch->is_error = 1;
+    mutexUnlock(&batch->lock);
+    goto done;
+  }
+
+  while (1) {
+    mutexLock(&batch->lock);
+    group = batch->next_group++;
+    err = batch->is_error;
+    mutexUnlock(&batch->lock);
+    if (err || group >= batch->group_count) break;
+
+    if (batch->phase == 0)
+      err = readBlockIndex(zf, ds, batch->group_block[group], b);
+    else
+      err = readBlock(zf, ds, batch->group_block[group], b);
+
+    for (i = batch->group_start[group];
+         !err && i < batch->group_start[group+1]; i++) {
+      req = batch->requests + i;
+      line = lineInBlock(b, req->line_idx);
+      assert(line);
+      if (batch->phase == 0) {
+        batch->lengths[req->pos] = line->length;
+      } else {
+        err = copyLine(zf, ds, b, line, batch->buf + batch->offsets[req->pos],
+                       line->length + 1, 0);
+      }
+    }
+
+    if (err) {
+      mutexLock(&batch->lock);
+      batch->is_error = 1;
+      mutexUnlock(&batch->lock);
+    }
+  }
+
+ done:
+  if (ds) ZSTD_freeDStream(ds);
+  if (b) freeBlock(b);
+  return NULL;
+}
+
+
+ZLINE_EXPORT int64_t ZlineFile_get_window
+  (ZlineFile zf, uint64_t first_line, uint64_t n_lines, uint64_t col,
+   uint64_t width, char *out, uint64_t stride) {
+
+  ZlineWindow win;
+  Thread *threads = NULL;
+  u64 i, n, short_count = 0;
+  int64_t len;
+  int thread_count, started;
+  char *line_buf;
+
+  if (first_line > zf->line_count || n_lines > zf->line_count - first_line ||
+      stride < width)
+    return -1;
+  if (n_lines == 0 || width == 0) return 0;
+
+  /* While writing, some lines are only in memory, so just get them
+     one at a time. */
+  if (zf->mode == ZLINE_MODE_CREATE) {
+    line_buf = (char*) malloc(width + 1);
+    if (!line_buf) return -1;
+    for (i=0; i < n_lines; i++) {
+      len = ZlineFile_line_length(zf, first_line + i);
+      if (len < 0 ||
+          !ZlineFile_get_line2(zf, first_line + i, line_buf, width + 1, col)) {
+        free(line_buf);
+        return -1;
+      }
+      n = (u64)len > col ? MIN((u64)len - col, width) : 0;
+      memcpy(out + i * stride, line_buf, n);
+      if (n < width) {
+        memset(out + i * stride + n, 0, width - n);
+        short_count++;
+      }
+    }
+    free(line_buf);
+    return short_count;
+  }
+
+  memset(&win, 0, sizeof win);
+  win.zf = zf;
+  win.first_line = first_line;
+  win.end_line = first_line + n_lines;
+  win.col = col;
+  win.width = width;
+  win.out = out;
+  win.stride = stride;
+  win.next_block = getLineBlock(zf, first_line);
+  win.end_block = getLineBlock(zf, win.end_line - 1) + 1;
+
+  thread_count = MAX(zf->reader_thread_count, 1);
+  if ((u64)thread_count > win.end_block - win.next_block)
+    thread_count = win.end_block - win.next_block;
+  if (thread_count > 1) {
+    threads = (Thread*) malloc(sizeof(Thread) * thread_count);
+    if (!threads) thread_count = 1;
+  }
+
+  mutexInit(&win.lock);
+  for (started = 0; started < thread_count - 1; started++) {
+    if (threadStart(&threads[started], windowThreadFn, &win)) break;
+  }
+  /* this thread does its share too */
+  windowThreadFn(&win);
+  while (started > 0)
+    threadJoin(threads[--started]);
+  mutexDestroy(&win.lock);
+  free(threads);
+
+  return win.is_error ? -1 : (int64_t) win.short_count;
+}
+
+
+static void *windowThreadFn(void *arg) {
+  ZlineWindow *win = (ZlineWindow*) arg;
+  ZlineFile zf = win->zf;
+  ZSTD_DStream *ds = ZSTD_createDStream();
+  ZlineBlock *b = createBlock(0, 0);
+  ZlineIndexLine *line;
+  u64 block_idx, i, end, n, short_count = 0;
+  char *row;
+  int err = !ds || !b;
+
+  while (!err) {
+    mutexLock(&win->lock);
+    block_idx = win->next_block++;
+    err = win->is_error;
+    mutexUnlock(&win->lock);
+    if (err || block_idx >= win->end_block) break;
+
+    if (readBlock(zf, ds, block_idx, b)) {
+      err = 1;
+      break;
+    }
+
+    i = MAX(b->first_line, win->first_line);
+    end = MIN(b->first_line + b->lines_size, win->end_line);
+    for (; i < end && !err; i++) {
+      line = b->lines + (i - b->first_line);
+      row = win->out + (i - win->first_line) * win->stride;
+      n = line->length > win->col
+        ? MIN(line->length - win->col, win->width) : 0;
+
+      /* readBlock leaves a very long line on disk, so decompress just
+         the frames with the window */
+      if (n > 0 && b->content_size > 0)
+        memcpy(row, b->content + line->offset + win->col, n);
+      else if (n > 0)
+        err = decompressContent(zf, ds, b, row, n, line->offset + win->col)
+          != (int64_t) n;
+
+      if (n < win->width) {
+        memset(row + n, 0, win->width - n);
+        short_count++;
+      }
+    }
+  }
+
+  mutexLock(&win->lock);
+  win->short_count += short_count;
+  if (err) win->is_error = 1;
+  mutexUnlock(&win->lock);
+
+  if (ds) ZSTD_freeDStream(ds);
+  if (b) freeBlock(b);
+  return NULL;
+}
+
+
+ZLINE_EXPORT int ZlineFile_get_line_view
+  (ZlineFile zf, uint64_t line_idx, ZlineView *view) {
+  ZlineIndexLine *line;
+  ZlineBlock *block, *copy;
+
+  view->data = NULL;
+  view->length = 0;
+  view->pin = NULL;
+
+  /* In write mode, the write block's content moves as lines are added. */
+  if (zf->mode != ZLINE_MODE_READ || line_idx >= zf->line_count) return -1;
+
+  if (loadLine(zf, line_idx, &line, &block)) return -1;
+
+  if (line->length == 0) {
+    view->data = "";
+    return 0;
+  }
+
+  if (block->content_size > 0) {
+    block->pin_count++;
+    view->data = block->content + line->offset;
+    view->length = line->length;
+    view->pin = block;
+    return 0;
+  }
+
+  /* loadLine leaves very long lines on disk. Decompress this one into
+     a block of its own that lasts as long as the view. The line may be
+     more than INT_MAX bytes, too big for createBlock, so allocate its
+     content directly. */
+  copy = (ZlineBlock*) calloc(1, sizeof(ZlineBlock));
+  if (copy) copy->content = (char*) malloc(line->length + 1);
+  if (!copy || !copy->content ||
+      copyLine(zf, zf->decompress_stream, block, line, copy->content,
+               line->length + 1, 0)) {
+    freeBlock(copy);
+    return -1;
+  }
+  copy->idx = -1;
+  copy->content_capacity = line->length + 1;
+  copy->content_size = line->length;
+  copy->is_view_copy = 1;
+  copy->pin_count = 1;
+
+  view->data = copy->content;
+  view->length = line->length;
+  view->pin = copy;
+  return 0;
+}
+
+
+ZLINE_EXPORT void ZlineFile_release_view(ZlineFile zf, ZlineView *view) {
+  ZlineBlock *b = (ZlineBlock*) view->pin;
+
+  if (b) {
+    assert(b->pin_count > 0);
+    b->pin_count--;
+    if (b->pin_count == 0 && b->is_view_copy)
+      freeBlock(b);
+  }
+
+  view->data = NULL;
+  view->length = 0;
+  view->pin = NULL;
+}
+
+
+ZLINE_EXPORT ZlineIterator ZlineIterator_create
+  (ZlineFile zf, uint64_t first_line, uint64_t end_line, int is_reverse,
+   int thread_count) {
+  return iteratorCreate(zf, first_line, end_line, is_reverse, thread_count,
+                        NULL);
+}
+
+
+static ZlineIterator iteratorCreate
+  (ZlineFile zf, uint64_t first_line, uint64_t end_line, int is_reverse,
+   int thread_count, const ZlineSearch *search) {
+
+  ZlineIterator it;
+  int i;
+
+  if (!zf || zf->mode != ZLINE_MODE_READ ||
+      first_line > end_line || end_line > zf->line_count)
+    return NULL;
+
+  it = (ZlineIterator) calloc(1, sizeof(struct ZlineIterator));
+  if (!it) return NULL;
+
+  mutexInit(&it->lock);
+  condInit(&it->cond);
+
+  it->zf = zf;
+  it->is_reverse = is_reverse;
+  it->remaining = end_line - first_line;
+  it->next_line = is_reverse ? end_line - 1 : first_line;
+  it->current_slot = -1;
+
+  if (it->remaining > 0) {
+    it->first_block = getLineBlock(zf, first_line);
+    it->last_block = getLineBlock(zf, end_line - 1);
+    it->block_count = it->last_block - it->first_block + 1;
+  }
+
+  /* Don't start more threads than there are blocks to decode. Each
+     thread can be up to two blocks ahead of the reader. */
+  if (thread_count < 0 || it->block_count < 2) thread_count = 0;
+  if ((u64)thread_count > it->block_count)
+    thread_count = (int) it->block_count;
+  it->slot_count = thread_count * 2 + 1;
+
+  it->slots = (ZlineBlock**) calloc(it->slot_count, sizeof(ZlineBlock*));
+  it->slot_state = (int*) calloc(it->slot_count, sizeof(int));
+  if (!it->slots || !it->slot_state) goto fail;
+  for (i=0; i < it->slot_count; i++)
+    it->slots[i] = createBlock(0, 0);
+
+  it->search = search;
+  if (search) {
+    it->matches = (ZlineSearchMatches*)
+      calloc(it->slot_count, sizeof(ZlineSearchMatches));
+    if (!it->matches) goto fail;
+  }
+
+  if (thread_count > 0) {
+    it->threads = (Thread*) malloc(sizeof(Thread) * thread_count);
+    if (!it->threads) goto fail;
+    for (i=0; i < thread_count; i++) {
+      if (threadStart(&it->threads[i], iteratorThreadFn, it)) break;
+      it->thread_count++;
+    }
+  }
+
+  if (it->thread_count == 0) {
+    it->decompress_stream = ZSTD_createDStream();
+    if (!it->decompress_stream) goto fail;
+  }
+
+  return it;
+
+ fail:
+  ZlineIterator_close(it);
+  return NULL;
+}
+
+
+/* Return the index of the block with the given sequence number. */
+static u64 iteratorBlock(ZlineIterator it, u64 seq) {
+  return it->is_reverse ? it->last_block - seq : it->first_block + seq;
+}
+
+
+/* Decode the block with the given sequence number into its slot,
+   including its content even if it is very large. */
+static int iteratorDecode(ZlineIterator it, ZSTD_DStream *ds, u64 seq) {
+  ZlineBlock *b = it->slots[seq % it->slot_count];
+
+  /* skip blocks that can't contain a match, leaving the slot empty */
+  if (it->search &&
+      !searchMayMatch(it->zf, it->search, iteratorBlock(it, seq))) {
+    b->idx = -1;
+    b->lines_size = 0;
+    b->content_size = 0;
+    it->matches[seq % it->slot_count].count = 0;
+    return 0;
+  }
+
+  if (readBlockIndex(it->zf, ds, iteratorBlock(it, seq), b) ||
+      readBlockContent(it->zf, ds, b))
+    return -1;
+
+  if (it->search)
+    return searchBlock(it->search, b, it->matches + seq % it->slot_count);
+  return 0;
+}
+
+
+static void *iteratorThreadFn(void *arg) {
+  ZlineIterator it = (ZlineIterator) arg;
+  ZSTD_DStream *ds = ZSTD_createDStream();
+  u64 seq;
+  int slot, err;
+
+  mutexLock(&it->lock);
+  while (1) {
+    /* wait until there is a free slot */
+    while (!it->is_shutdown &&
+           it->next_decode < it->block_count &&
+           it->next_decode >= it->next_read + it->slot_count)
+      condWait(&it->cond, &it->lock);
+
+    if (it->is_shutdown || it->next_decode >= it->block_count) break;
+
+    seq = it->next_decode++;
+    slot = seq % it->slot_count;
+    it->slot_state[slot] = ZLINE_SLOT_DECODING;
+    mutexUnlock(&it->lock);
+
+    err = ds ? iteratorDecode(it, ds, seq) : -1;
+
+    mutexLock(&it->lock);
+    it->slot_state[slot] = err ? ZLINE_SLOT_ERROR : ZLINE_SLOT_READY;
+    condBroadcast(&it->cond);
+  }
+  mutexUnlock(&it->lock);
+
+  if (ds) ZSTD_freeDStream(ds);
+  return NULL;
 }
 
-  
-static void linesInsureCapacity(ZlineBlock *b, int capacity) {
-  int new_cap;
-  if (!b->lines || b->lines_capacity < capacity) {
-    new_cap = b->lines_capacity * 2;
-    if (new_cap < capacity) new_cap = capacity;
-    b->lines = (ZlineIndexLine*) realloc
-      (b->lines, sizeof(ZlineIndexLine) * new_cap);
-    if (!b->lines) {
-      fprintf(stderr, "Out of memory allocating line array\n");
-      assert(0);
-    }
-    b->lines_capacity = new_cap;
+
+/* Release the reader's current block and move on to the next one,
+   waiting for it to be decoded if necessary. */
+static int iteratorAdvance(ZlineIterator it) {
+  int slot, state;
+
+  if (it->thread_count == 0) {
+    if (it->current_slot >= 0) it->next_read++;
+    it->current_slot = 0;
+    return iteratorDecode(it, it->decompress_stream, it->next_read);
+  }
+
+  mutexLock(&it->lock);
+  if (it->current_slot >= 0) {
+    it->slot_state[it->current_slot] = ZLINE_SLOT_EMPTY;
+    it->next_read++;
+    condBroadcast(&it->cond);
   }
+  slot = it->next_read % it->slot_count;
+  it->current_slot = slot;
+
+  while (it->slot_state[slot] != ZLINE_SLOT_READY &&
+         it->slot_state[slot] != ZLINE_SLOT_ERROR)
+    condWait(&it->cond, &it->lock);
+  state = it->slot_state[slot];
+  mutexUnlock(&it->lock);
+
+  return state == ZLINE_SLOT_READY ? 0 : -1;
 }
 
 
-static void contentInsureCapacity(ZlineBlock *b, int capacity) {
-  int new_cap;
-  if (!b->content || b->content_capacity < capacity) {
-    new_cap = b->content_capacity * 2;
-    if (new_cap < capacity) new_cap = capacity;
-    b->content = (char*) realloc(b->content, new_cap);
-    if (!b->content) {
-      fprintf(stderr, "Out of memory allocating content array\n");
-      assert(0);
+ZLINE_EXPORT int ZlineIterator_next
+  (ZlineIterator it, ZlineView *view, uint64_t *line_idx) {
+  ZlineIndexLine *line;
+  ZlineBlock *b;
+
+  view->data = NULL;
+  view->length = 0;
+  view->pin = NULL;
+
+  if (it->remaining == 0) return 0;
+
+  b = it->current_slot >= 0 ? it->slots[it->current_slot] : NULL;
+  line = lineInBlock(b, it->next_line);
+
+  /* the next block in the sequence will contain the next line */
+  if (!line) {
+    if (iteratorAdvance(it)) {
+      it->remaining = 0;
+      return -1;
     }
-    b->content_capacity = new_cap;
+    b = it->slots[it->current_slot];
+    line = lineInBlock(b, it->next_line);
+    assert(line);
   }
-}
 
+  view->data = line->length ? b->content + line->offset : "";
+  view->length = line->length;
+  if (line_idx) *line_idx = it->next_line;
 
-static void ZlineFile_deallocate(ZlineFile zf) {
-  if (!zf) return;
+  it->remaining--;
+  if (it->remaining > 0) {
+    if (it->is_reverse)
+      it->next_line--;
+    else
+      it->next_line++;
+  }
 
-  if (zf->compress_stream)
-    ZSTD_freeCStream(zf->compress_stream);
-  if (zf->decompress_stream)
-    ZSTD_freeDStream(zf->decompress_stream);
-  if (zf->fp) fclose(zf->fp);
-  freeBlock(zf->write_block);
-  freeBlock(zf->read_block);
-  free(zf->blocks);
-  free(zf->block_starts);
-  free(zf->filename);
-  free(zf);
+  return 1;
 }
 
 
-static int flushOutbuf(ZlineFile zf, ZSTD_outBuffer *outbuf,
-                       int64_t *bytes_written) {
-  size_t write_len;
+ZLINE_EXPORT void ZlineIterator_close(ZlineIterator it) {
+  int i;
 
-  write_len = fwrite(outbuf->dst, 1, outbuf->pos, zf->fp);
-  if (write_len != outbuf->pos) {
-    fprintf(stderr, "Failed to write to \"%s\"\n", zf->filename);
-    return 1;
-  } else {
-    *bytes_written += write_len;
-    outbuf->pos = 0;
-    return 0;
+  if (!it) return;
+
+  if (it->thread_count > 0) {
+    mutexLock(&it->lock);
+    it->is_shutdown = 1;
+    condBroadcast(&it->cond);
+    mutexUnlock(&it->lock);
+    for (i=0; i < it->thread_count; i++)
+      threadJoin(it->threads[i]);
+  }
+  free(it->threads);
+
+  if (it->slots) {
+    for (i=0; i < it->slot_count; i++)
+      freeBlock(it->slots[i]);
   }
+  free(it->slots);
+  if (it->matches) {
+    for (i=0; i < it->slot_count; i++) {
+      free(it->matches[i].lines);
+      free(it->matches[i].marks);
+    }
+  }
+  free(it->matches);
+  mutexDestroy(&it->lock);
+  condDestroy(&it->cond);
+  free(it->slot_state);
+  if (it->decompress_stream) ZSTD_freeDStream(it->decompress_stream);
+  free(it);
 }
 
 
-/* Return the number of compressed bytes written to zf->fp */
-static int64_t compressToFile(ZlineFile zf, const void *input,
-                              int64_t input_len) {
-  unsigned char buf[FILE_BUFFER_SIZE];
-  ZSTD_outBuffer outbuf;
-  ZSTD_inBuffer inbuf;
-  size_t write_len;
-  int64_t bytes_written = 0;
+ZLINE_EXPORT ZlineAsync ZlineAsync_create(ZlineFile zf, int thread_count) {
+  ZlineAsync za;
+  int i;
 
-  /* make sure the input data is not larger than a size_t can represent */
-  assert(input_len <= SIZE_MAX);
-  assert(zf->compress_stream);
+  if (!zf || zf->mode != ZLINE_MODE_READ) return NULL;
 
-  if (input_len == 0) return 0;
+  za = (ZlineAsync) calloc(1, sizeof(struct ZlineAsync));
+  if (!za) return NULL;
 
-  inbuf.src = input;
-  inbuf.size = input_len;
-  inbuf.pos = 0;
+  mutexInit(&za->lock);
+  condInit(&za->work_cond);
+  condInit(&za->done_cond);
+  za->zf = zf;
 
-  outbuf.dst = buf;
-  outbuf.size = sizeof buf;
-  outbuf.pos = 0;
+  za->block_jobs = (ZlineAsyncJob**)
+    calloc(zf->blocks_size ? zf->blocks_size : 1, sizeof(ZlineAsyncJob*));
+  if (!za->block_jobs) goto fail;
 
-  ZSTD_initCStream(zf->compress_stream, ZSTD_COMPRESSION_LEVEL);
+  if (thread_count <= 0) thread_count = getCpuCount();
+  za->threads = (Thread*) malloc(sizeof(Thread) * thread_count);
+  if (!za->threads) goto fail;
+  for (i=0; i < thread_count; i++) {
+    if (threadStart(&za->threads[i], asyncThreadFn, za)) break;
+    za->thread_count++;
+  }
+  if (za->thread_count == 0) goto fail;
 
-  while (inbuf.pos < inbuf.size) {
-    ZSTD_compressStream(zf->compress_stream, &outbuf, &inbuf);
+  return za;
 
-    /* either the input data has been fully processed or
-       the output buffer is full */
-    assert(inbuf.pos == inbuf.size || outbuf.pos == outbuf.size);
+ fail:
+  ZlineAsync_close(za);
+  return NULL;
+}
 
-    /* only flush the output buffer if it is full, because the last bit
-       can probably be flushed along with the end-of-stream data. */
-    if (outbuf.pos == outbuf.size)
-      if (flushOutbuf(zf, &outbuf, &bytes_written)) return -1;
+
+ZLINE_EXPORT int ZlineAsync_submit
+  (ZlineAsync za, uint64_t first_line, uint64_t line_count,
+   ZlineAsyncCallback callback, void *arg) {
+
+  ZlineFile zf = za->zf;
+  ZlineAsyncRequest *req;
+  ZlineAsyncPiece *piece;
+  ZlineAsyncJob **new_jobs, *job;
+  u64 first_block, piece_count, end_line, block_start, block_end, i;
+
+  if (line_count == 0 || first_line >= zf->line_count ||
+      line_count > zf->line_count - first_line)
+    return -1;
+
+  end_line = first_line + line_count;
+  first_block = getLineBlock(zf, first_line);
+  piece_count = getLineBlock(zf, end_line - 1) - first_block + 1;
+
+  req = (ZlineAsyncRequest*) malloc
+    (sizeof(ZlineAsyncRequest) + sizeof(ZlineAsyncPiece) * piece_count
+     + sizeof(u64) * line_count * 2);
+  /* Any block may need a new job, and they're allocated before taking
+     the lock. The ones that aren't needed are freed afterwards. */
+  new_jobs = (ZlineAsyncJob**) calloc(piece_count, sizeof(ZlineAsyncJob*));
+  if (!req || !new_jobs) goto fail;
+  for (i=0; i < piece_count; i++) {
+    new_jobs[i] = (ZlineAsyncJob*) malloc(sizeof(ZlineAsyncJob));
+    if (!new_jobs[i]) goto fail;
   }
 
-  while (1) {
-    write_len = ZSTD_endStream(zf->compress_stream, &outbuf);
-    if (ZSTD_isError(write_len)) {
-      fprintf(stderr, "Error writing compressed data\n");
-      assert(write_len == 0);
+  req->c.arg = arg;
+  req->c.first_line = first_line;
+  req->c.line_count = line_count;
+  req->c.status = 0;
+  req->c.data = NULL;
+  req->pieces = (ZlineAsyncPiece*) (req + 1);
+  req->c.offsets = (u64*) (req->pieces + piece_count);
+  req->c.lengths = req->c.offsets + line_count;
+  req->callback = callback;
+  req->piece_count = req->pieces_left = piece_count;
+  req->next = NULL;
+
+  for (i=0; i < piece_count; i++) {
+    piece = req->pieces + i;
+    block_start = ZlineFile_get_block_first_line(zf, first_block + i);
+    block_end = block_start
+      + ZlineFile_get_block_line_count(zf, first_block + i);
+    piece->request = req;
+    piece->first_line = MAX(first_line, block_start);
+    piece->line_count = MIN(end_line, block_end) - piece->first_line;
+    piece->data = NULL;
+    piece->data_len = 0;
+  }
+
+  mutexLock(&za->lock);
+  for (i=0; i < piece_count; i++) {
+    job = za->block_jobs[first_block + i];
+    if (!job) {
+      job = new_jobs[i];
+      new_jobs[i] = NULL;
+      job->block_idx = first_block + i;
+      job->pieces = NULL;
+      job->next = NULL;
+      if (za->job_tail)
+        za->job_tail->next = job;
+      else
+        za->job_head = job;
+      za->job_tail = job;
+      za->block_jobs[first_block + i] = job;
+      condSignal(&za->work_cond);
     }
-    if (write_len == 0) break;
-    if (flushOutbuf(zf, &outbuf, &bytes_written)) return -1;
+    req->pieces[i].next = job->pieces;
+    job->pieces = req->pieces + i;
   }
+  za->pending++;
+  if (!callback) za->in_flight_polled++;
+  mutexUnlock(&za->lock);
 
-  assert(write_len == 0);
+  for (i=0; i < piece_count; i++)
+    free(new_jobs[i]);
+  free(new_jobs);
+  return 0;
 
-  if (outbuf.pos > 0)
-    flushOutbuf(zf, &outbuf, &bytes_written);
-  
-  return bytes_written;
+ fail:
+  if (new_jobs) {
+    for (i=0; i < piece_count; i++)
+      free(new_jobs[i]);
+  }
+  free(new_jobs);
+  free(req);
+  return -1;
 }
 
 
-/* return # of bytes written to readbuf */
-static int64_t decompressFromFile
-  (ZlineFile zf, void *readbuf, int64_t readbuf_len,
-   int64_t compressed_len, uint64_t read_offset) {
-
-  unsigned char buf[FILE_BUFFER_SIZE];
-  ZSTD_outBuffer outbuf;
-  ZSTD_inBuffer inbuf;
-  size_t to_read, bytes_read, result;
-  int64_t input_remaining = compressed_len, skip_remaining = read_offset;
+static void *asyncThreadFn(void *arg) {
+  ZlineAsync za = (ZlineAsync) arg;
+  ZSTD_DStream *ds = ZSTD_createDStream();
+  ZlineBlock *b = createBlock(0, 0);
+  ZlineAsyncJob *job;
+  ZlineAsyncPiece *piece;
+  ZlineAsyncRequest *finished, *req;
+  int err;
 
-  /* make sure the input data is not larger than a size_t can represent */
-  assert(compressed_len <= SIZE_MAX);
-  assert(zf->decompress_stream);
+  mutexLock(&za->lock);
+  while (1) {
+    while (!za->job_head && !za->is_shutdown)
+      condWait(&za->work_cond, &za->lock);
+
+    /* on shutdown, finish the queued jobs first */
+    job = za->job_head;
+    if (!job) break;
+    za->job_head = job->next;
+    if (!za->job_head) za->job_tail = NULL;
+    za->block_jobs[job->block_idx] = NULL;
+    mutexUnlock(&za->lock);
+
+    /* keep the last block decoded; the next job may want it again */
+    err = !ds || !b;
+    if (!err && b->idx != (i64) job->block_idx &&
+        readBlock(za->zf, ds, job->block_idx, b)) {
+      b->idx = -1;
+      err = 1;
+    }
 
-  if (compressed_len == 0) return 0;
+    /* a piece that fails is left with no data */
+    if (!err) {
+      for (piece = job->pieces; piece; piece = piece->next)
+        asyncCopyPiece(za->zf, ds, b, piece);
+    }
 
-  inbuf.src = buf;
-  inbuf.size = 0;
-  inbuf.pos = 0;
-  
-  ZSTD_initDStream(zf->decompress_stream);
-
-  /* skip the first 'skip_remaining' bytes */
-  while (input_remaining > 0 && skip_remaining > 0) {
-    unsigned char junk_buf[FILE_BUFFER_SIZE];
-    outbuf.dst = junk_buf;
-    outbuf.size = MIN(FILE_BUFFER_SIZE, skip_remaining);
-    outbuf.pos = 0;
-
-    /* move unconsumed input data to the top of the buffer */
-    if (inbuf.pos < inbuf.size) {
-      memmove(buf, buf + inbuf.pos, inbuf.size - inbuf.pos);
-    }              
-    inbuf.size -= inbuf.pos;
-    inbuf.pos = 0;
-
-    /* fill the input buffer with compressed data */
-    to_read = MIN(sizeof buf - inbuf.size, input_remaining);
-    bytes_read = fread(buf + inbuf.size, 1, to_read, zf->fp);
-    if (bytes_read != to_read) {
-      fprintf(stderr, "Failed to read from \"%s\"\n", zf->filename);
-      return 0;
+    /* collect the requests this job completed */
+    finished = NULL;
+    mutexLock(&za->lock);
+    for (piece = job->pieces; piece; piece = piece->next) {
+      req = piece->request;
+      if (--req->pieces_left == 0) {
+        req->next = finished;
+        finished = req;
+      }
     }
-    inbuf.size += bytes_read;
-    input_remaining -= bytes_read;
+    mutexUnlock(&za->lock);
+    free(job);
 
-    /* decompress to junk buffer */
-    result = ZSTD_decompressStream(zf->decompress_stream, &outbuf, &inbuf);
-    if (ZSTD_isError(result)) {
-      fprintf(stderr, "Error decompressing data from \"%s\"\n",
-              zf->filename);
-      return 0;
+    while (finished) {
+      req = finished;
+      finished = req->next;
+      asyncFinish(za, req);
     }
 
-    skip_remaining -= outbuf.pos;
+    mutexLock(&za->lock);
   }
+  mutexUnlock(&za->lock);
 
-  outbuf.dst = readbuf;
-  outbuf.size = readbuf_len;
-  outbuf.pos = 0;
+  if (b) freeBlock(b);
+  if (ds) ZSTD_freeDStream(ds);
+  return NULL;
+}
 
-  /* Stop if all compressed data has been read or readbuf is full.
-     If readbuf fills up before all the content has been decompressed,
-     it's the caller's problem. */
-  while (input_remaining > 0 && outbuf.pos < outbuf.size) {
-
-    /* move unconsumed input data to the top of the buffer */
-    if (inbuf.pos < inbuf.size) {
-      memmove(buf, buf + inbuf.pos, inbuf.size - inbuf.pos);
-    }              
-    inbuf.size -= inbuf.pos;
-    inbuf.pos = 0;
-
-    /* fill the input buffer with compressed data */
-    to_read = MIN(sizeof buf - inbuf.size, input_remaining);
-    bytes_read = fread(buf + inbuf.size, 1, to_read, zf->fp);
-    if (bytes_read != to_read) {
-      fprintf(stderr, "Failed to read from \"%s\"\n", zf->filename);
-      return 0;
-    }
-    inbuf.size += bytes_read;
-    input_remaining -= bytes_read;
 
-    /* decompress */
-    result = ZSTD_decompressStream(zf->decompress_stream, &outbuf, &inbuf);
-    if (ZSTD_isError(result)) {
-      fprintf(stderr, "Error decompressing data from \"%s\"\n",
-              zf->filename);
-      return 0;
+static int asyncCopyPiece(ZlineFile zf, ZSTD_DStream *ds, ZlineBlock *b,
+                          ZlineAsyncPiece *piece) {
+  ZlineAsyncRequest *req = piece->request;
+  ZlineIndexLine *lines = b->lines + (piece->first_line - b->first_line);
+  u64 *offsets = req->c.offsets + (piece->first_line - req->c.first_line);
+  u64 *lengths = req->c.lengths + (piece->first_line - req->c.first_line);
+  u64 i, pos = 0;
+
+  piece->data_len = 0;
+  for (i=0; i < piece->line_count; i++)
+    piece->data_len += lines[i].length + 1;
+
+  piece->data = (char*) malloc(piece->data_len);
+  if (!piece->data) return -1;
+
+  for (i=0; i < piece->line_count; i++) {
+    offsets[i] = pos;
+    lengths[i] = lines[i].length;
+    if (copyLine(zf, ds, b, lines + i, piece->data + pos,
+                 lines[i].length + 1, 0)) {
+      free(piece->data);
+      piece->data = NULL;
+      return -1;
     }
+    pos += lines[i].length + 1;
   }
 
-  return outbuf.pos;
+  return 0;
 }
-  
 
 
-/* Open an existing zlines file for reading.
-   Use the result as the 'zf' argument to other functions in this module.
-   Call ZlineFile_close(zf) to close the file.
-*/
-ZLINE_EXPORT ZlineFile ZlineFile_read(const char *filename) {
-  ZlineFile zf = (ZlineFile) calloc(1, sizeof(struct ZlineFile));
-  size_t read_len;
-  u64 file_size, block_idx;
-  int64_t bytes_read;
-  int max_content_len = 0, max_line_count = 0;
-  
-  assert(zf);
+static void asyncFinish(ZlineAsync za, ZlineAsyncRequest *req) {
+  ZlineAsyncPiece *piece;
+  u64 i, j, total = 0, r;
 
-  zf->filename = strdup(filename);
-  zf->mode = ZLINE_MODE_READ;
+  for (i=0; i < req->piece_count; i++) {
+    if (!req->pieces[i].data) req->c.status = -1;
+    total += req->pieces[i].data_len;
+  }
 
-  file_size = getFileSize(filename);
-  
-  zf->fp = fopen(filename, "rb");
-  if (!zf->fp) goto fail;
+  /* one piece is already laid out as the completion needs it */
+  if (req->c.status == 0 && req->piece_count == 1) {
+    req->c.data = req->pieces[0].data;
+    req->pieces[0].data = NULL;
+  } else if (req->c.status == 0) {
+    req->c.data = (char*) malloc(total);
+    if (!req->c.data) req->c.status = -1;
+  }
 
-  zf->decompress_stream = ZSTD_createDStream();
+  /* shift each piece's offsets to where it lands in the result */
+  total = 0;
+  for (i=0; i < req->piece_count; i++) {
+    piece = req->pieces + i;
+    if (piece->data && req->c.data) {
+      memcpy(req->c.data + total, piece->data, piece->data_len);
+      r = piece->first_line - req->c.first_line;
+      for (j=0; j < piece->line_count; j++)
+        req->c.offsets[r + j] += total;
+    }
+    total += piece->data_len;
+    free(piece->data);
+    piece->data = NULL;
+  }
 
-  /* read the header */
-  if (readHeader(zf)) goto fail;
+  if (req->c.status != 0) {
+    free(req->c.data);
+    req->c.data = NULL;
+  }
 
-  /* allocate space for the index */
-  blocksInsureCapacity(zf, zf->blocks_size);
+  if (req->callback) {
+    req->callback(req->c.arg, &req->c);
+    mutexLock(&za->lock);
+    za->pending--;
+    condBroadcast(&za->done_cond);
+    mutexUnlock(&za->lock);
+  } else {
+    req->next = NULL;
+    mutexLock(&za->lock);
+    if (za->done_tail)
+      za->done_tail->next = req;
+    else
+      za->done_head = req;
+    za->done_tail = req;
+    za->in_flight_polled--;
+    condBroadcast(&za->done_cond);
+    mutexUnlock(&za->lock);
+  }
+}
 
-  if (fseek(zf->fp, zf->index_offset, SEEK_SET)) goto fail;
 
-  /* read the index */
+ZLINE_EXPORT ZlineCompletion *ZlineAsync_poll(ZlineAsync za, int wait) {
+  ZlineAsyncRequest *req;
 
-  if (zf->is_index_compressed) {
-    /* [0]: block array, [1]: line array */
-    u64 compressed_sizes[2];
+  mutexLock(&za->lock);
+  while (wait && !za->done_head && za->in_flight_polled > 0)
+    condWait(&za->done_cond, &za->lock);
+
+  req = za->done_head;
+  if (req) {
+    za->done_head = req->next;
+    if (!za->done_head) za->done_tail = NULL;
+    req->next = NULL;
+    za->pending--;
+  }
+  mutexUnlock(&za->lock);
 
-    if (2 != fread(compressed_sizes, sizeof(u64), 2, zf->fp)) goto fail;
+  return req ? &req->c : NULL;
+}
 
-    if (zf->index_offset + compressed_sizes[0] >= file_size ||
-        zf->index_offset + compressed_sizes[1] >= file_size ||
-        zf->index_offset + compressed_sizes[0] + compressed_sizes[1]
-        + 2*sizeof(u64) != file_size) {
-      fprintf(stderr, "Error in compressed index size\n");
-      goto fail;
-    }
 
-    /* read the compressed block index */
-    bytes_read = decompressFromFile
-      (zf, zf->blocks, zf->blocks_size * sizeof(ZlineIndexBlock),
-       compressed_sizes[0], 0);
-    if (bytes_read != zf->blocks_size * sizeof(ZlineIndexBlock))
-      goto fail;
+ZLINE_EXPORT uint64_t ZlineAsync_pending(ZlineAsync za) {
+  uint64_t pending;
+  mutexLock(&za->lock);
+  pending = za->pending;
+  mutexUnlock(&za->lock);
+  return pending;
+}
 
-    /* read the compressed line starts */
-    bytes_read = decompressFromFile
-      (zf, zf->block_starts, (zf->blocks_size-1) * sizeof(u64),
-       compressed_sizes[1], 0);
-    if (bytes_read != (zf->blocks_size-1) * sizeof(u64))
-      goto fail;
-  }
 
-  /* read uncompressed index */
-  else {
-    read_len = fread(zf->blocks, sizeof(ZlineIndexBlock), zf->blocks_size,
-                     zf->fp);
-    if (read_len != zf->blocks_size) goto fail;
-    
-    read_len = fread(zf->block_starts, sizeof(u64), zf->blocks_size-1, zf->fp);
-    if (read_len != zf->blocks_size - 1) goto fail;
-  }
+ZLINE_EXPORT void ZlineAsync_close(ZlineAsync za) {
+  ZlineAsyncRequest *req;
+  int i;
 
-  /* scan the index to find the largest content */
-  for (block_idx = 0; block_idx < zf->blocks_size; block_idx++) {
-    max_content_len = MAX(max_content_len,
-                          zf->blocks[block_idx].decompressed_length);
-    max_line_count = MAX(max_line_count, ZlineFile_get_block_line_count(zf, block_idx));
-  }
+  if (!za) return;
 
-  zf->read_block = createBlock(max_content_len, max_line_count);
-  if (!zf->read_block) {
-    fprintf(stderr, "Out of memory opening file\n");
-    goto fail;
-  }
-  zf->read_block->idx = -1;
-  
-  return zf;
+  mutexLock(&za->lock);
+  za->is_shutdown = 1;
+  condBroadcast(&za->work_cond);
+  mutexUnlock(&za->lock);
+  for (i=0; i < za->thread_count; i++)
+    threadJoin(za->threads[i]);
+  free(za->threads);
 
- fail:
-  ZlineFile_deallocate(zf);
+  while (za->done_head) {
+    req = za->done_head;
+    za->done_head = req->next;
+    ZlineCompletion_free(&req->c);
+  }
 
-  return NULL;
+  free(za->block_jobs);
+  mutexDestroy(&za->lock);
+  condDestroy(&za->work_cond);
+  condDestroy(&za->done_cond);
+  free(za);
 }
 
 
-/* Returns the number of lines in the file. */
-ZLINE_EXPORT uint64_t ZlineFile_line_count(ZlineFile zf) {
-  return zf->line_count;
+ZLINE_EXPORT void ZlineCompletion_free(ZlineCompletion *c) {
+  if (!c) return;
+  free(c->data);
+  free((ZlineAsyncRequest*) c);
 }
 
 
-/* Returns the length of the given line or -1 if there is no such line. */
-ZLINE_EXPORT int64_t ZlineFile_line_length(ZlineFile zf, uint64_t line_idx) {
+ZLINE_EXPORT int64_t ZlineFile_search
+  (ZlineFile zf, const char *const *patterns, int pattern_count,
+   uint64_t first_line, uint64_t end_line, int thread_count,
+   ZlineSearchCallback callback, void *arg) {
+
+  ZlineSearch search;
+  ZlineSearchMatches *m;
+  ZlineIterator it;
   ZlineIndexLine *line;
-  ZlineBlock *block;
-  
-  if (line_idx >= zf->line_count)
+  ZlineBlock *b;
+  u64 seq, i;
+  int64_t found = 0;
+  int p, is_done = 0;
+
+  if (pattern_count < 1) return -1;
+
+  search.patterns = patterns;
+  search.pattern_count = pattern_count;
+  search.lengths = (u64*) malloc(sizeof(u64) * pattern_count);
+  if (!search.lengths) return -1;
+  for (p=0; p < pattern_count; p++)
+    search.lengths[p] = strlen(patterns[p]);
+
+  /* With k-mer filters, blocks that can't contain any of the patterns
+     aren't decompressed. If any pattern is too short to have a k-mer,
+     every block has to be searched. */
+  search.probes = NULL;
+  search.probe_counts = NULL;
+  if (zf->filter_size) {
+    search.probes = (u64*)
+      malloc(sizeof(u64) * MAX_FILTER_PROBES * pattern_count);
+    search.probe_counts = (int*) malloc(sizeof(int) * pattern_count);
+    for (p=0; search.probes && search.probe_counts && p < pattern_count;
+         p++) {
+      search.probe_counts[p] = kmerProbes
+        (zf, patterns[p], search.lengths[p],
+         search.probes + (u64)p * MAX_FILTER_PROBES);
+      if (search.probe_counts[p] == 0) break;
+    }
+    if (p < pattern_count) {
+      free(search.probes);
+      free(search.probe_counts);
+      search.probes = NULL;
+      search.probe_counts = NULL;
+    }
+  }
+
+  it = iteratorCreate(zf, first_line, end_line, 0, thread_count, &search);
+  if (!it) {
+    free(search.lengths);
+    free(search.probes);
+    free(search.probe_counts);
     return -1;
+  }
 
-  loadLine(zf, line_idx, &line, &block);
-  assert(line);
-  
-  return line->length;
+  /* The background threads have already found the matches in each
+     block; report the ones in range. */
+  for (seq = 0; seq < it->block_count && !is_done; seq++) {
+    if (iteratorAdvance(it)) {
+      found = -1;
+      break;
+    }
+    b = it->slots[it->current_slot];
+    m = it->matches + it->current_slot;
+
+    for (i=0; i < m->count; i++) {
+      if (m->lines[i] < first_line) continue;
+      if (m->lines[i] >= end_line) break;
+      found++;
+      if (callback) {
+        line = b->lines + (m->lines[i] - b->first_line);
+        if (callback(arg, m->lines[i],
+                     line->length ? b->content + line->offset : "",
+                     line->length)) {
+          is_done = 1;
+          break;
+        }
+      }
+    }
+  }
+
+  ZlineIterator_close(it);
+  free(search.lengths);
+  free(search.probes);
+  free(search.probe_counts);
+  return found;
 }
 
 
-/* Returns the length of the longest line. */
-ZLINE_EXPORT uint64_t ZlineFile_max_line_length(ZlineFile zf) {
-  return zf->max_line_len;
+static void buildKmerFilter(const ZlineBlock *b, int k, unsigned char *filter,
+                            u64 filter_size) {
+  const unsigned char *p;
+  u64 nbits = filter_size * 8, top = 1, h, bit, i;
+  int line;
+
+  memset(filter, 0, filter_size);
+
+  /* top = KMER_HASH_BASE^(k-1), the weight of the oldest byte */
+  for (i=1; i < (u64)k; i++) top *= KMER_HASH_BASE;
+
+  for (line=0; line < b->lines_size; line++) {
+    if (b->lines[line].length < (u64)k) continue;
+    p = (const unsigned char*) b->content + b->lines[line].offset;
+
+    h = 0;
+    for (i=0; i < (u64)k-1; i++)
+      h = h * KMER_HASH_BASE + p[i];
+
+    for (; i < b->lines[line].length; i++) {
+      h = h * KMER_HASH_BASE + p[i];
+      bit = kmerBit(h, nbits);
+      filter[bit >> 3] |= 1 << (bit & 7);
+      h -= p[i-k+1] * top;
+    }
+  }
 }
 
 
-/* returns the index of the block containing this line */
-static u64 getLineBlock(ZlineFile zf, u64 line_idx) {
-  if (zf->blocks_size <= 1) {
-    return 0;
-  } else {
-    u64 i;
-    /* linear scan */
-    /* XXX change to binary scan for larger arrays */
-    for (i=0; i < zf->blocks_size-1; i++) {
-      if (line_idx <= zf->block_starts[i] - 1) {
-        return i;
-      }
-    }
-    return i;
+static int kmerProbes(ZlineFile zf, const char *pattern, u64 len,
+                      u64 *probes) {
+  const unsigned char *p = (const unsigned char*) pattern;
+  u64 k = zf->filter_k, n, start, h, i, j;
+  int count;
+
+  if (!zf->filter_size || len < k) return 0;
+
+  n = len - k + 1;
+  count = (int) MIN(n, MAX_FILTER_PROBES);
+  for (i=0; i < (u64)count; i++) {
+    start = count > 1 ? i * (n - 1) / (count - 1) : 0;
+    h = 0;
+    for (j=0; j < k; j++)
+      h = h * KMER_HASH_BASE + p[start + j];
+    probes[i] = kmerBit(h, zf->filter_size * 8);
   }
+
+  return count;
 }
 
 
-/* Make sure a line is in memory.
-   Set *block to the either zf->write_block or zf->read_block, whichever
-   contains the line.
-   Set *line to point to the record of its offset and length.
-   If the line isn't in memory, the block containing it will
-   be loaded into zf->read_block.
-*/
-static int loadLine(ZlineFile zf, u64 line_idx, ZlineIndexLine **line,
-                    ZlineBlock **block) {
-  u64 block_idx;
+static int filterMayMatch(ZlineFile zf, u64 block_idx, const u64 *probes,
+                          int probe_count) {
+  u64 filter_offset = zf->blocks[block_idx].offset - zf->filter_size;
+  unsigned char byte;
+  int i;
 
-  /* check if the line is in the write block */
-  if (zf->mode == ZLINE_MODE_CREATE) {
-    *line = lineInBlock(zf->write_block, line_idx);
-    if (*line) {
-      *block = zf->write_block;
-      return 0;
-    }
-  }
+  if (probe_count == 0 ||
+      zf->blocks[block_idx].offset < zf->data_offset + zf->filter_size)
+    return 1;
 
-  /* check if it's in the read block */
-  *line = lineInBlock(zf->read_block, line_idx);
-  if (*line) {
-    *block = zf->read_block;
-    return 0;
+  for (i=0; i < probe_count; i++) {
+    if (readFromFile(zf, &byte, 1, filter_offset + (probes[i] >> 3)))
+      return 1;
+    if (!(byte & (1 << (probes[i] & 7)))) return 0;
   }
 
-  /* load the block containing the line into the read block */
-  block_idx = getLineBlock(zf, line_idx);
-  readBlock(zf, block_idx);
-  *line = lineInBlock(zf->read_block, line_idx);
-  assert(*line);
-  *block = zf->read_block;
-
-  return 0;
+  return 1;
 }
 
 
-ZLINE_EXPORT int ZlineFile_get_line_details
-  (ZlineFile zf, uint64_t line_idx, uint64_t *length,
-   uint64_t *offset, uint64_t *block_idx) {
-  ZlineIndexLine *line;
-  ZlineBlock *block;
+static int searchMayMatch(ZlineFile zf, const ZlineSearch *search,
+                          u64 block_idx) {
+  int p;
 
-  if (line_idx >= zf->line_count) return -1;
-  
-  *block_idx = getLineBlock(zf, line_idx);
-  loadLine(zf, line_idx, &line, &block);
-  *length = line->length;
-  *offset = line->offset;
-  return 0;
-}
+  if (!search->probes) return 1;
 
+  for (p=0; p < search->pattern_count; p++) {
+    if (filterMayMatch(zf, block_idx,
+                       search->probes + (u64)p * MAX_FILTER_PROBES,
+                       search->probe_counts[p]))
+      return 1;
+  }
 
-static ZlineIndexLine* lineInBlock(ZlineBlock *block, u64 line_idx) {
-  if (block &&
-      block->lines_size > 0 &&
-      line_idx >= block->first_line &&
-      line_idx < block->first_line + block->lines_size)
-    return block->lines + (line_idx - block->first_line);
-  else
-    return NULL;
+  return 0;
 }
 
 
-/* Read a block, store the decompressed result in zf->read_block.
-   Return nonzero on error. 
-   If the data is larger than a normal block, just read the line index.
-*/
-static int readBlock(ZlineFile zf, u64 block_idx) {
-  ZlineIndexBlock *block;
-  ZlineBlock *b;
-  int block_line_count;
-  int64_t line_bytes, bytes_read;
+static int searchBlock(const ZlineSearch *search, ZlineBlock *b,
+                       ZlineSearchMatches *m) {
+  const char *hit;
+  u64 pos, line_end, len, i;
+  int p, line;
 
-  assert(block_idx < zf->blocks_size);
+  m->count = 0;
+  if (b->lines_size == 0) return 0;
 
-  /* check if we already have this block decompressed */
-  if (zf->read_block && block_idx == zf->read_block->idx) {
-    return 0;
+  if (m->marks_capacity < (u64)b->lines_size) {
+    free(m->marks);
+    m->marks = (char*) malloc(b->lines_size);
+    m->marks_capacity = m->marks ? b->lines_size : 0;
+    if (!m->marks) return -1;
   }
+  memset(m->marks, 0, b->lines_size);
 
-  if (!zf->decompress_stream)
-    zf->decompress_stream = ZSTD_createDStream();
+  for (p=0; p < search->pattern_count; p++) {
+    len = search->lengths[p];
 
-  block = zf->blocks + block_idx;
+    /* an empty pattern matches everything */
+    if (len == 0) {
+      memset(m->marks, 1, b->lines_size);
+      break;
+    }
 
-  /* compute the number of lines in this block */
-  block_line_count = ZlineFile_get_block_line_count(zf, block_idx);
+    /* Search the content of the whole block at once, then find the
+       line each match is in. A match that runs into the next line
+       doesn't count. */
+    pos = 0;
+    line = 0;
+    while (pos < b->content_size &&
+           (hit = findPattern(b->content + pos, b->content_size - pos,
+                              search->patterns[p], len))) {
+      pos = hit - b->content;
+      while (pos >= b->lines[line].offset + b->lines[line].length) line++;
+      line_end = b->lines[line].offset + b->lines[line].length;
+      if (pos + len <= line_end) {
+        m->marks[line] = 1;
+        pos = line_end;
+      } else {
+        pos++;
+      }
+    }
+  }
 
-  /* allocate zf->read_block if needed, otherwise make sure its
-     content and line arrays are big enough */
-  if (!zf->read_block) {
-    zf->read_block = createBlock(block->decompressed_length, block_line_count);
-  } else {
-    linesInsureCapacity(zf->read_block, block_line_count);
+  for (i=0; i < (u64)b->lines_size; i++) {
+    if (!m->marks[i]) continue;
+    if (m->count == m->capacity) {
+      u64 *lines;
+      m->capacity = MAX(m->capacity * 2, 64);
+      lines = (u64*) realloc(m->lines, sizeof(u64) * m->capacity);
+      if (!lines) return -1;
+      m->lines = lines;
+    }
+    m->lines[m->count++] = b->first_line + i;
   }
 
-  b = zf->read_block;
-  b->idx = block_idx;
-  b->offset = block->offset;
-  b->first_line = (block_idx == 0) ? 0 : zf->block_starts[block_idx-1];
+  return 0;
+}
 
-  zf->fseek_flag = 1;
-  if (fseek(zf->fp, block->offset, SEEK_SET)) {
-    fprintf(stderr, "Failed to seek to block %" PRIu64 " offset %" PRIu64 "\n",
-            block_idx, block->offset);
-    return 1;
+
+static const char *findPattern(const char *s, u64 len, const char *pat,
+                               u64 pat_len) {
+  const char *end = s + len, *p;
+  u64 i = 0;
+
+  if (len < pat_len) return NULL;
+
+#ifdef USE_SSE2_SEARCH
+  /* Check 16 positions at a time for the first, middle, and last
+     characters of the pattern, and compare the rest only where all
+     three match. */
+  if (pat_len >= 2) {
+    u64 mid = pat_len / 2;
+    __m128i first = _mm_set1_epi8(pat[0]);
+    __m128i middle = _mm_set1_epi8(pat[mid]);
+    __m128i last = _mm_set1_epi8(pat[pat_len-1]);
+    unsigned mask;
+
+    for (; i + 16 + pat_len - 1 <= len; i += 16) {
+      __m128i a = _mm_loadu_si128((const __m128i*) (s + i));
+      __m128i b = _mm_loadu_si128((const __m128i*) (s + i + mid));
+      __m128i c = _mm_loadu_si128((const __m128i*) (s + i + pat_len - 1));
+      mask = _mm_movemask_epi8
+        (_mm_and_si128(_mm_and_si128(_mm_cmpeq_epi8(a, first),
+                                     _mm_cmpeq_epi8(b, middle)),
+                       _mm_cmpeq_epi8(c, last)));
+      while (mask) {
+        int bit = __builtin_ctz(mask);
+        if (!memcmp(s + i + bit, pat, pat_len)) return s + i + bit;
+        mask &= mask - 1;
+      }
+    }
   }
+#endif
 
-  b->lines_size = block_line_count;
-  line_bytes = b->lines_size * sizeof(ZlineIndexLine);
+  /* look for the first character with memchr, and check the rest */
+  for (p = s + i; p + pat_len <= end; p++) {
+    p = (const char*) memchr(p, pat[0], end - p - pat_len + 1);
+    if (!p) break;
+    if (!memcmp(p, pat, pat_len)) return p;
+  }
 
-  /* Read line index */
-  if (isBlockLineIndexCompressed(block)) {
-    uint64_t compressed_index_len;
-    if (1 != fread(&compressed_index_len, sizeof compressed_index_len, 1,
-                   zf->fp))
-      goto fail;
+  return NULL;
+}
 
-    b->line_index_size = compressed_index_len;
 
-    bytes_read = decompressFromFile(zf, b->lines, line_bytes,
-                                    compressed_index_len, 0);
-  } else {
-    b->line_index_size = line_bytes;
-    bytes_read = fread(b->lines, 1, line_bytes, zf->fp);
-  }
-  if (bytes_read != line_bytes)
-    goto fail;
+ZLINE_EXPORT int64_t ZlineFile_find_key
+  (ZlineFile zf, const char *key, uint64_t key_len, uint64_t *count) {
+  const char *k;
+  u64 k_len, lo, hi, mid, block, i, first, block_lines, n = 0;
 
-  /* If the block is small enough, decompress it all into memory now.
-     If it's large, don't load the content into memory. */
-  if (block_line_count == 1 &&
-      block->decompressed_length > MAX_IN_MEMORY_BLOCK) {
-    b->content_size = 0;
-  } else {
-    contentInsureCapacity(zf->read_block, block->decompressed_length);
+  if (count) *count = 0;
+  if (zf->mode != ZLINE_MODE_READ || !zf->has_keys || zf->blocks_size == 0)
+    return -1;
 
-    /* Read compressed content */
-    b->content_size = block->decompressed_length;
-    bytes_read = decompressFromFile(zf, b->content, b->content_size,
-                                    getBlockCompressedLen(block), 0);
-    if (bytes_read != b->content_size)
-      goto fail;
+  /* Find the first block whose first key is not less than 'key'. The
+     first match is either in the block before it, or its first line. */
+  lo = 0;
+  hi = zf->blocks_size;
+  while (lo < hi) {
+    mid = lo + (hi - lo) / 2;
+    blockLineKey(zf, mid, 0, &k, &k_len);
+    if (compareKeys(zf, k, k_len, key, key_len) < 0)
+      lo = mid + 1;
+    else
+      hi = mid;
+  }
+  block = lo;
+  i = 0;
+
+  /* search the lines of the block before it, after its first line */
+  if (block > 0) {
+    block--;
+    block_lines = ZlineFile_get_block_line_count(zf, block);
+    lo = 1;
+    hi = block_lines;
+    while (lo < hi) {
+      mid = lo + (hi - lo) / 2;
+      if (blockLineKey(zf, block, mid, &k, &k_len)) return -1;
+      if (compareKeys(zf, k, k_len, key, key_len) < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+    i = lo;
+    if (i == block_lines) {
+      block++;
+      i = 0;
+    }
+  }
+  first = ZlineFile_get_block_first_line(zf, block) + i;
+
+  /* Count the lines with this key, which may continue into later
+     blocks. Without 'count' just check the first one. */
+  for (; block < zf->blocks_size; block++, i = 0) {
+    block_lines = ZlineFile_get_block_line_count(zf, block);
+    for (; i < block_lines; i++) {
+      if (blockLineKey(zf, block, i, &k, &k_len)) return -1;
+      if (compareKeys(zf, k, k_len, key, key_len)) goto done;
+      n++;
+      if (!count) goto done;
+    }
   }
 
-  return 0;
-
-fail:
-  fprintf(stderr, "Failed to read block %" PRIu64 "\n", block_idx);
-  return 1;
+ done:
+  if (n == 0) return -1;
+  if (count) *count = n;
+  return first;
 }
 
 
-/* Reads a line from the file and returns it as a string.
-   The result has been allocated with malloc(); the caller is responsible
-   for deallocating it with free().
+void lineFieldKey(const char *line, uint64_t len, int field, char delimiter,
+                  const char **key, uint64_t *key_len) {
+  u64 start = 0, end;
 
-   If line_idx is invalid, a memory allocation failed, or an error was
-   encountered reading the file, this will return NULL.
-*/
-ZLINE_EXPORT char *ZlineFile_get_line(ZlineFile zf, uint64_t line_idx) {
-  int64_t len = ZlineFile_line_length(zf, line_idx);
-  char *buf, *result;
+#define isDelimiter(c) \
+  (delimiter ? (c) == delimiter : ((c) == ' ' || (c) == '\t'))
 
-  if (len < 0) return NULL;
-  
-  buf = (char*) malloc(len + 1);
-  if (buf == NULL) {
-    fprintf(stderr, "Out of memory reading line %" PRIu64 " containing %"
-            PRIi64 " bytes\n", line_idx, len);
-    return NULL;
+  for (; field > 0 && start < len; field--) {
+    while (start < len && !isDelimiter(line[start])) start++;
+    if (start < len) start++;
   }
-  
-  result = ZlineFile_get_line2(zf, line_idx, buf, len+1, 0);
-
-  if (result == NULL)
-    free(buf);
 
-  return result;
-}
+  end = start;
+  while (end < len && !isDelimiter(line[end])) end++;
 
+#undef isDelimiter
 
-/* Like ZlineFile_get_line, but rather than copying the whole line, it
-   copies part of line starting 'offset' bytes from its beginning.
+  *key = line + start;
+  *key_len = end - start;
+}
 
-   The results are written to 'buf', including a nul terminating
-   byte. If the results are longer than buf_len bytes, only the first
-   'buf_len'-1 bytes and a nul terminator are copied to 'buf'.
 
-   If 'offset' is past the end of the string, a zero-length string
-   is returned.
+/* Parse an integer key: an optional sign, then digits. Anything after
+   them is ignored. */
+static i64 keyNumber(const char *s, u64 len) {
+  u64 i = 0, value = 0;
+  int is_negative = 0;
 
-   Returns NULL on error, otherwise it returns 'buf'.
-*/
-ZLINE_EXPORT char *ZlineFile_get_line2
-  (ZlineFile zf, uint64_t line_idx,
-   char *buf, uint64_t buf_len, uint64_t offset) {
-  
-  ZlineIndexLine *line;
-  ZlineBlock *block;
-  int64_t file_pos = -1, copy_len;
+  if (len > 0 && (s[0] == '-' || s[0] == '+')) {
+    is_negative = s[0] == '-';
+    i++;
+  }
+  for (; i < len && s[i] >= '0' && s[i] <= '9'; i++)
+    value = value * 10 + (s[i] - '0');
 
-  assert(zf);
+  return is_negative ? -(i64)value : (i64)value;
+}
 
-  if (line_idx >= zf->line_count) return NULL;
 
-  zf->fseek_flag = 0;
+static int compareKeys(ZlineFile zf, const char *a, u64 a_len,
+                       const char *b, u64 b_len) {
+  i64 x, y;
+  int result;
 
-  /* save the file position in case we need to return to it */
-  if (zf->mode == ZLINE_MODE_CREATE) {
-    assert(zf->write_block);
-    file_pos = zf->write_block->offset;
-    /* XXX expensive assert */
-    assert(file_pos == ftell(zf->fp));
+  if (zf->key_flags & ZLINE_KEY_NUMERIC) {
+    x = keyNumber(a, a_len);
+    y = keyNumber(b, b_len);
+    return x < y ? -1 : x > y;
   }
-  
-  /* Load the block containing this line, either into write_block
-     or read_block. */
-  loadLine(zf, line_idx, &line, &block);
 
-  copy_len = 0;
+  result = MIN(a_len, b_len) ? memcmp(a, b, MIN(a_len, b_len)) : 0;
+  if (result) return result;
+  return a_len < b_len ? -1 : a_len > b_len;
+}
 
-  if (line->length > 0 && offset < line->length) {
-    
-    copy_len = MIN(line->length - offset, buf_len-1);
 
-    /* If the line was loaded into memory, copy it to the result buffer */
-    if (block->content_size > 0) {
-      memcpy(buf, block->content + line->offset + offset, copy_len);
-    }
+static int addFence(ZlineFile zf, const char *key, u64 len) {
+  u64 capacity;
 
-    /* if the line was long, loadLine will leave it on disk. Decompress
-       it straight to the buffer. */
-    else {
-      ZlineIndexBlock *index_block;
-      i64 compressed_len, decompressed_len;
-      assert(block->lines_size == 1);
-      assert(block == zf->read_block);
-      assert(zf->blocks_size > block->idx);
-      
-      index_block = zf->blocks + block->idx;
-      assert(index_block->offset == block->offset);
-      assert(!isBlockLineIndexCompressed(index_block));
-      
-      fseek(zf->fp, block->offset + block->line_index_size, SEEK_SET);
-      compressed_len = getBlockCompressedLen(index_block);
-      
-      decompressed_len = decompressFromFile(zf, buf, copy_len,
-                                            compressed_len, offset);
-      if (decompressed_len != (i64)copy_len) {
-        fprintf(stderr, "Failed to decompress line %" PRIu64 " from file\n",
-                line_idx);
-        goto fail;
-      }
-    }
+  if (zf->fence_count == zf->fence_ends_capacity) {
+    u64 *ends;
+    capacity = MAX(zf->fence_ends_capacity * 2, INITIAL_BLOCK_CAPACITY);
+    ends = (u64*) realloc(zf->fence_ends, sizeof(u64) * capacity);
+    if (!ends) return -1;
+    zf->fence_ends = ends;
+    zf->fence_ends_capacity = capacity;
   }
 
-  buf[copy_len] = 0;
+  if (zf->fences_size + len > zf->fences_capacity) {
+    char *fences;
+    capacity = MAX(zf->fences_capacity * 2, zf->fences_size + len);
+    fences = (char*) realloc(zf->fences, capacity);
+    if (!fences) return -1;
+    zf->fences = fences;
+    zf->fences_capacity = capacity;
+  }
 
- fail:
-  /* restore the file pointer */
-  if (zf->fseek_flag && file_pos != -1)
-    fseek(zf->fp, file_pos, SEEK_SET);
-  
-  return buf;
+  memcpy(zf->fences + zf->fences_size, key, len);
+  zf->fences_size += len;
+  zf->fence_ends[zf->fence_count++] = zf->fences_size;
+  return 0;
 }
-              
 
-/* Returns the number of compressed blocks in the file.
-   If the file is open in write mode, this may under-report the block
-   count by one. */
-ZLINE_EXPORT uint64_t ZlineFile_get_block_count(ZlineFile zf) {
-  assert(zf);
-  return zf->blocks_size;
-}
 
+static int setLastKey(ZlineFile zf, const char *key, u64 len) {
+  if (len > zf->last_key_capacity) {
+    char *last_key = (char*) realloc(zf->last_key, len);
+    if (!last_key) return -1;
+    zf->last_key = last_key;
+    zf->last_key_capacity = len;
+  }
 
-/* Fetches the decompressed size of the given block.
-   If block_idx is invalid, returns 0. */
-ZLINE_EXPORT uint64_t ZlineFile_get_block_size_original
-(ZlineFile zf, uint64_t block_idx) {
-  assert(zf);
-  if (block_idx >= zf->blocks_size) return 0;
-  return zf->blocks[block_idx].decompressed_length;
+  memcpy(zf->last_key, key, len);
+  zf->last_key_len = len;
+  return 0;
 }
 
 
-/* Fetches the compressed size of the given block.
-   If block_idx is invalid, returns 0. */
-ZLINE_EXPORT uint64_t ZlineFile_get_block_size_compressed
-(ZlineFile zf, uint64_t block_idx) {
-  assert(zf);
-  if (block_idx >= zf->blocks_size) return 0;
-  return getBlockCompressedLen(zf->blocks + block_idx);
+static int writeFences(ZlineFile zf) {
+  if (zf->fence_count == 0) return 0;
+  if (fwrite(zf->fence_ends, sizeof(u64), zf->fence_count, zf->fp)
+      != zf->fence_count ||
+      fwrite(zf->fences, 1, zf->fences_size, zf->fp) != zf->fences_size)
+    return -1;
+  return 0;
 }
 
 
-/* Returns the index of the first line in the block.
-   If block_idx is invalid, returns 0. */
-ZLINE_EXPORT uint64_t ZlineFile_get_block_first_line
-(ZlineFile zf, uint64_t block_idx) {
-  assert(zf);
-  if (block_idx >= zf->blocks_size) return 0;
-
-  if (block_idx == 0)
-    return 0;
-  else
-    return zf->block_starts[block_idx - 1];
-}
+static int readFences(ZlineFile zf) {
+  u64 n = zf->blocks_size, ends_len = sizeof(u64) * zf->blocks_size, i;
 
+  if (!zf->has_keys) return 0;
 
-/* Returns the number of lines stored in the block.
-   If block_idx is invalid, returns 0. */
-ZLINE_EXPORT uint64_t ZlineFile_get_block_line_count
-(ZlineFile zf, uint64_t block_idx) {
-  u64 block_start, block_end;
+  if (zf->fence_offset < zf->data_offset ||
+      zf->fence_offset > zf->index_offset ||
+      ends_len > zf->index_offset - zf->fence_offset)
+    goto bad;
 
-  assert(zf);
-  if (block_idx >= zf->blocks_size) return 0;
+  zf->fence_ends = (u64*) malloc(ends_len);
+  if (!zf->fence_ends ||
+      readFromFile(zf, zf->fence_ends, ends_len, zf->fence_offset))
+    return -1;
+  zf->fence_count = zf->fence_ends_capacity = n;
+
+  for (i=1; i < n; i++)
+    if (zf->fence_ends[i] < zf->fence_ends[i-1]) goto bad;
+  zf->fences_size = n ? zf->fence_ends[n-1] : 0;
+  if (zf->fences_size > zf->index_offset - zf->fence_offset - ends_len)
+    goto bad;
+
+  zf->fences = (char*) malloc(zf->fences_size + 1);
+  if (!zf->fences ||
+      readFromFile(zf, zf->fences, zf->fences_size,
+                   zf->fence_offset + ends_len))
+    return -1;
+  zf->fences_capacity = zf->fences_size + 1;
 
-  block_start = (block_idx == 0)
-    ? 0
-    : zf->block_starts[block_idx-1];
-  block_end = (block_idx == zf->blocks_size-1)
-    ? zf->line_count
-    : zf->block_starts[block_idx];
+  return 0;
 
-  return block_end - block_start;
+ bad:
+  fprintf(stderr, "Invalid key fences in \"%s\"\n", zf->filename);
+  return -1;
 }
 
 
-ZLINE_EXPORT uint64_t ZlineFile_get_block_offset
-  (ZlineFile zf, uint64_t block_idx) {
-  if (block_idx >= zf->blocks_size) return 0;
-  return zf->blocks[block_idx].offset;
-}
+static int blockLineKey(ZlineFile zf, u64 block_idx, u64 i,
+                        const char **key, u64 *key_len) {
+  ZlineBlock *b;
+  ZlineIndexLine *line;
 
+  if (i == 0) {
+    *key = zf->fences + fenceStart(zf, block_idx);
+    *key_len = zf->fence_ends[block_idx] - fenceStart(zf, block_idx);
+    return 0;
+  }
 
-/* Return the offset in the file where the block index starts */
-ZLINE_EXPORT uint64_t ZlineFile_get_block_index_offset(ZlineFile zf) {
-  return zf->index_offset;
+  b = getBlock(zf, block_idx);
+  if (!b) return -1;
+  line = b->lines + i;
+  lineKey(zf, b->content + line->offset, line->length, key, key_len);
+  return 0;
 }
@@ -19,6 +19,42 @@
 struct ZlineFile;
 typedef struct ZlineFile* ZlineFile;
 
+/* A line returned by ZlineFile_get_line_view. 'data' is not
+   nul-terminated. 'pin' is for internal use. */
+typedef struct {
+  const char *data;
+  uint64_t length;
+  void *pin;
+} ZlineView;
+
+/* Iterates through a range of lines. See ZlineIterator_create. */
+struct ZlineIterator;
+typedef struct ZlineIterator* ZlineIterator;
+
+/* A read cursor on a ZlineFile. See ZlineCursor_create. */
+struct ZlineCursor;
+typedef struct ZlineCursor* ZlineCursor;
+
+/* Reads lines in background threads. See ZlineAsync_create. */
+struct ZlineAsync;
+typedef struct ZlineAsync* ZlineAsync;
+
+/* The result of a request to a ZlineAsync. Line first_line+i is
+   data + offsets[i], lengths[i] bytes long and followed by a nul byte.
+   If status is -1 there was an error, and data is NULL.
+   Free it with ZlineCompletion_free. */
+typedef struct {
+  void *arg;
+  uint64_t first_line, line_count;
+  int status;
+  char *data;
+  uint64_t *offsets, *lengths;
+} ZlineCompletion;
+
+/* Called by a ZlineAsync thread when a request finishes. The callback
+   owns 'c' and must eventually call ZlineCompletion_free on it. */
+typedef void (*ZlineAsyncCallback)(void *arg, ZlineCompletion *c);
+
 
 #ifdef __CYGWIN__
 #define ZLINE_EXPORT __attribute__ ((visibility ("default")))
@@ -47,6 +83,43 @@ ZLINE_EXPORT ZlineFile ZlineFile_create(const char *filename);
 ZLINE_EXPORT ZlineFile ZlineFile_create2(const char *filename,
                                           uint64_t block_size);
 
+
+/* Like ZlineFile_create2, but full blocks are compressed by
+   'thread_count' background threads, each with its own compression
+   context, and a separate thread writes them to the file in order.
+   The caller can keep adding lines while earlier blocks are being
+   compressed.
+
+   If thread_count is 0, blocks are compressed on the calling thread,
+   as with ZlineFile_create2.
+*/
+ZLINE_EXPORT ZlineFile ZlineFile_create3(const char *filename,
+                                          uint64_t block_size,
+                                          int thread_count);
+
+
+/* Open an existing zlines file to add more lines to it. The index at
+   the end of the file is cut off, new blocks are written where it was,
+   and ZlineFile_close writes a new index and header. The existing
+   lines can still be read while new ones are added.
+
+   If the file has a dictionary or a codec (see ZlineFile_set_codec),
+   new blocks are compressed with them too.
+   Files written in the older v2.0 format can't be appended to; read
+   them and write a new file instead.
+
+   Until ZlineFile_close finishes, the file has no index and can't be
+   read. Returns NULL on error.
+*/
+ZLINE_EXPORT ZlineFile ZlineFile_open_append(const char *filename);
+
+
+/* Like ZlineFile_open_append, but with the block size and background
+   threads of ZlineFile_create3. */
+ZLINE_EXPORT ZlineFile ZlineFile_open_append2(const char *filename,
+                                              uint64_t block_size,
+                                              int thread_count);
+
   
 /* Open an existing zlines file for reading.
    Use the result as the 'zf' argument to other functions in this module.
@@ -55,6 +128,187 @@ ZLINE_EXPORT ZlineFile ZlineFile_create2(const char *filename,
 ZLINE_EXPORT ZlineFile ZlineFile_read(const char *filename);
 
 
+/* Like ZlineFile_read, but keep recently used blocks in memory after
+   they are decompressed, using up to cache_size bytes. This helps when
+   lines are accessed out of order, alternating between a few blocks.
+
+   Whatever cache_size is, at least one block will be kept in memory;
+   with a cache_size of 0 this is the same as ZlineFile_read.
+*/
+ZLINE_EXPORT ZlineFile ZlineFile_read2(const char *filename,
+                                       uint64_t cache_size);
+
+
+/* Like ZlineFile_read2, but the file is memory-mapped. Blocks are
+   decompressed in one call straight from the mapped data, and if the
+   index was written uncompressed (see ZlineFile_set_index_compression)
+   it is used in place, so opening a large file costs almost nothing.
+
+   If the file cannot be mapped, it is read normally.
+*/
+ZLINE_EXPORT ZlineFile ZlineFile_read_mmap(const char *filename,
+                                           uint64_t cache_size);
+
+
+/* Select whether the index at the end of the file will be compressed.
+   It is compressed by default. An uncompressed index is larger, but
+   ZlineFile_read_mmap can use it without reading or decompressing it.
+   Returns -1 if the file is not open for writing, or 0 on success. */
+ZLINE_EXPORT int ZlineFile_set_index_compression(ZlineFile zf, int compress);
+
+
+/* Add every line in a buffer of text, such as a memory-mapped text
+   file, using thread_count threads (0: one per processor). Lines end
+   with "\n" or "\r\n", which are not stored, and a final line without a
+   newline is added too. The text is split into pieces at newlines, and
+   each thread packs the lines of its pieces into blocks and compresses
+   them, so this is much faster than adding lines one at a time.
+   Each piece starts a new block, so blocks are split a little
+   differently than by ZlineFile_add_line.
+   Returns -1 if the file is not open for writing or on error, or 0 on
+   success. */
+ZLINE_EXPORT int ZlineFile_add_text(ZlineFile zf, const char *text,
+                                    uint64_t length, int thread_count);
+
+
+/* Compress the content of every block with a zstd dictionary. The
+   dictionary is stored in the file, so readers need nothing extra.
+   With a dictionary trained on data like the file's, small blocks
+   (which make random access fast) compress nearly as well as large ones.
+   Must be called before any lines are added.
+   Returns -1 if the file is not open for writing, lines have already
+   been added, or a dictionary was already set, or 0 on success. */
+ZLINE_EXPORT int ZlineFile_set_dictionary(ZlineFile zf, const void *dict,
+                                          uint64_t dict_size);
+
+
+/* Train a zstd dictionary of up to dict_capacity bytes from sample_count
+   samples (typically lines), which are stored back to back in 'samples'.
+   A sample about 100 times the size of the dictionary works well.
+   Returns the size of the dictionary written to 'dict', or -1 on error,
+   for example if there isn't enough sample data. */
+ZLINE_EXPORT int64_t ZlineFile_train_dictionary
+  (void *dict, uint64_t dict_capacity, const char *samples,
+   const uint64_t *sample_lengths, uint64_t sample_count);
+
+
+/* Codecs for ZlineFile_set_codec. */
+#define ZLINE_CODEC_NONE 0
+#define ZLINE_CODEC_NT2 1
+#define ZLINE_CODEC_REF 2
+
+/* Select a codec that is applied to the content of each block before it
+   is compressed with zstd.
+
+   ZLINE_CODEC_NT2 is for DNA or RNA sequence. A, C, G, and T are packed
+   into 2 bits each, and anything else (N, gaps, IUPAC codes, lowercase)
+   is kept in a list of exceptions, so zstd has about a quarter as many
+   bytes to compress and decompress. Blocks that aren't mostly
+   nucleotides, and lines long enough to be split into frames, are
+   stored without it.
+
+   ZLINE_CODEC_REF is for lines that are nearly alike, such as the rows
+   of a multiple sequence alignment. Each block gets a reference line,
+   the consensus of its lines column by column, and each line is stored
+   as the runs of characters where it differs from the reference. To
+   read a line, the reference is copied and those runs are written over
+   it. Blocks where this doesn't save at least half the space are
+   stored without it.
+
+   Applies to blocks written after the call. Files with blocks packed
+   this way can't be read by versions of this library without the codec.
+   Returns -1 if the file is not open for writing or the codec is
+   unknown, or 0 on success. */
+ZLINE_EXPORT int ZlineFile_set_codec(ZlineFile zf, int codec);
+
+
+/* Store a filter with each block that records which k-mers (substrings
+   of length k, within a line) occur in it, so ZlineFile_search can skip
+   blocks that can't contain a pattern without decompressing them. Each
+   k-mer sets one bit of a filter_size-byte filter, so a false positive
+   is possible but a false negative is not. If filter_size is 0, it is
+   1/8 of the block size: one bit per byte of content.
+
+   A pattern needs all of its k-mers to be present, so even with about
+   half the bits set, a pattern 10 or 20 bytes longer than k rules out
+   nearly every block that doesn't contain it. k should be a little
+   shorter than the shortest pattern that will be searched for, such as
+   16 for 20-30 base motifs; shorter patterns search every block.
+   Blocks holding one very long line fill their filter and are always
+   searched.
+
+   Must be called before any lines are added. Files with filters can't
+   be read by versions of this library without them.
+   Returns -1 if the file is not open for writing, lines have already
+   been added, or k (1..256) or filter_size (up to 512 MiB) is out of
+   range, or 0 on success. */
+ZLINE_EXPORT int ZlineFile_set_kmer_filter(ZlineFile zf, int k,
+                                          uint64_t filter_size);
+
+
+/* Flags for ZlineFile_set_sorted_key. */
+#define ZLINE_KEY_NUMERIC 1
+
+/* Declare that the lines will be added in order by a key, so they can
+   be looked up by key with ZlineFile_find_key. The key of a line is
+   field 'field' (starting from 0), where fields are separated by
+   'delimiter', or by spaces and tabs if delimiter is 0. For example,
+   field 0 of a FASTQ header line is the read name. Keys are compared
+   byte by byte, as with "LC_ALL=C sort", or as integers (an optional
+   sign and then digits) with ZLINE_KEY_NUMERIC. Lines with equal keys
+   are allowed.
+
+   The key of the first line of each block is stored in the file. A line
+   that is out of order is refused by ZlineFile_add_line or
+   ZlineFile_add_text, which return -1.
+
+   Must be called before any lines are added. Files with keys can't be
+   read by versions of this library without them.
+   Returns -1 if the file is not open for writing, lines have already
+   been added, or the arguments are invalid, or 0 on success. */
+ZLINE_EXPORT int ZlineFile_set_sorted_key(ZlineFile zf, int field,
+                                         char delimiter, int flags);
+
+/* If the file is sorted by key, set any of *field, *delimiter, and
+   *flags that aren't NULL to the arguments of ZlineFile_set_sorted_key
+   and return 0. Otherwise return -1. */
+ZLINE_EXPORT int ZlineFile_get_sorted_key(ZlineFile zf, int *field,
+                                         char *delimiter, int *flags);
+
+
+/* Values for ZlineFile_set_fixed_width other than a width. */
+#define ZLINE_FIXED_WIDTH_AUTO -1
+#define ZLINE_FIXED_WIDTH_OFF -2
+
+/* A block whose lines all have the same length, such as the rows of an
+   alignment matrix, is stored without a line index: the offset of each
+   line is its position in the block times the width. That saves the
+   index's space in the file and the time to read and decode it.
+
+   With ZLINE_FIXED_WIDTH_AUTO this is done for any block of two or
+   more lines of the same length. With a width, every line must have
+   that length; ZlineFile_add_line and ZlineFile_add_text fail on any
+   other line. Either way, versions of this library without fixed-width
+   blocks can't read the file, so by default (ZLINE_FIXED_WIDTH_OFF)
+   every line index is stored.
+
+   The file's header keeps the setting for ZlineFile_open_append: a
+   width is still required, and a file with no fixed-width blocks is
+   continued with ZLINE_FIXED_WIDTH_OFF. Call this again after opening
+   the file to change it.
+
+   Returns -1 if the file is not open for writing, the lines already
+   added don't have the given width, or the argument is invalid, or 0
+   on success. */
+ZLINE_EXPORT int ZlineFile_set_fixed_width(ZlineFile zf, int64_t width);
+
+/* Returns the length of every line in the file if they all have the
+   same length, or -1 if they don't. When a file is read, that is only
+   known if it has fixed-width blocks. */
+ZLINE_EXPORT int64_t ZlineFile_get_fixed_width(ZlineFile zf);
+
+
+
 /* If the file is open for writing, this finishes writing the file.
    The file is closed, and any memory allocated internally is deallocated. */
 ZLINE_EXPORT void ZlineFile_close(ZlineFile zf);
@@ -75,13 +329,30 @@ ZLINE_EXPORT int ZlineFile_add_line2(ZlineFile zf, const char *line,
 ZLINE_EXPORT uint64_t ZlineFile_line_count(ZlineFile zf);
 
   
-/* Returns the length of the given line or -1 if there is no such line. */
+/* Returns the length of the given line or -1 if there is no such line.
+   If the line's block isn't cached, only the block's line index is read;
+   the content is not decompressed. */
 ZLINE_EXPORT int64_t ZlineFile_line_length(ZlineFile zf, uint64_t line_idx);
 
+/* Store the lengths of lines first_line..first_line+count-1 in
+   lengths[0..count-1]. Like ZlineFile_line_length, this reads only
+   line indexes, never line content.
+   Returns 0 on success or -1 on error or if the range is out of bounds. */
+ZLINE_EXPORT int ZlineFile_line_lengths(ZlineFile zf, uint64_t first_line,
+                                        uint64_t count, uint64_t *lengths);
+
   
 /* Returns the length of the longest line. */
 ZLINE_EXPORT uint64_t ZlineFile_max_line_length(ZlineFile zf);
 
+
+/* Returns the length of the shortest line added while writing, or 0
+   if there are none. The header doesn't record it, so in a file that
+   has been read or opened for appending it is only known if every line
+   has the same length (see ZlineFile_get_fixed_width); otherwise this
+   returns 0. */
+ZLINE_EXPORT uint64_t ZlineFile_min_line_length(ZlineFile zf);
+
   
 /* Reads a line from the file and returns it as a string.
    The result has been allocated with malloc(); the caller is responsible
@@ -107,6 +378,219 @@ ZLINE_EXPORT char *ZlineFile_get_line2
    char *buf, uint64_t buf_len, uint64_t offset);
 
 
+/* A ZlineFile is not thread-safe, but once it has been opened for
+   reading, any number of threads can read lines from it concurrently
+   if each uses its own cursor. A cursor has its own decompression
+   context and its own decompressed block, and the file is read with
+   pread() so threads don't share a file position.
+
+   Returns NULL if zf was not opened for reading.
+   Close every cursor before closing the file. */
+ZLINE_EXPORT ZlineCursor ZlineCursor_create(ZlineFile zf);
+
+/* Deallocate a cursor. */
+ZLINE_EXPORT void ZlineCursor_close(ZlineCursor cursor);
+
+/* Like ZlineFile_line_length, ZlineFile_get_line, and
+   ZlineFile_get_line2, but using the cursor's own state. */
+ZLINE_EXPORT int64_t ZlineCursor_line_length
+  (ZlineCursor cursor, uint64_t line_idx);
+ZLINE_EXPORT char *ZlineCursor_get_line
+  (ZlineCursor cursor, uint64_t line_idx);
+ZLINE_EXPORT char *ZlineCursor_get_line2
+  (ZlineCursor cursor, uint64_t line_idx,
+   char *buf, uint64_t buf_len, uint64_t offset);
+
+
+
+/* Get a line without copying it. view->data is set to point to the
+   line in the decompressed block, and the block is pinned in the cache
+   until the view is released with ZlineFile_release_view, so it stays
+   valid even as other blocks are read. Release views promptly: pinned
+   blocks aren't counted against the cache size when deciding what to
+   evict, so many outstanding views can keep many blocks in memory.
+
+   Only available on files open for reading. Release every view before
+   closing the file.
+
+   Returns 0 on success, or -1 if the line number is invalid, the file
+   isn't open for reading, or there was a read error.
+*/
+ZLINE_EXPORT int ZlineFile_get_line_view
+  (ZlineFile zf, uint64_t line_idx, ZlineView *view);
+
+/* Release a view returned by ZlineFile_get_line_view. It's OK to
+   release a view that was not set because of an error. */
+ZLINE_EXPORT void ZlineFile_release_view(ZlineFile zf, ZlineView *view);
+
+
+/* Iterate through lines [first_line, end_line) of a file open for
+   reading, in order, or in reverse order (end_line-1 down to
+   first_line) if is_reverse is nonzero. Lines are returned as views
+   into the iterator's own decompressed blocks.
+
+   If thread_count is more than 0, that many background threads
+   decompress the blocks ahead of the one being read, so a full pass
+   over a file isn't limited by the speed of one decompressor.
+
+   Returns NULL if the file isn't open for reading or the range is
+   invalid. An empty range is OK.
+*/
+ZLINE_EXPORT ZlineIterator ZlineIterator_create
+  (ZlineFile zf, uint64_t first_line, uint64_t end_line, int is_reverse,
+   int thread_count);
+
+/* Get the next line. view is set to point to it, and it remains
+   valid until the next call to ZlineIterator_next or ZlineIterator_close.
+   Don't call ZlineFile_release_view on it.
+
+   Sets *line_idx (if it's not NULL) to the index of the line.
+   Returns 1 if a line was returned, 0 at the end of the range,
+   or -1 on a read error.
+*/
+ZLINE_EXPORT int ZlineIterator_next
+  (ZlineIterator it, ZlineView *view, uint64_t *line_idx);
+
+/* Stop the background threads and deallocate the iterator. */
+ZLINE_EXPORT void ZlineIterator_close(ZlineIterator it);
+
+
+/* Start thread_count threads (the number of CPUs if thread_count <= 0)
+   to read lines of zf, which must be open for reading, in the
+   background. ZlineAsync_submit queues a request and returns at once,
+   so one thread can keep thousands of requests in flight.
+
+   Requests are split by block, and all the queued requests for one
+   block share a single read and decode of it, so many requests for
+   nearby lines cost little more than one.
+
+   Returns NULL if zf isn't open for reading or out of memory.
+   Close it before closing zf. */
+ZLINE_EXPORT ZlineAsync ZlineAsync_create(ZlineFile zf, int thread_count);
+
+/* Request lines [first_line, first_line+line_count). When they have
+   been read, callback(arg, completion) is called on one of the
+   background threads, or if callback is NULL the completion is queued
+   for ZlineAsync_poll. completion->arg is set to arg either way.
+
+   Returns 0 if the request was queued, or -1 if the range is invalid
+   or empty, or out of memory. */
+ZLINE_EXPORT int ZlineAsync_submit
+  (ZlineAsync za, uint64_t first_line, uint64_t line_count,
+   ZlineAsyncCallback callback, void *arg);
+
+/* Get the next finished request that was submitted without a callback,
+   in the order they finished. If none is ready, returns NULL, or if
+   'wait' is nonzero, waits for one; it returns NULL only if there are
+   no such requests left in flight. */
+ZLINE_EXPORT ZlineCompletion *ZlineAsync_poll(ZlineAsync za, int wait);
+
+/* The number of requests that have been submitted but whose callback
+   hasn't been called or whose completion hasn't been polled. */
+ZLINE_EXPORT uint64_t ZlineAsync_pending(ZlineAsync za);
+
+/* Finish every request in flight, calling their callbacks, stop the
+   threads, and deallocate za, including completions never polled. */
+ZLINE_EXPORT void ZlineAsync_close(ZlineAsync za);
+
+/* Deallocate a completion from a ZlineAsync. */
+ZLINE_EXPORT void ZlineCompletion_free(ZlineCompletion *c);
+
+
+/* Called by ZlineFile_search for each matching line. 'line' is not
+   nul-terminated, and is only valid until the callback returns.
+   Return nonzero to stop the search. */
+typedef int (*ZlineSearchCallback)(void *arg, uint64_t line_idx,
+                                   const char *line, uint64_t length);
+
+/* Find the lines in [first_line, end_line) that contain any of the
+   pattern_count nul-terminated patterns (plain strings, not regular
+   expressions), and call callback(arg, ...) for each of them in order.
+   callback may be NULL to just count them.
+
+   Blocks are decompressed and searched by thread_count background
+   threads (none if thread_count is 0) while the calling thread reports
+   the matches, so a search of a large file scales with the number of
+   cores rather than running at the speed of one decompressor.
+
+   If the file has k-mer filters (see ZlineFile_set_kmer_filter), blocks
+   whose filter rules out every pattern aren't read at all.
+
+   Returns the number of matching lines reported, or -1 on error. */
+ZLINE_EXPORT int64_t ZlineFile_search
+  (ZlineFile zf, const char *const *patterns, int pattern_count,
+   uint64_t first_line, uint64_t end_line, int thread_count,
+   ZlineSearchCallback callback, void *arg);
+
+
+/* Find the lines whose key is 'key' in a file sorted by key (see
+   ZlineFile_set_sorted_key). The stored keys of the blocks are binary
+   searched, and then the lines of one block, so finding the first
+   matching line decompresses at most one block.
+
+   Returns the index of the first matching line, or -1 if there is none,
+   the file has no keys, or there is an error reading it. If count is
+   not NULL, *count is set to the number of matching lines, which
+   follow the first one. */
+ZLINE_EXPORT int64_t ZlineFile_find_key
+  (ZlineFile zf, const char *key, uint64_t key_len, uint64_t *count);
+
+
+/* Check a block's k-mer filter for a pattern of 'length' bytes.
+   Returns 0 if the block can't contain it, 1 if it might (always, if
+   the file has no filters or the pattern is shorter than k), or -1 if
+   the file is not open for reading or block_idx is invalid. */
+ZLINE_EXPORT int ZlineFile_block_may_contain
+  (ZlineFile zf, uint64_t block_idx, const char *pattern, uint64_t length);
+
+
+/* Read many lines in one call. This is much faster than calling
+   ZlineFile_get_line for each line when many lines are wanted, because
+   the requests are grouped by block, and each block is decompressed
+   only once. See also ZlineFile_set_thread_count.
+
+   line_idx - array of n line numbers, in any order, possibly repeated
+   buf - the lines are copied here in the order requested, each one
+     followed by a nul byte
+   offsets, lengths - arrays of n elements. offsets[i] is set to the
+     position in buf of line line_idx[i], and lengths[i] to its length.
+
+   Returns the number of bytes needed for all the lines, including the
+   nul terminators. If that's more than buf_len, only lengths and
+   offsets are filled in, so the call can be repeated with a big enough
+   buffer. buf may be NULL if buf_len is 0.
+   Returns -1 if any line number is invalid or on a read error.
+*/
+ZLINE_EXPORT int64_t ZlineFile_get_lines
+  (ZlineFile zf, const uint64_t *line_idx, uint64_t n,
+   char *buf, uint64_t buf_len, uint64_t *offsets, uint64_t *lengths);
+
+/* Set the number of threads ZlineFile_get_lines may use to decompress
+   blocks when the file is open for reading. The default is 1.
+   If thread_count is 0, use one per processor.
+   Returns -1 if the file is not open for reading, or 0 on success. */
+ZLINE_EXPORT int ZlineFile_set_thread_count(ZlineFile zf, int thread_count);
+
+
+/* Copy the same columns of a range of lines into a dense tile, such as
+   a window of sites from the rows of an alignment. Bytes [col, col+width)
+   of line first_line+i are copied to out + i*stride, for each i in
+   [0, n_lines). Where a line ends before col+width, the rest of its row
+   is filled with nul bytes. Nothing else is written to out.
+
+   Each block holding the lines is decompressed once, in parallel with
+   the threads set by ZlineFile_set_thread_count. Of a line long enough
+   to be split into frames, only the frames the window overlaps are
+   decompressed.
+
+   Returns the number of lines that ended before col+width, or -1 if
+   the lines are invalid, stride is less than width, or on a read
+   error. */
+ZLINE_EXPORT int64_t ZlineFile_get_window
+  (ZlineFile zf, uint64_t first_line, uint64_t n_lines, uint64_t col,
+   uint64_t width, char *out, uint64_t stride);
+
+
 
 /* The functions below are only useful for looking inside the implementation. */
 
@@ -128,6 +612,10 @@ ZLINE_EXPORT uint64_t ZlineFile_get_block_first_line
   (ZlineFile zf, uint64_t block_idx);
 ZLINE_EXPORT uint64_t ZlineFile_get_block_line_count
   (ZlineFile zf, uint64_t block_idx);
+/* Returns the index of the block containing a line, or -1 if line_idx
+   is invalid. Nothing is read from the file. */
+ZLINE_EXPORT int64_t ZlineFile_get_line_block
+  (ZlineFile zf, uint64_t line_idx);
 ZLINE_EXPORT int ZlineFile_get_line_details
   (ZlineFile zf, uint64_t line_idx, uint64_t *length,
    uint64_t *offset_in_block, uint64_t *block_idx);
@@ -137,6 +625,12 @@ ZLINE_EXPORT uint64_t ZlineFile_get_block_offset
 /* Return the offset in the file where the block index starts */
 ZLINE_EXPORT uint64_t ZlineFile_get_block_index_offset(ZlineFile zf);
 
+/* Returns the number of block lookups that were satisfied from the
+   cache of decompressed blocks, and the number that required reading
+   and decompressing a block. Either pointer may be NULL. */
+ZLINE_EXPORT void ZlineFile_get_cache_stats
+  (ZlineFile zf, uint64_t *hits, uint64_t *misses);
+
 
 
  
@@ -18,6 +18,7 @@
 #include <stdlib.h>
 #include "zstd.h"
 #include "zline_api.h"
+#include "common.h"
 
 /* This the entry for one block of data when the block isn't necessarily
    in memory. */
@@ -47,7 +48,9 @@ typedef struct ZlineIndexBlock {
 */
 
 
-/* One line of data. */
+/* One line of data. In version 2.0 files the line index of each block
+   is an array of these. Since version 2.1 only the lengths are stored,
+   as varints, and the offsets are computed when the index is read. */
 typedef struct ZlineIndexLine {
   /* offset, in the decompressed block, where this line can be found. */
   uint64_t offset;
@@ -85,9 +88,107 @@ typedef struct ZlineBlock {
   */
   uint64_t line_index_size;
 
+  /* Links in the block cache's least-recently-used list. The most
+     recently used block is at the head of the list. */
+  struct ZlineBlock *lru_prev, *lru_next;
+
+  /* Number of ZlineViews pointing into this block's content. A block
+     with views will not be evicted from the cache. */
+  int pin_count;
+
+  /* Set on blocks made just to hold one long line for a ZlineView.
+     These are not in the cache, and are freed when the view is
+     released. */
+  int is_view_copy;
+
 } ZlineBlock;
 
 
+/* Decompressed blocks that are being kept in memory for a file opened
+   for reading. The cache holds at least one block, and it will hold more
+   as long as the total size of the blocks is at most max_bytes. */
+typedef struct ZlineBlockCache {
+  /* Most recently used block is head, least recently used is tail. */
+  ZlineBlock *head, *tail;
+
+  /* Lookup table from block index to cached block, or NULL if that
+     block is not cached. Has blocks_capacity entries. */
+  ZlineBlock **by_index;
+
+  /* number of blocks in the cache */
+  int count;
+
+  /* memory budget and current memory usage, in bytes */
+  uint64_t max_bytes, bytes_used;
+
+  /* number of block lookups that were or were not found in the cache */
+  uint64_t hits, misses;
+} ZlineBlockCache;
+
+
+/* A block that has been handed to the background compression threads.
+   The compressed form (line index followed by compressed content)
+   is written to 'output'. */
+typedef struct ZlineWriteJob {
+  ZlineBlock *block;
+
+  char *output;
+  uint64_t output_capacity;
+
+  /* bytes of output used by the line index and by the content */
+  uint64_t line_index_len, compressed_len;
+
+  /* LINE_INDEX_COMPRESSED_FLAG, CONTENT_FRAMED_FLAG, FIXED_WIDTH_FLAG,
+     and the codec */
+  uint64_t flags;
+
+  /* ZlineFile.fixed_width when the block was queued */
+  int64_t fixed_width;
+
+  /* codec to use for the content, and a buffer for its output */
+  int codec;
+  char *packed;
+  uint64_t packed_capacity;
+
+  /* If filter_len is not 0, a k-mer filter of that many bytes is built
+     at the start of 'output', before the line index. */
+  int filter_k;
+  uint64_t filter_len;
+
+  /* set when the compressed form is ready to be written */
+  int is_compressed;
+} ZlineWriteJob;
+
+
+/* State for writing a file with background threads. Full blocks are
+   queued in 'jobs', which is used as a ring buffer indexed by a
+   sequence number modulo job_count. Compressor threads pick up
+   blocks in order, and the write thread writes each compressed block
+   to the file in order and fills in its entry in the block index. */
+typedef struct ZlineWriter {
+  int thread_count;
+  Thread *compress_threads;
+  Thread write_thread;
+
+  /* protects everything below, as well as ZlineFile.blocks */
+  Mutex lock;
+  CondVar cond;
+
+  ZlineWriteJob *jobs;
+  int job_count;
+
+  /* sequence numbers: jobs [next_write..next_submit) are queued,
+     and [next_compress..next_submit) have not been picked up
+     by a compressor thread */
+  uint64_t next_submit, next_compress, next_write;
+
+  /* offset in the file where the next block will be written */
+  uint64_t write_offset;
+
+  int is_shutdown, is_error;
+} ZlineWriter;
+
+
 /*
   file overhead = header + pad + blocks + lines
     header = 256
@@ -97,11 +198,310 @@ typedef struct ZlineBlock {
 */
 
 
+/* One line requested from ZlineFile_get_lines: the line number and
+   its position in the caller's list. */
+typedef struct {
+  uint64_t line_idx, pos;
+} ZlineLineRequest;
+
+
+/* State shared by the threads working on one ZlineFile_get_lines call.
+   The requests are sorted by line number and split into groups that
+   are each contained in one block, so each block is decoded once. */
+typedef struct ZlineBatch {
+  ZlineFile zf;
+
+  ZlineLineRequest *requests;
+
+  /* requests [group_start[i]..group_start[i+1]) are in block group_block[i] */
+  uint64_t *group_start, *group_block;
+  uint64_t group_count;
+
+  /* the caller's output arrays */
+  char *buf;
+  uint64_t *offsets, *lengths;
+
+  /* 0: fill in lengths from each block's line index,
+     1: decompress each block and copy the lines */
+  int phase;
+
+  /* protects next_group and is_error */
+  Mutex lock;
+  uint64_t next_group;
+  int is_error;
+} ZlineBatch;
+
+
+/* State shared by the threads working on one ZlineFile_get_window call.
+   Each thread takes the next block holding some of the lines and
+   copies their part of the window to the caller's tile. */
+typedef struct ZlineWindow {
+  ZlineFile zf;
+
+  /* lines [first_line..end_line), columns [col..col+width) */
+  uint64_t first_line, end_line, col, width;
+
+  /* the caller's tile, with a row every 'stride' bytes */
+  char *out;
+  uint64_t stride;
+
+  /* protects everything below; blocks [next_block..end_block) have
+     not been taken */
+  Mutex lock;
+  uint64_t next_block, end_block;
+  uint64_t short_count;
+  int is_error;
+} ZlineWindow;
+
+
+/* One block built by ZlineFile_add_text, compressed and waiting to be
+   written: 'output' holds the k-mer filter (if any), the line index, and
+   the content. */
+typedef struct ZlineTextBlock {
+  char *output;
+  uint64_t filter_len, line_index_len, compressed_len;
+
+  /* If the file is sorted by key, the keys of the first and last lines
+     of the block, back to back */
+  char *keys;
+  uint64_t first_key_len, last_key_len;
+
+  /* LINE_INDEX_COMPRESSED_FLAG, CONTENT_FRAMED_FLAG, and the codec */
+  uint64_t flags;
+
+  uint64_t decompressed_length, line_count;
+} ZlineTextBlock;
+
+
+/* A piece of the text given to ZlineFile_add_text, starting at the
+   beginning of a line and ending just after a newline (or at the end
+   of the text). Its lines are packed into blocks of their own. */
+typedef struct ZlineTextSegment {
+  const char *start, *end;
+
+  ZlineTextBlock *blocks;
+  uint64_t block_count, block_capacity;
+
+  uint64_t line_count, min_line_len, max_line_len;
+  int is_done;
+} ZlineTextSegment;
+
+
+/* State shared by the threads of one ZlineFile_add_text call. Worker
+   threads take segments in order, and the calling thread writes their
+   blocks in order. Workers stay at most max_ahead segments ahead of the
+   writer, to limit the memory holding compressed blocks. */
+typedef struct ZlineTextJob {
+  ZlineFile zf;
+  int block_size, codec;
+
+  ZlineTextSegment *segments;
+  uint64_t segment_count;
+
+  /* protects everything below, and ZlineTextSegment.is_done */
+  Mutex lock;
+  CondVar cond;
+  uint64_t next_segment, next_write;
+  uint64_t max_ahead;
+  int is_error;
+} ZlineTextJob;
+
+
+/* State shared by the threads decoding the frames of one long line.
+   Frame i holds bytes [i*frame_size, (i+1)*frame_size) of the line, and
+   the part of it in [first_byte, end_byte) goes to
+   buf + (position - first_byte). */
+typedef struct ZlineFrameJob {
+  ZlineFile zf;
+
+  /* file offset of each frame, and of the end of the last one */
+  uint64_t *frame_offsets;
+  uint64_t frame_size, line_length;
+
+  char *buf;
+  uint64_t first_byte, end_byte;
+
+  /* protects next_frame, ds, and is_error. The first thread to start
+     takes the caller's decompression stream; the others make their own. */
+  Mutex lock;
+  uint64_t next_frame, end_frame;
+  ZSTD_DStream *ds;
+  int is_error;
+} ZlineFrameJob;
+
+
+/* Patterns for ZlineFile_search, and the lines of one block that
+   contain any of them. */
+typedef struct ZlineSearch {
+  const char *const *patterns;
+  uint64_t *lengths;
+  int pattern_count;
+
+  /* If the file has k-mer filters and every pattern is at least k bytes
+     long, probes[p*MAX_FILTER_PROBES + i] for i < probe_counts[p] are
+     filter bits that must be set in any block containing pattern p.
+     Otherwise NULL, and every block is searched. */
+  uint64_t *probes;
+  int *probe_counts;
+} ZlineSearch;
+
+typedef struct ZlineSearchMatches {
+  /* line numbers of the matching lines, in order */
+  uint64_t *lines;
+  uint64_t count, capacity;
+
+  /* one flag per line of the block, set if the line matches */
+  char *marks;
+  uint64_t marks_capacity;
+} ZlineSearchMatches;
+
+
+/* States of a ZlineIterator slot */
+#define ZLINE_SLOT_EMPTY 0
+#define ZLINE_SLOT_DECODING 1
+#define ZLINE_SLOT_READY 2
+#define ZLINE_SLOT_ERROR 3
+
+/* State for iterating through a range of lines. The blocks covering the
+   range are numbered in the order they will be read, and block number
+   s is decoded into slots[s % slot_count], so background threads can
+   fill up to slot_count blocks ahead of the reader. */
+struct ZlineIterator {
+  ZlineFile zf;
+
+  /* the next line to return, and the number of lines left */
+  uint64_t next_line, remaining;
+  int is_reverse;
+
+  /* first and last block of the range; first_block <= last_block */
+  uint64_t first_block, last_block, block_count;
+
+  ZlineBlock **slots;
+  int *slot_state;
+  int slot_count;
+
+  Thread *threads;
+  int thread_count;
+
+  /* used by the reader when there are no background threads */
+  ZSTD_DStream *decompress_stream;
+
+  /* Protects everything below, and slot_state. Block sequence numbers
+     [next_read..next_decode) have been picked up by a thread. */
+  Mutex lock;
+  CondVar cond;
+  uint64_t next_decode, next_read;
+  int is_shutdown;
+
+  /* the slot the reader is currently returning lines from, or -1 */
+  int current_slot;
+
+  /* Set for ZlineFile_search: after decoding a block, a background
+     thread finds its matching lines and stores them in
+     matches[slot]. */
+  const ZlineSearch *search;
+  ZlineSearchMatches *matches;
+};
+
+
+/* The lines of one ZlineAsync request that are in one block. Once its
+   block is decoded, 'data' holds copies of them, each followed by a
+   nul byte, and their offsets in it go in the request's 'offsets'. */
+typedef struct ZlineAsyncPiece {
+  struct ZlineAsyncRequest *request;
+  uint64_t first_line, line_count;
+  char *data;
+  uint64_t data_len;
+
+  /* the next piece waiting for the same block */
+  struct ZlineAsyncPiece *next;
+} ZlineAsyncPiece;
+
+/* One request to a ZlineAsync. The completion is first, so a pointer
+   to it is a pointer to the request. The pieces, offsets, and lengths
+   are allocated along with it. */
+typedef struct ZlineAsyncRequest {
+  ZlineCompletion c;
+  ZlineAsyncCallback callback;
+
+  ZlineAsyncPiece *pieces;
+  uint64_t piece_count, pieces_left;
+
+  /* the next request in the completion queue */
+  struct ZlineAsyncRequest *next;
+} ZlineAsyncRequest;
+
+/* A block to be decoded, and every piece of a request that needs it. */
+typedef struct ZlineAsyncJob {
+  uint64_t block_idx;
+  ZlineAsyncPiece *pieces;
+  struct ZlineAsyncJob *next;
+} ZlineAsyncJob;
+
+/* State of a ZlineAsync. Jobs are decoded in the order they were
+   queued. block_jobs[b] is the queued job for block b, or NULL if there
+   isn't one, so a request for a block that is already waiting to be
+   decoded joins its job rather than making a new one. */
+struct ZlineAsync {
+  ZlineFile zf;
+
+  Thread *threads;
+  int thread_count;
+
+  /* protects everything below */
+  Mutex lock;
+  CondVar work_cond, done_cond;
+
+  ZlineAsyncJob *job_head, *job_tail;
+  ZlineAsyncJob **block_jobs;
+
+  /* finished requests submitted without a callback */
+  ZlineAsyncRequest *done_head, *done_tail;
+
+  /* requests submitted without a callback that haven't finished */
+  uint64_t in_flight_polled;
+
+  /* submitted requests whose callback hasn't been called or whose
+     completion hasn't been polled */
+  uint64_t pending;
+
+  int is_shutdown;
+};
+
+
+/* Per-thread read state. The ZlineFile it refers to is only read. */
+struct ZlineCursor {
+  ZlineFile zf;
+  ZSTD_DStream *decompress_stream;
+
+  /* the most recently read block, or NULL */
+  ZlineBlock *block;
+};
+
+
 struct ZlineFile {
   char *filename;
   FILE *fp;
   int mode;
 
+  /* File descriptor of fp. Blocks are read with pread(), so multiple
+     threads can read the file without sharing a file position. */
+  int fd;
+
+  /* Minor version of the file format, from the header: "zline v2.<n>".
+     Version 2.0 stores each line's offset and length as two u64s in a
+     block's line index. Since 2.1 it stores only lengths, as varints. */
+  int version_minor;
+
+  /* If the file was opened with ZlineFile_read_mmap, the whole file is
+     mapped here, and blocks are decompressed directly from the map. */
+  char *map;
+  uint64_t map_length;
+
+  /* If the index is not compressed and the file is mapped, blocks and
+     block_starts point into the map rather than to allocated memory. */
+  int is_index_mapped;
+
   /* Compressing the index will save space, but if the index is not
      compressed, it would be easier to memory-map the file and access
      data quickly. */
@@ -113,9 +513,69 @@ struct ZlineFile {
      easier to pass a block to another thread. */
   ZlineBlock *write_block;
 
-  /* Current block being read */
+  /* If the file is being written with background threads, this is
+     their state. Otherwise NULL. */
+  struct ZlineWriter *writer;
+
+  /* Number of threads ZlineFile_get_lines may use when reading. */
+  int reader_thread_count;
+
+  /* Most recently used block in the cache */
   ZlineBlock *read_block;
 
+  /* Blocks that have been read and decompressed */
+  ZlineBlockCache cache;
+
+  /* Optional zstd dictionary used for the content of every block. It is
+     stored in the file right after the header, and data_offset is past
+     it. Line indexes are compressed without it. */
+  uint64_t dict_size;
+  ZSTD_CDict *cdict;
+  ZSTD_DDict *ddict;
+
+  /* Codec for the content of new blocks (ZLINE_CODEC_*), and a bit
+     (1 << codec) for each codec blocks in the file may use. Those are
+     listed in the "alg" line of the header, so older readers refuse
+     the file rather than return packed data. */
+  int codec, codecs_used;
+
+  /* If filter_size is not 0, each block is preceded in the file by a
+     filter of that many bytes with a bit set for each k-mer (substring
+     of length filter_k) in its lines. See ZlineFile_set_kmer_filter. */
+  int filter_k;
+  uint64_t filter_size;
+
+  /* The width every new line must have (see ZlineFile_set_fixed_width),
+     or ZLINE_FIXED_WIDTH_AUTO or ZLINE_FIXED_WIDTH_OFF. A required width
+     is written to the header as "fixed_width <w> required". */
+  int64_t fixed_width;
+
+  /* Set if any block is stored without a line index because its lines
+     all have the same length. The header says so with "fixed_width <w>"
+     if every line in the file is w bytes long, or "fixed_blocks" if
+     not, so older readers refuse the file. */
+  int has_fixed_blocks;
+
+  /* If has_keys is set, the lines are sorted by a key (see
+     ZlineFile_set_sorted_key), and 'fences' holds the key of the first
+     line of each block: block i's is [fence_ends[i-1], fence_ends[i]),
+     starting at 0 for block 0. They are stored after the last block,
+     at fence_offset: the fence_ends array followed by the keys. */
+  int has_keys, key_field, key_flags;
+  char key_delimiter;
+  char *fences;
+  uint64_t *fence_ends;
+  uint64_t fence_count, fence_ends_capacity, fences_size, fences_capacity;
+  uint64_t fence_offset;
+
+  /* key of the last line added, to make sure the lines are in order */
+  char *last_key;
+  uint64_t last_key_len, last_key_capacity;
+
+  /* Line index of one block, read without its content, to answer
+     line length queries for blocks that aren't in the cache. */
+  ZlineBlock *index_block;
+
   /* Total number of lines in the file */
   uint64_t line_count;
   
@@ -133,23 +593,40 @@ struct ZlineFile {
   /* Index of the first line in each block. This contains block_count-1
      entries, because the first block always starts with line 0.
      This is a cache of the data in ZlineBlock.first_line.
-     This is sorted, so either a linear search can be used.
+     This is sorted, so it can be binary searched.
   */
   uint64_t *block_starts;
 
-  uint64_t max_line_len;
+  /* When a file with many blocks is read, line_dir[j] is the block
+     containing line j << line_dir_shift, so the block of any line is
+     between line_dir[j] and line_dir[j+1], usually the same block or
+     the next one. There are line_dir_size entries; NULL when writing. */
+  uint64_t *line_dir;
+  uint64_t line_dir_size;
+  int line_dir_shift;
 
-  /* This is set to 1 whenever fseek is called. 
-     When writing the file, the current file offset is always
-     write_block->offset.
-     If a line is read from and earlier block, fseek will need to be called
-     to read the earlier block. If this flag has been set, then the caller
-     will know it needs to restore the file pointer. */
-  int fseek_flag;
+  /* If every block but the last holds this many lines, as they do when
+     the lines have a fixed width, the block containing a line is found
+     by division rather than with line_dir. Otherwise 0. */
+  uint64_t lines_per_block;
+
+  /* Lengths of the shortest and longest lines. When the file is read,
+     min_line_len is only known if the header has "fixed_width";
+     otherwise it is 0. */
+  uint64_t min_line_len, max_line_len;
 
   ZSTD_CStream *compress_stream;
   ZSTD_DStream *decompress_stream;
 };
 
 
+/* Set *key and *key_len to field 'field' (counting from 0) of a line,
+   where fields are separated by 'delimiter', or by spaces and tabs if
+   delimiter is 0. If the line doesn't have that many fields, the key
+   is empty. Both ZlineFile_set_sorted_key and ZlineIndex_build find
+   keys this way, so an index and a sorted file agree on them. */
+void lineFieldKey(const char *line, uint64_t len, int field, char delimiter,
+                  const char **key, uint64_t *key_len);
+
+
 #endif /* __ZLINE_INTERNAL_API_H__ */
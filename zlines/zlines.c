@@ -29,13 +29,35 @@
 
 #include "zstd.h"
 #include "zline_api.h"
+#include "zrec_api.h"
+#include "zindex_api.h"
 #include "common.h"
 
 #define DEFAULT_BLOCK_SIZE (4 * 1024 * 1024)
 #define CREATE_FILE_UPDATE_FREQUENCY_BYTES (50*1024*1024)
 
+/* "zlines create -d" trains its dictionary on this many times
+   the dictionary size of input text */
+#define DICT_SAMPLE_RATIO 100
+
+/* "zlines verify" hands out blocks to its threads this many at a time,
+   and stops after this many mismatched lines */
+#define VERIFY_BLOCKS_PER_TASK 16
+#define VERIFY_MAX_ERRORS 10
+
+/* "zlines index" writes <file><INDEX_SUFFIX>, and "zlines find" uses it
+   if it's there and the file isn't sorted by key */
+#define INDEX_SUFFIX ".idx"
+
+/* "zlines get" fetches up to this many lines at once */
+#define GET_BATCH_SIZE 65536
+
+/* Options.fixed_width without -w: a new file has no fixed-width blocks,
+   and an appended file keeps its own setting */
+#define FIXED_WIDTH_UNSET -3
+
 enum ProgramMode {PROG_CREATE, PROG_DETAILS, PROG_VERIFY, PROG_GET,
-                  PROG_PRINT};
+                  PROG_PRINT, PROG_GREP, PROG_FIND, PROG_INDEX};
 
 typedef uint64_t u64;
 typedef int64_t i64;
@@ -50,17 +72,70 @@ typedef struct {
 typedef struct {
   enum ProgramMode mode;
   int block_size;
+  int thread_count;
   const char *input_filename;
   const char *output_filename;
 
   /* used in "get" mode */
   Range *line_numbers;
   int line_number_count;
+  u64 cache_size;
+  int use_mmap;
+
+  /* used in "create" mode */
+  int uncompressed_index;
+  u64 dict_size;
+  int append;
+  int codec;
+  int record_fields;
+  int kmer_length;
+  int key_field, key_flags;
+  i64 fixed_width;
 
   /* used in "details" mode */
   int flag_blocks, flag_lines;
+
+  /* used in "grep" mode, and the keys in "find" mode */
+  const char **patterns;
+  int pattern_count;
+  int flag_count, flag_line_numbers;
 } Options;
 
+
+/* State shared by the threads of "zlines verify". Each block of the
+   zlines file is compared with the part of the memory-mapped text file
+   at block_text[block]. */
+typedef struct {
+  ZlineFile zf;
+  const char *text;
+  u64 text_len, line_count, block_count;
+
+  /* 1 for "\n", 2 for "\r\n" */
+  int newline_len;
+  u64 *block_text;
+
+  /* protects everything below */
+  Mutex lock;
+  u64 next_block;
+  u64 mismatches[VERIFY_MAX_ERRORS];
+  int mismatch_count;
+
+  /* set if a line doesn't end the way newline_len says */
+  int bad_newline;
+} VerifyJob;
+
+
+/* The first lines of the input, read to train a dictionary and then
+   added to the file. */
+typedef struct {
+  char *data;
+  u64 *lengths;
+  u64 count, size;
+
+  /* next line to add, and its offset in data */
+  u64 next, pos;
+} LineSample;
+
 int quiet = 0;
 
 int parseArgs(int argc, char **argv, Options *opt);
@@ -68,10 +143,22 @@ void printHelp(void);
 int processFile(Options *opt, FILE *input_fp);
 
 int createFile(Options *opt);
+int createRecordFile(Options *opt);
 int fileDetails(Options *opt);
 int verifyFile(Options *opt);
 int getLines(Options *opt);
 int printLines(Options *opt);
+int grepFile(Options *opt);
+int findKeys(Options *opt);
+int indexFile(Options *opt);
+
+/* "zlines find" with an index: look up all the keys at once, then read
+   all their lines at once. Like ZlineFile_find_key, this prints every
+   line with each key. */
+int findIndexedKeys(Options *opt, ZlineFile zf, const char *index_filename);
+
+/* Returns <filename><INDEX_SUFFIX>. The caller must free it. */
+char *indexFilename(const char *filename);
 
 /* Return nonzero on error */
 int parseRange(Range *r, const char *s);
@@ -84,6 +171,8 @@ int main(int argc, char **argv) {
 
   switch (opt.mode) {
   case PROG_CREATE:
+    if (opt.record_fields)
+      return createRecordFile(&opt);
     return createFile(&opt);
 
   case PROG_DETAILS:
@@ -97,6 +186,15 @@ int main(int argc, char **argv) {
 
   case PROG_PRINT:
     return printLines(&opt);
+
+  case PROG_GREP:
+    return grepFile(&opt);
+
+  case PROG_FIND:
+    return findKeys(&opt);
+
+  case PROG_INDEX:
+    return indexFile(&opt);
   }  
 
   return 0;
@@ -108,11 +206,26 @@ int parseArgs(int argc, char **argv, Options *opt) {
 
   opt->mode = PROG_CREATE;
   opt->block_size = DEFAULT_BLOCK_SIZE;
+  opt->thread_count = 0;
   quiet = 0;
   opt->input_filename = opt->output_filename = NULL;
   opt->line_numbers = 0;
   opt->line_number_count = 0;
   opt->flag_blocks = opt->flag_lines = 0;
+  opt->cache_size = 0;
+  opt->use_mmap = 0;
+  opt->uncompressed_index = 0;
+  opt->dict_size = 0;
+  opt->append = 0;
+  opt->codec = ZLINE_CODEC_NONE;
+  opt->record_fields = 0;
+  opt->kmer_length = 0;
+  opt->key_field = -1;
+  opt->key_flags = 0;
+  opt->fixed_width = FIXED_WIDTH_UNSET;
+  opt->patterns = (const char**) malloc(sizeof(char*) * argc);
+  opt->pattern_count = 0;
+  opt->flag_count = opt->flag_line_numbers = 0;
 
   if (argc < 2) printHelp();
   
@@ -126,6 +239,12 @@ int parseArgs(int argc, char **argv, Options *opt) {
     opt->mode = PROG_GET;
   } else if (!strcmp(argv[argno], "print")) {
     opt->mode = PROG_PRINT;
+  } else if (!strcmp(argv[argno], "grep")) {
+    opt->mode = PROG_GREP;
+  } else if (!strcmp(argv[argno], "find")) {
+    opt->mode = PROG_FIND;
+  } else if (!strcmp(argv[argno], "index")) {
+    opt->mode = PROG_INDEX;
   } else if (!strcmp(argv[argno], "-h")) {
     printHelp();
   } else {
@@ -154,6 +273,122 @@ int parseArgs(int argc, char **argv, Options *opt) {
       }
     }
       
+    else if (!strcmp(argv[argno], "-c") && opt->mode == PROG_GREP) {
+      opt->flag_count = 1;
+    }
+
+    else if (!strcmp(argv[argno], "-e")) {
+      argno++;
+      if (argno >= argc) printHelp();
+      opt->patterns[opt->pattern_count++] = argv[argno];
+    }
+
+    else if (!strcmp(argv[argno], "-c")) {
+      argno++;
+      if (argno >= argc) printHelp();
+      if (parseSize(argv[argno], &opt->cache_size)) {
+        fprintf(stderr, "Invalid cache size: \"%s\"\n", argv[argno]);
+        return 1;
+      }
+    }
+      
+    else if (!strcmp(argv[argno], "-t")) {
+      argno++;
+      if (argno >= argc) printHelp();
+      if (1 != sscanf(argv[argno], "%d", &opt->thread_count) ||
+          opt->thread_count < 0) {
+        fprintf(stderr, "Invalid thread count: \"%s\"\n", argv[argno]);
+        return 1;
+      }
+    }
+      
+    else if (!strcmp(argv[argno], "-m")) {
+      opt->use_mmap = 1;
+    }
+      
+    else if (!strcmp(argv[argno], "-u")) {
+      opt->uncompressed_index = 1;
+    }
+      
+    else if (!strcmp(argv[argno], "-d")) {
+      argno++;
+      if (argno >= argc) printHelp();
+      if (parseSize(argv[argno], &opt->dict_size) || opt->dict_size == 0) {
+        fprintf(stderr, "Invalid dictionary size: \"%s\"\n", argv[argno]);
+        return 1;
+      }
+    }
+      
+    else if (!strcmp(argv[argno], "-r")) {
+      argno++;
+      if (argno >= argc) printHelp();
+      if (1 != sscanf(argv[argno], "%d", &opt->record_fields) ||
+          opt->record_fields < 1) {
+        fprintf(stderr, "Invalid field count: \"%s\"\n", argv[argno]);
+        return 1;
+      }
+    }
+      
+    else if (!strcmp(argv[argno], "-k")) {
+      argno++;
+      if (argno >= argc) printHelp();
+      if (1 != sscanf(argv[argno], "%d", &opt->kmer_length) ||
+          opt->kmer_length < 1) {
+        fprintf(stderr, "Invalid k-mer length: \"%s\"\n", argv[argno]);
+        return 1;
+      }
+    }
+      
+    else if (!strcmp(argv[argno], "-s") || !strcmp(argv[argno], "-S")) {
+      opt->key_flags = argv[argno][1] == 'S' ? ZLINE_KEY_NUMERIC : 0;
+      argno++;
+      if (argno >= argc) printHelp();
+      if (1 != sscanf(argv[argno], "%d", &opt->key_field) ||
+          opt->key_field < 0) {
+        fprintf(stderr, "Invalid key field: \"%s\"\n", argv[argno]);
+        return 1;
+      }
+    }
+      
+    else if (!strcmp(argv[argno], "-w")) {
+      argno++;
+      if (argno >= argc) printHelp();
+      if (!strcmp(argv[argno], "off")) {
+        opt->fixed_width = ZLINE_FIXED_WIDTH_OFF;
+      } else if (!strcmp(argv[argno], "auto")) {
+        opt->fixed_width = ZLINE_FIXED_WIDTH_AUTO;
+      } else if (1 != sscanf(argv[argno], "%" SCNi64, &opt->fixed_width) ||
+                 opt->fixed_width < 0) {
+        fprintf(stderr, "Invalid line width: \"%s\"\n", argv[argno]);
+        return 1;
+      }
+    }
+      
+    else if (!strcmp(argv[argno], "-f") && opt->mode == PROG_INDEX) {
+      argno++;
+      if (argno >= argc) printHelp();
+      if (1 != sscanf(argv[argno], "%d", &opt->key_field) ||
+          opt->key_field < 0) {
+        fprintf(stderr, "Invalid key field: \"%s\"\n", argv[argno]);
+        return 1;
+      }
+    }
+      
+    else if (!strcmp(argv[argno], "-n")) {
+      if (opt->mode == PROG_GREP || opt->mode == PROG_FIND)
+        opt->flag_line_numbers = 1;
+      else
+        opt->codec = ZLINE_CODEC_NT2;
+    }
+      
+    else if (!strcmp(argv[argno], "-D")) {
+      opt->codec = ZLINE_CODEC_REF;
+    }
+      
+    else if (!strcmp(argv[argno], "-a")) {
+      opt->append = 1;
+    }
+      
     else if (!strcmp(argv[argno], "-q")) {
       quiet = 1;
     }
@@ -173,6 +408,18 @@ int parseArgs(int argc, char **argv, Options *opt) {
   switch (opt->mode) {
   case PROG_CREATE:
     if (argno+2 != argc) printHelp();
+    if (opt->append &&
+        (opt->dict_size || opt->uncompressed_index || opt->kmer_length ||
+         opt->key_field >= 0)) {
+      fprintf(stderr, "-d, -k, -s, and -u can't be changed when appending\n");
+      return 1;
+    }
+    if (opt->record_fields &&
+        (opt->append || opt->dict_size || opt->uncompressed_index ||
+         opt->key_field >= 0)) {
+      fprintf(stderr, "-a, -d, -s, and -u can't be used with -r\n");
+      return 1;
+    }
     opt->output_filename = argv[argno++];
     opt->input_filename = argv[argno++];
     break;
@@ -189,10 +436,28 @@ int parseArgs(int argc, char **argv, Options *opt) {
     break;
 
   case PROG_PRINT:
+  case PROG_INDEX:
     if (argno+1 != argc) printHelp();
     opt->input_filename = argv[argno++];
     break;
 
+  case PROG_GREP:
+    if (argno >= argc) printHelp();
+    opt->input_filename = argv[argno++];
+    if (opt->pattern_count == 0) {
+      if (argno >= argc) printHelp();
+      opt->patterns[opt->pattern_count++] = argv[argno++];
+    }
+    if (argno != argc) printHelp();
+    break;
+
+  case PROG_FIND:
+    if (argno+1 >= argc) printHelp();
+    opt->input_filename = argv[argno++];
+    while (argno < argc)
+      opt->patterns[opt->pattern_count++] = argv[argno++];
+    break;
+
   case PROG_GET:
     if (argno+1 >= argc) printHelp();
     opt->input_filename = argv[argno++];
@@ -220,10 +485,72 @@ void printHelp(void) {
           "    if input text file is \"-\", use stdin\n"
           "    options:\n"
           "      -b <block size> : size (in bytes) of compression blocks\n"
+          "      -t <threads> : use this many threads. A text file is split\n"
+          "                     among them; stdin is read by one thread\n"
+          "                     and compressed by the others.\n"
+          "      -u : don't compress the index, so it can be used in place\n"
+          "           when the file is memory-mapped\n"
+          "      -d <size> : train a compression dictionary of up to <size>\n"
+          "                  bytes on the start of the input (e.g. 112k);\n"
+          "                  helps small blocks compress well\n"
+          "      -n : pack the nucleotides A, C, G, and T into 2 bits each\n"
+          "           before compressing; for DNA or RNA sequence lines\n"
+          "      -D : store each line as its differences from a consensus\n"
+          "           of its block; for alignment rows and other lines\n"
+          "           that are nearly alike\n"
+          "      -k <k> : store a filter of the k-mers in each block, so\n"
+          "               \"zlines grep\" can skip blocks that don't contain\n"
+          "               the pattern; k should be a little shorter than\n"
+          "               the patterns, such as 16 for 20-30 bases\n"
+          "      -s <field> : the lines are sorted by this field (0 is the\n"
+          "                   first; fields are separated by spaces or\n"
+          "                   tabs), so \"zlines find\" can look them up\n"
+          "      -S <field> : like -s, but the field is sorted as a number\n"
+          "      -w <width> : every line is <width> bytes long, so blocks\n"
+          "                   are stored without a line index. \"-w auto\"\n"
+          "                   does that for any block of lines of one\n"
+          "                   length. Either way, older versions of zlines\n"
+          "                   can't read the file; \"-w off\", the default,\n"
+          "                   keeps every index. With -a, the file's own\n"
+          "                   setting is the default\n"
+          "      -r <fields> : make a record file (see zrec_api.h), where each\n"
+          "                    group of <fields> lines is one record, such\n"
+          "                    as 4 for FASTQ, and each field is compressed\n"
+          "                    separately\n"
+          "      -a : add the lines to the end of an existing zlines file\n"
           "      -q : don't print status output\n"
           "\n"
-          "  zlines print <zlines file>\n"
+          "  zlines print [options] <zlines file>\n"
           "    prints every line in the file\n"
+          "    options:\n"
+          "      -t <threads> : decompress blocks ahead with this many threads\n"
+          "                     (default: one per processor)\n"
+          "\n"
+          "  zlines grep [options] <zlines file> <pattern>\n"
+          "    prints the lines that contain the pattern (a plain string)\n"
+          "    options:\n"
+          "      -e <pattern> : search for this pattern; may be repeated to\n"
+          "                     find lines containing any of them\n"
+          "      -n : print the line number (starting from 0) before each line\n"
+          "      -c : just print the number of matching lines\n"
+          "      -t <threads> : search blocks with this many threads\n"
+          "                     (default: one per processor)\n"
+          "\n"
+          "  zlines find [options] <zlines file> <key> [<key> ...]\n"
+          "    prints the lines with each key, in a file created with -s or -S,\n"
+          "    or using the index built by \"zlines index\" if there is one\n"
+          "    options:\n"
+          "      -n : print the line number (starting from 0) before each line\n"
+          "\n"
+          "  zlines index [options] <zlines file>\n"
+          "    writes a hash table of the key of each line to\n"
+          "    <zlines file>" INDEX_SUFFIX ", so \"zlines find\" can look up keys\n"
+          "    in a file that isn't sorted\n"
+          "    options:\n"
+          "      -f <field> : the key is this field (default 0, the first;\n"
+          "                   fields are separated by spaces or tabs)\n"
+          "      -t <threads> : decompress blocks with this many threads\n"
+          "                     (default: one per processor)\n"
           "\n"
           "  zlines details [options] <zlines file>\n"
           "    prints internal details about the data encoded in the file\n"
@@ -231,11 +558,19 @@ void printHelp(void) {
           "      -b: print details about each compressed block\n"
           "      -l: print details about each line of data\n"
           "\n"
-          "  zlines verify <zlines file> <text file>\n"
+          "  zlines verify [options] <zlines file> <text file>\n"
           "    tests if the zlines file matches the given text file\n"
+          "    options:\n"
+          "      -t <threads> : compare blocks with this many threads\n"
+          "                     (default: one per processor)\n"
           "\n"
-          "  zlines get <zlines file> <line#> [<line#> ...]\n"
-          "    extracts the given lines from the file and prints them\n\n"
+          "  zlines get [options] <zlines file> <line#> [<line#> ...]\n"
+          "    extracts the given lines from the file and prints them\n"
+          "    options:\n"
+          "      -c <size> : keep up to <size> bytes of decompressed blocks\n"
+          "                  in memory (suffixes k, m, g are accepted)\n"
+          "      -m : memory-map the file\n"
+          "      -t <threads> : decompress blocks with this many threads\n\n"
           "    line#: index of the line, starting from 0\n"
           "    Negative numbers count back from the end: -1 is the last line\n"
           "    Ranges in the style of Python array slices are also supported.\n"
@@ -365,13 +700,68 @@ void statusOutput(u64 line_count, u64 byte_count, u64 file_size) {
 }
 
 
+/* Read lines from the input until there are at least 'target' bytes,
+   train a dictionary on them, and give it to zf. The lines are left in
+   'sample' to be added to the file. */
+void trainDictionary(ZlineFile zf, FILE *input_fp, u64 dict_size,
+                     u64 target, LineSample *sample) {
+  char *line = NULL, buf[50];
+  ssize_t line_len;
+  size_t buf_len = 0;
+  u64 capacity = 0, line_capacity = 0;
+  int64_t trained_size;
+  void *dict;
+
+  memset(sample, 0, sizeof *sample);
+
+  while (sample->size < target) {
+    line_len = getline(&line, &buf_len, input_fp);
+    if (line_len == -1) break;
+
+    if (sample->size + line_len > capacity) {
+      capacity = MAX(capacity * 2, sample->size + line_len);
+      sample->data = (char*) realloc(sample->data, capacity);
+      assert(sample->data);
+    }
+    if (sample->count == line_capacity) {
+      line_capacity = MAX(line_capacity * 2, 1024);
+      sample->lengths = (u64*) realloc(sample->lengths,
+                                       sizeof(u64) * line_capacity);
+      assert(sample->lengths);
+    }
+
+    memcpy(sample->data + sample->size, line, line_len);
+    sample->size += line_len;
+    sample->lengths[sample->count++] = line_len;
+  }
+  free(line);
+
+  dict = malloc(dict_size);
+  assert(dict);
+  trained_size = ZlineFile_train_dictionary(dict, dict_size, sample->data,
+                                            sample->lengths, sample->count);
+  if (trained_size < 0) {
+    fprintf(stderr, "Continuing without a dictionary.\n");
+  } else {
+    if (ZlineFile_set_dictionary(zf, dict, trained_size))
+      fprintf(stderr, "Failed to set dictionary.\n");
+    else if (!quiet)
+      printf("trained a %s byte dictionary\n", commafy(buf, trained_size));
+  }
+  free(dict);
+}
+
+
 /* Read a text file and create a zlines file from it. */
 int createFile(Options *opt) {
   ZlineFile zf;
-  char *line = NULL, buf1[50], buf2[50];
+  char *line = NULL, *line_ptr, buf1[50], buf2[50];
   ssize_t line_len;
   size_t buf_len = 0;
-  int err = 0;
+  int err = 0, is_parallel = 0;
+  LineSample sample;
+  char *text = NULL;
+  u64 text_len = 0;
   u64 idx, total_bytes = 0, total_zblock_size = 0;
   u64 input_file_size = 0, output_file_size;
   u64 min_line_len = UINT64_MAX, max_line_len = 0;
@@ -386,17 +776,67 @@ int createFile(Options *opt) {
   if (input_fp != stdin)
     input_file_size = getFileSize(opt->input_filename);
 
+  /* With threads, split a text file among them rather than reading
+     it one line at a time. */
+  if (opt->thread_count > 0 && input_fp != stdin &&
+      !mapFile(opt->input_filename, 0, &text, &text_len))
+    is_parallel = 1;
+
   /* open the zlines file */
-  zf = ZlineFile_create2(opt->output_filename, opt->block_size);
+  if (opt->append)
+    zf = ZlineFile_open_append2(opt->output_filename, opt->block_size,
+                                is_parallel ? 0 : opt->thread_count);
+  else
+    zf = ZlineFile_create3(opt->output_filename, opt->block_size,
+                           is_parallel ? 0 : opt->thread_count);
   if (!zf) {
     fprintf(stderr, "Error: cannot write \"%s\"\n", opt->output_filename);
     return 1;
   }
+  if (opt->uncompressed_index)
+    ZlineFile_set_index_compression(zf, 0);
+  if (opt->codec != ZLINE_CODEC_NONE)
+    ZlineFile_set_codec(zf, opt->codec);
+  if (opt->kmer_length && ZlineFile_set_kmer_filter(zf, opt->kmer_length, 0)) {
+    fprintf(stderr, "Invalid k-mer length: %d\n", opt->kmer_length);
+    ZlineFile_close(zf);
+    return 1;
+  }
+  if (opt->key_field >= 0)
+    ZlineFile_set_sorted_key(zf, opt->key_field, 0, opt->key_flags);
+  if (opt->fixed_width != FIXED_WIDTH_UNSET &&
+      ZlineFile_set_fixed_width(zf, opt->fixed_width)) {
+    fprintf(stderr, "The lines in \"%s\" are not %" PRIi64 " bytes long\n",
+            opt->output_filename, opt->fixed_width);
+    ZlineFile_close(zf);
+    return 1;
+  }
 
-  while (1) {
-    /* read a line */
-    line_len = getline(&line, &buf_len, input_fp);
-    if (line_len == -1) break;
+  memset(&sample, 0, sizeof sample);
+  if (opt->dict_size)
+    trainDictionary(zf, input_fp, opt->dict_size,
+                    opt->dict_size * DICT_SAMPLE_RATIO, &sample);
+
+  if (is_parallel) {
+    /* the dictionary was trained on the start of the same text */
+    sample.next = sample.count;
+    if (ZlineFile_add_text(zf, text, text_len, opt->thread_count))
+      err = 1;
+    total_bytes = text_len;
+    unmapFile(text, text_len);
+  }
+
+  while (!is_parallel) {
+    /* read a line, starting with the lines used to train the dictionary */
+    if (sample.next < sample.count) {
+      line_ptr = sample.data + sample.pos;
+      line_len = sample.lengths[sample.next++];
+      sample.pos += line_len;
+    } else {
+      line_len = getline(&line, &buf_len, input_fp);
+      if (line_len == -1) break;
+      line_ptr = line;
+    }
     total_bytes += line_len;
 
     /* output a status update now and then */
@@ -406,14 +846,14 @@ int createFile(Options *opt) {
     }
 
     /* remove the trailing newline from the line */
-    line_len = trimNewline(line, line_len);
+    line_len = trimNewline(line_ptr, line_len);
 
     /* track the maximum and minimum line lengths */
     if ((u64)line_len > max_line_len) max_line_len = line_len;
     if ((u64)line_len < min_line_len) min_line_len = line_len;
 
     /* add the line to the zlines file */
-    if (ZlineFile_add_line2(zf, line, line_len)) {
+    if (ZlineFile_add_line2(zf, line_ptr, line_len)) {
       err = 1;
       break;
     }
@@ -422,17 +862,26 @@ int createFile(Options *opt) {
   /* print a final status update */
   statusOutput(ZlineFile_line_count(zf), total_bytes, input_file_size);
 
+  /* ZlineFile_add_text tracked the line lengths */
+  if (is_parallel) {
+    min_line_len = ZlineFile_min_line_length(zf);
+    max_line_len = ZlineFile_max_line_length(zf);
+  }
+
   /* close the zlines file because the index and header aren't written until
      the file is closed. */
   ZlineFile_close(zf);
   free(line);
+  free(sample.data);
+  free(sample.lengths);
   if (input_fp != stdin) fclose(input_fp);
 
   output_file_size = getFileSize(opt->output_filename);
 
-  /* reopen the zlines file for reading */
+  /* reopen the zlines file for reading; it may have no lines if
+     adding them failed */
   zf = ZlineFile_read(opt->output_filename);
-  assert(zf);
+  if (!zf) return 1;
 
   /* compute the compressed size of the data */
   for (idx = 0; idx < ZlineFile_get_block_count(zf); idx++)
@@ -456,6 +905,103 @@ int createFile(Options *opt) {
 }
 
 
+/* "zlines create -r": every opt->record_fields lines of the input are
+   one record. */
+int createRecordFile(Options *opt) {
+  ZrecFile zr;
+  ZlineFile zf;
+  FILE *input_fp;
+  char **values, buf1[50], buf2[50];
+  size_t *sizes;
+  u64 *lengths, total_bytes = 0, input_file_size = 0, idx, zblock_size;
+  u64 next_update = CREATE_FILE_UPDATE_FREQUENCY_BYTES;
+  ssize_t line_len;
+  int i, field = 0, err = 0, n = opt->record_fields;
+
+  input_fp = openFileOrStdin(opt->input_filename);
+  if (!input_fp) return 1;
+  if (input_fp != stdin)
+    input_file_size = getFileSize(opt->input_filename);
+
+  zr = ZrecFile_create(opt->output_filename, n, opt->block_size,
+                       opt->thread_count);
+  if (!zr) {
+    fprintf(stderr, "Error: cannot write \"%s\"\n", opt->output_filename);
+    return 1;
+  }
+
+  /* fields the codec doesn't suit will be stored unpacked, block by block */
+  if (opt->codec != ZLINE_CODEC_NONE)
+    for (i=0; i < n; i++)
+      ZlineFile_set_codec(ZrecFile_field(zr, i), opt->codec);
+  if (opt->kmer_length)
+    for (i=0; i < n; i++)
+      ZlineFile_set_kmer_filter(ZrecFile_field(zr, i), opt->kmer_length, 0);
+
+  values = (char**) calloc(n, sizeof(char*));
+  sizes = (size_t*) calloc(n, sizeof(size_t));
+  lengths = (u64*) malloc(sizeof(u64) * n);
+  assert(values && sizes && lengths);
+
+  while ((line_len = getline(&values[field], &sizes[field], input_fp))
+         != -1) {
+    total_bytes += line_len;
+    if (total_bytes >= next_update) {
+      statusOutput(ZrecFile_record_count(zr) * n, total_bytes,
+                   input_file_size);
+      next_update = total_bytes + CREATE_FILE_UPDATE_FREQUENCY_BYTES;
+    }
+
+    lengths[field] = trimNewline(values[field], line_len);
+    if (++field == n) {
+      if (ZrecFile_add_record(zr, (const char *const *) values, lengths)) {
+        err = 1;
+        break;
+      }
+      field = 0;
+    }
+  }
+  statusOutput(ZrecFile_record_count(zr) * n + field, total_bytes,
+               input_file_size);
+  if (field > 0)
+    fprintf(stderr, "\nWarning: the last %d line%s not a whole record, "
+            "so %s not added\n", field, field == 1 ? " is" : "s are",
+            field == 1 ? "it was" : "they were");
+
+  if (ZrecFile_close(zr)) err = 1;
+  for (i=0; i < n; i++) free(values[i]);
+  free(values);
+  free(sizes);
+  free(lengths);
+  if (input_fp != stdin) fclose(input_fp);
+  if (err) return 1;
+
+  /* report the compressed size of each field */
+  zr = ZrecFile_read(opt->output_filename, 0);
+  if (!zr) {
+    fprintf(stderr, "Error: cannot read \"%s\"\n", opt->output_filename);
+    return 1;
+  }
+  if (!quiet) {
+    printf("\n%s records\n", commafy(buf1, ZrecFile_record_count(zr)));
+    for (i=0; i < n; i++) {
+      zf = ZrecFile_field(zr, i);
+      zblock_size = 0;
+      for (idx = 0; idx < ZlineFile_get_block_count(zf); idx++)
+        zblock_size += ZlineFile_get_block_size_compressed(zf, idx);
+      printf("field %d: %s bytes compressed in %" PRIu64 " block%s, "
+             "longest %s\n", i, commafy(buf1, zblock_size),
+             ZlineFile_get_block_count(zf),
+             ZlineFile_get_block_count(zf)==1 ? "" : "s",
+             commafy(buf2, ZlineFile_max_line_length(zf)));
+    }
+  }
+  ZrecFile_close(zr);
+
+  return err;
+}
+
+
 int fileDetails(Options *opt) {
   ZlineFile zf;
   u64 i;
@@ -468,6 +1014,9 @@ int fileDetails(Options *opt) {
 
   printf("%" PRIu64 " lines, longest line %" PRIu64 " bytes\n",
          ZlineFile_line_count(zf), ZlineFile_max_line_length(zf));
+  if (ZlineFile_get_fixed_width(zf) >= 0)
+    printf("every line is %" PRIi64 " bytes\n",
+           ZlineFile_get_fixed_width(zf));
   
   printf("data begins at offset %" PRIu64 "\n", ZlineFile_get_block_offset(zf, 0));
   printf("block index at offset %" PRIu64 "\n", ZlineFile_get_block_index_offset(zf));
@@ -503,15 +1052,174 @@ int fileDetails(Options *opt) {
 }
 
 
+static void verifyMismatch(VerifyJob *job, u64 line_idx) {
+  int i;
+
+  mutexLock(&job->lock);
+  if (job->mismatch_count < VERIFY_MAX_ERRORS) {
+    /* keep the list sorted */
+    for (i = job->mismatch_count;
+         i > 0 && job->mismatches[i-1] > line_idx; i--)
+      job->mismatches[i] = job->mismatches[i-1];
+    job->mismatches[i] = line_idx;
+    job->mismatch_count++;
+  }
+  mutexUnlock(&job->lock);
+}
+
+
+/* Compare groups of blocks with the text until there are none left. */
+void *verifyThread(void *arg) {
+  VerifyJob *job = (VerifyJob*) arg;
+  ZlineIterator it;
+  ZlineView view;
+  u64 block, end_block, first_line, block_end_line, line_idx, pos;
+  int stop, is_bad, result;
+
+  while (1) {
+    mutexLock(&job->lock);
+    block = job->next_block;
+    job->next_block += VERIFY_BLOCKS_PER_TASK;
+    stop = job->bad_newline || job->mismatch_count >= VERIFY_MAX_ERRORS;
+    mutexUnlock(&job->lock);
+    if (stop || block >= job->block_count) break;
+
+    end_block = MIN(block + VERIFY_BLOCKS_PER_TASK, job->block_count);
+    first_line = ZlineFile_get_block_first_line(job->zf, block);
+    it = ZlineIterator_create
+      (job->zf, first_line, end_block < job->block_count
+       ? ZlineFile_get_block_first_line(job->zf, end_block) : job->line_count,
+       0, 0);
+    if (!it) {
+      verifyMismatch(job, first_line);
+      continue;
+    }
+
+    for (; block < end_block; block++) {
+      pos = job->block_text[block];
+      block_end_line = block + 1 < job->block_count
+        ? ZlineFile_get_block_first_line(job->zf, block + 1)
+        : job->line_count;
+      is_bad = 0;
+
+      /* after a mismatch, skip to the next block, since the lines after
+         it may not line up */
+      while ((result = ZlineIterator_next(it, &view, &line_idx)) == 1) {
+        if (!is_bad) {
+          if (view.length > job->text_len - pos ||
+              memcmp(job->text + pos, view.data, view.length)) {
+            verifyMismatch(job, line_idx);
+            is_bad = 1;
+          } else {
+            pos += view.length;
+            if (line_idx == job->line_count - 1 && pos == job->text_len) {
+              /* no newline after the last line */
+            } else if (job->text_len - pos >= (u64)job->newline_len &&
+                       job->text[pos + job->newline_len - 1] == '\n' &&
+                       (job->newline_len == 1 || job->text[pos] == '\r')) {
+              pos += job->newline_len;
+            } else {
+              mutexLock(&job->lock);
+              job->bad_newline = 1;
+              mutexUnlock(&job->lock);
+              is_bad = 1;
+            }
+          }
+        }
+        if (line_idx + 1 == block_end_line) break;
+      }
+
+      if (result != 1) {
+        /* the file couldn't be read */
+        verifyMismatch(job, ZlineFile_get_block_first_line(job->zf, block));
+        break;
+      }
+    }
+
+    ZlineIterator_close(it);
+  }
+
+  return NULL;
+}
+
+
+/* Compare the zlines file with a memory-mapped text file, with each
+   thread checking a group of blocks at a time. Block k starts in the
+   text after the content and newlines of every line before it, which
+   the block index gives without reading the blocks.
+   Returns the number of mismatched lines, or -1 if the text can't be
+   checked this way, for example if it has a mix of "\n" and "\r\n"
+   line endings or is a different size. */
+int verifyParallel(ZlineFile zf, const char *text, u64 text_len,
+                   int thread_count) {
+  VerifyJob job;
+  Thread *threads;
+  const char *nl;
+  u64 i, content_len = 0, expected_len;
+  int started, result;
+
+  memset(&job, 0, sizeof job);
+  job.zf = zf;
+  job.text = text;
+  job.text_len = text_len;
+  job.line_count = ZlineFile_line_count(zf);
+  job.block_count = ZlineFile_get_block_count(zf);
+
+  /* use the line ending of the first line for every line */
+  nl = (const char*) memchr(text, '\n', text_len);
+  job.newline_len = (nl && nl > text && nl[-1] == '\r') ? 2 : 1;
+
+  job.block_text = (u64*) malloc(sizeof(u64) * (job.block_count + 1));
+  threads = (Thread*) malloc(sizeof(Thread) * thread_count);
+  assert(job.block_text && threads);
+  for (i=0; i < job.block_count; i++) {
+    job.block_text[i] = content_len +
+      ZlineFile_get_block_first_line(zf, i) * job.newline_len;
+    content_len += ZlineFile_get_block_size_original(zf, i);
+  }
+
+  /* the last newline is optional */
+  expected_len = content_len + job.line_count * job.newline_len;
+  if (text_len != expected_len &&
+      !(job.line_count > 0 && text_len == expected_len - job.newline_len)) {
+    free(job.block_text);
+    free(threads);
+    return -1;
+  }
+
+  mutexInit(&job.lock);
+  for (started = 0; started < thread_count; started++)
+    if (threadStart(&threads[started], verifyThread, &job)) break;
+  if (started == 0) verifyThread(&job);
+  while (started > 0)
+    threadJoin(threads[--started]);
+  mutexDestroy(&job.lock);
+
+  if (job.bad_newline) {
+    result = -1;
+  } else {
+    for (i=0; i < (u64)job.mismatch_count; i++)
+      printf("Line %" PRIu64 " mismatch.\n", job.mismatches[i]);
+    if (job.mismatch_count == VERIFY_MAX_ERRORS)
+      printf("Too many errors. Exiting.\n");
+    result = job.mismatch_count;
+  }
+
+  free(job.block_text);
+  free(threads);
+  return result;
+}
+
+
 int verifyFile(Options *opt) {
   ZlineFile zf;
-  u64 line_idx = 0, line_count, buf_len;
-  char *line = NULL, *extracted_line;
+  u64 line_idx = 0, line_count, buf_len, text_len;
+  char *line = NULL, *extracted_line, *text;
   const char *text_filename, *zlines_filename;
   ssize_t line_len;
   size_t line_cap = 0;
   FILE *text_file;
-  int err_count = 0;
+  int err_count = 0, thread_count;
 
   zlines_filename = opt->output_filename;
   text_filename = opt->input_filename;
@@ -522,6 +1230,22 @@ int verifyFile(Options *opt) {
     return 1;
   }
 
+  /* If the text is a file, check blocks in parallel. If that can't be
+     done, fall back to reading the text one line at a time. */
+  if (strcmp(text_filename, "-") &&
+      !mapFile(text_filename, 0, &text, &text_len)) {
+    thread_count = opt->thread_count > 0 ? opt->thread_count : getCpuCount();
+    err_count = verifyParallel(zf, text, text_len, thread_count);
+    unmapFile(text, text_len);
+    if (err_count >= 0) {
+      ZlineFile_close(zf);
+      if (err_count == 0)
+        printf("No errors\n");
+      return err_count > 0;
+    }
+    err_count = 0;
+  }
+
   line_count = ZlineFile_line_count(zf);
   buf_len = ZlineFile_max_line_length(zf) + 1;
   extracted_line = (char*) malloc(buf_len);
@@ -567,7 +1291,7 @@ int verifyFile(Options *opt) {
   if (err_count == 0)
     printf("No errors\n");
   
-  return 0;
+  return err_count > 0;
 }
 
 
@@ -583,42 +1307,88 @@ int checkLineNumbers(int64_t *line_no, int64_t n_lines) {
 }
 
 
-void printLine(ZlineFile zf, i64 line_no, char **buf, size_t *buf_size) {
-  i64 line_len = ZlineFile_line_length(zf, line_no);
-  if (line_len < 0) {
-    fprintf(stderr, "Invalid line number: %" PRIi64 "\n", line_no);
+/* Lines requested with "zlines get" are collected here, then fetched
+   together with ZlineFile_get_lines, which decompresses each block
+   only once. */
+typedef struct {
+  uint64_t *idx, *offsets, *lengths;
+  int count;
+  char *buf;
+  u64 buf_len;
+} LineBatch;
+
+
+void flushLineBatch(ZlineFile zf, LineBatch *batch) {
+  int64_t total;
+  int i;
+
+  if (batch->count == 0) return;
+
+  total = ZlineFile_get_lines(zf, batch->idx, batch->count, batch->buf,
+                              batch->buf_len, batch->offsets, batch->lengths);
+
+  /* make sure the buffer is big enough */
+  if (total > 0 && (u64)total > batch->buf_len) {
+    batch->buf_len = MAX(batch->buf_len * 2, (u64)total);
+    free(batch->buf);
+    batch->buf = (char*) malloc(batch->buf_len);
+    if (!batch->buf) {
+      fprintf(stderr, "Out of memory\n");
+      exit(1);
+    }
+    total = ZlineFile_get_lines(zf, batch->idx, batch->count, batch->buf,
+                                batch->buf_len, batch->offsets,
+                                batch->lengths);
+  }
+
+  if (total < 0) {
+    fprintf(stderr, "Failed to read lines\n");
     exit(1);
   }
 
-  /* make sure the buffer is big enough */
-  if (*buf_size < line_len + 1) {
-    *buf_size = MAX(*buf_size * 2, line_len + 1);
-    free(*buf);
-    *buf = (char*) malloc(*buf_size);
+  for (i=0; i < batch->count; i++) {
+    char *line = batch->buf + batch->offsets[i];
+    line[batch->lengths[i]] = '\n';
+    fwrite(line, batch->lengths[i] + 1, 1, stdout);
   }
 
-  ZlineFile_get_line2(zf, line_no, *buf, *buf_size, 0);
-  puts(*buf);
+  batch->count = 0;
 }
 
 
+void printLine(ZlineFile zf, i64 line_no, LineBatch *batch) {
+  batch->idx[batch->count++] = line_no;
+  if (batch->count == GET_BATCH_SIZE)
+    flushLineBatch(zf, batch);
+}
+
 
 int getLines(Options *opt) {
   ZlineFile zf;
   int i;
   i64 line_idx, file_line_count;
-  char *buf;
-  size_t buf_len;
+  LineBatch batch;
 
-  zf = ZlineFile_read(opt->input_filename);
+  if (opt->use_mmap)
+    zf = ZlineFile_read_mmap(opt->input_filename, opt->cache_size);
+  else
+    zf = ZlineFile_read2(opt->input_filename, opt->cache_size);
   if (!zf) {
     fprintf(stderr, "Failed to open \"%s\" for reading.\n",
             opt->input_filename);
     return 1;
   }
 
-  buf_len = 100;
-  buf = (char*) malloc(buf_len);
+  if (opt->thread_count > 0)
+    ZlineFile_set_thread_count(zf, opt->thread_count);
+
+  batch.count = 0;
+  batch.idx = (uint64_t*) malloc(sizeof(uint64_t) * GET_BATCH_SIZE);
+  batch.offsets = (uint64_t*) malloc(sizeof(uint64_t) * GET_BATCH_SIZE);
+  batch.lengths = (uint64_t*) malloc(sizeof(uint64_t) * GET_BATCH_SIZE);
+  batch.buf_len = 0;
+  batch.buf = NULL;
+  assert(batch.idx && batch.offsets && batch.lengths);
 
   /* number of lines in the file */
   file_line_count = ZlineFile_line_count(zf);
@@ -658,17 +1428,21 @@ int getLines(Options *opt) {
     assert(r.step != 0);
     if (r.step > 0) {
       for (line_idx = r.start; line_idx < r.end; line_idx += r.step) {
-        printLine(zf, line_idx, &buf, &buf_len);
+        printLine(zf, line_idx, &batch);
       }
     } else {
       for (line_idx = r.start; line_idx > r.end; line_idx += r.step) {
-        printLine(zf, line_idx, &buf, &buf_len);
+        printLine(zf, line_idx, &batch);
       }
     }
   }
+  flushLineBatch(zf, &batch);
 
   free(opt->line_numbers);
-  free(buf);
+  free(batch.idx);
+  free(batch.offsets);
+  free(batch.lengths);
+  free(batch.buf);
   
   ZlineFile_close(zf);
   
@@ -676,10 +1450,176 @@ int getLines(Options *opt) {
 }
 
 
-int printLines(Options *opt) {
+static int grepPrintLine(void *arg, uint64_t line_idx, const char *line,
+                         uint64_t length) {
+  Options *opt = (Options*) arg;
+  if (opt->flag_line_numbers) printf("%" PRIu64 ":", line_idx);
+  fwrite(line, 1, length, stdout);
+  putchar('\n');
+  return 0;
+}
+
+
+/* Exit status is 0 if any lines matched, 1 if none did, or 2 on error,
+   like grep. */
+int grepFile(Options *opt) {
   ZlineFile zf;
-  u64 i, count, line_len, buf_len;
-  char *line;
+  int64_t found;
+  int thread_count;
+
+  zf = ZlineFile_read(opt->input_filename);
+  if (!zf) {
+    fprintf(stderr, "Failed to open \"%s\" for reading.\n",
+            opt->input_filename);
+    return 2;
+  }
+
+  thread_count = opt->thread_count > 0 ? opt->thread_count : getCpuCount();
+  found = ZlineFile_search(zf, opt->patterns, opt->pattern_count,
+                           0, ZlineFile_line_count(zf), thread_count,
+                           opt->flag_count ? NULL : grepPrintLine, opt);
+  if (found < 0)
+    fprintf(stderr, "Error reading \"%s\"\n", opt->input_filename);
+  else if (opt->flag_count)
+    printf("%" PRIi64 "\n", found);
+
+  ZlineFile_close(zf);
+  free(opt->patterns);
+
+  return found < 0 ? 2 : found == 0 ? 1 : 0;
+}
+
+
+int findKeys(Options *opt) {
+  ZlineFile zf;
+  int64_t first;
+  uint64_t count, i;
+  char *line, *index_filename;
+  int k, missing = 0;
+
+  zf = ZlineFile_read(opt->input_filename);
+  if (!zf) {
+    fprintf(stderr, "Failed to open \"%s\" for reading.\n",
+            opt->input_filename);
+    return 2;
+  }
+
+  /* The sorted key is the file's own, and the index may have been built
+     on another field, so only use it if the file isn't sorted. */
+  index_filename = indexFilename(opt->input_filename);
+  if (ZlineFile_get_sorted_key(zf, NULL, NULL, NULL) &&
+      fileExists(index_filename)) {
+    missing = findIndexedKeys(opt, zf, index_filename);
+    free(index_filename);
+    ZlineFile_close(zf);
+    free(opt->patterns);
+    return missing;
+  }
+  free(index_filename);
+
+  for (k=0; k < opt->pattern_count; k++) {
+    first = ZlineFile_find_key(zf, opt->patterns[k], strlen(opt->patterns[k]),
+                               &count);
+    if (first < 0) {
+      fprintf(stderr, "Key \"%s\" not found\n", opt->patterns[k]);
+      missing = 1;
+      continue;
+    }
+
+    for (i=0; i < count; i++) {
+      line = ZlineFile_get_line(zf, first + i);
+      if (!line) {
+        fprintf(stderr, "Error reading \"%s\"\n", opt->input_filename);
+        ZlineFile_close(zf);
+        return 2;
+      }
+      if (opt->flag_line_numbers) printf("%" PRIu64 ":", first + i);
+      puts(line);
+      free(line);
+    }
+  }
+
+  ZlineFile_close(zf);
+  free(opt->patterns);
+
+  return missing;
+}
+
+
+int findIndexedKeys(Options *opt, ZlineFile zf, const char *index_filename) {
+  ZlineIndex zi;
+  int k, n = opt->pattern_count, missing = 0;
+  int64_t line_count, needed = 0;
+  u64 *counts, *lines = NULL, *offsets = NULL, *lengths = NULL;
+  u64 max_lines = n, i, j;
+  char *buf = NULL;
+
+  zi = ZlineIndex_open(index_filename, zf);
+  if (!zi) return 2;
+
+  counts = (u64*) malloc(sizeof(u64) * n);
+  assert(counts);
+
+  /* most keys have one line; if not, try again with room for them all */
+  while (1) {
+    lines = (u64*) realloc(lines, sizeof(u64) * MAX(max_lines, 1));
+    assert(lines);
+    line_count = ZlineIndex_lookup_all(zi, opt->patterns, NULL, n,
+                                       lines, max_lines, counts);
+    if (line_count < 0 || (u64)line_count <= max_lines) break;
+    max_lines = line_count;
+  }
+  ZlineIndex_close(zi);
+  if (line_count < 0) {
+    fprintf(stderr, "Error reading \"%s\"\n", index_filename);
+    missing = 2;
+    goto done;
+  }
+
+  offsets = (u64*) malloc(sizeof(u64) * MAX(line_count, 1));
+  lengths = (u64*) malloc(sizeof(u64) * MAX(line_count, 1));
+  assert(offsets && lengths);
+  for (i=0; i < (u64)line_count; i++)
+    needed += ZlineFile_line_length(zf, lines[i]) + 1;
+
+  buf = (char*) malloc(needed ? needed : 1);
+  assert(buf);
+  if (line_count > 0 &&
+      needed != ZlineFile_get_lines(zf, lines, line_count, buf, needed,
+                                    offsets, lengths)) {
+    fprintf(stderr, "Error reading \"%s\"\n", opt->input_filename);
+    missing = 2;
+    goto done;
+  }
+
+  for (k=0, i=0; k < n; k++) {
+    if (counts[k] == 0) {
+      fprintf(stderr, "Key \"%s\" not found\n", opt->patterns[k]);
+      missing = 1;
+      continue;
+    }
+    for (j=0; j < counts[k]; j++, i++) {
+      if (opt->flag_line_numbers) printf("%" PRIu64 ":", lines[i]);
+      fwrite(buf + offsets[i], 1, lengths[i], stdout);
+      putchar('\n');
+    }
+  }
+
+ done:
+  free(buf);
+  free(counts);
+  free(lines);
+  free(offsets);
+  free(lengths);
+  return missing;
+}
+
+
+int indexFile(Options *opt) {
+  ZlineFile zf;
+  char *index_filename;
+  int thread_count, err;
+  double timer = getSeconds();
 
   zf = ZlineFile_read(opt->input_filename);
   if (!zf) {
@@ -688,29 +1628,63 @@ int printLines(Options *opt) {
     return 1;
   }
 
-  /* number of lines in the file */
-  count = ZlineFile_line_count(zf);
+  index_filename = indexFilename(opt->input_filename);
+  thread_count = opt->thread_count > 0 ? opt->thread_count : getCpuCount();
+  err = ZlineIndex_build(zf, index_filename,
+                         opt->key_field >= 0 ? opt->key_field : 0, 0,
+                         thread_count);
+  if (!err && !quiet)
+    printf("Indexed %" PRIu64 " lines in %.3fs, wrote %s\n",
+           ZlineFile_line_count(zf), getSeconds() - timer, index_filename);
+
+  free(index_filename);
+  ZlineFile_close(zf);
+  return err ? 1 : 0;
+}
 
-  /* allocate a buffer big enough to hold any line, plus newline and nul */
-  buf_len = ZlineFile_max_line_length(zf) + 2;
-  line = (char*) malloc(buf_len);
-  if (!line) {
+
+char *indexFilename(const char *filename) {
+  char *name = (char*) malloc(strlen(filename) + strlen(INDEX_SUFFIX) + 1);
+  assert(name);
+  sprintf(name, "%s%s", filename, INDEX_SUFFIX);
+  return name;
+}
+
+
+int printLines(Options *opt) {
+  ZlineFile zf;
+  ZlineIterator it;
+  ZlineView line;
+  int result, thread_count;
+
+  zf = ZlineFile_read(opt->input_filename);
+  if (!zf) {
+    fprintf(stderr, "Failed to open \"%s\" for reading.\n",
+            opt->input_filename);
+    return 1;
+  }
+
+  /* decompress upcoming blocks on other threads while printing */
+  thread_count = opt->thread_count > 0 ? opt->thread_count : getCpuCount();
+  it = ZlineIterator_create(zf, 0, ZlineFile_line_count(zf), 0,
+                            thread_count);
+  if (!it) {
     fprintf(stderr, "Out of memory\n");
     return 1;
   }
 
   /* extract each line and print it */
-  for (i = 0; i < count; i++) {
-    line_len = ZlineFile_line_length(zf, i);
-    ZlineFile_get_line2(zf, i, line, buf_len, 0);
-    line[line_len] = '\n';
-    fwrite(line, line_len+1, 1, stdout);
+  while ((result = ZlineIterator_next(it, &line, NULL)) == 1) {
+    fwrite(line.data, 1, line.length, stdout);
+    putchar('\n');
   }
-  
+  if (result < 0)
+    fprintf(stderr, "Error reading \"%s\"\n", opt->input_filename);
+
+  ZlineIterator_close(it);
   ZlineFile_close(zf);
-  free(line);
   
-  return 0;
+  return result < 0 ? 1 : 0;
 }
 
       
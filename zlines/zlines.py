@@ -48,6 +48,12 @@ is system-dependent.
 The "pysetup" script is a simple attempt at providing commands to set
 this up for the user on different systems.
 
+For reading or writing many lines at once, get_many() and add_many()
+make one library call per batch rather than one per line. The native
+module _zlines (built with "make pyext", see zlines_pyext.c) goes
+further, returning batches as buffers without a Python object per line
+and releasing the GIL while blocks are decompressed.
+
 
 """
 
@@ -76,15 +82,35 @@ ZlineFile_create = zlineslib.ZlineFile_create
 ZlineFile_create.argtypes = [c_char_p]
 ZlineFile_create.restype = c_void_p
 
+# open an existing file to add lines to it
+ZlineFile_open_append = zlineslib.ZlineFile_open_append
+ZlineFile_open_append.argtypes = [c_char_p]
+ZlineFile_open_append.restype = c_void_p
+
 # open an existing file
 ZlineFile_read = zlineslib.ZlineFile_read
 ZlineFile_read.restype = c_void_p
 
+# open an existing file, caching decompressed blocks
+ZlineFile_read2 = zlineslib.ZlineFile_read2
+ZlineFile_read2.argtypes = [c_char_p, c_ulonglong]
+ZlineFile_read2.restype = c_void_p
+
+# open an existing file by memory-mapping it
+ZlineFile_read_mmap = zlineslib.ZlineFile_read_mmap
+ZlineFile_read_mmap.argtypes = [c_char_p, c_ulonglong]
+ZlineFile_read_mmap.restype = c_void_p
+
 # add a line to a file being created
 ZlineFile_add_line = zlineslib.ZlineFile_add_line
 ZlineFile_add_line.argtypes = [c_void_p, c_char_p]
 ZlineFile_add_line.restype = c_int
 
+# add a line with a given length
+ZlineFile_add_line2 = zlineslib.ZlineFile_add_line2
+ZlineFile_add_line2.argtypes = [c_void_p, c_char_p, c_ulonglong]
+ZlineFile_add_line2.restype = c_int
+
 # get the number of lines in a file
 ZlineFile_line_count = zlineslib.ZlineFile_line_count
 ZlineFile_line_count.restype = c_ulonglong
@@ -95,6 +121,12 @@ ZlineFile_line_length = zlineslib.ZlineFile_line_length
 ZlineFile_line_length.argtypes = [c_void_p, c_ulonglong]
 ZlineFile_line_length.restype = c_longlong
 
+# get the lengths of a range of lines without decompressing them
+ZlineFile_line_lengths = zlineslib.ZlineFile_line_lengths
+ZlineFile_line_lengths.argtypes = [c_void_p, c_ulonglong, c_ulonglong,
+                                   POINTER(c_ulonglong)]
+ZlineFile_line_lengths.restype = c_int
+
 # get the maximum line length for this file
 ZlineFile_max_line_length = zlineslib.ZlineFile_max_line_length
 ZlineFile_max_line_length.argtypes = [c_void_p]
@@ -106,6 +138,13 @@ ZlineFile_get_line2.argtypes = [c_void_p, c_ulonglong, c_char_p, c_ulonglong,
                                 c_ulonglong]
 ZlineFile_get_line2.restype = c_char_p
 
+# get many lines in one call
+ZlineFile_get_lines = zlineslib.ZlineFile_get_lines
+ZlineFile_get_lines.argtypes = [c_void_p, POINTER(c_ulonglong), c_ulonglong,
+                                c_void_p, c_ulonglong, POINTER(c_ulonglong),
+                                POINTER(c_ulonglong)]
+ZlineFile_get_lines.restype = c_longlong
+
 # get internal number of data blocks
 ZlineFile_get_block_count = zlineslib.ZlineFile_get_block_count
 ZlineFile_get_block_count.argtypes = [c_void_p]
@@ -133,15 +172,42 @@ ZlineFile_get_block_line_count.restype = c_ulonglong
 
 
 
+# get the number of block cache hits and misses
+ZlineFile_get_cache_stats = zlineslib.ZlineFile_get_cache_stats
+ZlineFile_get_cache_stats.argtypes = [c_void_p, POINTER(c_ulonglong),
+                                      POINTER(c_ulonglong)]
+
+
+# a line returned by an iterator
+class ZlineView(Structure):
+  _fields_ = [('data', c_void_p), ('length', c_ulonglong), ('pin', c_void_p)]
+
+# iterate through a range of lines, decompressing blocks ahead
+ZlineIterator_create = zlineslib.ZlineIterator_create
+ZlineIterator_create.argtypes = [c_void_p, c_ulonglong, c_ulonglong, c_int,
+                                 c_int]
+ZlineIterator_create.restype = c_void_p
+
+ZlineIterator_next = zlineslib.ZlineIterator_next
+ZlineIterator_next.argtypes = [c_void_p, POINTER(ZlineView),
+                               POINTER(c_ulonglong)]
+ZlineIterator_next.restype = c_int
+
+ZlineIterator_close = zlineslib.ZlineIterator_close
+ZlineIterator_close.argtypes = [c_void_p]
+
+
 # close a file (from either ZlineFile_create or ZlineFile_read)
 ZlineFile_close = zlineslib.ZlineFile_close
 ZlineFile_close.argtypes = [c_void_p]
 
 class zline_file:
-  def __init__(self, filename, mode='r', encoding='default'):
+  def __init__(self, filename, mode='r', encoding='default', cache_size=0,
+               mmap=False):
     """
     Open a zlines file for reading or writing.
-    mode must be 'w' (create a new file) or 'r' (read an existing file).
+    mode must be 'w' (create a new file), 'r' (read an existing file),
+    or 'a' (add lines to the end of an existing file).
     filename will be converted to UTF-8 encoding.
 
     encoding is the character set (None, ascii, utf-8, latin1, ...)
@@ -150,7 +216,12 @@ class zline_file:
     None (no encoding change will be made) and under Python3 it will be
     'UTF-8'.
 
-    Throws ValueError if mode is not 'w' or 'r'.
+    cache_size is the number of bytes of decompressed blocks to keep
+    in memory when reading. At least one block is always kept.
+
+    If mmap is true, a file opened for reading is memory-mapped.
+
+    Throws ValueError if mode is not 'w', 'r', or 'a'.
     Throws IOError if there is an error opening the file.
     """
     
@@ -169,8 +240,15 @@ class zline_file:
       self._file = ZlineFile_create(filename)
       if self._file == None:
         raise IOError('Cannot create file')
+    elif mode == 'a':
+      self._file = ZlineFile_open_append(filename)
+      if self._file == None:
+        raise IOError('Cannot append to file or incorrect format')
     elif mode == 'r':
-      self._file = ZlineFile_read(filename)
+      if mmap:
+        self._file = ZlineFile_read_mmap(filename, cache_size)
+      else:
+        self._file = ZlineFile_read2(filename, cache_size)
       if self._file == None:
         raise IOError('Cannot read file or incorrect format')
     else:
@@ -201,6 +279,50 @@ class zline_file:
       raise RuntimeError('File is opened for reading')
 
 
+  def add_many(self, lines):
+    """
+    Add each line in a sequence, as add() does.
+    """
+    for line in lines:
+      if self._encoding:
+        line = line.encode(self._encoding)
+      if ZlineFile_add_line2(self._file, line, len(line)) == -1:
+        raise RuntimeError('File is opened for reading')
+
+
+  def get_many(self, line_nos):
+    """
+    Returns a list of the given lines. Negative numbers count back from
+    the end. The lines are read with one call to the library, which
+    decompresses each block only once.
+    Raises IndexError if any line number is out of range.
+    """
+    nlines = len(self)
+    count = len(line_nos)
+    indices = (c_ulonglong * count)()
+    for i, line_no in enumerate(line_nos):
+      if line_no < 0: line_no += nlines
+      if line_no < 0 or line_no >= nlines: raise IndexError
+      indices[i] = line_no
+    offsets = (c_ulonglong * count)()
+    lengths = (c_ulonglong * count)()
+
+    # first get the size of the buffer, then the lines
+    size = ZlineFile_get_lines(self._file, indices, count, None, 0,
+                               offsets, lengths)
+    if size < 0: raise IOError('Error reading file')
+    buf = create_string_buffer(max(size, 1))
+    if ZlineFile_get_lines(self._file, indices, count, buf, size,
+                           offsets, lengths) != size:
+      raise IOError('Error reading file')
+
+    data = buf.raw
+    result = [data[offsets[i] : offsets[i] + lengths[i]] for i in range(count)]
+    if self._encoding:
+      result = [line.decode(self._encoding) for line in result]
+    return result
+
+
   def __len__(self):
     """
     Returns the number of lines in the file.
@@ -216,6 +338,19 @@ class zline_file:
     return int(ZlineFile_line_length(self._file, line_no))
 
 
+  def line_lens(self, start=0, stop=None):
+    """
+    Returns a list of the lengths of lines start..stop-1. Only the
+    line indexes are read, so this is much faster than reading the lines.
+    """
+    if stop is None: stop = len(self)
+    count = max(0, stop - start)
+    lengths = (c_ulonglong * count)()
+    if ZlineFile_line_lengths(self._file, start, count, lengths) != 0:
+      raise IndexError
+    return list(lengths)
+
+
   def max_line_len(self):
     """
     Returns the length of the longest line in the file.
@@ -233,8 +368,6 @@ class zline_file:
     
     # handle slices
     if isinstance(line_no, slice):
-      result = []
-
       if line_no.start == None:
         start = 0
       else:
@@ -253,12 +386,8 @@ class zline_file:
       else:
         step = line_no.step
 
-      for index in range(start, stop, step):
-        try:
-          result.append(self[index])
-        except IndexError:
-          pass
-      return result
+      return self.get_many([index for index in range(start, stop, step)
+                            if 0 <= index < nlines])
     
     # implement negative indices
     if line_no < 0:
@@ -275,11 +404,62 @@ class zline_file:
     else:
       return line
 
+  def __iter__(self):
+    return self.lines()
+
+
+  def lines(self, start=0, stop=None, reverse=False, threads=2):
+    """
+    Generates lines [start, stop) from the file, or in reverse order
+    if reverse is true. When the file is open for reading, 'threads'
+    background threads decompress upcoming blocks.
+    """
+    nlines = len(self)
+    if stop == None or stop > nlines: stop = nlines
+    if start > stop: start = stop
+
+    it = None
+    if self._file:
+      it = ZlineIterator_create(self._file, start, stop, int(reverse),
+                                threads)
+
+    # files being written can't use an iterator
+    if not it:
+      order = range(stop-1, start-1, -1) if reverse else range(start, stop)
+      for line_no in order:
+        yield self[line_no]
+      return
+
+    try:
+      view = ZlineView()
+      while True:
+        result = ZlineIterator_next(it, byref(view), None)
+        if result == 0: break
+        if result < 0: raise IOError('Error reading file')
+        line = string_at(view.data, view.length)
+        if self._encoding:
+          line = line.decode(self._encoding)
+        yield line
+    finally:
+      ZlineIterator_close(it)
+
+
   def block_count(self):
     """ Returns the number of compressed data blocks in the file. """
     return int(ZlineFile_get_block_count(self._file))
 
   
+  def cache_stats(self):
+    """
+    Returns (hits, misses): the number of block lookups that were found
+    in the block cache, and the number that had to be decompressed.
+    """
+    hits = c_ulonglong()
+    misses = c_ulonglong()
+    ZlineFile_get_cache_stats(self._file, byref(hits), byref(misses))
+    return (int(hits.value), int(misses.value))
+
+
   def block(self, block_no):
     """
     Returns details about the given block.
@@ -306,5 +486,5 @@ class zline_file:
     }
 
 
-def open(filename, mode='r', encoding='default'):
-  return zline_file(filename, mode, encoding)
+def open(filename, mode='r', encoding='default', cache_size=0, mmap=False):
+  return zline_file(filename, mode, encoding, cache_size, mmap)
@@ -0,0 +1,784 @@
+/*
+  zlines
+
+  A native Python module, "_zlines", for reading and writing zlines files
+  in batches. Build it with "make pyext".
+
+  zlines.py calls the library through ctypes one line at a time, so a
+  Python program reading many lines spends much of its time converting
+  arguments. Here each call reads or adds a whole batch of lines, and the
+  GIL is released while blocks are decompressed, so other Python threads
+  keep running.
+
+  Sample usage:
+
+    import _zlines
+    f = _zlines.File('reads.zlines')
+    data, offsets, lengths = f.get_many([5, 1000, 3])
+    line = data[offsets[0] : offsets[0] + lengths[0]]
+    for first_line, data, offsets, lengths in f.blocks():
+      ...
+
+  'data' is a bytes object holding the lines, each followed by a nul
+  byte, and 'offsets' and 'lengths' are memoryviews of unsigned 64-bit
+  integers (format 'Q'), so numpy.frombuffer(offsets, numpy.uint64)
+  wraps them without a copy.
+
+  A ZlineFile isn't thread-safe, so each File has a lock, taken with the
+  GIL released. Different File objects can be read concurrently.
+
+  Python.h needs a C99 compiler, so unlike the rest of zlines this file
+  isn't compiled with -std=c89.
+
+
+  https://github.com/oshkosher/bioio/tree/master/zlines
+
+  Ed Karrels, ed.karrels@gmail.com, January 2017
+*/
+
+#define PY_SSIZE_T_CLEAN
+#include <Python.h>
+#include <pythread.h>
+#include <stdint.h>
+#include <string.h>
+#include "zline_api.h"
+
+typedef uint64_t u64;
+typedef int64_t i64;
+
+typedef struct {
+  PyObject_HEAD
+  ZlineFile zf;
+  int is_writing;
+  PyThread_type_lock lock;
+} FileObject;
+
+/* Iterates through the blocks of a file. See File.blocks(). */
+typedef struct {
+  PyObject_HEAD
+  FileObject *file;
+  u64 next_block, end_block;
+} BlockIterObject;
+
+static PyTypeObject FileType;
+static PyTypeObject BlockIterType;
+
+/* Release the GIL and take the file's lock. Everything between these
+   must be plain C; no Python objects may be touched. */
+#define BEGIN_FILE_CALL(self)                           \
+  Py_BEGIN_ALLOW_THREADS                                \
+  PyThread_acquire_lock((self)->lock, WAIT_LOCK);
+
+#define END_FILE_CALL(self)                     \
+  PyThread_release_lock((self)->lock);          \
+  Py_END_ALLOW_THREADS
+
+
+/* Set a Python exception and return NULL if the file has been closed. */
+static int checkOpen(FileObject *self);
+
+/* Get the number of lines and blocks in the file (either pointer may be
+   NULL) with its lock held, so another thread can't close it meanwhile.
+   Returns nonzero with a Python exception set if it is closed. */
+static int fileCounts(FileObject *self, u64 *line_count, u64 *block_count);
+
+/* Convert a sequence of ints, a buffer of 8-byte integers, or a slice
+   to an array of line numbers in idx[0..*n). Negative numbers count
+   back from the end, as in a list. The caller must PyMem_Free(*idx).
+   Returns nonzero with a Python exception set on error. */
+static int getIndices(FileObject *self, PyObject *obj, u64 **idx, u64 *n);
+
+/* Read lines idx[0..n) into new bytes objects: the lines, and their
+   offsets and lengths as arrays of u64. Returns nonzero with a Python
+   exception set on error. */
+static int readLines(FileObject *self, const u64 *idx, u64 n,
+                     PyObject **data, PyObject **offsets, PyObject **lengths);
+
+/* Returns (data, offsets, lengths) from readLines, with offsets and
+   lengths as memoryviews of format 'Q'. Steals the references. */
+static PyObject *linesTuple(PyObject *data, PyObject *offsets,
+                            PyObject *lengths);
+
+/* Returns a list of bytes objects, one per line. */
+static PyObject *linesList(PyObject *data, PyObject *offsets,
+                           PyObject *lengths);
+
+/* Returns (first_line, data, offsets, lengths) for one block. */
+static PyObject *readBlock(FileObject *self, u64 block_idx);
+
+
+static int File_init(FileObject *self, PyObject *args, PyObject *kwds) {
+  static char *kwlist[] = {"filename", "mode", "cache_size", "mmap",
+                           "block_size", "threads", NULL};
+  PyObject *filename_obj = NULL;
+  const char *filename, *mode = "r";
+  unsigned long long cache_size = 0, block_size = 0;
+  int use_mmap = 0, threads = 0;
+  ZlineFile zf = NULL;
+
+  if (!PyArg_ParseTupleAndKeywords(args, kwds, "O&|sKpKi", kwlist,
+                                   PyUnicode_FSConverter, &filename_obj,
+                                   &mode, &cache_size, &use_mmap,
+                                   &block_size, &threads))
+    return -1;
+
+  if (self->zf) {
+    PyErr_SetString(PyExc_ValueError, "File is already open");
+    Py_DECREF(filename_obj);
+    return -1;
+  }
+
+  if (strcmp(mode, "r") && strcmp(mode, "w") && strcmp(mode, "a")) {
+    PyErr_Format(PyExc_ValueError, "Invalid mode '%s'", mode);
+    Py_DECREF(filename_obj);
+    return -1;
+  }
+
+  filename = PyBytes_AS_STRING(filename_obj);
+  Py_BEGIN_ALLOW_THREADS
+  if (mode[0] == 'w') {
+    zf = ZlineFile_create3(filename, block_size, threads);
+  } else if (mode[0] == 'a') {
+    zf = ZlineFile_open_append2(filename, block_size, threads);
+  } else {
+    zf = use_mmap ? ZlineFile_read_mmap(filename, cache_size)
+      : ZlineFile_read2(filename, cache_size);
+    if (zf && threads > 0) ZlineFile_set_thread_count(zf, threads);
+  }
+  Py_END_ALLOW_THREADS
+
+  if (!zf) {
+    PyErr_Format(PyExc_IOError, "Cannot open \"%s\"", filename);
+    Py_DECREF(filename_obj);
+    return -1;
+  }
+  Py_DECREF(filename_obj);
+
+  if (!self->lock) {
+    self->lock = PyThread_allocate_lock();
+    if (!self->lock) {
+      ZlineFile_close(zf);
+      PyErr_NoMemory();
+      return -1;
+    }
+  }
+
+  self->zf = zf;
+  self->is_writing = mode[0] != 'r';
+  return 0;
+}
+
+
+static PyObject *File_close(FileObject *self, PyObject *unused) {
+  ZlineFile zf;
+
+  if (!self->zf) Py_RETURN_NONE;
+
+  /* closing a file being written can take a while */
+  BEGIN_FILE_CALL(self);
+  zf = self->zf;
+  self->zf = NULL;
+  if (zf) ZlineFile_close(zf);
+  END_FILE_CALL(self);
+
+  Py_RETURN_NONE;
+}
+
+
+static void File_dealloc(FileObject *self) {
+  if (self->zf) ZlineFile_close(self->zf);
+  if (self->lock) PyThread_free_lock(self->lock);
+  Py_TYPE(self)->tp_free((PyObject*) self);
+}
+
+
+static Py_ssize_t File_length(FileObject *self) {
+  u64 line_count = 0;
+  if (fileCounts(self, &line_count, NULL)) return -1;
+  return (Py_ssize_t) line_count;
+}
+
+
+static PyObject *File_getitem(FileObject *self, PyObject *key) {
+  PyObject *data, *offsets, *lengths, *result;
+  u64 *idx, n, length;
+
+  if (checkOpen(self)) return NULL;
+  if (getIndices(self, key, &idx, &n)) return NULL;
+
+  if (readLines(self, idx, n, &data, &offsets, &lengths)) {
+    PyMem_Free(idx);
+    return NULL;
+  }
+  PyMem_Free(idx);
+
+  /* one line, or a list of them for a slice */
+  if (PyIndex_Check(key)) {
+    memcpy(&length, PyBytes_AS_STRING(lengths), sizeof(u64));
+    result = PyBytes_FromStringAndSize(PyBytes_AS_STRING(data),
+                                       (Py_ssize_t) length);
+    Py_DECREF(data);
+    Py_DECREF(offsets);
+    Py_DECREF(lengths);
+    return result;
+  }
+
+  return linesList(data, offsets, lengths);
+}
+
+
+static PyObject *File_get_many(FileObject *self, PyObject *arg) {
+  PyObject *data, *offsets, *lengths;
+  u64 *idx, n;
+  int err;
+
+  if (checkOpen(self)) return NULL;
+  if (getIndices(self, arg, &idx, &n)) return NULL;
+
+  err = readLines(self, idx, n, &data, &offsets, &lengths);
+  PyMem_Free(idx);
+  if (err) return NULL;
+
+  return linesTuple(data, offsets, lengths);
+}
+
+
+static PyObject *File_get_lines(FileObject *self, PyObject *arg) {
+  PyObject *data, *offsets, *lengths;
+  u64 *idx, n;
+  int err;
+
+  if (checkOpen(self)) return NULL;
+  if (getIndices(self, arg, &idx, &n)) return NULL;
+
+  err = readLines(self, idx, n, &data, &offsets, &lengths);
+  PyMem_Free(idx);
+  if (err) return NULL;
+
+  return linesList(data, offsets, lengths);
+}
+
+
+static PyObject *File_get_block(FileObject *self, PyObject *arg) {
+  unsigned long long block_idx = PyLong_AsUnsignedLongLong(arg);
+
+  if (PyErr_Occurred()) return NULL;
+  if (checkOpen(self)) return NULL;
+
+  return readBlock(self, block_idx);
+}
+
+
+static PyObject *File_block_count(FileObject *self, PyObject *unused) {
+  u64 block_count = 0;
+  if (fileCounts(self, NULL, &block_count)) return NULL;
+  return PyLong_FromUnsignedLongLong(block_count);
+}
+
+
+static PyObject *File_blocks(FileObject *self, PyObject *args) {
+  unsigned long long start = 0, end = (unsigned long long) -1;
+  u64 count = 0;
+  BlockIterObject *it;
+
+  if (!PyArg_ParseTuple(args, "|KK", &start, &end)) return NULL;
+  if (fileCounts(self, NULL, &count)) return NULL;
+
+  if (end > count) end = count;
+
+  it = PyObject_New(BlockIterObject, &BlockIterType);
+  if (!it) return NULL;
+  Py_INCREF(self);
+  it->file = self;
+  it->next_block = start;
+  it->end_block = end;
+  return (PyObject*) it;
+}
+
+
+static PyObject *File_add_many(FileObject *self, PyObject *arg) {
+  PyObject *seq;
+  const char **lines = NULL;
+  Py_ssize_t i, n, len, failed = -1;
+  u64 *lengths = NULL;
+
+  if (checkOpen(self)) return NULL;
+  if (!self->is_writing) {
+    PyErr_SetString(PyExc_ValueError, "File is opened for reading");
+    return NULL;
+  }
+
+  seq = PySequence_Fast(arg, "add_many() needs a sequence of lines");
+  if (!seq) return NULL;
+  n = PySequence_Fast_GET_SIZE(seq);
+
+  lines = (const char**) PyMem_Malloc(sizeof(char*) * (n ? n : 1));
+  lengths = (u64*) PyMem_Malloc(sizeof(u64) * (n ? n : 1));
+  if (!lines || !lengths) {
+    PyErr_NoMemory();
+    goto done;
+  }
+
+  /* str is stored as UTF-8. The pointers stay valid while seq holds
+     the objects. */
+  for (i=0; i < n; i++) {
+    PyObject *item = PySequence_Fast_GET_ITEM(seq, i);
+    if (PyUnicode_Check(item)) {
+      lines[i] = PyUnicode_AsUTF8AndSize(item, &len);
+      if (!lines[i]) goto done;
+    } else if (PyBytes_Check(item)) {
+      lines[i] = PyBytes_AS_STRING(item);
+      len = PyBytes_GET_SIZE(item);
+    } else {
+      PyErr_Format(PyExc_TypeError, "line %zd is not str or bytes", i);
+      goto done;
+    }
+    lengths[i] = len;
+  }
+
+  BEGIN_FILE_CALL(self);
+  if (self->zf) {
+    for (i=0; i < n; i++) {
+      if (ZlineFile_add_line2(self->zf, lines[i], lengths[i])) {
+        failed = i;
+        break;
+      }
+    }
+  } else {
+    failed = 0;
+  }
+  END_FILE_CALL(self);
+
+  if (failed >= 0)
+    PyErr_Format(PyExc_IOError, "Error adding line %zd", failed);
+
+ done:
+  PyMem_Free(lines);
+  PyMem_Free(lengths);
+  Py_DECREF(seq);
+  if (PyErr_Occurred()) return NULL;
+  Py_RETURN_NONE;
+}
+
+
+static PyObject *File_add(FileObject *self, PyObject *arg) {
+  PyObject *lines, *result;
+
+  lines = PyTuple_Pack(1, arg);
+  if (!lines) return NULL;
+  result = File_add_many(self, lines);
+  Py_DECREF(lines);
+  return result;
+}
+
+
+static PyObject *File_enter(FileObject *self, PyObject *unused) {
+  Py_INCREF(self);
+  return (PyObject*) self;
+}
+
+
+static PyObject *File_exit(FileObject *self, PyObject *args) {
+  return File_close(self, NULL);
+}
+
+
+static void BlockIter_dealloc(BlockIterObject *it) {
+  Py_DECREF(it->file);
+  PyObject_Del(it);
+}
+
+
+static PyObject *BlockIter_next(BlockIterObject *it) {
+  if (it->next_block >= it->end_block) return NULL;
+  if (checkOpen(it->file)) return NULL;
+  return readBlock(it->file, it->next_block++);
+}
+
+
+static int checkOpen(FileObject *self) {
+  if (self->zf) return 0;
+  PyErr_SetString(PyExc_ValueError, "I/O operation on closed file");
+  return -1;
+}
+
+
+static int fileCounts(FileObject *self, u64 *line_count, u64 *block_count) {
+  int is_closed = 0;
+
+  if (checkOpen(self)) return -1;
+
+  BEGIN_FILE_CALL(self);
+  if (!self->zf) {
+    is_closed = 1;
+  } else {
+    if (line_count) *line_count = ZlineFile_line_count(self->zf);
+    if (block_count) *block_count = ZlineFile_get_block_count(self->zf);
+  }
+  END_FILE_CALL(self);
+
+  return is_closed ? checkOpen(self) : 0;
+}
+
+
+static int getIndices(FileObject *self, PyObject *obj, u64 **idx, u64 *n) {
+  u64 line_count = 0, i;
+  Py_ssize_t start, stop, step, len;
+  Py_buffer view;
+  PyObject *seq;
+
+  *idx = NULL;
+  *n = 0;
+  if (fileCounts(self, &line_count, NULL)) return -1;
+
+  if (PyIndex_Check(obj)) {
+    Py_ssize_t line = PyNumber_AsSsize_t(obj, PyExc_IndexError);
+    if (line == -1 && PyErr_Occurred()) return -1;
+    if (line < 0) line += (Py_ssize_t) line_count;
+    if (line < 0 || (u64) line >= line_count) {
+      PyErr_SetString(PyExc_IndexError, "line index out of range");
+      return -1;
+    }
+    *idx = (u64*) PyMem_Malloc(sizeof(u64));
+    if (!*idx) {
+      PyErr_NoMemory();
+      return -1;
+    }
+    (*idx)[0] = line;
+    *n = 1;
+    return 0;
+  }
+
+  if (PySlice_Check(obj)) {
+    if (PySlice_Unpack(obj, &start, &stop, &step)) return -1;
+    len = PySlice_AdjustIndices((Py_ssize_t) line_count, &start, &stop, step);
+    *idx = (u64*) PyMem_Malloc(sizeof(u64) * (len ? len : 1));
+    if (!*idx) {
+      PyErr_NoMemory();
+      return -1;
+    }
+    for (i=0; i < (u64) len; i++)
+      (*idx)[i] = start + (Py_ssize_t) i * step;
+    *n = len;
+    return 0;
+  }
+
+  /* an array of 8-byte integers, such as a numpy array, is used as is */
+  if (PyObject_CheckBuffer(obj) &&
+      !PyObject_GetBuffer(obj, &view, PyBUF_FORMAT | PyBUF_C_CONTIGUOUS)) {
+    if (view.itemsize == 8 && view.format &&
+        strchr("qQlLnN", view.format[strlen(view.format) - 1])) {
+      len = view.len / 8;
+      *idx = (u64*) PyMem_Malloc(sizeof(u64) * (len ? len : 1));
+      if (!*idx) {
+        PyBuffer_Release(&view);
+        PyErr_NoMemory();
+        return -1;
+      }
+      memcpy(*idx, view.buf, len * sizeof(u64));
+      PyBuffer_Release(&view);
+      for (i=0; i < (u64) len; i++) {
+        if ((i64)(*idx)[i] < 0) (*idx)[i] += line_count;
+        if ((*idx)[i] >= line_count) {
+          PyMem_Free(*idx);
+          *idx = NULL;
+          PyErr_SetString(PyExc_IndexError, "line index out of range");
+          return -1;
+        }
+      }
+      *n = len;
+      return 0;
+    }
+    PyBuffer_Release(&view);
+  }
+  PyErr_Clear();
+
+  seq = PySequence_Fast(obj, "line numbers must be an int, a slice, "
+                        "or a sequence of ints");
+  if (!seq) return -1;
+  len = PySequence_Fast_GET_SIZE(seq);
+  *idx = (u64*) PyMem_Malloc(sizeof(u64) * (len ? len : 1));
+  if (!*idx) {
+    Py_DECREF(seq);
+    PyErr_NoMemory();
+    return -1;
+  }
+
+  for (i=0; i < (u64) len; i++) {
+    Py_ssize_t line = PyNumber_AsSsize_t(PySequence_Fast_GET_ITEM(seq, i),
+                                         PyExc_IndexError);
+    if (line == -1 && PyErr_Occurred()) goto fail;
+    if (line < 0) line += (Py_ssize_t) line_count;
+    if (line < 0 || (u64) line >= line_count) {
+      PyErr_SetString(PyExc_IndexError, "line index out of range");
+      goto fail;
+    }
+    (*idx)[i] = line;
+  }
+
+  Py_DECREF(seq);
+  *n = len;
+  return 0;
+
+ fail:
+  Py_DECREF(seq);
+  PyMem_Free(*idx);
+  *idx = NULL;
+  return -1;
+}
+
+
+static int readLines(FileObject *self, const u64 *idx, u64 n,
+                     PyObject **data, PyObject **offsets, PyObject **lengths) {
+  u64 *offsets_buf, *lengths_buf;
+  i64 total = 0, got = 0;
+  char *buf;
+  int is_closed = 0;
+
+  *data = NULL;
+  *offsets = PyBytes_FromStringAndSize(NULL, sizeof(u64) * n);
+  *lengths = PyBytes_FromStringAndSize(NULL, sizeof(u64) * n);
+  if (!*offsets || !*lengths) goto fail;
+  offsets_buf = (u64*) PyBytes_AS_STRING(*offsets);
+  lengths_buf = (u64*) PyBytes_AS_STRING(*lengths);
+
+  /* With no buffer, ZlineFile_get_lines reads just the line indexes of
+     the blocks to get the size of the buffer. */
+  BEGIN_FILE_CALL(self);
+  if (!self->zf)
+    is_closed = 1;
+  else if (n > 0)
+    total = ZlineFile_get_lines(self->zf, idx, n, NULL, 0,
+                                offsets_buf, lengths_buf);
+  END_FILE_CALL(self);
+
+  if (is_closed) {
+    checkOpen(self);
+    goto fail;
+  }
+  if (total < 0) {
+    PyErr_SetString(PyExc_IOError, "Error reading lines");
+    goto fail;
+  }
+
+  *data = PyBytes_FromStringAndSize(NULL, total);
+  if (!*data) goto fail;
+  buf = PyBytes_AS_STRING(*data);
+
+  BEGIN_FILE_CALL(self);
+  if (!self->zf)
+    is_closed = 1;
+  else if (n > 0)
+    got = ZlineFile_get_lines(self->zf, idx, n, buf, total,
+                              offsets_buf, lengths_buf);
+  END_FILE_CALL(self);
+
+  if (is_closed) {
+    checkOpen(self);
+    goto fail;
+  }
+  if (got != total) {
+    PyErr_SetString(PyExc_IOError, "Error reading lines");
+    goto fail;
+  }
+
+  return 0;
+
+ fail:
+  Py_XDECREF(*data);
+  Py_XDECREF(*offsets);
+  Py_XDECREF(*lengths);
+  *data = *offsets = *lengths = NULL;
+  return -1;
+}
+
+
+static PyObject *linesTuple(PyObject *data, PyObject *offsets,
+                            PyObject *lengths) {
+  PyObject *offsets_view = NULL, *lengths_view = NULL, *tmp;
+
+  tmp = PyMemoryView_FromObject(offsets);
+  if (tmp) {
+    offsets_view = PyObject_CallMethod(tmp, "cast", "s", "Q");
+    Py_DECREF(tmp);
+  }
+  tmp = PyMemoryView_FromObject(lengths);
+  if (tmp) {
+    lengths_view = PyObject_CallMethod(tmp, "cast", "s", "Q");
+    Py_DECREF(tmp);
+  }
+  Py_DECREF(offsets);
+  Py_DECREF(lengths);
+
+  if (!offsets_view || !lengths_view) {
+    Py_DECREF(data);
+    Py_XDECREF(offsets_view);
+    Py_XDECREF(lengths_view);
+    return NULL;
+  }
+
+  return Py_BuildValue("(NNN)", data, offsets_view, lengths_view);
+}
+
+
+static PyObject *linesList(PyObject *data, PyObject *offsets,
+                           PyObject *lengths) {
+  const u64 *offsets_buf = (const u64*) PyBytes_AS_STRING(offsets);
+  const u64 *lengths_buf = (const u64*) PyBytes_AS_STRING(lengths);
+  Py_ssize_t n = PyBytes_GET_SIZE(lengths) / sizeof(u64), i;
+  const char *buf = PyBytes_AS_STRING(data);
+  PyObject *list = PyList_New(n), *line;
+
+  for (i=0; list && i < n; i++) {
+    line = PyBytes_FromStringAndSize(buf + offsets_buf[i],
+                                     (Py_ssize_t) lengths_buf[i]);
+    if (!line) {
+      Py_CLEAR(list);
+      break;
+    }
+    PyList_SET_ITEM(list, i, line);
+  }
+
+  Py_DECREF(data);
+  Py_DECREF(offsets);
+  Py_DECREF(lengths);
+  return list;
+}
+
+
+static PyObject *readBlock(FileObject *self, u64 block_idx) {
+  PyObject *data, *offsets, *lengths, *lines, *result;
+  u64 first = 0, count = 0, *idx, i;
+  int is_closed = 0, is_valid = 0;
+
+  if (checkOpen(self)) return NULL;
+
+  BEGIN_FILE_CALL(self);
+  if (!self->zf) {
+    is_closed = 1;
+  } else if (block_idx < ZlineFile_get_block_count(self->zf)) {
+    is_valid = 1;
+    first = ZlineFile_get_block_first_line(self->zf, block_idx);
+    count = ZlineFile_get_block_line_count(self->zf, block_idx);
+  }
+  END_FILE_CALL(self);
+
+  if (is_closed) {
+    checkOpen(self);
+    return NULL;
+  }
+  if (!is_valid) {
+    PyErr_SetString(PyExc_IndexError, "block index out of range");
+    return NULL;
+  }
+  idx = (u64*) PyMem_Malloc(sizeof(u64) * (count ? count : 1));
+  if (!idx) return PyErr_NoMemory();
+  for (i=0; i < count; i++) idx[i] = first + i;
+
+  if (readLines(self, idx, count, &data, &offsets, &lengths)) {
+    PyMem_Free(idx);
+    return NULL;
+  }
+  PyMem_Free(idx);
+
+  lines = linesTuple(data, offsets, lengths);
+  if (!lines) return NULL;
+  result = Py_BuildValue("(KOOO)", (unsigned long long) first,
+                         PyTuple_GET_ITEM(lines, 0), PyTuple_GET_ITEM(lines, 1),
+                         PyTuple_GET_ITEM(lines, 2));
+  Py_DECREF(lines);
+  return result;
+}
+
+
+static PyMethodDef File_methods[] = {
+  {"close", (PyCFunction) File_close, METH_NOARGS,
+   "Close the file. A file being written is finished."},
+  {"get_many", (PyCFunction) File_get_many, METH_O,
+   "get_many(indices) -> (data, offsets, lengths)\n\n"
+   "Read the lines given by a sequence of ints, an array of 8-byte\n"
+   "integers, or a slice. Line i is\n"
+   "data[offsets[i] : offsets[i] + lengths[i]]."},
+  {"get_lines", (PyCFunction) File_get_lines, METH_O,
+   "get_lines(indices) -> list of bytes\n\n"
+   "Like get_many, but returns each line as a bytes object."},
+  {"get_block", (PyCFunction) File_get_block, METH_O,
+   "get_block(block_idx) -> (first_line, data, offsets, lengths)\n\n"
+   "Read all the lines of one compressed block."},
+  {"block_count", (PyCFunction) File_block_count, METH_NOARGS,
+   "Returns the number of compressed blocks."},
+  {"blocks", (PyCFunction) File_blocks, METH_VARARGS,
+   "blocks([start, [end]]) -> iterator\n\n"
+   "Iterate through blocks [start, end), as get_block returns them."},
+  {"add", (PyCFunction) File_add, METH_O,
+   "Add one line (str or bytes) to a file opened for writing."},
+  {"add_many", (PyCFunction) File_add_many, METH_O,
+   "Add a sequence of lines (str or bytes) to a file opened for writing."},
+  {"__enter__", (PyCFunction) File_enter, METH_NOARGS, NULL},
+  {"__exit__", (PyCFunction) File_exit, METH_VARARGS, NULL},
+  {NULL}
+};
+
+static PyMappingMethods File_as_mapping = {
+  (lenfunc) File_length,
+  (binaryfunc) File_getitem,
+  NULL
+};
+
+static PyTypeObject FileType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  "_zlines.File",
+  sizeof(FileObject),
+};
+
+static PyTypeObject BlockIterType = {
+  PyVarObject_HEAD_INIT(NULL, 0)
+  "_zlines.BlockIterator",
+  sizeof(BlockIterObject),
+};
+
+static struct PyModuleDef zlines_module = {
+  PyModuleDef_HEAD_INIT,
+  "_zlines",
+  "Batched native access to zlines files. See zlines_pyext.c.",
+  -1,
+  NULL
+};
+
+
+PyMODINIT_FUNC PyInit__zlines(void) {
+  PyObject *m;
+
+  FileType.tp_flags = Py_TPFLAGS_DEFAULT;
+  FileType.tp_doc =
+    "File(filename, mode='r', cache_size=0, mmap=False, block_size=0, "
+    "threads=0)\n\n"
+    "Open a zlines file. mode is 'r' (read), 'w' (create), or 'a'\n"
+    "(append). When reading, 'threads' threads decompress the blocks\n"
+    "of a batch; when writing, they compress full blocks.";
+  FileType.tp_new = PyType_GenericNew;
+  FileType.tp_init = (initproc) File_init;
+  FileType.tp_dealloc = (destructor) File_dealloc;
+  FileType.tp_methods = File_methods;
+  FileType.tp_as_mapping = &File_as_mapping;
+
+  BlockIterType.tp_flags = Py_TPFLAGS_DEFAULT;
+  BlockIterType.tp_dealloc = (destructor) BlockIter_dealloc;
+  BlockIterType.tp_iter = PyObject_SelfIter;
+  BlockIterType.tp_iternext = (iternextfunc) BlockIter_next;
+
+  if (PyType_Ready(&FileType) < 0 || PyType_Ready(&BlockIterType) < 0)
+    return NULL;
+
+  m = PyModule_Create(&zlines_module);
+  if (!m) return NULL;
+
+  Py_INCREF(&FileType);
+  if (PyModule_AddObject(m, "File", (PyObject*) &FileType) < 0) {
+    Py_DECREF(&FileType);
+    Py_DECREF(m);
+    return NULL;
+  }
+
+  return m;
+}
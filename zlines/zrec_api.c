@@ -0,0 +1,329 @@
+/*
+  zrec
+
+  Records with a fixed number of fields, each field stored in its own
+  zlines file. See zrec_api.h.
+
+
+  https://github.com/oshkosher/bioio/tree/master/zlines
+
+  Ed Karrels, ed.karrels@gmail.com, January 2017
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include "zrec_api.h"
+#include "common.h"
+
+/* sanity check on the manifest */
+#define ZREC_MAX_FIELDS 1000
+
+#define MAX_MANIFEST_LINE_LEN 100
+
+typedef uint64_t u64;
+
+struct ZrecFile {
+  /* name of the manifest; field i is in "<filename>.<i>" */
+  char *filename;
+
+  int is_writing;
+  int field_count;
+  ZlineFile *fields;
+  u64 record_count;
+};
+
+
+/* Returns the name of the zlines file holding one field. The caller
+   must free it. */
+static char *fieldFilename(const char *filename, int field);
+
+static ZrecFile allocate(const char *filename, int field_count);
+
+/* Close the field files and deallocate everything. */
+static void deallocate(ZrecFile zr);
+
+static int writeManifest(ZrecFile zr);
+static int readManifest(ZrecFile zr);
+
+
+ZLINE_EXPORT ZrecFile ZrecFile_create(const char *filename, int field_count,
+                                      uint64_t block_size, int thread_count) {
+  ZrecFile zr;
+  char *name;
+  int i;
+
+  if (field_count < 1 || field_count > ZREC_MAX_FIELDS) {
+    fprintf(stderr, "ZrecFile_create error: invalid field count %d\n",
+            field_count);
+    return NULL;
+  }
+
+  zr = allocate(filename, field_count);
+  if (!zr) return NULL;
+  zr->is_writing = 1;
+
+  for (i=0; i < field_count; i++) {
+    name = fieldFilename(filename, i);
+    if (!name) goto fail;
+    zr->fields[i] = ZlineFile_create3(name, block_size, thread_count);
+    free(name);
+    if (!zr->fields[i]) goto fail;
+  }
+
+  return zr;
+
+ fail:
+  deallocate(zr);
+  return NULL;
+}
+
+
+ZLINE_EXPORT int ZrecFile_add_record(ZrecFile zr, const char *const *fields,
+                                     const uint64_t *lengths) {
+  int i;
+
+  if (!zr->is_writing) return -1;
+
+  for (i=0; i < zr->field_count; i++) {
+    if (ZlineFile_add_line2(zr->fields[i], fields[i],
+                            lengths ? lengths[i] : strlen(fields[i])))
+      return -1;
+  }
+  zr->record_count++;
+
+  return 0;
+}
+
+
+ZLINE_EXPORT ZrecFile ZrecFile_read(const char *filename,
+                                    uint64_t cache_size) {
+  ZrecFile zr = allocate(filename, 0);
+  char *name;
+  int i;
+
+  if (!zr) return NULL;
+  if (readManifest(zr)) goto fail;
+
+  zr->fields = (ZlineFile*) calloc(zr->field_count, sizeof(ZlineFile));
+  if (!zr->fields) goto fail;
+
+  for (i=0; i < zr->field_count; i++) {
+    name = fieldFilename(filename, i);
+    if (!name) goto fail;
+    zr->fields[i] = ZlineFile_read2(name, cache_size);
+    if (!zr->fields[i]) {
+      fprintf(stderr, "Failed to read field %d of \"%s\" from \"%s\"\n",
+              i, filename, name);
+      free(name);
+      goto fail;
+    }
+    free(name);
+
+    if (ZlineFile_line_count(zr->fields[i]) != zr->record_count) {
+      fprintf(stderr, "Field %d of \"%s\" has %" PRIu64 " records, "
+              "expected %" PRIu64 "\n", i, filename,
+              ZlineFile_line_count(zr->fields[i]), zr->record_count);
+      goto fail;
+    }
+  }
+
+  return zr;
+
+ fail:
+  deallocate(zr);
+  return NULL;
+}
+
+
+ZLINE_EXPORT int ZrecFile_close(ZrecFile zr) {
+  int i, err = 0;
+
+  /* The fields are finished before the manifest is written, so a
+     manifest is never left pointing at incomplete fields. */
+  for (i=0; i < zr->field_count; i++) {
+    if (zr->fields[i]) ZlineFile_close(zr->fields[i]);
+    zr->fields[i] = NULL;
+  }
+
+  /* the empty field files can't be read, so don't leave a manifest
+     pointing at them, even one from an earlier file */
+  if (zr->is_writing && zr->record_count == 0) {
+    fprintf(stderr, "No records were added to \"%s\"\n", zr->filename);
+    remove(zr->filename);
+    err = -1;
+  } else if (zr->is_writing) {
+    err = writeManifest(zr);
+  }
+
+  deallocate(zr);
+  return err;
+}
+
+
+ZLINE_EXPORT uint64_t ZrecFile_record_count(ZrecFile zr) {
+  return zr->record_count;
+}
+
+
+ZLINE_EXPORT int ZrecFile_field_count(ZrecFile zr) {
+  return zr->field_count;
+}
+
+
+ZLINE_EXPORT ZlineFile ZrecFile_field(ZrecFile zr, int field) {
+  if (field < 0 || field >= zr->field_count) return NULL;
+  return zr->fields[field];
+}
+
+
+ZLINE_EXPORT int64_t ZrecFile_get_records
+  (ZrecFile zr, uint64_t first, uint64_t count, const int *fields, int n,
+   char *buf, uint64_t buf_len, uint64_t *offsets, uint64_t *lengths) {
+
+  u64 *idx = NULL, *field_offsets = NULL, *field_lengths = NULL;
+  u64 r, total = 0;
+  int64_t field_total = -1;
+  int i;
+
+  if (first > zr->record_count || count > zr->record_count - first)
+    return -1;
+  for (i=0; i < n; i++)
+    if (fields[i] < 0 || fields[i] >= zr->field_count) return -1;
+  if (count == 0 || n <= 0) return 0;
+
+  idx = (u64*) malloc(sizeof(u64) * count);
+  field_offsets = (u64*) malloc(sizeof(u64) * count);
+  field_lengths = (u64*) malloc(sizeof(u64) * count);
+  if (!idx || !field_offsets || !field_lengths) {
+    fprintf(stderr, "Out of memory\n");
+    goto done;
+  }
+
+  for (r=0; r < count; r++) idx[r] = first + r;
+
+  /* Read each field into the part of buf after the previous ones. Once
+     the buffer is full, just collect the lengths. */
+  for (i=0; i < n; i++) {
+    u64 space = total < buf_len ? buf_len - total : 0;
+
+    field_total = ZlineFile_get_lines
+      (zr->fields[fields[i]], idx, count, space ? buf + total : NULL, space,
+       field_offsets, field_lengths);
+    if (field_total < 0) goto done;
+
+    for (r=0; r < count; r++) {
+      offsets[r*n + i] = total + field_offsets[r];
+      lengths[r*n + i] = field_lengths[r];
+    }
+    total += field_total;
+  }
+
+ done:
+  free(idx);
+  free(field_offsets);
+  free(field_lengths);
+  return field_total < 0 ? -1 : (int64_t) total;
+}
+
+
+static char *fieldFilename(const char *filename, int field) {
+  char *name = (char*) malloc(strlen(filename) + 16);
+  if (name) sprintf(name, "%s.%d", filename, field);
+  return name;
+}
+
+
+static ZrecFile allocate(const char *filename, int field_count) {
+  ZrecFile zr = (ZrecFile) calloc(1, sizeof(struct ZrecFile));
+  if (!zr) return NULL;
+
+  zr->filename = strdup(filename);
+  zr->field_count = field_count;
+  if (field_count > 0)
+    zr->fields = (ZlineFile*) calloc(field_count, sizeof(ZlineFile));
+  if (!zr->filename || (field_count > 0 && !zr->fields)) {
+    fprintf(stderr, "Out of memory\n");
+    deallocate(zr);
+    return NULL;
+  }
+
+  return zr;
+}
+
+
+static void deallocate(ZrecFile zr) {
+  int i;
+
+  if (zr->fields) {
+    for (i=0; i < zr->field_count; i++)
+      if (zr->fields[i]) ZlineFile_close(zr->fields[i]);
+  }
+  free(zr->fields);
+  free(zr->filename);
+  free(zr);
+}
+
+
+static int writeManifest(ZrecFile zr) {
+  FILE *f = fopen(zr->filename, "w");
+  int err;
+
+  if (!f) {
+    fprintf(stderr, "Failed to write \"%s\"\n", zr->filename);
+    return -1;
+  }
+
+  fprintf(f, "zrec v1\n");
+  fprintf(f, "fields %d\n", zr->field_count);
+  fprintf(f, "records %" PRIu64 "\n", zr->record_count);
+  err = ferror(f);
+  if (fclose(f) || err) {
+    fprintf(stderr, "Failed to write \"%s\"\n", zr->filename);
+    return -1;
+  }
+
+  return 0;
+}
+
+
+static int readManifest(ZrecFile zr) {
+  char buf[MAX_MANIFEST_LINE_LEN], word[MAX_MANIFEST_LINE_LEN];
+  FILE *f = fopen(zr->filename, "r");
+  int has_records = 0, pos;
+
+  if (!f) {
+    fprintf(stderr, "Failed to open \"%s\"\n", zr->filename);
+    return -1;
+  }
+
+  if (!fgets(buf, sizeof buf, f) || strncmp(buf, "zrec v1", 7))
+    goto format_error;
+
+  while (fgets(buf, sizeof buf, f)) {
+    if (1 != sscanf(buf, "%s %n", word, &pos)) continue;
+
+    if (!strcmp(word, "fields")) {
+      if (1 != sscanf(buf+pos, "%d", &zr->field_count)) goto format_error;
+    } else if (!strcmp(word, "records")) {
+      if (1 != sscanf(buf+pos, "%" SCNu64, &zr->record_count))
+        goto format_error;
+      has_records = 1;
+    } else {
+      goto format_error;
+    }
+  }
+
+  if (zr->field_count < 1 || zr->field_count > ZREC_MAX_FIELDS ||
+      !has_records)
+    goto format_error;
+
+  fclose(f);
+  return 0;
+
+ format_error:
+  fprintf(stderr, "Error reading \"%s\", invalid format\n", zr->filename);
+  fclose(f);
+  return -1;
+}
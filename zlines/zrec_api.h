@@ -0,0 +1,91 @@
+/*
+  zrec
+
+  Records with a fixed number of fields, such as the four lines of a
+  FASTQ read, stored with each field in a zlines file of its own.
+
+  A record file "reads.zrec" is a short text manifest, and field i of
+  every record is line r of the zlines file "reads.zrec.<i>". Similar
+  data is compressed together (sequences with sequences, quality strings
+  with quality strings), each field can use its own codec or dictionary,
+  and reading one field of a range of records reads nothing else.
+
+
+  https://github.com/oshkosher/bioio/tree/master/zlines
+
+  Ed Karrels, ed.karrels@gmail.com, January 2017
+*/
+
+#ifndef __ZREC_API_H__
+#define __ZREC_API_H__
+
+#include <stdint.h>
+#include "zline_api.h"
+
+struct ZrecFile;
+typedef struct ZrecFile* ZrecFile;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Create a record file with field_count fields per record. block_size
+   and thread_count are passed to ZlineFile_create3 for each field.
+   Call ZrecFile_close to finish writing it. Returns NULL on error. */
+ZLINE_EXPORT ZrecFile ZrecFile_create(const char *filename, int field_count,
+                                      uint64_t block_size, int thread_count);
+
+/* Add a record. fields[i] is the value of field i, and lengths[i] its
+   length. If lengths is NULL, the fields are nul-terminated.
+   Returns -1 if the file is not open for writing or on error. */
+ZLINE_EXPORT int ZrecFile_add_record(ZrecFile zr, const char *const *fields,
+                                     const uint64_t *lengths);
+
+/* Open a record file for reading. cache_size is passed to
+   ZlineFile_read2 for each field. Returns NULL on error. */
+ZLINE_EXPORT ZrecFile ZrecFile_read(const char *filename,
+                                    uint64_t cache_size);
+
+/* Close the file. When writing, this finishes each field's zlines file
+   and then writes the manifest. A file with no records can't be read,
+   so it gets no manifest.
+   Returns -1 if the manifest was not written, otherwise 0. */
+ZLINE_EXPORT int ZrecFile_close(ZrecFile zr);
+
+/* Returns the number of records in the file. */
+ZLINE_EXPORT uint64_t ZrecFile_record_count(ZrecFile zr);
+
+/* Returns the number of fields in each record. */
+ZLINE_EXPORT int ZrecFile_field_count(ZrecFile zr);
+
+/* Returns the zlines file holding one field, or NULL if field is out of
+   range. Use it to set a codec or dictionary for the field before adding
+   records, or to read the field with any of the ZlineFile functions. It
+   is closed by ZrecFile_close. */
+ZLINE_EXPORT ZlineFile ZrecFile_field(ZrecFile zr, int field);
+
+/* Read some fields of records [first, first+count).
+
+   fields - array of n field numbers, in any order
+   buf - the values are copied here, each followed by a nul byte
+   offsets, lengths - arrays of count*n elements. For record first+r,
+     the value of fields[i] is at buf+offsets[r*n+i] and has length
+     lengths[r*n+i].
+
+   Each field is read from its own zlines file with ZlineFile_get_lines,
+   so fields that aren't requested aren't decompressed.
+
+   Returns the number of bytes needed for all the values, including the
+   nul terminators. If that's more than buf_len, the call can be repeated
+   with a big enough buffer. Returns -1 if the range or a field number is
+   invalid, or on a read error.
+*/
+ZLINE_EXPORT int64_t ZrecFile_get_records
+  (ZrecFile zr, uint64_t first, uint64_t count, const int *fields, int n,
+   char *buf, uint64_t buf_len, uint64_t *offsets, uint64_t *lengths);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* __ZREC_API_H__ */